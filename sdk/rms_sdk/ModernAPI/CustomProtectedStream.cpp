@@ -6,6 +6,7 @@
  * ======================================================================
  */
 
+#include <iterator>
 #include "../ModernAPI/RMSExceptions.h"
 #include "../Core/ProtectionPolicy.h"
 #include "../Platform/Logger/Logger.h"
@@ -29,19 +30,64 @@ shared_ptr<CustomProtectedStream>CustomProtectedStream::Create(
   shared_ptr<UserPolicy>policy,
   SharedStream          stream,
   uint64_t              contentStartPosition,
-  uint64_t              contentSize)
+  uint64_t              contentSize,
+  uint64_t              blockCacheSize)
 {
   Logger::Hidden("+CustomProtectedStream::Create");
 
   if (policy.get() == nullptr) {
     throw exceptions::RMSInvalidArgumentException("Invalid policy argument");
   }
-  auto pCryptoProvider = policy->GetImpl()->GetCryptoProvider();
 
+  auto result = CreateWithProvider(policy->GetImpl()->GetCryptoProvider(),
+                                   stream, contentStartPosition, contentSize,
+                                   blockCacheSize);
+
+  Logger::Hidden("-CustomProtectedStream::Create");
+  return result;
+}
+
+shared_ptr<CustomProtectedStream>CustomProtectedStream::Create(
+  shared_ptr<UserPolicy>policy,
+  SharedStream          stream,
+  uint64_t              contentStartPosition,
+  uint64_t              contentSize,
+  CipherMode            cipherMode,
+  uint64_t              blockCacheSize)
+{
+  Logger::Hidden("+CustomProtectedStream::Create");
+
+  if (policy.get() == nullptr) {
+    throw exceptions::RMSInvalidArgumentException("Invalid policy argument");
+  }
+
+  auto key = policy->GetImpl()->GetCryptoProvider()->GetKey();
+  shared_ptr<CustomProtectedStream> result;
+
+  if (cipherMode == CIPHER_MODE_CTR) {
+    result = CreateCtr(key, stream, contentStartPosition, contentSize,
+                       blockCacheSize);
+  } else {
+    result = CreateWithProvider(CreateCryptoProvider(cipherMode, key), stream,
+                                contentStartPosition, contentSize,
+                                blockCacheSize);
+  }
+
+  Logger::Hidden("-CustomProtectedStream::Create");
+  return result;
+}
+
+shared_ptr<CustomProtectedStream>CustomProtectedStream::CreateWithProvider(
+  shared_ptr<ICryptoProvider>pCryptoProvider,
+  SharedStream               stream,
+  uint64_t                   contentStartPosition,
+  uint64_t                   contentSize,
+  uint64_t                   blockCacheSize)
+{
   // create an IStreamImpl implementation of the backing stream
   auto pBackingStreamImpl = stream;
 
-  // We want the cache block size to be 512 for cbc512, 4096 for cbc4k
+  // We want the cache block size to be 512 for cbc512 and ctr, 4096 for cbc4k
   // In case of ECB blocksize is 16, Keep cache block size to be 4k.
   uint64_t nProtectedStreamBlockSize = pCryptoProvider->GetBlockSize() ==
                                        512 ? 512 : 4096;
@@ -57,13 +103,57 @@ shared_ptr<CustomProtectedStream>CustomProtectedStream::Create(
                                                                 pBackingStreamImpl,
                                                                 contentStartPosition,
                                                                 contentSize,
-                                                                nProtectedStreamBlockSize);
+                                                                nProtectedStreamBlockSize,
+                                                                blockCacheSize);
 
-  auto result =
-    shared_ptr<CustomProtectedStream>(new CustomProtectedStream(
-                                        pProtectedStreamImpl));
+  return shared_ptr<CustomProtectedStream>(new CustomProtectedStream(
+                                             pProtectedStreamImpl));
+}
 
-  Logger::Hidden("-CustomProtectedStream::Create");
+shared_ptr<CustomProtectedStream>CustomProtectedStream::CreateCtr(
+  const vector<uint8_t>& key,
+  SharedStream           stream,
+  uint64_t               contentStartPosition,
+  uint64_t               contentSize,
+  uint64_t               blockCacheSize)
+{
+  if (stream.get() == nullptr) {
+    throw exceptions::RMSNullPointerException("Invalid stream argument");
+  }
+
+  vector<uint8_t> nonce;
+
+  if (contentSize == 0) {
+    // a new container, its nonce goes first
+    nonce = CreateCtrNonce();
+
+    if (stream->WriteAsync(nonce.data(), nonce.size(), contentStartPosition,
+                           launch::deferred).get() !=
+        static_cast<int64_t>(nonce.size())) {
+      throw exceptions::RMSStreamException("Can't write the CTR nonce");
+    }
+  } else {
+    nonce.resize(CTR_NONCE_SIZE);
+
+    if ((contentSize < CTR_NONCE_SIZE) ||
+        (stream->ReadAsync(nonce.data(), nonce.size(), contentStartPosition,
+                           launch::deferred).get() !=
+         static_cast<int64_t>(nonce.size()))) {
+      throw exceptions::RMSStreamException("Can't read the CTR nonce");
+    }
+    contentSize -= CTR_NONCE_SIZE;
+  }
+
+  auto result = CreateWithProvider(CreateCtrCryptoProvider(key, nonce), stream,
+                                   contentStartPosition + CTR_NONCE_SIZE,
+                                   contentSize, blockCacheSize);
+
+  // rewriting content would reuse its key stream
+  result->m_pWritten = make_shared<WrittenRanges>();
+
+  if (contentSize > 0) {
+    result->m_pWritten->ranges[0] = contentSize;
+  }
   return result;
 }
 
@@ -78,6 +168,54 @@ uint64_t CustomProtectedStream::GetEncryptedContentLength(
     contentLength);
 }
 
+uint64_t CustomProtectedStream::GetEncryptedContentLength(
+  std::shared_ptr<UserPolicy>policy,
+  uint64_t                   contentLength,
+  CipherMode                 cipherMode)
+{
+  if (policy.get() == nullptr) {
+    throw exceptions::RMSNullPointerException("Invalid policy argument");
+  }
+
+  uint64_t cbHeader = cipherMode == CIPHER_MODE_CTR ? CTR_NONCE_SIZE : 0;
+
+  return cbHeader + rmscrypto::api::GetCipherTextSize(contentLength, cipherMode);
+}
+
+void CustomProtectedStream::CheckWrite(uint64_t u64Offset, uint64_t u64Size)
+{
+  if ((m_pWritten.get() == nullptr) || (u64Size == 0)) {
+    return;
+  }
+
+  // claim [u64Offset, u64End) unless some of it was written
+  uint64_t u64End = u64Offset + u64Size;
+
+  lock_guard<mutex> locker(m_pWritten->locker);
+  auto& ranges = m_pWritten->ranges;
+
+  // the ranges around it, the one before may end inside it
+  auto next = ranges.upper_bound(u64Offset);
+  auto prev = next == ranges.begin() ? ranges.end() : std::prev(next);
+
+  if (((next != ranges.end()) && (next->first < u64End)) ||
+      ((prev != ranges.end()) && (prev->second > u64Offset))) {
+    throw exceptions::RMSStreamException("CTR content can't be rewritten");
+  }
+
+  // merge with the neighbours it touches
+  if ((prev != ranges.end()) && (prev->second == u64Offset)) {
+    u64Offset = prev->first;
+    ranges.erase(prev);
+  }
+
+  if ((next != ranges.end()) && (next->first == u64End)) {
+    u64End = next->second;
+    ranges.erase(next);
+  }
+  ranges[u64Offset] = u64End;
+}
+
 shared_future<int64_t>CustomProtectedStream::ReadAsync(uint8_t    *pbBuffer,
                                                        int64_t     cbBuffer,
                                                        int64_t     cbOffset,
@@ -91,6 +229,7 @@ shared_future<int64_t>CustomProtectedStream::WriteAsync(const uint8_t *cpbBuffer
                                                         int64_t        cbOffset,
                                                         std::launch    launchType)
 {
+  CheckWrite(static_cast<uint64_t>(cbOffset), static_cast<uint64_t>(cbBuffer));
   return m_pImpl->WriteAsync(cpbBuffer, cbBuffer, cbOffset, launchType);
 }
 
@@ -107,6 +246,7 @@ int64_t CustomProtectedStream::Read(uint8_t *pbBuffer,
 int64_t CustomProtectedStream::Write(const uint8_t *cpbBuffer,
                                      int64_t        cbBuffer)
 {
+  CheckWrite(m_pImpl->Position(), static_cast<uint64_t>(cbBuffer));
   return m_pImpl->Write(cpbBuffer, cbBuffer);
 }
 
@@ -116,8 +256,11 @@ bool CustomProtectedStream::Flush() {
 
 SharedStream CustomProtectedStream::Clone()
 {
-  return static_pointer_cast<IStream>(
-    shared_ptr<CustomProtectedStream>(new CustomProtectedStream(m_pImpl->Clone())));
+  auto result = shared_ptr<CustomProtectedStream>(
+    new CustomProtectedStream(m_pImpl->Clone()));
+
+  result->m_pWritten = m_pWritten;
+  return static_pointer_cast<IStream>(result);
 }
 
 void CustomProtectedStream::Seek(uint64_t u64Position)
@@ -147,6 +290,13 @@ uint64_t CustomProtectedStream::Size()
 
 void CustomProtectedStream::Size(uint64_t u64Value)
 {
+  uint64_t u64Size = m_pImpl->Size();
+
+  if (u64Value >= u64Size) {
+    CheckWrite(u64Size, u64Value - u64Size);
+  } else if (m_pWritten.get() != nullptr) {
+    throw exceptions::RMSStreamException("CTR content can't be truncated");
+  }
   m_pImpl->Size(u64Value);
 }
 
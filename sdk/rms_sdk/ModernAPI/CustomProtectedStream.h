@@ -9,8 +9,11 @@
 #ifndef _RMS_LIB_CUSTOMPROTECTEDSTREAM_H_
 #define _RMS_LIB_CUSTOMPROTECTEDSTREAM_H_
 
+#include <map>
+#include <mutex>
 #include "UserPolicy.h"
 #include "IStream.h"
+#include "CryptoAPI.h"
 #include "ModernAPIExport.h"
 
 namespace rmscore {
@@ -22,12 +25,36 @@ public:
     std::shared_ptr<UserPolicy>  policy,
     rmscrypto::api::SharedStream stream,
     uint64_t                     contentStartPosition,
-    uint64_t                     contentSize);
+    uint64_t                     contentSize,
+    uint64_t                     blockCacheSize =
+      rmscrypto::api::DEFAULT_BLOCK_CACHE_SIZE);
+
+  // Same as above, with the content key of the policy used in cipherMode
+  // instead of the policy's own mode. For app defined containers, e.g. with
+  // CIPHER_MODE_CTR for cheap random access.
+  // A CIPHER_MODE_CTR container starts with a random nonce of CTR_NONCE_SIZE
+  // bytes, written here when contentSize is 0, and is encrypted under a key
+  // derived from the policy key and that nonce. Its content is written once:
+  // writes may come in any order, but writing over bytes which were written
+  // before, or shrinking the content, throws RMSStreamException.
+  static std::shared_ptr<CustomProtectedStream>Create(
+    std::shared_ptr<UserPolicy>  policy,
+    rmscrypto::api::SharedStream stream,
+    uint64_t                     contentStartPosition,
+    uint64_t                     contentSize,
+    rmscrypto::api::CipherMode   cipherMode,
+    uint64_t                     blockCacheSize =
+      rmscrypto::api::DEFAULT_BLOCK_CACHE_SIZE);
 
   static uint64_t GetEncryptedContentLength(
     std::shared_ptr<UserPolicy>policy,
     uint64_t                   contentLength);
 
+  static uint64_t GetEncryptedContentLength(
+    std::shared_ptr<UserPolicy>policy,
+    uint64_t                   contentLength,
+    rmscrypto::api::CipherMode cipherMode);
+
   virtual std::shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
                                                int64_t     cbBuffer,
                                                int64_t     cbOffset,
@@ -66,7 +93,35 @@ protected:
 
 private:
 
+  static std::shared_ptr<CustomProtectedStream>CreateWithProvider(
+    std::shared_ptr<rmscrypto::api::ICryptoProvider>pCryptoProvider,
+    rmscrypto::api::SharedStream                    stream,
+    uint64_t                                        contentStartPosition,
+    uint64_t                                        contentSize,
+    uint64_t                                        blockCacheSize);
+
+  static std::shared_ptr<CustomProtectedStream>CreateCtr(
+    const std::vector<uint8_t>&  key,
+    rmscrypto::api::SharedStream stream,
+    uint64_t                     contentStartPosition,
+    uint64_t                     contentSize,
+    uint64_t                     blockCacheSize);
+
+  void CheckWrite(uint64_t u64Offset,
+                  uint64_t u64Size);
+
+  // Written ranges [first, end) of a write once (CTR) container, disjoint
+  // and not adjacent, keyed by first
+  struct WrittenRanges
+  {
+    std::mutex                   locker;
+    std::map<uint64_t, uint64_t> ranges;
+  };
+
   std::shared_ptr<IStream> m_pImpl;
+
+  // shared by clones, nullptr for the other modes
+  std::shared_ptr<WrittenRanges> m_pWritten;
 };
 } // namespace modernapi
 } // namespace rmscore
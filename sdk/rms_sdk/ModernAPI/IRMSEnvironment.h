@@ -9,6 +9,7 @@
 #ifndef _RMS_LIB_IRMSENVIRONMENT_H
 #define _RMS_LIB_IRMSENVIRONMENT_H
 
+#include <cstddef>
 #include <memory>
 
 #include "ModernAPIExport.h"
@@ -23,6 +24,13 @@ public:
   enum class LoggerOption : int { Always, Never };
   virtual void                                 LogOption(LoggerOption opt) = 0;
   virtual LoggerOption                         LogOption()                 = 0;
+
+  // Number of worker threads of the shared executor which runs the SDK's
+  // asynchronous operations. Takes effect if set before the first of them;
+  // 0 (the default) means one per hardware thread.
+  virtual void                                 ExecutorThreadCount(
+    size_t count) = 0;
+  virtual size_t                               ExecutorThreadCount() = 0;
 };
 
 DLL_PUBLIC_RMS std::shared_ptr<IRMSEnvironment>RMSEnvironment();
@@ -8,8 +8,14 @@
 
 #include <QFile>
 #include <vector>
+#include <atomic>
+#include <limits>
 #include <CryptoAPI.h>
 #include <BlockBasedProtectedStream.h>
+#include <Executor.h>
+#ifndef _WIN32
+# include <PositionalFileStream.h>
+#endif // ifndef _WIN32
 #include "../PFile/PfileHeaderReader.h"
 #include "../PFile/PfileHeaderWriter.h"
 #include "../ModernAPI/RMSExceptions.h"
@@ -34,16 +40,49 @@ GetProtectedFileStreamResult::GetProtectedFileStreamResult(
   , m_stream(stream)
 {}
 
-ProtectedFileStream::ProtectedFileStream(SharedStream          pImpl,
-                                         shared_ptr<UserPolicy>policy,
-                                         const string        & originalFileExtension)
+PfileInfo::PfileInfo()
+  : m_status(ProbeNotPFile)
+  , m_majorVersion(0)
+  , m_minorVersion(0)
+  , m_hasOriginalFileSize(false)
+  , m_originalFileSize(0)
+  , m_contentStartPosition(0)
+{}
+
+ProtectedFileStream::ProtectedFileStream(SharedStream           pImpl,
+                                         shared_ptr<UserPolicy> policy,
+                                         const string         & originalFileExtension,
+                                         SharedStream           pBackingStream,
+                                         shared_ptr<PfileHeader>pHeader,
+                                         uint64_t               u64BlockSize,
+                                         uint64_t               u64PlainTextSize)
   : m_policy(policy)
   , m_originalFileExtension(originalFileExtension)
   , m_pImpl(pImpl)
+  , m_pBackingStream(pBackingStream)
+  , m_pHeader(pHeader)
+  , m_u64BlockSize(u64BlockSize)
+  , m_u64PlainTextSize(u64PlainTextSize)
+  , m_bIsModified(false)
 {}
 
+const uint64_t ProtectedFileStream::UNKNOWN_SIZE;
+
 ProtectedFileStream::~ProtectedFileStream() {}
 
+// The cipher mode of the content of a PFile of majorVersion protected with a
+// policy of policyCipherMode. Older versions of the SDK ignored ECB cipher
+// mode when encrypting pfile format.
+static CipherMode GetContentCipherMode(CipherMode policyCipherMode,
+                                       uint32_t   majorVersion)
+{
+  if ((CipherMode::CIPHER_MODE_ECB == policyCipherMode) &&
+      (majorVersion <= rmscore::pfile::MaxMajorVerionsCBC4KIsForced)) {
+    return CipherMode::CIPHER_MODE_CBC4K;
+  }
+  return policyCipherMode;
+}
+
 shared_ptr<GetProtectedFileStreamResult>ProtectedFileStream::Acquire(
   SharedStream                       stream,
   const string                     & userId,
@@ -51,7 +90,8 @@ shared_ptr<GetProtectedFileStreamResult>ProtectedFileStream::Acquire(
   IConsentCallback                  *consentCallback,
   PolicyAcquisitionOptions           options,
   ResponseCacheFlags                 cacheMask,
-  std::shared_ptr<std::atomic<bool> >cancelState)
+  std::shared_ptr<std::atomic<bool> >cancelState,
+  uint64_t                           blockCacheSize)
 {
   Logger::Hidden("+ProtectedFileStream::Get");
 
@@ -71,7 +111,7 @@ shared_ptr<GetProtectedFileStreamResult>ProtectedFileStream::Acquire(
     header  = headerReader->Read(stream);
     pHeader = header.get();
     Logger::Hidden(
-      "ProtectedFileStream: Read pfile header. Major version: %d, minor version: %d, file extension: '%s', content start position: %d, original file size: %I64d",
+      "ProtectedFileStream: Read pfile header. Major version: %d, minor version: %d, file extension: '%s', content start position: %I64d, original file size: %I64d",
       pHeader->GetMajorVersion(),
       pHeader->GetMinorVersion(),
       pHeader->GetFileExtension().c_str(),
@@ -111,7 +151,8 @@ shared_ptr<GetProtectedFileStreamResult>ProtectedFileStream::Acquire(
   ProtectedFileStream *protectedFileStream = policy ?
                                              CreateProtectedFileStream(policy,
                                                                        stream,
-                                                                       header) :
+                                                                       header,
+                                                                       blockCacheSize) :
                                              nullptr;
 
   auto result = make_shared<GetProtectedFileStreamResult>(
@@ -123,7 +164,10 @@ shared_ptr<GetProtectedFileStreamResult>ProtectedFileStream::Acquire(
 shared_ptr<ProtectedFileStream>ProtectedFileStream::Create(
   shared_ptr<UserPolicy>policy,
   SharedStream          stream,
-  const string        & originalFileExtension)
+  const string        & originalFileExtension,
+  uint64_t              blockCacheSize,
+  uint64_t              headerPadding,
+  bool                  use64BitLayout)
 {
   Logger::Hidden("+ProtectedFileStream::Create");
 
@@ -138,19 +182,39 @@ shared_ptr<ProtectedFileStream>ProtectedFileStream::Create(
     auto publishingLicense = policy->SerializedPolicy();
     ByteArray metadata; // No metadata
 
-    // calculate content size
-    uint32_t contentStartPosition =
-      static_cast<uint32_t>(ext.size() +
-                            publishingLicense.size()
-                            +
-                            metadata.size() + 454);
+    // the content starts after the header, whose size depends on the
+    // version's layout, and the padding reserved for a longer license
+    auto getContentStartPosition = [&](uint32_t majorVersion) {
+      auto pLayout = make_shared<PfileHeader>(ByteArray(publishingLicense),
+                                              ext,
+                                              0,
+                                              static_cast<uint64_t>(-1),
+                                              ByteArray(metadata),
+                                              majorVersion,
+                                              static_cast<uint32_t>(rmscore::pfile::MNVERSION_FOR_WRITING),
+                                              CleartextRedirectHeader);
+      return headerWriter->GetHeaderSize(pLayout) + headerPadding;
+    };
+
+    uint32_t majorVersion = use64BitLayout ?
+                            rmscore::pfile::MIN_MJVERSION_WITH_64BIT_LAYOUT :
+                            rmscore::pfile::MJVERSION_FOR_WRITING;
+    uint64_t contentStartPosition = getContentStartPosition(majorVersion);
+
+    // the 32 bit fields can't point past 4 GB
+    if (contentStartPosition > numeric_limits<uint32_t>::max())
+    {
+      majorVersion         = rmscore::pfile::MIN_MJVERSION_WITH_64BIT_LAYOUT;
+      contentStartPosition = getContentStartPosition(majorVersion);
+    }
+
     pHeader = make_shared<PfileHeader>(move(publishingLicense),
                                        ext,
                                        contentStartPosition,
                                        static_cast<uint64_t>(-1), // No known
                                                                   // originalFileSize
                                        move(metadata),
-                                       static_cast<uint32_t>(rmscore::pfile::MJVERSION_FOR_WRITING),
+                                       majorVersion,
                                        static_cast<uint32_t>(rmscore::pfile::MNVERSION_FOR_WRITING),
                                        CleartextRedirectHeader);
 
@@ -158,32 +222,345 @@ shared_ptr<ProtectedFileStream>ProtectedFileStream::Create(
     stream->Flush();
   }
 
-  auto result = CreateProtectedFileStream(policy, stream, pHeader);
+  auto result = CreateProtectedFileStream(policy, stream, pHeader,
+                                          blockCacheSize);
+
+  // the header says the size is unknown until the first Flush()
+  result->m_u64PlainTextSize = 0;
+  result->m_bIsModified      = true;
 
   Logger::Hidden("-ProtectedFileStream::Create");
   return shared_ptr<ProtectedFileStream>(result);
 }
 
+// The new header of a reprotected stream, in the version of the current one
+static shared_ptr<PfileHeader>ReprotectedHeader(
+  shared_ptr<PfileHeader>currentHeader,
+  shared_ptr<UserPolicy> policy,
+  uint64_t               contentStartPosition,
+  uint64_t               originalFileSize)
+{
+  return make_shared<PfileHeader>(ByteArray(policy->SerializedPolicy()),
+                                  currentHeader->GetFileExtension(),
+                                  contentStartPosition,
+                                  originalFileSize,
+                                  ByteArray(currentHeader->GetMetadata()),
+                                  currentHeader->GetMajorVersion(),
+                                  currentHeader->GetMinorVersion(),
+                                  currentHeader->GetCleartextRedirectionHeader());
+}
+
+shared_ptr<ProtectedFileStream>ProtectedFileStream::Reprotect(
+  shared_ptr<ProtectedFileStream>stream,
+  shared_ptr<UserPolicy>         policy,
+  uint64_t                       blockCacheSize)
+{
+  Logger::Hidden("+ProtectedFileStream::Reprotect");
+
+  CheckReprotect(stream, policy);
+
+  // pending writes go to the backing stream before the header is rewritten
+  stream->Flush();
+
+  auto     currentHeader        = stream->m_pHeader;
+  auto     backingStream        = stream->m_pBackingStream;
+  auto     headerWriter         = IPfileHeaderWriter::Create();
+  uint64_t contentStartPosition = currentHeader->GetContentStartPosition();
+  auto     pHeader              = ReprotectedHeader(currentHeader, policy,
+                                                    contentStartPosition,
+                                                    stream->Size());
+
+  // moving the content in place would leave a file that is neither the old
+  // nor the new one if it failed part way
+  if (headerWriter->GetHeaderSize(pHeader) > contentStartPosition)
+  {
+    throw exceptions::RMSInvalidArgumentException(
+            "The header doesn't fit in front of the content");
+  }
+
+  backingStream->Seek(0);
+  headerWriter->Write(backingStream, pHeader);
+  backingStream->Flush();
+
+  // The caller's stream is reopened with the new header, or its next Flush()
+  // would write the old one back
+  unique_ptr<ProtectedFileStream> reopened(
+    CreateProtectedFileStream(policy, backingStream, pHeader, blockCacheSize));
+
+  stream->m_policy         = reopened->m_policy;
+  stream->m_pImpl          = reopened->m_pImpl;
+  stream->m_pBackingStream = reopened->m_pBackingStream;
+  stream->m_pHeader        = reopened->m_pHeader;
+  stream->m_u64BlockSize   = reopened->m_u64BlockSize;
+  stream->m_u64PlainTextSize.store(reopened->m_u64PlainTextSize.load());
+  stream->m_bIsModified = false;
+
+  Logger::Hidden("-ProtectedFileStream::Reprotect");
+  return stream;
+}
+
+shared_ptr<ProtectedFileStream>ProtectedFileStream::Reprotect(
+  shared_ptr<ProtectedFileStream>stream,
+  shared_ptr<UserPolicy>         policy,
+  SharedStream                   target,
+  uint64_t                       blockCacheSize,
+  uint64_t                       headerPadding)
+{
+  Logger::Hidden("+ProtectedFileStream::Reprotect");
+
+  CheckReprotect(stream, policy);
+
+  if (target.get() == nullptr) {
+    throw exceptions::RMSNullPointerException("Invalid argument");
+  }
+
+  // pending writes go to the backing stream before the content is copied
+  stream->Flush();
+
+  auto currentHeader = stream->m_pHeader;
+  auto headerWriter  = IPfileHeaderWriter::Create();
+  auto pHeader       = ReprotectedHeader(currentHeader, policy, 0,
+                                         stream->Size());
+  uint64_t contentStartPosition = headerWriter->GetHeaderSize(pHeader) +
+                                  headerPadding;
+
+  // checked before anything is copied, the writer would refuse it after
+  if (!pHeader->Has64BitLayout() &&
+      (contentStartPosition > numeric_limits<uint32_t>::max()))
+  {
+    throw exceptions::RMSInvalidArgumentException(
+            "The header padding is too large for this PFile version");
+  }
+
+  pHeader = ReprotectedHeader(currentHeader, policy, contentStartPosition,
+                              pHeader->GetOriginalFileSize());
+
+  Logger::Hidden(
+    "ProtectedFileStream::Reprotect: copying the content from %I64d to %I64d",
+    currentHeader->GetContentStartPosition(),
+    contentStartPosition);
+
+  // The header goes last, a target left part way isn't a PFile. Zeros hold
+  // its place meanwhile, not every stream can be written past its end.
+  vector<uint8_t> zeros(static_cast<size_t>(min<uint64_t>(contentStartPosition,
+                                                          1024 * 1024)));
+
+  for (uint64_t u64Done = 0; u64Done < contentStartPosition;)
+  {
+    uint64_t cbZeros = min<uint64_t>(contentStartPosition - u64Done,
+                                     zeros.size());
+
+    target->WriteAsync(zeros.data(), static_cast<int64_t>(cbZeros),
+                       static_cast<int64_t>(u64Done), launch::deferred).get();
+    u64Done += cbZeros;
+  }
+
+  CopyContent(stream->m_pBackingStream, currentHeader->GetContentStartPosition(),
+              target, contentStartPosition);
+  target->Seek(0);
+  headerWriter->Write(target, pHeader);
+  target->Flush();
+
+  auto result = CreateProtectedFileStream(policy, target, pHeader,
+                                          blockCacheSize);
+
+  Logger::Hidden("-ProtectedFileStream::Reprotect");
+  return shared_ptr<ProtectedFileStream>(result);
+}
+
+void ProtectedFileStream::CheckReprotect(shared_ptr<ProtectedFileStream>stream,
+                                         shared_ptr<UserPolicy>         policy)
+{
+  if ((stream.get() == nullptr) || (stream->m_pHeader.get() == nullptr) ||
+      (policy.get() == nullptr)) {
+    throw exceptions::RMSNullPointerException("Invalid argument");
+  }
+
+  // The header keeps its version: readers pick the cipher mode of the
+  // content and the layout of the header by it. The encrypted content is
+  // kept too, so the new policy must decrypt it under that version.
+  uint32_t majorVersion  = stream->m_pHeader->GetMajorVersion();
+  auto     currentPolicy = stream->m_policy->GetImpl();
+  auto     newPolicy     = policy->GetImpl();
+
+  if ((GetContentCipherMode(currentPolicy->GetCipherMode(), majorVersion) !=
+       GetContentCipherMode(newPolicy->GetCipherMode(), majorVersion)) ||
+      (currentPolicy->GetCryptoProvider()->GetKey() !=
+       newPolicy->GetCryptoProvider()->GetKey()))
+  {
+    throw exceptions::RMSInvalidArgumentException(
+            "The policies have different content keys");
+  }
+}
+
+void ProtectedFileStream::CopyContent(SharedStream from,
+                                      uint64_t     u64From,
+                                      SharedStream to,
+                                      uint64_t     u64To)
+{
+  const uint64_t cbChunk = 1024 * 1024;
+  uint64_t u64Size       = from->Size() > u64From ? from->Size() - u64From : 0;
+  vector<uint8_t> buffer(static_cast<size_t>(min(u64Size, cbChunk)));
+
+  for (uint64_t u64Done = 0; u64Done < u64Size;)
+  {
+    uint64_t cbCopy = min(u64Size - u64Done, cbChunk);
+    int64_t  cbRead = from->ReadAsync(&buffer[0],
+                                      static_cast<int64_t>(cbCopy),
+                                      static_cast<int64_t>(u64From + u64Done),
+                                      launch::deferred).get();
+
+    if (cbRead != static_cast<int64_t>(cbCopy)) {
+      throw exceptions::RMSStreamException("Can't read the content");
+    }
+
+    to->WriteAsync(&buffer[0],
+                   static_cast<int64_t>(cbCopy),
+                   static_cast<int64_t>(u64To + u64Done),
+                   launch::deferred).get();
+    u64Done += cbCopy;
+  }
+}
+
+PfileInfo ProtectedFileStream::Probe(SharedStream stream)
+{
+  Logger::Hidden("+ProtectedFileStream::Probe");
+
+  if (stream.get() == nullptr) {
+    throw exceptions::RMSNullPointerException("Invalid stream");
+  }
+
+  PfileInfo info;
+  shared_ptr<PfileHeader> header;
+
+  try
+  {
+    header = IPfileHeaderReader::Create()->Read(stream);
+  }
+  catch (exceptions::RMSPFileException& e)
+  {
+    switch (e.reason())
+    {
+    case exceptions::RMSPFileException::NotPFile:
+      info.m_status = ProbeNotPFile;
+      break;
+
+    case exceptions::RMSPFileException::NotSupportedVersion:
+      info.m_status = ProbeNotSupportedVersion;
+      break;
+
+    default:
+      info.m_status = ProbeBadHeader;
+      break;
+    }
+    return info;
+  }
+
+  info.m_status                = ProbeIsPFile;
+  info.m_majorVersion          = header->GetMajorVersion();
+  info.m_minorVersion          = header->GetMinorVersion();
+  info.m_originalFileExtension = header->GetFileExtension();
+  info.m_hasOriginalFileSize   = header->HasOriginalFileSize();
+  info.m_originalFileSize      = info.m_hasOriginalFileSize ?
+                                 header->GetOriginalFileSize() : 0;
+  info.m_contentStartPosition = header->GetContentStartPosition();
+
+  auto& publishingLicense = header->GetPublishingLicense();
+  auto  sha256            = CreateCryptoEngine()->CreateHash(
+    CryptoHashAlgorithm::CRYPTO_HASH_ALGORITHM_SHA256);
+
+  info.m_publishingLicenseHash.resize(sha256->GetOutputSize());
+  uint32_t cbHash = static_cast<uint32_t>(info.m_publishingLicenseHash.size());
+
+  sha256->Update(publishingLicense.data(), publishingLicense.size());
+  sha256->Final(&info.m_publishingLicenseHash[0], cbHash);
+  info.m_publishingLicenseHash.resize(cbHash);
+
+  Logger::Hidden("-ProtectedFileStream::Probe");
+  return info;
+}
+
+// Opens path to read its header. Not memory mapped like CreateStreamFromFile:
+// a file truncated while it is probed would raise SIGBUS, and mapping every
+// file of a scan costs more than the few reads of a header.
+static SharedStream OpenForProbe(const string& path)
+{
+#ifndef _WIN32
+  return make_shared<PositionalFileStream>(path, ios_base::in);
+#else // ifndef _WIN32
+  return CreateStreamFromFile(path, ios_base::in);
+#endif // ifndef _WIN32
+}
+
+vector<PfileInfo>ProtectedFileStream::ProbeMany(const vector<string>& paths,
+                                                size_t               threadCount)
+{
+  Logger::Hidden("+ProtectedFileStream::ProbeMany: %d files",
+                 static_cast<int>(paths.size()));
+
+  vector<PfileInfo> infos(paths.size());
+
+  if (paths.empty()) {
+    return infos;
+  }
+
+  // A pool of its own: the probes block on file I/O, on the default
+  // executor they would hold the workers of every stream in the process.
+  Executor executor(threadCount);
+  size_t   cWorkers = min(executor.ThreadCount(), paths.size());
+  atomic<size_t> next(0);
+  vector<future<void> > workers;
+
+  for (size_t i = 0; i < cWorkers; ++i)
+  {
+    workers.push_back(Async(executor, launch::async, [&paths, &infos, &next]() {
+        for (size_t index = next++; index < paths.size(); index = next++)
+        {
+          try
+          {
+            infos[index] = Probe(OpenForProbe(paths[index]));
+          }
+          catch (std::exception& e)
+          {
+            Logger::Hidden("ProtectedFileStream::ProbeMany: %s: %s",
+                           paths[index].c_str(), e.what());
+            infos[index]          = PfileInfo();
+            infos[index].m_status = ProbeIOError;
+          }
+        }
+      }));
+  }
+
+  for (auto& worker : workers) {
+    worker.get();
+  }
+
+  Logger::Hidden("-ProtectedFileStream::ProbeMany");
+  return infos;
+}
+
 ProtectedFileStream * ProtectedFileStream::CreateProtectedFileStream(
   shared_ptr<UserPolicy>policy,
   SharedStream          stream,
   shared_ptr<rmscore::pfile::PfileHeader>
-  pHeader)
+  pHeader,
+  uint64_t blockCacheSize)
 {
   // create an IStreamImpl implementation of the backing stream
   auto pBackingStreamImpl            = stream->Clone();
   uint64_t nProtectedStreamBlockSize = 4096;
 
   shared_ptr<ICryptoProvider> pCryptoProvider = nullptr;
-  ulong  contentStartPosition                 = 0;
+  uint64_t contentStartPosition               = 0;
   string fileExtension;
 
   auto protectionPolicy = policy->GetImpl();
-  if ((rmscrypto::api::CipherMode::CIPHER_MODE_ECB  == protectionPolicy->GetCipherMode()) &&
-      (pHeader->GetMajorVersion() <= rmscore::pfile::MaxMajorVerionsCBC4KIsForced))
+  auto cipherMode       = GetContentCipherMode(protectionPolicy->GetCipherMode(),
+                                               pHeader->GetMajorVersion());
+
+  if (cipherMode != protectionPolicy->GetCipherMode())
   {
-    // Older versions of the SDK ignored ECB cipher mode when encrypting pfile format.
-    protectionPolicy->ReinitilizeCryptoProvider(rmscrypto::api::CipherMode::CIPHER_MODE_CBC4K);
+    protectionPolicy->ReinitilizeCryptoProvider(cipherMode);
   }
 
   pCryptoProvider = policy->GetImpl()->GetCryptoProvider();
@@ -203,14 +580,30 @@ ProtectedFileStream * ProtectedFileStream::CreateProtectedFileStream(
   contentStartPosition = pHeader->GetContentStartPosition();
   fileExtension        = pHeader->GetFileExtension();
 
+  uint64_t u64ContentSize = stream->Size() - contentStartPosition;
+
+  // The recorded size is only used if it matches the encrypted content, a
+  // file changed by a writer that didn't update the header falls back to
+  // decrypting the final block.
+  uint64_t u64PlainTextSize = UNKNOWN_SIZE;
+
+  if (pHeader->HasOriginalFileSize() &&
+      (GetCipherTextSize(pHeader->GetOriginalFileSize(),
+                         protectionPolicy->GetCipherMode()) == u64ContentSize))
+  {
+    u64PlainTextSize = pHeader->GetOriginalFileSize();
+  }
+
   auto pProtectedStreamImpl = BlockBasedProtectedStream::Create(pCryptoProvider,
                                                                 pBackingStreamImpl,
                                                                 contentStartPosition,
-                                                                stream->Size() -
-                                                                contentStartPosition,
-                                                                nProtectedStreamBlockSize);
+                                                                u64ContentSize,
+                                                                nProtectedStreamBlockSize,
+                                                                blockCacheSize);
 
-  return new ProtectedFileStream(pProtectedStreamImpl, policy, fileExtension);
+  return new ProtectedFileStream(pProtectedStreamImpl, policy, fileExtension,
+                                 pBackingStreamImpl, pHeader,
+                                 nProtectedStreamBlockSize, u64PlainTextSize);
 }
 
 shared_future<int64_t>ProtectedFileStream::ReadAsync(uint8_t    *pbBuffer,
@@ -226,11 +619,17 @@ shared_future<int64_t>ProtectedFileStream::WriteAsync(const uint8_t *cpbBuffer,
                                                       int64_t        cbOffset,
                                                       std::launch    launchType)
 {
+  BeginWrite(static_cast<uint64_t>(cbOffset + cbBuffer));
   return m_pImpl->WriteAsync(cpbBuffer, cbBuffer, cbOffset, launchType);
 }
 
 future<bool>ProtectedFileStream::FlushAsync(std::launch launchType) {
-  return m_pImpl->FlushAsync(launchType);
+  // the same as Flush(), which records the size in the header after the
+  // content
+  return Async(*Executor::Default(), launchType,
+               [](shared_ptr<ProtectedFileStream>self) -> bool {
+        return self->Flush();
+      }, shared_from_this());
 }
 
 int64_t ProtectedFileStream::Read(uint8_t *pbBuffer,
@@ -242,17 +641,36 @@ int64_t ProtectedFileStream::Read(uint8_t *pbBuffer,
 int64_t ProtectedFileStream::Write(const uint8_t *cpbBuffer,
                                    int64_t        cbBuffer)
 {
+  BeginWrite(m_pImpl->Position() + static_cast<uint64_t>(cbBuffer));
   return m_pImpl->Write(cpbBuffer, cbBuffer);
 }
 
 bool ProtectedFileStream::Flush() {
-  return m_pImpl->Flush();
+  // Nothing to write for an unmodified stream. The block stream would write
+  // the padding of a final block it hasn't read over the content.
+  if (!m_bIsModified) {
+    return true;
+  }
+
+  bool bResult = m_pImpl->Flush();
+
+  RecordPlainTextSize();
+
+  // only now, a stream whose flush threw is still modified
+  m_bIsModified = false;
+  return bResult;
 }
 
 SharedStream ProtectedFileStream::Clone()
 {
+  uint64_t u64PlainTextSize = m_bIsModified ? UNKNOWN_SIZE : m_u64PlainTextSize.load();
+
   return shared_ptr<IStream>(new ProtectedFileStream(m_pImpl->Clone(), m_policy,
-                                                     m_originalFileExtension));
+                                                     m_originalFileExtension,
+                                                     m_pBackingStream,
+                                                     m_pHeader,
+                                                     m_u64BlockSize,
+                                                     u64PlainTextSize));
 }
 
 void ProtectedFileStream::Seek(uint64_t u64Position)
@@ -277,12 +695,105 @@ bool ProtectedFileStream::CanWrite() const
 
 uint64_t ProtectedFileStream::Size()
 {
-  return m_pImpl->Size();
+  // Not the size of the block stream: until it writes its final block, the
+  // block stream of an existing file only knows the size of the encrypted
+  // content.
+  uint64_t u64Size = m_u64PlainTextSize;
+
+  if (u64Size == UNKNOWN_SIZE)
+  {
+    u64Size            = ReadPlainTextSize();
+    m_u64PlainTextSize = u64Size;
+  }
+  return u64Size;
 }
 
 void ProtectedFileStream::Size(uint64_t u64Value)
 {
+  BeginWrite(u64Value);
   m_pImpl->Size(u64Value);
+  m_u64PlainTextSize = u64Value;
+}
+
+void ProtectedFileStream::BeginWrite(uint64_t u64End)
+{
+  // readers of the 32 bit layout derive the IVs from 32 bit block numbers
+  if (!m_pHeader->Has64BitLayout() &&
+      (u64End > rmscore::pfile::MAX_BLOCKS_WITH_32BIT_LAYOUT * m_u64BlockSize))
+  {
+    throw exceptions::RMSStreamException(
+            "The content is too large for this PFile version");
+  }
+
+  // the size is read before the first change, while the backing stream still
+  // has all of the content
+  if (!m_bIsModified) {
+    Size();
+  }
+
+  // writes past the end grow the content
+  uint64_t u64Size = m_u64PlainTextSize;
+
+  while ((u64End > u64Size) &&
+         !m_u64PlainTextSize.compare_exchange_weak(u64Size, u64End)) {}
+  m_bIsModified = true;
+}
+
+uint64_t ProtectedFileStream::ReadPlainTextSize()
+{
+  uint64_t u64ContentStart = m_pHeader->GetContentStartPosition();
+  uint64_t u64BackingSize  = m_pBackingStream->Size();
+  uint64_t u64ContentSize  = u64BackingSize > u64ContentStart ?
+                             u64BackingSize - u64ContentStart : 0;
+
+  // without padding the encrypted content is as long as the plain text
+  auto protectionPolicy = m_policy->GetImpl();
+
+  if ((u64ContentSize == 0) ||
+      (GetCipherTextSize(1, protectionPolicy->GetCipherMode()) == 1)) {
+    return u64ContentSize;
+  }
+
+  // A stream of its own over the flushed content, so the position and the
+  // blocks cached by this one are left alone. Only the final block is read.
+  auto pContent = BlockBasedProtectedStream::Create(protectionPolicy->GetCryptoProvider(),
+                                                    m_pBackingStream->Clone(),
+                                                    u64ContentStart,
+                                                    u64ContentSize,
+                                                    m_u64BlockSize);
+  uint64_t u64FinalBlock = (u64ContentSize - 1) / m_u64BlockSize * m_u64BlockSize;
+  vector<uint8_t> buffer(static_cast<size_t>(u64ContentSize - u64FinalBlock));
+
+  int64_t cbRead = pContent->ReadAsync(&buffer[0],
+                                       static_cast<int64_t>(buffer.size()),
+                                       static_cast<int64_t>(u64FinalBlock),
+                                       launch::deferred).get();
+
+  return u64FinalBlock + static_cast<uint64_t>(max(cbRead, static_cast<int64_t>(0)));
+}
+
+void ProtectedFileStream::RecordPlainTextSize()
+{
+  uint64_t u64Size = Size();
+
+  // headers before v2.1 have no field for it
+  if (m_pHeader->HasOriginalFileSizeField())
+  {
+    IPfileHeaderWriter::Create()->WriteOriginalFileSize(m_pBackingStream,
+                                                        m_pHeader,
+                                                        u64Size);
+    m_pBackingStream->Flush();
+  }
+}
+
+void ProtectedFileStream::SetConcurrentAccess(bool isConcurrent)
+{
+  auto pBlockStream = dynamic_pointer_cast<BlockBasedProtectedStream>(m_pImpl);
+
+  if (pBlockStream == nullptr) {
+    throw exceptions::RMSStreamException("Invalid stream");
+  }
+  pBlockStream->SetConcurrentAccess(isConcurrent);
 }
 } // namespace stream
 } // namespace rmscore
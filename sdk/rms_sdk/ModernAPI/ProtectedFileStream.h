@@ -9,6 +9,7 @@
 #ifndef _RMS_LIB_PROTECTEDFILESTREAM_H_
 #define _RMS_LIB_PROTECTEDFILESTREAM_H_
 
+#include <atomic>
 #include <CryptoAPI.h>
 #include "UserPolicy.h"
 #include "ModernAPIExport.h"
@@ -22,6 +23,11 @@ class PfileHeader;
 namespace modernapi {
 class ProtectedFileStream;
 
+// Zero bytes ProtectedFileStream::Create leaves between the header and the
+// content, so that ProtectedFileStream::Reprotect can write a longer
+// publishing license without moving the content.
+const uint64_t DEFAULT_PFILE_HEADER_PADDING = 4096;
+
 /*!
   @brief The result of the ProtectedFileStream::Acquire operation
 */
@@ -37,6 +43,40 @@ struct DLL_PUBLIC_RMS GetProtectedFileStreamResult
                                std::shared_ptr<ProtectedFileStream> stream);
 };
 
+/*!
+  @brief Outcome of ProtectedFileStream::Probe for one file
+*/
+enum PfileProbeStatus {
+  ProbeIsPFile             = 0, // the header was read, see PfileInfo
+  ProbeNotPFile            = 1, // not a PFile
+  ProbeNotSupportedVersion = 2, // a PFile of a version this SDK can't read
+  ProbeBadHeader           = 3, // a PFile with a corrupt or truncated header
+  ProbeIOError             = 4  // ProbeMany only: the file couldn't be read
+};
+
+/*!
+  @brief PFile header metadata returned by ProtectedFileStream::Probe. The
+  fields other than m_status are only set for ProbeIsPFile.
+*/
+struct DLL_PUBLIC_RMS PfileInfo
+{
+    PfileProbeStatus     m_status;
+    uint32_t             m_majorVersion;
+    uint32_t             m_minorVersion;
+    std::string          m_originalFileExtension;
+
+    // false if the header doesn't record the size of the original content
+    bool                 m_hasOriginalFileSize;
+    uint64_t             m_originalFileSize;
+    uint64_t             m_contentStartPosition;
+
+    // SHA-256 of the publishing license: files protected with the same
+    // license have the same hash, on any machine and with any SDK version
+    std::vector<uint8_t> m_publishingLicenseHash;
+
+    PfileInfo();
+};
+
 /*!
   @brief Wraps a std::iostream to provide transparent encryption and decryption
   on read and write.
@@ -44,7 +84,9 @@ struct DLL_PUBLIC_RMS GetProtectedFileStreamResult
   Use ProtectedFileStream::Acquire when working with encrypted (PFile) content.
   Use ProtectedFileStream::Create to wrap and encrypt a new stream.
 */
-class DLL_PUBLIC_RMS ProtectedFileStream : public rmscrypto::api::IStream
+class DLL_PUBLIC_RMS ProtectedFileStream : public rmscrypto::api::IStream,
+                                           public std::enable_shared_from_this<
+                                             ProtectedFileStream>
 {
 public:
 
@@ -77,6 +119,14 @@ public:
     virtual bool CanRead() const override;
     virtual bool CanWrite() const override;
     virtual uint64_t Position() override;
+
+    /*!
+    @brief Size of the plain text content.
+
+    Taken from the original file size recorded in the PFile header when it
+    matches the size of the encrypted content. Otherwise the final block is
+    decrypted once to learn it.
+    */
     virtual uint64_t Size() override;
     virtual void Size(uint64_t u64Value) override;
 
@@ -95,6 +145,8 @@ public:
     @param consentCallback A consent callback to ensure user consent.
     @param options
     @param cacheMask How API responses should be cached.
+    @param cancelState Set to true to cancel the policy acquisition.
+    @param blockCacheSize Memory budget (in bytes) for decrypted blocks kept by the stream.
     @return A GetProtectedFileStreamResult struct with status and pointer to wrapped stream.
     */
     static std::shared_ptr<GetProtectedFileStreamResult> Acquire(rmscrypto::api::SharedStream stream,
@@ -105,7 +157,8 @@ public:
         ResponseCacheFlags cacheMask = static_cast<ResponseCacheFlags>(RESPONSE_CACHE_INMEMORY |
                                                                        RESPONSE_CACHE_ONDISK |
                                                                        RESPONSE_CACHE_CRYPTED),
-        std::shared_ptr<std::atomic<bool> > cancelState = nullptr);
+        std::shared_ptr<std::atomic<bool> > cancelState = nullptr,
+        uint64_t blockCacheSize = rmscrypto::api::DEFAULT_BLOCK_CACHE_SIZE);
 
     /*!
     @brief Wrap a new stream as a protected stream.
@@ -117,11 +170,105 @@ public:
     @param policy The UserPolicy object that defines the policy used to protect the created PFile
     @param stream The backing stream, where encrypted content will be written.
     @param originalFileExtension The file extension of the original unprotected file.
+    @param blockCacheSize Memory budget (in bytes) for decrypted blocks kept by the stream.
+    @param headerPadding Bytes reserved after the header for a later Reprotect.
+    @param use64BitLayout Write a v4 header, which content of more than 2^32
+                          blocks (16 TB with CBC4K) needs. SDKs that read up
+                          to v3 can't open such files, so v3 is written
+                          unless this is set or the header needs offsets
+                          past 4 GB.
     @return A ProtectedFileStream.
     */
     static std::shared_ptr<ProtectedFileStream> Create(std::shared_ptr<UserPolicy>  policy,
                                                        rmscrypto::api::SharedStream stream,
-                                                       const std::string& originalFileExtension);
+                                                       const std::string& originalFileExtension,
+                                                       uint64_t blockCacheSize = rmscrypto::api::DEFAULT_BLOCK_CACHE_SIZE,
+                                                       uint64_t headerPadding = DEFAULT_PFILE_HEADER_PADDING,
+                                                       bool use64BitLayout = false);
+
+    /*!
+    @brief Protect a PFile with another policy without re-encrypting it.
+
+    Only possible if the new policy has the same content key and cipher mode
+    as the policy of the stream, e.g. after the publishing license of the same
+    content was updated. The header is rewritten in place, in the format
+    version the file already has, with the new publishing license. The cipher
+    modes are compared as that version applies them: content of files up to
+    v2 is CBC4K even under an ECB license. The content is left as it is, so
+    the new header must fit in front of it; otherwise reprotect to another
+    stream with the overload below.
+
+    @param stream A stream from Acquire. It is flushed, then reopened with
+                  the new header and policy. Clones of it must not be used
+                  afterwards.
+    @param policy The UserPolicy to protect the PFile with.
+    @param blockCacheSize Memory budget (in bytes) for decrypted blocks kept by the stream.
+    @return stream.
+    */
+    static std::shared_ptr<ProtectedFileStream> Reprotect(std::shared_ptr<ProtectedFileStream> stream,
+                                                          std::shared_ptr<UserPolicy> policy,
+                                                          uint64_t blockCacheSize = rmscrypto::api::DEFAULT_BLOCK_CACHE_SIZE);
+
+    /*!
+    @brief Protect a PFile with another policy into another stream.
+
+    The same as the overload above, but the new header and the encrypted
+    content are written to target, with headerPadding bytes between them.
+    The PFile of stream is only read, so a failure part way leaves it as it
+    was. The header is written last, a target left part way isn't a PFile.
+    To replace a file, write to a temporary file next to it and rename it
+    over the file once this returns.
+
+    @param stream A stream from Acquire, flushed here.
+    @param policy The UserPolicy to protect the PFile with.
+    @param target An empty stream for the new PFile.
+    @param blockCacheSize Memory budget (in bytes) for decrypted blocks kept by the stream.
+    @param headerPadding Bytes reserved after the header for a later Reprotect.
+    @return A ProtectedFileStream over target, with the new policy.
+    */
+    static std::shared_ptr<ProtectedFileStream> Reprotect(std::shared_ptr<ProtectedFileStream> stream,
+                                                          std::shared_ptr<UserPolicy> policy,
+                                                          rmscrypto::api::SharedStream target,
+                                                          uint64_t blockCacheSize = rmscrypto::api::DEFAULT_BLOCK_CACHE_SIZE,
+                                                          uint64_t headerPadding = DEFAULT_PFILE_HEADER_PADDING);
+
+    /*!
+    @brief Read the PFile header of a stream without acquiring its policy.
+
+    Only the header is read and nothing goes to the network, so it is cheap
+    enough to classify large numbers of files. Streams that aren't PFiles, or
+    whose header can't be parsed, are reported in PfileInfo::m_status.
+
+    @param stream The stream to check, read from offset 0.
+    @return The header metadata of the stream.
+    */
+    static PfileInfo Probe(rmscrypto::api::SharedStream stream);
+
+    /*!
+    @brief Probe many files in parallel.
+
+    Each file is opened read-only and only its header is read, with pread
+    rather than a memory mapping, so files truncated during the scan are safe.
+    A file that can't be opened or read is reported as ProbeIOError in its
+    PfileInfo instead of failing the whole batch.
+
+    @param paths The files to check.
+    @param threadCount Threads probing at once, 0 for one per hardware thread.
+    @return One PfileInfo per path, in the order of paths.
+    */
+    static std::vector<PfileInfo> ProbeMany(const std::vector<std::string>& paths,
+                                            size_t threadCount = 0);
+
+    /*!
+    @brief Allow reads and writes of different blocks to run in parallel.
+
+    Interior blocks are then locked by range instead of by stream, and
+    asynchronous operations are no longer ordered with each other. Operations
+    near the end of the content are still serialized. Off by default.
+
+    @param isConcurrent True to lock by range, false to serialize every operation.
+    */
+    void SetConcurrentAccess(bool isConcurrent);
 
     std::shared_ptr<UserPolicy> Policy() { return m_policy; }
 
@@ -129,14 +276,30 @@ public:
 
 private:
 
-    ProtectedFileStream(rmscrypto::api::SharedStream pImpl,
-                        std::shared_ptr<UserPolicy>  policy,
-                        const std::string&           originalFileExtension);
+    ProtectedFileStream(rmscrypto::api::SharedStream        pImpl,
+                        std::shared_ptr<UserPolicy>         policy,
+                        const std::string&                  originalFileExtension,
+                        rmscrypto::api::SharedStream        pBackingStream,
+                        std::shared_ptr<pfile::PfileHeader> pHeader,
+                        uint64_t                            u64BlockSize,
+                        uint64_t                            u64PlainTextSize);
+
+    void     BeginWrite(uint64_t u64End);
+    uint64_t ReadPlainTextSize();
+    void     RecordPlainTextSize();
+
+    static void CheckReprotect(std::shared_ptr<ProtectedFileStream> stream,
+                               std::shared_ptr<UserPolicy>          policy);
+    static void CopyContent(rmscrypto::api::SharedStream from,
+                            uint64_t                     u64From,
+                            rmscrypto::api::SharedStream to,
+                            uint64_t                     u64To);
 
 
     static ProtectedFileStream* CreateProtectedFileStream(std::shared_ptr<UserPolicy> policy,
                                                           rmscrypto::api::SharedStream stream,
-                                                          std::shared_ptr<pfile::PfileHeader> pHeader);
+                                                          std::shared_ptr<pfile::PfileHeader> pHeader,
+                                                          uint64_t blockCacheSize);
 
 private:
 
@@ -144,6 +307,18 @@ private:
   std::string m_originalFileExtension;
   std::shared_ptr<IStream> m_pImpl;
 
+  // the header is rewritten with the content size on Flush()
+  rmscrypto::api::SharedStream m_pBackingStream;
+  std::shared_ptr<pfile::PfileHeader> m_pHeader;
+  uint64_t m_u64BlockSize;
+
+  // size of the content, UNKNOWN_SIZE until it has been read. Writes
+  // before the end leave it as it is, only those past it grow the content.
+  std::atomic<uint64_t> m_u64PlainTextSize;
+  std::atomic<bool> m_bIsModified;
+
+  static const uint64_t UNKNOWN_SIZE = static_cast<uint64_t>(-1);
+
 }; // class ProtectedFileStream
 } // namespace modernapi
 } // namespace rmscore
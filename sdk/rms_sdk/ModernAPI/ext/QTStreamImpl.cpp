@@ -20,7 +20,8 @@ SharedStream QTStreamImpl::Create(QSharedPointer<QDataStream>stream) {
 }
 
 QTStreamImpl::QTStreamImpl(QSharedPointer<QDataStream>stream)
-  : stream_(stream) {}
+  : stream_(stream)
+  , queue_(SerialQueue::Create()) {}
 
 shared_future<int64_t>QTStreamImpl::ReadAsync(uint8_t    *pbBuffer,
                                               int64_t     cbBuffer,
@@ -29,7 +30,7 @@ shared_future<int64_t>QTStreamImpl::ReadAsync(uint8_t    *pbBuffer,
 {
   auto selfPtr = shared_from_this();
 
-  return std::async(launchType, [](
+  return Async(*queue_, launchType, [](
                       std::shared_ptr<QTStreamImpl>self,
                       uint8_t      *buffer,
                       int64_t size,
@@ -53,7 +54,7 @@ shared_future<int64_t>QTStreamImpl::WriteAsync(const uint8_t *cpbBuffer,
 {
   auto selfPtr = shared_from_this();
 
-  return std::async(launchType, [](
+  return Async(*queue_, launchType, [](
                       std::shared_ptr<QTStreamImpl>self,
                       const uint8_t *buffer,
                       int64_t size,
@@ -14,6 +14,7 @@
 #include <QSharedPointer>
 #include <QDataStream>
 #include <CryptoAPI.h>
+#include <Executor.h>
 
 class DLL_PUBLIC_RMS QTStreamImpl :
   public rmscrypto::api::IStream,
@@ -59,5 +60,6 @@ private:
 
   QSharedPointer<QDataStream> stream_;
   std::mutex locker_; // QDataStream is not thread safe!!!
+  std::shared_ptr<rmscrypto::api::SerialQueue> queue_;
 };
 #endif // ifndef _RMS_LIB_QDATASTREAM_H_
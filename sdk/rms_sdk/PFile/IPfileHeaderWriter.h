@@ -21,9 +21,22 @@ public:
 
   virtual ~IPfileHeaderWriter() {}
 
+  // Writes the header at the stream's position, which must be 0, and zeros
+  // from its end up to the header's content start position. Throws if the
+  // content would start inside the header.
   virtual size_t Write(rmscrypto::api::SharedStream stream,
                        const std::shared_ptr<PfileHeader> header) = 0;
 
+  // Rewrites the original file size field of a header already written to the
+  // stream, in place. The header must have the field (v2.1 and later).
+  virtual void   WriteOriginalFileSize(rmscrypto::api::SharedStream stream,
+                                       const std::shared_ptr<PfileHeader> header,
+                                       uint64_t originalFileSize) = 0;
+
+  // Number of bytes Write() writes for the header, the content may start
+  // right after them.
+  virtual uint64_t GetHeaderSize(const std::shared_ptr<PfileHeader> header) = 0;
+
 public:
 
   static std::shared_ptr<IPfileHeaderWriter>Create();
@@ -15,7 +15,7 @@ namespace rmscore {
 namespace pfile {
 PfileHeader::PfileHeader(ByteArray  && publishingLicense,
                          const string& fileExtension,
-                         uint32_t      contentStartPosition,
+                         uint64_t      contentStartPosition,
                          uint64_t      originalFileSize,
                          ByteArray  && metadata,
                          uint32_t      majorVersion,
@@ -39,7 +39,7 @@ const string& PfileHeader::GetFileExtension() const {
   return m_FileExtension;
 }
 
-uint32_t PfileHeader::GetContentStartPosition()  const {
+uint64_t PfileHeader::GetContentStartPosition()  const {
   return m_ContentStartPosition;
 }
 
@@ -47,6 +47,20 @@ uint64_t PfileHeader::GetOriginalFileSize()  const {
   return m_OriginalFileSize;
 }
 
+bool PfileHeader::HasOriginalFileSize() const {
+  return HasOriginalFileSizeField() &&
+         (m_OriginalFileSize != static_cast<uint64_t>(-1));
+}
+
+bool PfileHeader::Has64BitLayout() const {
+  return m_MajorVersion >= MIN_MJVERSION_WITH_64BIT_LAYOUT;
+}
+
+bool PfileHeader::HasOriginalFileSizeField() const {
+  return ((m_MajorVersion == 2) && (m_MinorVersion >= 1)) ||
+         (m_MajorVersion > 2);
+}
+
 uint32_t PfileHeader::GetMajorVersion()  const {
   return m_MajorVersion;
 }
@@ -17,8 +17,15 @@ namespace rmscore {
 namespace pfile {
 
 static const uint32_t MIN_SUPPORTED_MJVERSION_FOR_READING = 2;
-static const uint32_t MAX_SUPPORTED_MJVERSION_FOR_READING = 3;
+static const uint32_t MAX_SUPPORTED_MJVERSION_FOR_READING = 4;
 static const uint32_t MJVERSION_FOR_WRITING = 3;
+
+// From this version on the offsets and lengths of the header are 64 bit and
+// the content may have more than 2^32 blocks. Earlier versions use 32 bit
+// fields and 32 bit block numbers. Only written when the file needs it, since
+// readers of earlier versions refuse it.
+static const uint32_t MIN_MJVERSION_WITH_64BIT_LAYOUT = 4;
+static const uint64_t MAX_BLOCKS_WITH_32BIT_LAYOUT    = 1ULL << 32;
 static const uint32_t MNVERSION_FOR_WRITING = 0;
 // PFiles from this version and below were forced to be written with CBC4K encryption, regardless
 // of the published license information.
@@ -29,7 +36,7 @@ public:
 
   PfileHeader(common::ByteArray&& publishingLicense,
               const std::string & fileExtension,
-              uint32_t            contentStartPosition,
+              uint64_t            contentStartPosition,
               uint64_t            originalFileSize,
               common::ByteArray&& metadata,
               uint32_t            majorVersion,
@@ -39,8 +46,16 @@ public:
   const common::ByteArray& GetPublishingLicense() const;
   const common::ByteArray& GetMetadata() const;
   const std::string      & GetFileExtension() const;
-  uint32_t                 GetContentStartPosition() const;
+  uint64_t                 GetContentStartPosition() const;
   uint64_t                 GetOriginalFileSize() const;
+
+  // false for headers before v2.1, which have no such field, and for files
+  // written with the size unknown (-1)
+  bool                     HasOriginalFileSize() const;
+
+  // true for v2.1 and later headers, whether or not the size is known
+  bool                     HasOriginalFileSizeField() const;
+  bool                     Has64BitLayout() const;
   uint32_t                 GetMajorVersion() const;
   uint32_t                 GetMinorVersion() const;
   const std::string      & GetCleartextRedirectionHeader() const;
@@ -49,7 +64,7 @@ private:
 
   common::ByteArray m_PublishingLicense;
   std::string m_FileExtension;
-  const uint32_t m_ContentStartPosition;
+  const uint64_t m_ContentStartPosition;
   const uint64_t m_OriginalFileSize;
   common::ByteArray m_Metadata;
   const uint32_t    m_MajorVersion;
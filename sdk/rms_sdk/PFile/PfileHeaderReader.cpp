@@ -7,6 +7,9 @@
  */
 
 #include <future>
+#include <cstring>
+#include <algorithm>
+#include <limits>
 #include "../ModernAPI/RMSExceptions.h"
 #include "../Platform/Logger/Logger.h"
 #include "PfileHeaderReader.h"
@@ -22,6 +25,107 @@ const ByteArray ExpectedPreamble = { 0x2E, 0x70, 0x66, 0x69, 0x6C, 0x65 }; // by
                                                                            // of
                                                                            // ".pfile"
 
+// positions of the fields in front of the cleartext redirection header
+static const uint64_t MajorVersionOffset         = 6;
+static const uint64_t MinorVersionOffset         = 10;
+static const uint64_t RedirectHeaderLengthOffset = 14;
+static const uint64_t RedirectHeaderOffset       = 18;
+
+const uint32_t PfileHeaderReader::HEADER_PREFIX_SIZE;
+
+struct PfileHeaderReader::Layout {
+  uint32_t majorVersion;
+  uint32_t minorVersion;
+  uint64_t redirectHeaderLength;
+  uint64_t extensionOffset;
+  uint64_t extensionLength;
+  uint64_t plOffset;
+  uint64_t plLength;
+  uint64_t contentOffset;
+  uint64_t originalFileSize;
+  uint64_t metadataOffset;
+  uint64_t metadataLength;
+  bool     hasMetadata;
+  bool     is64Bit;
+};
+
+// true if [offset, offset + length) lies within the cbData bytes read
+static bool Contains(uint64_t cbData, uint64_t offset, uint64_t length)
+{
+  return (offset <= cbData) && (length <= cbData - offset);
+}
+
+static uint32_t ReadUInt32(const uint8_t *pbData,
+                           uint64_t       cbData,
+                           uint64_t     & position)
+{
+  uint32_t value;
+
+  if (!Contains(cbData, position, sizeof(value))) {
+    throw exceptions::RMSPFileException("Truncated pfile header",
+                                        exceptions::RMSPFileException::BadArguments);
+  }
+
+  memcpy(&value, pbData + position, sizeof(value));
+  position += sizeof(value);
+  return value;
+}
+
+static uint64_t ReadUInt64(const uint8_t *pbData,
+                           uint64_t       cbData,
+                           uint64_t     & position)
+{
+  uint64_t value;
+
+  if (!Contains(cbData, position, sizeof(value))) {
+    throw exceptions::RMSPFileException("Truncated pfile header",
+                                        exceptions::RMSPFileException::BadArguments);
+  }
+
+  memcpy(&value, pbData + position, sizeof(value));
+  position += sizeof(value);
+  return value;
+}
+
+// a header field of 32 bits, or of 64 bits in the 64 bit layout
+static uint64_t ReadField(const uint8_t *pbData,
+                          uint64_t       cbData,
+                          uint64_t     & position,
+                          bool           is64Bit)
+{
+  return is64Bit ? ReadUInt64(pbData, cbData, position) :
+         ReadUInt32(pbData, cbData, position);
+}
+
+// end of a section, the 64 bit fields may add up past 2^64
+static uint64_t SectionEnd(uint64_t offset, uint64_t length)
+{
+  if (length > numeric_limits<uint64_t>::max() - offset)
+  {
+    throw exceptions::RMSPFileException("Bad block length",
+                                        exceptions::RMSPFileException::BadArguments);
+  }
+  return offset + length;
+}
+
+static void CopyBytes(ByteArray     & dst,
+                      const uint8_t *pbData,
+                      uint64_t       cbData,
+                      uint64_t       offset,
+                      uint64_t       length)
+{
+  // check for size
+  if (length == 0) return;
+
+  if (!Contains(cbData, offset, length))
+  {
+    throw exceptions::RMSPFileException("Bad block length",
+                                        exceptions::RMSPFileException::BadArguments);
+  }
+
+  dst.assign(pbData + offset, pbData + offset + length);
+}
+
 PfileHeaderReader::~PfileHeaderReader()
 {}
 
@@ -29,46 +133,73 @@ shared_ptr<PfileHeader>PfileHeaderReader::Read(rmscrypto::api::SharedStream stre
 {
   Logger::Hidden("PfileHeaderReader: Reading pfile header.");
 
-  CheckPreamble(stream);
-  auto version                    = ReadVersionNumber(stream);
-  auto cleartextRedirectionHeader = ReadCleartextRedirectionHeader(stream);
+  // Every read of the backing stream takes its lock and may be a round-trip
+  // on a network share, so the header is read in one piece and parsed in
+  // memory.
+  uint64_t  cbStream = stream->Size();
+  ByteArray header;
+
+  ReadAtOffset(header, stream, 0,
+               min(cbStream, static_cast<uint64_t>(HEADER_PREFIX_SIZE)));
+
+  CheckPreamble(header.data(), header.size());
+
+  Layout   layout;
+  uint64_t cbRequired = ParseLayout(header.data(), header.size(), layout);
+
+  // the header is longer than the prefix: the fixed fields (after a long
+  // redirection header) or the sections are missing
+  while (cbRequired > header.size())
+  {
+    if (cbRequired > cbStream)
+    {
+      throw exceptions::RMSPFileException("Bad block length",
+                                          exceptions::RMSPFileException::BadArguments);
+    }
+
+    uint64_t cbRead = header.size();
+    ReadAtOffset(header, stream, cbRead, cbRequired - cbRead);
 
-  return ReadHeader(stream, std::get<0>(version), std::get<1>(
-                      version), cleartextRedirectionHeader);
+    if (header.size() != cbRequired)
+    {
+      throw exceptions::RMSPFileException("Truncated pfile header",
+                                          exceptions::RMSPFileException::BadArguments);
+    }
+
+    cbRequired = ParseLayout(header.data(), header.size(), layout);
+  }
+
+  return ReadHeader(header.data(), header.size(), layout);
 }
 
-void PfileHeaderReader::CheckPreamble(rmscrypto::api::SharedStream stream)
+void PfileHeaderReader::CheckPreamble(const uint8_t *pbHeader,
+                                      uint64_t       cbHeader)
 {
-  ByteArray pr;
-
   Logger::Hidden("PfileHeaderReader: Checking preamble");
 
-  auto expectedLength = static_cast<uint32_t>(ExpectedPreamble.size());
-  ReadBytes(pr, stream, expectedLength);
-
-  if (pr.size() != expectedLength)
+  if (!Contains(cbHeader, 0, ExpectedPreamble.size()) ||
+      !equal(ExpectedPreamble.begin(), ExpectedPreamble.end(), pbHeader))
   {
     throw exceptions::RMSPFileException("Invalid pfile preambule",
                                         exceptions::RMSPFileException::NotPFile);
   }
-
-  for (uint32_t i = 0; i < pr.size(); ++i)
-  {
-    if (pr[i] != ExpectedPreamble[i]) {
-      throw exceptions::RMSPFileException("Invalid pfile preambule",
-                                          exceptions::RMSPFileException::NotPFile);
-    }
-  }
 }
 
 tuple<uint32_t, uint32_t>PfileHeaderReader::ReadVersionNumber(
-  rmscrypto::api::SharedStream stream)
+  const uint8_t *pbHeader,
+  uint64_t       cbHeader)
 {
   const uint32_t MaxValidVersionNumber = 256;
-  uint32_t majorVersion, minorVersion;
 
-  stream->Read(reinterpret_cast<uint8_t *>(&majorVersion), sizeof(uint32_t));
-  stream->Read(reinterpret_cast<uint8_t *>(&minorVersion), sizeof(uint32_t));
+  if (!Contains(cbHeader, MajorVersionOffset, 2 * sizeof(uint32_t)))
+  {
+    throw exceptions::RMSPFileException("Invalid pfile version",
+                                        exceptions::RMSPFileException::NotPFile);
+  }
+
+  uint64_t position     = MajorVersionOffset;
+  uint32_t majorVersion = ReadUInt32(pbHeader, cbHeader, position);
+  uint32_t minorVersion = ReadUInt32(pbHeader, cbHeader, position);
 
   Logger::Hidden("PfileHeaderReader: Major version: %d, Minor version: %d", majorVersion, minorVersion);
 
@@ -89,118 +220,117 @@ tuple<uint32_t, uint32_t>PfileHeaderReader::ReadVersionNumber(
   return make_tuple(majorVersion, minorVersion);
 }
 
-string PfileHeaderReader::ReadCleartextRedirectionHeader(
-  rmscrypto::api::SharedStream stream)
+// Returns the number of bytes from the start of the stream the header spans.
+// If that's more than cbHeader, the layout may be incomplete and the caller
+// parses again with that many bytes.
+uint64_t PfileHeaderReader::ParseLayout(const uint8_t *pbHeader,
+                                        uint64_t       cbHeader,
+                                        Layout       & layout)
 {
-  ByteArray redirectHeader;
-  uint32_t  redirectHeaderLength;
+  auto version = ReadVersionNumber(pbHeader, cbHeader);
+
+  layout.majorVersion = std::get<0>(version);
+  layout.minorVersion = std::get<1>(version);
+  layout.hasMetadata  = ((layout.majorVersion == 2) &&
+                         (layout.minorVersion >= 1)) ||
+                        layout.majorVersion > 2;
+  layout.is64Bit = layout.majorVersion >= MIN_MJVERSION_WITH_64BIT_LAYOUT;
 
-  stream->Read(reinterpret_cast<uint8_t *>(&redirectHeaderLength),
-               sizeof(uint32_t));
-  ReadBytes(redirectHeader, stream, redirectHeaderLength);
+  uint64_t position = RedirectHeaderLengthOffset;
 
-  if (redirectHeader.size() != redirectHeaderLength) {
+  if (!Contains(cbHeader, position, sizeof(uint32_t)))
+  {
     throw exceptions::RMSPFileException("Bad redirect header",
                                         exceptions::RMSPFileException::BadArguments);
   }
+  layout.redirectHeaderLength = ReadUInt32(pbHeader, cbHeader, position);
 
-  string redirectHeaderStr(redirectHeader.begin(), redirectHeader.end());
-  Logger::Hidden("PfileHeaderReader: Cleartext redirect header: %s", redirectHeaderStr.c_str());
-
-  return redirectHeaderStr;
-}
-
-string PfileHeaderReader::ReadExtension(rmscrypto::api::SharedStream stream,
-                                        uint32_t                     offset,
-                                        uint32_t                     length)
-{
-  ByteArray ext;
+  uint64_t fieldsOffset = RedirectHeaderOffset + layout.redirectHeaderLength;
+  uint64_t cbField      = layout.is64Bit ? sizeof(uint64_t) : sizeof(uint32_t);
+  uint64_t cbFields     = 6 * cbField;
 
-  if (offset >= stream->Size()) {
-    throw exceptions::RMSPFileException("Bad extension",
-                                        exceptions::RMSPFileException::BadArguments);
+  if (layout.hasMetadata) {
+    cbFields += sizeof(uint64_t) + 2 * cbField;
   }
 
-  ReadAtOffset(ext, stream, offset, length);
-  string extStr(ext.begin(), ext.end());
-
-  Logger::Hidden("PfileHeaderReader: Extension: %s", extStr.c_str());
+  if (!Contains(cbHeader, fieldsOffset, cbFields)) {
+    return fieldsOffset + cbFields;
+  }
 
-  return extStr;
-}
+  // the header size field is skipped, all offsets are from the stream start
+  bool is64Bit = layout.is64Bit;
 
-shared_ptr<PfileHeader>PfileHeaderReader::ReadHeader(
-  rmscrypto::api::SharedStream stream,
-  uint32_t                     majorVersion,
-  uint32_t                     minorVersion,
-  const string               & cleartextRedirectionHeader)
-{
-  uint32_t headerSize;
-  uint32_t extensionOffset = 0;
-  uint32_t extensionLength = 0;
-  uint32_t plOffset        = 0;
-  uint32_t plLength        = 0;
-  uint32_t contentOffset   = 0;
-
-  stream->Read(reinterpret_cast<uint8_t *>(&headerSize),      sizeof(uint32_t));
-  stream->Read(reinterpret_cast<uint8_t *>(&extensionOffset), sizeof(uint32_t));
-  stream->Read(reinterpret_cast<uint8_t *>(&extensionLength), sizeof(uint32_t));
-  stream->Read(reinterpret_cast<uint8_t *>(&plOffset),        sizeof(uint32_t));
-  stream->Read(reinterpret_cast<uint8_t *>(&plLength),        sizeof(uint32_t));
-  stream->Read(reinterpret_cast<uint8_t *>(&contentOffset),   sizeof(uint32_t));
-
-  uint32_t endOfHeader      = plOffset + plLength;
-  uint64_t originalFileSize = 0;
-  uint32_t metadataOffset   = 0;
-  uint32_t metadataLength   = 0;
+  position                 = fieldsOffset + cbField;
+  layout.extensionOffset   = ReadField(pbHeader, cbHeader, position, is64Bit);
+  layout.extensionLength   = ReadField(pbHeader, cbHeader, position, is64Bit);
+  layout.plOffset          = ReadField(pbHeader, cbHeader, position, is64Bit);
+  layout.plLength          = ReadField(pbHeader, cbHeader, position, is64Bit);
+  layout.contentOffset     = ReadField(pbHeader, cbHeader, position, is64Bit);
+  layout.originalFileSize  = 0;
+  layout.metadataOffset    = 0;
+  layout.metadataLength    = 0;
 
-  ByteArray metadata;
-  ByteArray publishingLicense;
+  uint64_t endOfHeader = SectionEnd(layout.plOffset, layout.plLength);
 
-  if (((majorVersion == 2) && (minorVersion >= 1)) ||
-        majorVersion > 2)
+  if (layout.hasMetadata)
   {
-    stream->Read(reinterpret_cast<uint8_t *>(&originalFileSize),
-                 sizeof(uint64_t));
-    stream->Read(reinterpret_cast<uint8_t *>(&metadataOffset),
-                 sizeof(uint32_t));
-    stream->Read(reinterpret_cast<uint8_t *>(&metadataLength),
-                 sizeof(uint32_t));
-    endOfHeader = metadataOffset + metadataLength;
+    layout.originalFileSize = ReadUInt64(pbHeader, cbHeader, position);
+    layout.metadataOffset   = ReadField(pbHeader, cbHeader, position, is64Bit);
+    layout.metadataLength   = ReadField(pbHeader, cbHeader, position, is64Bit);
+    endOfHeader             = SectionEnd(layout.metadataOffset,
+                                         layout.metadataLength);
   }
 
-  if (contentOffset < endOfHeader)
+  if (layout.contentOffset < endOfHeader)
   {
     throw exceptions::RMSPFileException("Bad content offset",
                                         exceptions::RMSPFileException::BadArguments);
   }
 
-  string extension = ReadExtension(stream, extensionOffset, extensionLength);
+  return max(max(endOfHeader, position),
+             max(SectionEnd(layout.extensionOffset, layout.extensionLength),
+                 SectionEnd(layout.plOffset, layout.plLength)));
+}
 
-  ReadAtOffset(publishingLicense, stream, plOffset, plLength);
-  if (((majorVersion == 2) && (minorVersion >= 1)) ||
-       (majorVersion > 2))
+shared_ptr<PfileHeader>PfileHeaderReader::ReadHeader(
+  const uint8_t *pbHeader,
+  uint64_t       cbHeader,
+  const Layout & layout)
+{
+  ByteArray redirectHeader;
+  ByteArray ext;
+  ByteArray publishingLicense;
+  ByteArray metadata;
+
+  CopyBytes(redirectHeader, pbHeader, cbHeader, RedirectHeaderOffset,
+            layout.redirectHeaderLength);
+  string redirectHeaderStr(redirectHeader.begin(), redirectHeader.end());
+  Logger::Hidden("PfileHeaderReader: Cleartext redirect header: %s", redirectHeaderStr.c_str());
+
+  CopyBytes(ext, pbHeader, cbHeader, layout.extensionOffset,
+            layout.extensionLength);
+  string extension(ext.begin(), ext.end());
+  Logger::Hidden("PfileHeaderReader: Extension: %s", extension.c_str());
+
+  CopyBytes(publishingLicense, pbHeader, cbHeader, layout.plOffset,
+            layout.plLength);
+
+  if (layout.hasMetadata)
   {
-    ReadAtOffset(metadata, stream, metadataOffset, metadataLength);
+    CopyBytes(metadata, pbHeader, cbHeader, layout.metadataOffset,
+              layout.metadataLength);
   }
   return make_shared<PfileHeader>(move(publishingLicense), extension,
-                                  contentOffset, originalFileSize,
-                                  move(metadata), majorVersion, minorVersion,
-                                  cleartextRedirectionHeader);
+                                  layout.contentOffset,
+                                  layout.originalFileSize,
+                                  move(metadata), layout.majorVersion,
+                                  layout.minorVersion, redirectHeaderStr);
 }
 
 void PfileHeaderReader::ReadAtOffset(ByteArray                  & dst,
                                      rmscrypto::api::SharedStream stream,
-                                     uint32_t                     offset,
-                                     uint32_t                     length)
-{
-  stream->Seek(offset);
-  ReadBytes(dst, stream, length);
-}
-
-void PfileHeaderReader::ReadBytes(ByteArray                  & dst,
-                                  rmscrypto::api::SharedStream stream,
-                                  uint32_t                     length)
+                                     uint64_t                     offset,
+                                     uint64_t                     length)
 {
   // check for size
   if (length == 0) return;
@@ -214,7 +344,12 @@ void PfileHeaderReader::ReadBytes(ByteArray                  & dst,
   auto pos = dst.size();
   dst.resize(pos + length);
 
-  stream->Read((uint8_t *)&dst[pos], length);
+  // positional read, no Seek and no shared stream cursor involved
+  auto cbRead = stream->ReadAsync(&dst[pos], static_cast<int64_t>(length),
+                                  static_cast<int64_t>(offset),
+                                  std::launch::deferred).get();
+
+  dst.resize(pos + static_cast<size_t>(max(cbRead, static_cast<int64_t>(0))));
 }
 
 shared_ptr<IPfileHeaderReader>IPfileHeaderReader::Create()
@@ -24,37 +24,41 @@ public:
 
   virtual ~PfileHeaderReader() override;
 
+  // Reads the header with a single read of the stream's first
+  // HEADER_PREFIX_SIZE bytes, and one more read only if the header is longer.
   virtual std::shared_ptr<PfileHeader>Read(rmscrypto::api::SharedStream stream)
   override;
   const static int NOT_PFILE     = 0x800401ffL;
   const static int NOT_SUPPORTED = 0x80070032L;
   const static int BAD_ARGUMENTS = 0x000000a0L;
 
+  // covers the fixed fields, the cleartext redirection header and the
+  // publishing license of most files
+  const static uint32_t HEADER_PREFIX_SIZE = 16 * 1024;
+
 private:
 
-  std::shared_ptr<PfileHeader>ReadHeader(rmscrypto::api::SharedStream stream,
-                                         uint32_t                     majorVersion,
-                                         uint32_t                     minorVersion,
-                                         const std::string          & cleartextRedirectionHeader);
+  // offsets and lengths of the header fields, defined in the .cpp
+  struct Layout;
+
+  uint64_t ParseLayout(const uint8_t *pbHeader,
+                       uint64_t       cbHeader,
+                       Layout       & layout);
+
+  std::shared_ptr<PfileHeader>ReadHeader(const uint8_t *pbHeader,
+                                         uint64_t       cbHeader,
+                                         const Layout & layout);
 
   void ReadAtOffset(common::ByteArray          & dst,
                     rmscrypto::api::SharedStream stream,
-                    uint32_t                     offset,
-                    uint32_t                     length);
-
-  void ReadBytes(common::ByteArray          & dst,
-                 rmscrypto::api::SharedStream stream,
-                 uint32_t                     length);
-
-  void                          CheckPreamble(rmscrypto::api::SharedStream stream);
-
-  std::tuple<uint32_t, uint32_t>ReadVersionNumber(
-    rmscrypto::api::SharedStream stream);
-  std::string                   ReadCleartextRedirectionHeader(
-    rmscrypto::api::SharedStream stream);
-  std::string                   ReadExtension(rmscrypto::api::SharedStream stream,
-                                              uint32_t                     offset,
-                                              uint32_t                     length);
+                    uint64_t                     offset,
+                    uint64_t                     length);
+
+  void CheckPreamble(const uint8_t *pbHeader,
+                     uint64_t       cbHeader);
+
+  std::tuple<uint32_t, uint32_t>ReadVersionNumber(const uint8_t *pbHeader,
+                                                  uint64_t       cbHeader);
 };
 } // namespace pfile
 } // namespace rmscore
@@ -6,9 +6,12 @@
  * ======================================================================
  */
 
+#include <algorithm>
 #include <future>
+#include <limits>
 #include "PfileHeaderWriter.h"
 #include "PfileHeader.h"
+#include "../ModernAPI/RMSExceptions.h"
 #include "../Platform/Logger/Logger.h"
 
 using namespace std;
@@ -17,6 +20,9 @@ using namespace rmscore::platform::logger;
 
 namespace rmscore {
 namespace pfile {
+// ".pfile"
+static const uint64_t PREAMBLE_SIZE = 6;
+
 PfileHeaderWriter::~PfileHeaderWriter()
 {}
 
@@ -27,7 +33,7 @@ size_t PfileHeaderWriter::Write(rmscrypto::api::SharedStream      stream,
 
   auto extension = header->GetFileExtension();
   Logger::Hidden("Writing pfile header. Major version: %d, minor version: %d," \
-                 " file extension: %s, content start position: %d, original file size: %I64d",
+                 " file extension: %s, content start position: %I64d, original file size: %I64d",
                  header->GetMajorVersion(),
                  header->GetMinorVersion(),
                  extension.c_str(),
@@ -43,10 +49,39 @@ size_t PfileHeaderWriter::Write(rmscrypto::api::SharedStream      stream,
   WriteExtension(stream, header);
   WritePublishingLicense(stream, header);
   WriteMetadata(stream, header);
+  WritePadding(stream, header);
 
   return stream->Size();
 }
 
+void PfileHeaderWriter::WriteOriginalFileSize(
+  rmscrypto::api::SharedStream      stream,
+  const std::shared_ptr<PfileHeader>header,
+  uint64_t                          originalFileSize)
+{
+  Logger::Hidden("PfileHeaderWriter::WriteOriginalFileSize: %I64d",
+                 originalFileSize);
+
+  if (!header->HasOriginalFileSizeField())
+  {
+    throw exceptions::RMSPFileException("This version is not supported",
+                                        exceptions::RMSPFileException::NotSupportedVersion);
+  }
+
+  // preamble, version numbers, redirection header and its length, then the
+  // six fields in front of the size (see WriteHeader)
+  uint64_t cbField  = header->Has64BitLayout() ? sizeof(uint64_t) :
+                      sizeof(uint32_t);
+  uint64_t position = PREAMBLE_SIZE + 2 * sizeof(uint32_t) + sizeof(uint32_t) +
+                      header->GetCleartextRedirectionHeader().size() +
+                      6 * cbField;
+
+  stream->WriteAsync(reinterpret_cast<const uint8_t *>(&originalFileSize),
+                     sizeof(uint64_t),
+                     static_cast<int64_t>(position),
+                     std::launch::deferred).get();
+}
+
 uint32_t PfileHeaderWriter::WritePreamble(rmscrypto::api::SharedStream writer)
 {
   Logger::Hidden("PfileHeaderWriter::WritePreamble");
@@ -98,28 +133,71 @@ void PfileHeaderWriter::WriteHeader(rmscrypto::api::SharedStream      writer,
                                     size_t                            headerOffset)
 {
   Logger::Hidden("PfileHeaderWriter::WriteHeader");
-  uint32_t headerSize      = 8 * sizeof(uint32_t) + sizeof(uint64_t);
-  uint32_t extensionOffset = static_cast<uint32_t>(headerOffset) +
-                             headerSize;
-  uint32_t extensionLength =
-    static_cast<uint32_t>(header->GetFileExtension().size());
-  uint32_t plOffset = extensionOffset + extensionLength;
-  uint32_t plLength =
-    static_cast<uint32_t>(header->GetPublishingLicense().size());
+  bool     is64Bit         = header->Has64BitLayout();
+  uint64_t headerSize      = GetFieldsSize(header);
+  uint64_t extensionOffset = headerOffset + headerSize;
+  uint64_t extensionLength = header->GetFileExtension().size();
+  uint64_t plOffset        = extensionOffset + extensionLength;
+  uint64_t plLength        = header->GetPublishingLicense().size();
   uint64_t originalFileSize = header->GetOriginalFileSize();
-  uint32_t metadataOffset   = plOffset + plLength;
-  uint32_t metadataLength   = static_cast<uint32_t>(header->GetMetadata().size());
-  uint32_t contentOffset    = metadataOffset + metadataLength;
-
-  writer->Write(reinterpret_cast<uint8_t *>(&headerSize),       sizeof(uint32_t));
-  writer->Write(reinterpret_cast<uint8_t *>(&extensionOffset),  sizeof(uint32_t));
-  writer->Write(reinterpret_cast<uint8_t *>(&extensionLength),  sizeof(uint32_t));
-  writer->Write(reinterpret_cast<uint8_t *>(&plOffset),         sizeof(uint32_t));
-  writer->Write(reinterpret_cast<uint8_t *>(&plLength),         sizeof(uint32_t));
-  writer->Write(reinterpret_cast<uint8_t *>(&contentOffset),    sizeof(uint32_t));
+  uint64_t metadataOffset   = plOffset + plLength;
+  uint64_t metadataLength   = header->GetMetadata().size();
+  uint64_t contentOffset    = header->GetContentStartPosition();
+
+  if (contentOffset < metadataOffset + metadataLength)
+  {
+    throw exceptions::RMSPFileException("Bad content offset",
+                                        exceptions::RMSPFileException::BadArguments);
+  }
+
+  if (!is64Bit && (contentOffset > numeric_limits<uint32_t>::max()))
+  {
+    throw exceptions::RMSPFileException("Header too large for this version",
+                                        exceptions::RMSPFileException::BadArguments);
+  }
+
+  WriteField(writer, headerSize,      is64Bit);
+  WriteField(writer, extensionOffset, is64Bit);
+  WriteField(writer, extensionLength, is64Bit);
+  WriteField(writer, plOffset,        is64Bit);
+  WriteField(writer, plLength,        is64Bit);
+  WriteField(writer, contentOffset,   is64Bit);
   writer->Write(reinterpret_cast<uint8_t *>(&originalFileSize), sizeof(uint64_t));
-  writer->Write(reinterpret_cast<uint8_t *>(&metadataOffset),   sizeof(uint32_t));
-  writer->Write(reinterpret_cast<uint8_t *>(&metadataLength),   sizeof(uint32_t));
+  WriteField(writer, metadataOffset,  is64Bit);
+  WriteField(writer, metadataLength,  is64Bit);
+}
+
+void PfileHeaderWriter::WriteField(rmscrypto::api::SharedStream writer,
+                                   uint64_t                     value,
+                                   bool                         is64Bit)
+{
+  if (is64Bit)
+  {
+    writer->Write(reinterpret_cast<uint8_t *>(&value), sizeof(uint64_t));
+    return;
+  }
+
+  uint32_t value32 = static_cast<uint32_t>(value);
+  writer->Write(reinterpret_cast<uint8_t *>(&value32), sizeof(uint32_t));
+}
+
+uint64_t PfileHeaderWriter::GetFieldsSize(const std::shared_ptr<PfileHeader>header)
+{
+  // eight offsets and lengths and the 64 bit original file size
+  uint64_t cbField = header->Has64BitLayout() ? sizeof(uint64_t) :
+                     sizeof(uint32_t);
+
+  return 8 * cbField + sizeof(uint64_t);
+}
+
+uint64_t PfileHeaderWriter::GetHeaderSize(const std::shared_ptr<PfileHeader>header)
+{
+  return PREAMBLE_SIZE + 2 * sizeof(uint32_t) + sizeof(uint32_t) +
+         header->GetCleartextRedirectionHeader().size() +
+         GetFieldsSize(header) +
+         header->GetFileExtension().size() +
+         header->GetPublishingLicense().size() +
+         header->GetMetadata().size();
 }
 
 void PfileHeaderWriter::WriteExtension(rmscrypto::api::SharedStream      writer,
@@ -155,6 +233,25 @@ void PfileHeaderWriter::WriteMetadata(rmscrypto::api::SharedStream      writer,
                 static_cast<int>(metadata.size()));
 }
 
+void PfileHeaderWriter::WritePadding(rmscrypto::api::SharedStream      writer,
+                                     const std::shared_ptr<PfileHeader>header)
+{
+  Logger::Hidden("PfileHeaderWriter::WritePadding");
+  uint64_t cbPadding = header->GetContentStartPosition() -
+                       GetHeaderSize(header);
+  common::ByteArray zeros(static_cast<size_t>(min(cbPadding,
+                                                  static_cast<uint64_t>(4096))));
+
+  while (cbPadding > 0)
+  {
+    uint64_t cbWrite = min(cbPadding, static_cast<uint64_t>(zeros.size()));
+
+    writer->Write(reinterpret_cast<const uint8_t *>(zeros.data()),
+                  static_cast<int64_t>(cbWrite));
+    cbPadding -= cbWrite;
+  }
+}
+
 shared_ptr<IPfileHeaderWriter>IPfileHeaderWriter::Create()
 {
   Logger::Hidden("PfileHeaderWriter::Create");
@@ -28,6 +28,14 @@ public:
   virtual size_t Write(rmscrypto::api::SharedStream           stream,
                        const std::shared_ptr<PfileHeader>header) override;
 
+  virtual void   WriteOriginalFileSize(rmscrypto::api::SharedStream           stream,
+                                       const std::shared_ptr<PfileHeader>header,
+                                       uint64_t                          originalFileSize)
+  override;
+
+  virtual uint64_t GetHeaderSize(const std::shared_ptr<PfileHeader>header)
+  override;
+
 private:
 
   uint32_t WritePreamble(rmscrypto::api::SharedStream writer);
@@ -44,6 +52,12 @@ private:
                                   const std::shared_ptr<PfileHeader>header);
   void     WriteMetadata(rmscrypto::api::SharedStream           writer,
                          const std::shared_ptr<PfileHeader>header);
+  void     WritePadding(rmscrypto::api::SharedStream           writer,
+                        const std::shared_ptr<PfileHeader>header);
+  void     WriteField(rmscrypto::api::SharedStream writer,
+                      uint64_t                     value,
+                      bool                         is64Bit);
+  uint64_t GetFieldsSize(const std::shared_ptr<PfileHeader>header);
 };
 } // namespace pfile
 } // namespace rmscore
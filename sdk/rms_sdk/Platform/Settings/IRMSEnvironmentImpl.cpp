@@ -42,6 +42,15 @@ modernapi::IRMSEnvironment::LoggerOption IRMSEnvironmentImpl::LogOption() {
   return static_cast<LoggerOption>(_optLog.load());
 }
 
+void IRMSEnvironmentImpl::ExecutorThreadCount(size_t count) {
+  // the executor is shared with the crypto library
+  rmscrypto::api::RMSCryptoEnvironment()->ExecutorThreadCount(count);
+}
+
+size_t IRMSEnvironmentImpl::ExecutorThreadCount() {
+  return rmscrypto::api::RMSCryptoEnvironment()->ExecutorThreadCount();
+}
+
 shared_ptr<modernapi::IRMSEnvironment>IRMSEnvironmentImpl::Environment() {
   return std::dynamic_pointer_cast<modernapi::IRMSEnvironment>(
     platform::settings::_instance);
@@ -25,6 +25,9 @@ public:
 
   virtual void                                      LogOption(LoggerOption opt);
   virtual LoggerOption                              LogOption();
+  virtual void                                      ExecutorThreadCount(
+    size_t count);
+  virtual size_t                                    ExecutorThreadCount();
 
   static std::shared_ptr<modernapi::IRMSEnvironment>Environment();
 
@@ -401,8 +401,8 @@ common::ByteArray RestClientCache::HashKey(const uint8_t *pbKey, size_t cbKey)
 
   uint32_t cbHashSize = static_cast<uint32_t>(vbHash.size());
 
-  // TODO.shch: remove (uint32_t&) cast
-  sha256->Hash(pbKey, static_cast<uint32_t>(cbKey), &vbHash[0], cbHashSize);
+  sha256->Update(pbKey, cbKey);
+  sha256->Final(&vbHash[0], cbHashSize);
   vbHash.resize(cbHashSize);
 
   common::ByteArray strBase64(common::ConvertBytesToBase64(vbHash));
@@ -2,4 +2,6 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
     platform_ut \
-    rest_clients_ut
+    rest_clients_ut \
+    pfile_ut \
+    modernapi_ut
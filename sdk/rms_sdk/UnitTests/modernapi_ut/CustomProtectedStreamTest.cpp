@@ -0,0 +1,267 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include "CustomProtectedStreamTest.h"
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RMSCryptoExceptions.h"
+#include "TestHelpers.h"
+#include "TestPolicy.h"
+#include "../../ModernAPI/CustomProtectedStream.h"
+#include "../../ModernAPI/RMSExceptions.h"
+
+using namespace std;
+using namespace rmscore::modernapi;
+using namespace rmscrypto::api;
+
+static const uint64_t CONTENT_START = 10;
+
+static vector<uint8_t> TestContent(size_t size)
+{
+    vector<uint8_t> content(size);
+
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<uint8_t>(i * 13);
+    }
+    return content;
+}
+
+// writes content to a new CTR container in backing after CONTENT_START bytes
+static void WriteCtrContainer(shared_ptr<UserPolicy>     policy,
+                              shared_ptr<stringstream>   backing,
+                              const vector<uint8_t>&     content)
+{
+    backing->write("container", CONTENT_START);
+
+    auto stream = CustomProtectedStream::Create(
+        policy, CreateStreamFromStdStream(static_pointer_cast<iostream>(backing)),
+        CONTENT_START, 0, CIPHER_MODE_CTR);
+
+    stream->Write(content.data(), content.size());
+    stream->Flush();
+}
+
+static vector<uint8_t> ReadCtrContainer(shared_ptr<UserPolicy>   policy,
+                                        shared_ptr<stringstream> backing)
+{
+    uint64_t contentSize = backing->str().size() - CONTENT_START;
+    auto stream = CustomProtectedStream::Create(
+        policy, CreateStreamFromStdStream(static_pointer_cast<iostream>(backing)),
+        CONTENT_START, contentSize, CIPHER_MODE_CTR);
+
+    vector<uint8_t> content(stream->Size());
+    stream->Read(content.data(), content.size());
+    return content;
+}
+
+void CustomProtectedStreamTest::test_CtrContainersDiffer()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x42);
+        auto content = TestContent(3 * 512 + 100);
+
+        auto backing1 = make_shared<stringstream>(
+            ios::in | ios::out | ios::binary);
+        auto backing2 = make_shared<stringstream>(
+            ios::in | ios::out | ios::binary);
+
+        WriteCtrContainer(policy, backing1, content);
+        WriteCtrContainer(policy, backing2, content);
+
+        auto data1 = backing1->str();
+        auto data2 = backing2->str();
+        uint64_t size = CONTENT_START + CTR_NONCE_SIZE + content.size();
+
+        QVERIFY(data1.size() == size);
+        QVERIFY(data2.size() == size);
+        QVERIFY(CustomProtectedStream::GetEncryptedContentLength(
+                    policy, content.size(), CIPHER_MODE_CTR) ==
+                size - CONTENT_START);
+
+        // same policy and content, but neither the nonces nor any block of
+        // the cipher text match
+        auto cipher1 = data1.substr(CONTENT_START);
+        auto cipher2 = data2.substr(CONTENT_START);
+        QVERIFY(cipher1.substr(0, CTR_NONCE_SIZE) !=
+                cipher2.substr(0, CTR_NONCE_SIZE));
+
+        for (size_t i = CTR_NONCE_SIZE; i < cipher1.size(); i += 16) {
+            QVERIFY(cipher1.substr(i, 16) != cipher2.substr(i, 16));
+        }
+
+        QVERIFY(ReadCtrContainer(policy, backing1) == content);
+        QVERIFY(ReadCtrContainer(policy, backing2) == content);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void CustomProtectedStreamTest::test_CtrRewriteRefused()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x43);
+        auto content = TestContent(1000);
+        auto backing = make_shared<stringstream>(
+            ios::in | ios::out | ios::binary);
+
+        WriteCtrContainer(policy, backing, content);
+        auto written = backing->str();
+
+        uint64_t contentSize = written.size() - CONTENT_START;
+        auto stream = CustomProtectedStream::Create(
+            policy,
+            CreateStreamFromStdStream(static_pointer_cast<iostream>(backing)),
+            CONTENT_START, contentSize, CIPHER_MODE_CTR);
+
+        // anything below the end would reuse the key stream
+        uint8_t byte = 0xff;
+        QVERIFY_THROW(stream->WriteAsync(&byte, 1, 999, launch::deferred),
+                      rmscore::exceptions::RMSStreamException);
+        QVERIFY_THROW(stream->Size(500),
+                      rmscore::exceptions::RMSStreamException);
+        stream->Seek(0);
+        QVERIFY_THROW(stream->Write(&byte, 1),
+                      rmscore::exceptions::RMSStreamException);
+
+        // appending is fine, also through a clone, and leaves the cipher text
+        // which is there as it was
+        auto tail = TestContent(700);
+        stream->Seek(content.size());
+        stream->Write(tail.data(), 300);
+        stream->Flush();
+        auto clone = stream->Clone();
+        clone->WriteAsync(tail.data() + 300, 400, content.size() + 300,
+                          launch::deferred).get();
+        clone->Flush();
+        QVERIFY_THROW(stream->WriteAsync(&byte, 1, content.size() + 500,
+                                         launch::deferred),
+                      rmscore::exceptions::RMSStreamException);
+
+        QVERIFY(backing->str().compare(0, written.size(), written) == 0);
+
+        content.insert(content.end(), tail.begin(), tail.end());
+        QVERIFY(ReadCtrContainer(policy, backing) == content);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void CustomProtectedStreamTest::test_CtrOutOfOrderWrites()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x44);
+        auto content = TestContent(1400);
+        auto backing = make_shared<stringstream>(
+            ios::in | ios::out | ios::binary);
+
+        backing->write("container", CONTENT_START);
+
+        auto stream = CustomProtectedStream::Create(
+            policy,
+            CreateStreamFromStdStream(static_pointer_cast<iostream>(backing)),
+            CONTENT_START, 0, CIPHER_MODE_CTR);
+
+        // [0, 100), [200, 300), then the gap between them
+        stream->WriteAsync(content.data(), 100, 0, launch::deferred).get();
+        stream->WriteAsync(content.data() + 200, 100, 200,
+                           launch::deferred).get();
+        stream->WriteAsync(content.data() + 100, 100, 100,
+                           launch::deferred).get();
+
+        // past the end and back into the gap it leaves
+        stream->WriteAsync(content.data() + 900, 500, 900,
+                           launch::deferred).get();
+        stream->WriteAsync(content.data() + 300, 600, 300,
+                           launch::deferred).get();
+
+        // only real overlaps are refused, also at the edges of the ranges
+        uint8_t bytes[20] = { 0 };
+        QVERIFY_THROW(stream->WriteAsync(bytes, 10, 150, launch::deferred),
+                      rmscore::exceptions::RMSStreamException);
+        QVERIFY_THROW(stream->WriteAsync(bytes, 20, 1390, launch::deferred),
+                      rmscore::exceptions::RMSStreamException);
+        QVERIFY_THROW(stream->WriteAsync(bytes, 1, 0, launch::deferred),
+                      rmscore::exceptions::RMSStreamException);
+        stream->Flush();
+
+        QVERIFY(ReadCtrContainer(policy, backing) == content);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void CustomProtectedStreamTest::test_CtrParallelWrites()
+{
+    try {
+        const size_t threadCount = 8;
+        const size_t chunkCount  = 10;
+        const size_t chunkSize   = 700;
+
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x45);
+        auto content = TestContent(threadCount * chunkCount * chunkSize);
+        auto backing = make_shared<stringstream>(
+            ios::in | ios::out | ios::binary);
+
+        backing->write("container", CONTENT_START);
+
+        auto stream = CustomProtectedStream::Create(
+            policy,
+            CreateStreamFromStdStream(static_pointer_cast<iostream>(backing)),
+            CONTENT_START, 0, CIPHER_MODE_CTR);
+
+        // every thread writes every threadCount-th chunk, from the last one
+        // down, so most writes land in front of written content
+        vector<thread> threads;
+        vector<int>    failures(threadCount, 0);
+
+        for (size_t t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&, t]() {
+                for (size_t i = chunkCount; i-- > 0;) {
+                    size_t offset = (i * threadCount + t) * chunkSize;
+
+                    try {
+                        stream->WriteAsync(content.data() + offset, chunkSize,
+                                           offset, launch::deferred).get();
+                    } catch (const rmscore::exceptions::RMSException&) {
+                        ++failures[t];
+                    }
+                }
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (auto failure : failures) {
+            QVERIFY(failure == 0);
+        }
+
+        uint8_t byte = 0;
+        QVERIFY_THROW(stream->WriteAsync(&byte, 1, content.size() / 2,
+                                         launch::deferred),
+                      rmscore::exceptions::RMSStreamException);
+        stream->Flush();
+
+        QVERIFY(ReadCtrContainer(policy, backing) == content);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
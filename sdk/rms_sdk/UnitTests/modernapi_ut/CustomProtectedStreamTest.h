@@ -0,0 +1,22 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef CUSTOMPROTECTEDSTREAMTEST_H
+#define CUSTOMPROTECTEDSTREAMTEST_H
+#include <QtTest>
+
+class CustomProtectedStreamTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void test_CtrContainersDiffer();
+    void test_CtrRewriteRefused();
+    void test_CtrOutOfOrderWrites();
+    void test_CtrParallelWrites();
+};
+#endif // CUSTOMPROTECTEDSTREAMTEST_H
@@ -0,0 +1,698 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include "ProtectedFileStreamTest.h"
+
+#include <QCryptographicHash>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BlockBasedProtectedStream.h"
+#include "RMSCryptoExceptions.h"
+#include "TestHelpers.h"
+#include "TestPolicy.h"
+#include "../../../rmscrypto_sdk/UnitTests/TestStreams.h"
+#include "../../ModernAPI/ProtectedFileStream.h"
+#include "../../ModernAPI/RMSExceptions.h"
+#include "../../PFile/PfileHeader.h"
+#include "../../PFile/PfileHeaderReader.h"
+#include "../../PFile/PfileHeaderWriter.h"
+
+using namespace std;
+using namespace rmscore::common;
+using namespace rmscore::modernapi;
+using namespace rmscore::pfile;
+using namespace rmscrypto::api;
+
+static shared_ptr<stringstream> CreateBacking(const string& content = string())
+{
+    auto backing = make_shared<stringstream>(ios::in | ios::out | ios::binary);
+
+    backing->write(content.data(), content.size());
+    return backing;
+}
+
+static SharedStream CreateStream(shared_ptr<stringstream> backing)
+{
+    return CreateStreamFromStdStream(static_pointer_cast<iostream>(backing));
+}
+
+static vector<uint8_t> TestContent(size_t size)
+{
+    vector<uint8_t> content(size);
+
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<uint8_t>(i * 7 + i / 251);
+    }
+    return content;
+}
+
+// the bytes of a PFile protected with policy
+static string WritePfile(shared_ptr<UserPolicy>  policy,
+                         const vector<uint8_t>& content,
+                         const string         & extension = ".txt")
+{
+    auto backing = CreateBacking();
+    auto stream  = ProtectedFileStream::Create(policy, CreateStream(backing),
+                                               extension);
+
+    stream->Write(content.data(), content.size());
+    stream->Flush();
+    return backing->str();
+}
+
+static shared_ptr<ProtectedFileStream> OpenPfile(SharedStream stream)
+{
+    TestAuthenticationCallback auth;
+    auto result = ProtectedFileStream::Acquire(stream, TEST_POLICY_OWNER, auth,
+                                               nullptr, POL_OfflineOnly,
+                                               RESPONSE_CACHE_INMEMORY);
+
+    if (result->m_stream.get() == nullptr) {
+        throw rmscore::exceptions::RMSStreamException("Can't open the PFile");
+    }
+    return result->m_stream;
+}
+
+static vector<uint8_t> ReadAll(shared_ptr<ProtectedFileStream> stream)
+{
+    vector<uint8_t> content(static_cast<size_t>(stream->Size()));
+
+    if (!content.empty()) {
+        content.resize(static_cast<size_t>(stream->ReadAsync(
+            &content[0], content.size(), 0, launch::deferred).get()));
+    }
+    return content;
+}
+
+static shared_ptr<PfileHeader> ReadHeader(const string& pfile)
+{
+    return IPfileHeaderReader::Create()->Read(CreateStream(CreateBacking(pfile)));
+}
+
+static shared_ptr<PfileHeader> ReadHeader(SharedStream stream)
+{
+    return IPfileHeaderReader::Create()->Read(stream);
+}
+
+static uint64_t RecordedSize(const string& pfile)
+{
+    auto header = IPfileHeaderReader::Create()->Read(
+        CreateStream(CreateBacking(pfile)));
+
+    return header->GetOriginalFileSize();
+}
+
+static void VerifyInfo(const PfileInfo & info,
+                       const string    & pfile,
+                       shared_ptr<UserPolicy> policy)
+{
+    auto header = IPfileHeaderReader::Create()->Read(
+        CreateStream(CreateBacking(pfile)));
+
+    QVERIFY(info.m_status == ProbeIsPFile);
+    QVERIFY(info.m_majorVersion == header->GetMajorVersion());
+    QVERIFY(info.m_minorVersion == header->GetMinorVersion());
+    QVERIFY(info.m_originalFileExtension == header->GetFileExtension());
+    QVERIFY(info.m_hasOriginalFileSize == header->HasOriginalFileSize());
+    QVERIFY(info.m_originalFileSize == header->GetOriginalFileSize());
+    QVERIFY(info.m_contentStartPosition == header->GetContentStartPosition());
+
+    auto license = policy->SerializedPolicy();
+    auto hash    = QCryptographicHash::hash(
+        QByteArray(reinterpret_cast<const char *>(license.data()),
+                   static_cast<int>(license.size())),
+        QCryptographicHash::Sha256);
+
+    QVERIFY(info.m_publishingLicenseHash ==
+            vector<uint8_t>(hash.begin(), hash.end()));
+}
+
+void ProtectedFileStreamTest::test_Probe()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x21, 3000);
+        auto content = TestContent(5000);
+        auto pfile   = WritePfile(policy, content, ".docx");
+
+        auto info = ProtectedFileStream::Probe(
+            CreateStream(CreateBacking(pfile)));
+
+        VerifyInfo(info, pfile, policy);
+        QVERIFY(info.m_originalFileExtension == ".docx");
+        QVERIFY(info.m_hasOriginalFileSize);
+        QVERIFY(info.m_originalFileSize == content.size());
+
+        // another license, another hash
+        auto other = ProtectedFileStream::Probe(CreateStream(CreateBacking(
+            WritePfile(CreateTestPolicy("MICROSOFT.CBC4K", 0x21, 3000),
+                       content, ".docx"))));
+        QVERIFY(other.m_publishingLicenseHash != info.m_publishingLicenseHash);
+
+        QVERIFY(ProtectedFileStream::Probe(CreateStream(CreateBacking(
+            "plain text, not a pfile"))).m_status == ProbeNotPFile);
+        QVERIFY(ProtectedFileStream::Probe(CreateStream(CreateBacking(
+            pfile.substr(0, 1000)))).m_status == ProbeBadHeader);
+
+        // an unknown major version
+        auto future = pfile;
+        future[6] = 99;
+        QVERIFY(ProtectedFileStream::Probe(CreateStream(CreateBacking(
+            future))).m_status == ProbeNotSupportedVersion);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_ProbeMany()
+{
+    try {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+
+        auto policy = CreateTestPolicy("MICROSOFT.CBC4K", 0x22, 500);
+        auto pfile  = WritePfile(policy, TestContent(100));
+
+        // valid and invalid files in turn, one which doesn't exist and a
+        // directory
+        const vector<pair<string, PfileProbeStatus> > files = {
+            { pfile,                     ProbeIsPFile  },
+            { "not a pfile",             ProbeNotPFile },
+            { pfile.substr(0, 600),      ProbeBadHeader },
+            { pfile,                     ProbeIsPFile  },
+            { string(),                  ProbeIOError  },
+            { pfile.substr(0, 300),      ProbeBadHeader },
+            { pfile,                     ProbeIsPFile  },
+            { "\x89PNG\r\n\x1a\n image", ProbeNotPFile }
+        };
+
+        vector<string> paths;
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            paths.push_back(dir.path().toStdString() + "/file" + to_string(i));
+
+            if (files[i].second != ProbeIOError) {
+                ofstream(paths.back(), ios::binary) << files[i].first;
+            }
+        }
+        paths.push_back(dir.path().toStdString());
+
+        auto infos = ProtectedFileStream::ProbeMany(paths, 3);
+
+        QVERIFY(infos.size() == files.size() + 1);
+        QVERIFY(infos.back().m_status == ProbeIOError);
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            QVERIFY2(infos[i].m_status == files[i].second, paths[i].c_str());
+
+            if (files[i].second == ProbeIsPFile) {
+                VerifyInfo(infos[i], pfile, policy);
+            }
+        }
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_SizeFallback()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x23);
+        auto content = TestContent(5000);
+        auto pfile   = WritePfile(policy, content);
+
+        // sizes which don't fit the encrypted content, and no size at all
+        const vector<uint64_t> recorded = {
+            1234, 6000, 0, static_cast<uint64_t>(-1)
+        };
+
+        for (auto size : recorded) {
+            auto backing = CreateStream(CreateBacking(pfile));
+            auto header  = IPfileHeaderReader::Create()->Read(backing);
+
+            IPfileHeaderWriter::Create()->WriteOriginalFileSize(backing, header,
+                                                                size);
+            backing->Flush();
+
+            auto stream = OpenPfile(backing);
+
+            QVERIFY2(stream->Size() == content.size(), to_string(size).c_str());
+            QVERIFY(ReadAll(stream) == content);
+        }
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_SizeAfterWrite()
+{
+    try {
+        for (auto mode : { "MICROSOFT.CBC4K", "MICROSOFT.CBC512.NOPADDING" }) {
+            auto policy  = CreateTestPolicy(mode, 0x24);
+            // whole AES blocks, CBC512.NOPADDING can't encrypt anything else
+            auto content = TestContent(5008);
+            auto backing = CreateCountingStream(WritePfile(policy, content));
+            auto stream  = OpenPfile(backing);
+
+            QVERIFY(stream->Size() == content.size());
+
+            // a write in front of the end keeps the size, and Flush() records
+            // it without reading the content again
+            const uint8_t middle[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+
+            stream->WriteAsync(middle, sizeof(middle), 100,
+                               launch::deferred).get();
+            copy(middle, middle + sizeof(middle), content.begin() + 100);
+            QVERIFY2(stream->Size() == content.size(), mode);
+
+            int reads = backing->Reads();
+
+            stream->Flush();
+            QVERIFY2(backing->Reads() == reads, mode);
+            QVERIFY2(stream->Size() == content.size(), mode);
+            QVERIFY2(RecordedSize(backing->Content()) == content.size(), mode);
+
+            // a write past the end grows it
+            auto appended = TestContent(48);
+
+            stream->WriteAsync(appended.data(), appended.size(), content.size(),
+                               launch::deferred).get();
+            content.insert(content.end(), appended.begin(), appended.end());
+            QVERIFY2(stream->Size() == content.size(), mode);
+
+            stream->Flush();
+            QVERIFY2(stream->Size() == content.size(), mode);
+            QVERIFY2(RecordedSize(backing->Content()) == content.size(), mode);
+
+            auto reopened = OpenPfile(CreateStream(CreateBacking(
+                backing->Content())));
+
+            QVERIFY2(reopened->Size() == content.size(), mode);
+            QVERIFY2(ReadAll(reopened) == content, mode);
+        }
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_FlushAsync()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x2D);
+        auto backing = CreateCountingStream(WritePfile(policy, TestContent(100)));
+        auto stream  = OpenPfile(backing);
+
+        // 100 and 110 bytes both encrypt to 112, only the header tells them
+        // apart
+        auto content = TestContent(110);
+
+        reverse(content.begin(), content.end());
+        stream->WriteAsync(content.data(), content.size(), 0,
+                           launch::deferred).get();
+        QVERIFY(stream->FlushAsync(launch::async).get());
+        QVERIFY(RecordedSize(backing->Content()) == content.size());
+
+        auto reopened = OpenPfile(CreateStream(CreateBacking(
+            backing->Content())));
+
+        QVERIFY(reopened->Size() == content.size());
+        QVERIFY(ReadAll(reopened) == content);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_FailedFlush()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x2E);
+        auto backing = CreateCountingStream(WritePfile(policy, TestContent(100)));
+        auto stream  = OpenPfile(backing);
+        auto content = TestContent(110);
+
+        stream->WriteAsync(content.data(), content.size(), 0,
+                           launch::deferred).get();
+
+        // the stream stays modified, so the next Flush() still records the
+        // size
+        bool bThrew = false;
+
+        backing->FailWrites(true);
+
+        try {
+            stream->Flush();
+        } catch (const rmscore::exceptions::RMSException&) {
+            bThrew = true;
+        } catch (const rmscrypto::exceptions::RMSCryptoException&) {
+            bThrew = true;
+        }
+        QVERIFY(bThrew);
+
+        backing->FailWrites(false);
+        stream->Flush();
+        QVERIFY(RecordedSize(backing->Content()) == content.size());
+        QVERIFY(ReadAll(OpenPfile(CreateStream(CreateBacking(
+            backing->Content())))) == content);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_HeaderVersion()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x25);
+        auto content = TestContent(3000);
+
+        // v3, which every client reads, unless the file needs v4
+        auto v3 = ProtectedFileStream::Probe(CreateStream(CreateBacking(
+            WritePfile(policy, content))));
+        QVERIFY(v3.m_majorVersion == MJVERSION_FOR_WRITING);
+        QVERIFY(MJVERSION_FOR_WRITING < MIN_MJVERSION_WITH_64BIT_LAYOUT);
+
+        // asked for, or for a header padded past 4 GB
+        const uint64_t paddings[] = { DEFAULT_PFILE_HEADER_PADDING, 1ULL << 32 };
+
+        for (auto padding : paddings) {
+            auto backing = make_shared<SparseStream>();
+            auto stream  = ProtectedFileStream::Create(
+                policy, backing, ".txt", DEFAULT_BLOCK_CACHE_SIZE, padding,
+                padding == DEFAULT_PFILE_HEADER_PADDING);
+
+            stream->Write(content.data(), content.size());
+            stream->Flush();
+
+            auto info = ProtectedFileStream::Probe(backing);
+
+            QVERIFY(info.m_majorVersion == MIN_MJVERSION_WITH_64BIT_LAYOUT);
+            QVERIFY(info.m_originalFileSize == content.size());
+            QVERIFY(ReadAll(OpenPfile(backing)) == content);
+        }
+
+        // content past 2^32 blocks needs the 64 bit block numbers of v4
+        auto stream = ProtectedFileStream::Create(policy,
+                                                  CreateStream(CreateBacking()),
+                                                  ".txt");
+        const uint64_t end = MAX_BLOCKS_WITH_32BIT_LAYOUT * 4096;
+
+        QVERIFY_THROW(stream->WriteAsync(content.data(), 1, end,
+                                         launch::deferred).get(),
+                      rmscore::exceptions::RMSStreamException);
+        QVERIFY_THROW(stream->Size(end + 1),
+                      rmscore::exceptions::RMSStreamException);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_HugeContent()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x2F);
+        auto backing = make_shared<SparseStream>();
+        auto stream  = ProtectedFileStream::Create(
+            policy, backing, ".txt", DEFAULT_BLOCK_CACHE_SIZE,
+            DEFAULT_PFILE_HEADER_PADDING, true);
+        auto head = TestContent(5000);
+        auto tail = TestContent(6000);
+
+        reverse(tail.begin(), tail.end());
+
+        // the tail starts 3 blocks and 100 bytes past block 2^32
+        const uint64_t tailBlock = MAX_BLOCKS_WITH_32BIT_LAYOUT + 3;
+        const uint64_t tailStart = tailBlock * 4096 + 100;
+
+        stream->WriteAsync(head.data(), head.size(), 0,
+                           launch::deferred).get();
+        stream->Flush();
+
+        // A real file has 16 TB of encrypted zeros up to the tail, which would
+        // take days to write. The gap is left a hole of the backing stream
+        // instead, up to a final block of encrypted zeros in front of the
+        // tail, and only the head and the tail are read back.
+        auto provider = CreateCryptoProvider(CIPHER_MODE_CBC4K,
+                                             vector<uint8_t>(16, 0x2F));
+        vector<uint8_t> zeros(4000), finalBlock(4096);
+        uint32_t cbFinalBlock = 0;
+
+        provider->Encrypt(zeros.data(), static_cast<uint32_t>(zeros.size()),
+                          tailBlock - 1, true, finalBlock.data(),
+                          static_cast<uint32_t>(finalBlock.size()),
+                          &cbFinalBlock);
+        backing->WriteAsync(finalBlock.data(), cbFinalBlock,
+                            ReadHeader(backing)->GetContentStartPosition() +
+                            (tailBlock - 1) * 4096, launch::deferred).get();
+
+        stream = OpenPfile(backing);
+        stream->WriteAsync(tail.data(), tail.size(), tailStart,
+                           launch::deferred).get();
+        stream->Flush();
+
+        auto reopened = OpenPfile(backing);
+
+        QVERIFY(ProtectedFileStream::Probe(backing).m_majorVersion ==
+                MIN_MJVERSION_WITH_64BIT_LAYOUT);
+        QVERIFY(reopened->Size() == tailStart + tail.size());
+
+        vector<uint8_t> readHead(head.size()), readTail(tail.size());
+
+        QVERIFY(reopened->ReadAsync(readHead.data(), readHead.size(), 0,
+                                    launch::deferred).get() ==
+                static_cast<int64_t>(head.size()));
+        QVERIFY(reopened->ReadAsync(readTail.data(), readTail.size(), tailStart,
+                                    launch::deferred).get() ==
+                static_cast<int64_t>(tail.size()));
+        QVERIFY(readHead == head);
+        QVERIFY(readTail == tail);
+
+        // the zeros written in front of the tail decrypt under their own
+        // block number
+        vector<uint8_t> readZeros(zeros.size(), 0xFF);
+
+        reopened->ReadAsync(readZeros.data(), readZeros.size(),
+                            (tailBlock - 1) * 4096, launch::deferred).get();
+        QVERIFY(all_of(readZeros.begin(), readZeros.end(),
+                       [](uint8_t b) { return b == 0; }));
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_HeaderPadding()
+{
+    try {
+        auto policy  = CreateTestPolicy("MICROSOFT.CBC4K", 0x26, 700);
+        auto content = TestContent(5000);
+
+        for (uint64_t padding : { 0, 100, 4096 }) {
+            auto backing = CreateBacking();
+            auto stream  = ProtectedFileStream::Create(policy,
+                                                       CreateStream(backing),
+                                                       ".txt",
+                                                       DEFAULT_BLOCK_CACHE_SIZE,
+                                                       padding);
+
+            stream->Write(content.data(), content.size());
+            stream->Flush();
+
+            auto header = ReadHeader(backing->str());
+
+            QVERIFY(header->GetContentStartPosition() ==
+                    IPfileHeaderWriter::Create()->GetHeaderSize(header) + padding);
+            QVERIFY(ReadAll(OpenPfile(CreateStream(backing))) == content);
+        }
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_Reprotect()
+{
+    try {
+        auto content = TestContent(5000);
+        auto backing = CreateBacking(WritePfile(
+            CreateTestPolicy("MICROSOFT.CBC4K", 0x27, 1000), content));
+        auto before  = ReadHeader(backing->str());
+
+        // a longer license which still fits in the padding
+        auto policy = CreateTestPolicy("MICROSOFT.CBC4K", 0x27, 1500);
+        auto stream = OpenPfile(CreateStream(backing));
+
+        QVERIFY(ProtectedFileStream::Reprotect(stream, policy) == stream);
+        QVERIFY(stream->Policy() == policy);
+        QVERIFY(ReadAll(stream) == content);
+
+        // the caller's stream has the new header, writes through it keep it
+        reverse(content.begin(), content.end());
+        stream->WriteAsync(content.data(), content.size(), 0,
+                           launch::deferred).get();
+        stream->Flush();
+
+        auto pfile = backing->str();
+        auto after = ReadHeader(pfile);
+
+        QVERIFY(after->GetPublishingLicense() == policy->SerializedPolicy());
+        QVERIFY(after->GetContentStartPosition() ==
+                before->GetContentStartPosition());
+        QVERIFY(after->GetMajorVersion() == before->GetMajorVersion());
+        QVERIFY(after->GetMinorVersion() == before->GetMinorVersion());
+        QVERIFY(after->GetOriginalFileSize() == content.size());
+        QVERIFY(ReadAll(OpenPfile(CreateStream(CreateBacking(pfile)))) ==
+                content);
+
+        // another key, or another cipher mode, can't decrypt the content
+        QVERIFY_THROW(ProtectedFileStream::Reprotect(
+                          OpenPfile(CreateStream(CreateBacking(pfile))),
+                          CreateTestPolicy("MICROSOFT.CBC4K", 0x28)),
+                      rmscore::exceptions::RMSInvalidArgumentException);
+        QVERIFY_THROW(ProtectedFileStream::Reprotect(
+                          OpenPfile(CreateStream(CreateBacking(pfile))),
+                          CreateTestPolicy("MICROSOFT.ECB", 0x27)),
+                      rmscore::exceptions::RMSInvalidArgumentException);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_ReprotectToTarget()
+{
+    try {
+        auto content = TestContent(20000);
+        auto backing = CreateBacking();
+        auto stream  = ProtectedFileStream::Create(
+            CreateTestPolicy("MICROSOFT.CBC4K", 0x29, 500),
+            CreateStream(backing), ".txt", DEFAULT_BLOCK_CACHE_SIZE, 16);
+
+        stream->Write(content.data(), content.size());
+        stream->Flush();
+
+        auto before = backing->str();
+
+        // the new license doesn't fit in front of the content, which isn't
+        // moved in place
+        auto policy = CreateTestPolicy("MICROSOFT.CBC4K", 0x29, 3000);
+        stream = OpenPfile(CreateStream(backing));
+
+        QVERIFY_THROW(ProtectedFileStream::Reprotect(stream, policy),
+                      rmscore::exceptions::RMSInvalidArgumentException);
+        QVERIFY(backing->str() == before);
+
+        // but copied to another stream, with the old PFile left as it was
+        auto target      = CreateBacking();
+        auto reprotected = ProtectedFileStream::Reprotect(stream, policy,
+                                                          CreateStream(target),
+                                                          DEFAULT_BLOCK_CACHE_SIZE,
+                                                          200);
+
+        QVERIFY(ReadAll(reprotected) == content);
+        QVERIFY(backing->str() == before);
+        QVERIFY(ReadAll(stream) == content);
+
+        // a target that fails part way leaves the PFile as it was
+        auto failing = CreateCountingStream(string());
+
+        failing->FailWrites(true);
+        QVERIFY_THROW(ProtectedFileStream::Reprotect(stream, policy, failing),
+                      rmscrypto::exceptions::RMSCryptoIOException);
+        QVERIFY(backing->str() == before);
+        QVERIFY(ReadAll(stream) == content);
+
+        auto pfile = target->str();
+        auto after = ReadHeader(pfile);
+
+        QVERIFY(after->GetPublishingLicense() == policy->SerializedPolicy());
+        QVERIFY(after->GetContentStartPosition() ==
+                IPfileHeaderWriter::Create()->GetHeaderSize(after) + 200);
+        QVERIFY(pfile.size() - after->GetContentStartPosition() ==
+                GetCipherTextSize(content.size(), CIPHER_MODE_CBC4K));
+        QVERIFY(after->GetMajorVersion() ==
+                ReadHeader(before)->GetMajorVersion());
+        QVERIFY(ReadAll(OpenPfile(CreateStream(CreateBacking(pfile)))) ==
+                content);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void ProtectedFileStreamTest::test_ReprotectForcedCbc4k()
+{
+    try {
+        // A v2.1 file of an ECB license as older SDKs wrote it, with the
+        // content in CBC4K
+        auto content = TestContent(5000);
+        auto policy  = CreateTestPolicy("MICROSOFT.ECB", 0x2A, 800);
+        auto create  = [&](uint64_t contentStart) {
+            return make_shared<PfileHeader>(ByteArray(policy->SerializedPolicy()),
+                                            ".txt", contentStart, content.size(),
+                                            ByteArray(), 2, 1,
+                                            CleartextRedirectHeader);
+        };
+        auto header  = create(IPfileHeaderWriter::Create()->GetHeaderSize(
+                                  create(0)) + DEFAULT_PFILE_HEADER_PADDING);
+        auto backing = CreateBacking();
+
+        IPfileHeaderWriter::Create()->Write(CreateStream(backing), header);
+
+        auto encrypted = BlockBasedProtectedStream::Create(
+            CreateCryptoProvider(CIPHER_MODE_CBC4K, vector<uint8_t>(16, 0x2A)),
+            CreateStream(backing), header->GetContentStartPosition(), 0, 4096);
+
+        encrypted->Write(content.data(), content.size());
+        encrypted->Flush();
+        QVERIFY(ReadAll(OpenPfile(CreateStream(backing))) == content);
+
+        // an ECB license, or a CBC4K one, reads the same content under v2.
+        // The header must stay v2, v3 would read it as ECB.
+        for (auto mode : { "MICROSOFT.ECB", "MICROSOFT.CBC4K" }) {
+            auto newPolicy = CreateTestPolicy(mode, 0x2A, 900);
+            auto stream    = ProtectedFileStream::Reprotect(
+                OpenPfile(CreateStream(backing)), newPolicy);
+
+            QVERIFY2(ReadAll(stream) == content, mode);
+
+            auto after = ReadHeader(backing->str());
+
+            QVERIFY2(after->GetMajorVersion() == 2, mode);
+            QVERIFY2(after->GetMinorVersion() == 1, mode);
+            QVERIFY2(after->GetPublishingLicense() ==
+                     newPolicy->SerializedPolicy(), mode);
+            QVERIFY2(ReadAll(OpenPfile(CreateStream(CreateBacking(
+                backing->str())))) == content, mode);
+        }
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef PROTECTEDFILESTREAMTEST_H
+#define PROTECTEDFILESTREAMTEST_H
+#include <QtTest>
+
+class ProtectedFileStreamTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void test_Probe();
+    void test_ProbeMany();
+    void test_SizeFallback();
+    void test_SizeAfterWrite();
+    void test_FlushAsync();
+    void test_FailedFlush();
+    void test_HeaderVersion();
+    void test_HugeContent();
+    void test_HeaderPadding();
+    void test_Reprotect();
+    void test_ReprotectToTarget();
+    void test_ReprotectForcedCbc4k();
+};
+#endif // PROTECTEDFILESTREAMTEST_H
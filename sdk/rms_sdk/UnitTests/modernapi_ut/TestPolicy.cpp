@@ -0,0 +1,51 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include "TestPolicy.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "../../Core/ProtectionPolicy.h"
+#include "../../Common/tools.h"
+
+using namespace std;
+using namespace rmscore;
+using namespace rmscore::modernapi;
+
+const string TEST_POLICY_OWNER = "owner@contoso.com";
+
+shared_ptr<UserPolicy>CreateTestPolicy(const string& cipherMode,
+                                       uint8_t       keyByte,
+                                       size_t        cbLicense)
+{
+    static atomic<uint32_t> nextLicense(0);
+
+    // the license only keys the policy cache here, it must be unique
+    auto id = to_string(nextLicense++) + ":";
+
+    restclients::PublishResponse response;
+    response.serializedLicense.assign(max(cbLicense, id.size()), '.');
+    copy(id.begin(), id.end(), response.serializedLicense.begin());
+    response.key.value      = common::ConvertBytesToBase64(
+        common::ByteArray(16, keyByte));
+    response.key.cipherMode = cipherMode;
+    response.owner          = TEST_POLICY_OWNER;
+
+    auto pImpl = make_shared<core::ProtectionPolicy>();
+    pImpl->Initialize(response, false, true);
+    pImpl->SetRequester(TEST_POLICY_OWNER);
+    core::ProtectionPolicy::AddProtectionPolicyToCache(pImpl);
+
+    TestAuthenticationCallback auth;
+    auto result = UserPolicy::Acquire(response.serializedLicense,
+                                      TEST_POLICY_OWNER, auth, nullptr,
+                                      POL_OfflineOnly,
+                                      RESPONSE_CACHE_INMEMORY, nullptr);
+    return result->Policy;
+}
@@ -0,0 +1,39 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef TESTPOLICY_H
+#define TESTPOLICY_H
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "../../ModernAPI/UserPolicy.h"
+
+extern const std::string TEST_POLICY_OWNER;
+
+// An owner policy with a key of keyByte and the server's cipher mode name
+// (e.g. "MICROSOFT.CBC4K"), put in the in-memory policy cache so that
+// UserPolicy::Acquire and ProtectedFileStream::Acquire find it offline. Each
+// call gets its own publishing license of cbLicense bytes.
+std::shared_ptr<rmscore::modernapi::UserPolicy>CreateTestPolicy(
+    const std::string& cipherMode,
+    uint8_t            keyByte,
+    size_t             cbLicense = 64);
+
+// Offline authentication for Acquire, the cached policies never need a token
+class TestAuthenticationCallback
+    : public rmscore::modernapi::IAuthenticationCallback {
+public:
+    virtual std::string GetToken(
+        std::shared_ptr<rmscore::modernapi::AuthenticationParameters>&) override
+    {
+        return std::string();
+    }
+};
+
+#endif // TESTPOLICY_H
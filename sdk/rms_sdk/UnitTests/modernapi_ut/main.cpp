@@ -0,0 +1,22 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <QCoreApplication>
+#include "CustomProtectedStreamTest.h"
+#include "ProtectedFileStreamTest.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int res = 0;
+    res += QTest::qExec(new CustomProtectedStreamTest(), argc, argv);
+    res += QTest::qExec(new ProtectedFileStreamTest(), argc, argv);
+
+    return res;
+}
@@ -0,0 +1,47 @@
+REPO_ROOT = $$PWD/../../../..
+DESTDIR   = $$REPO_ROOT/bin/tests
+TARGET    = ModernAPIUnitTests
+
+TEMPLATE  = app
+
+QT       += core network xml xmlpatterns testlib
+QT       -= gui
+
+CONFIG   += console c++11 debug_and_release
+CONFIG   -= app_bundle
+
+INCLUDEPATH       += $$REPO_ROOT/sdk/rmscrypto_sdk/CryptoAPI
+win32:INCLUDEPATH += $$REPO_ROOT/third_party/include
+
+LIBS       += -L$$REPO_ROOT/bin -L$$REPO_ROOT/bin/rms -L$$REPO_ROOT/bin/rms/platform
+
+CONFIG(debug, debug|release) {
+    TARGET = $$join(TARGET,,,d)
+    LIBS += -lmodprotectedfiled -lmodcored -lmodrestclientsd -lmodconsentd -lmodcommond -lmodjsond
+    LIBS += -lplatformhttpd -lplatformloggerd -lplatformxmld -lplatformjsond -lplatformfilesystemd -lplatformsettingsd
+    LIBS += -lrmscryptod
+    LIBS += -lrmsd
+} else {
+    LIBS += -lmodprotectedfile -lmodcore -lmodrestclients -lmodconsent -lmodcommon -lmodjson
+    LIBS += -lplatformhttp -lplatformlogger -lplatformxml -lplatformjson -lplatformfilesystem -lplatformsettings
+    LIBS += -lrmscrypto
+    LIBS += -lrms
+}
+
+win32:LIBS += -L$$REPO_ROOT/third_party/lib/eay/ -lssleay32 -llibeay32 -lGdi32 -lUser32 -lAdvapi32
+else:LIBS  += -lssl -lcrypto
+
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
+
+SOURCES += \
+    main.cpp \
+    TestPolicy.cpp \
+    CustomProtectedStreamTest.cpp \
+    ProtectedFileStreamTest.cpp
+
+HEADERS += \
+    TestPolicy.h \
+    CustomProtectedStreamTest.h \
+    ProtectedFileStreamTest.h \
+    TestHelpers.h \
+    $$REPO_ROOT/sdk/rmscrypto_sdk/UnitTests/TestStreams.h
@@ -0,0 +1,128 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include "PfileHeaderReaderTest.h"
+
+#include <string>
+
+#include "TestHelpers.h"
+#include "../../../rmscrypto_sdk/UnitTests/TestStreams.h"
+#include "../../ModernAPI/RMSExceptions.h"
+#include "../../PFile/PfileHeader.h"
+#include "../../PFile/PfileHeaderReader.h"
+#include "../../PFile/PfileHeaderWriter.h"
+
+using namespace std;
+using namespace rmscore::common;
+using namespace rmscore::pfile;
+
+static ByteArray TestLicense(size_t size)
+{
+    ByteArray license(size);
+
+    for (size_t i = 0; i < license.size(); ++i) {
+        license[i] = static_cast<uint8_t>('a' + i % 26);
+    }
+    return license;
+}
+
+// a header for a license of cbLicense bytes with the content right after it
+static shared_ptr<PfileHeader> CreateHeader(size_t cbLicense)
+{
+    auto create = [cbLicense](uint64_t contentStart) {
+        return make_shared<PfileHeader>(TestLicense(cbLicense), ".txt",
+                                        contentStart, 1234, ByteArray(),
+                                        MJVERSION_FOR_WRITING,
+                                        MNVERSION_FOR_WRITING,
+                                        CleartextRedirectHeader);
+    };
+
+    return create(IPfileHeaderWriter::Create()->GetHeaderSize(create(0)));
+}
+
+static string WriteHeader(shared_ptr<PfileHeader> header)
+{
+    auto stream = CreateCountingStream();
+
+    IPfileHeaderWriter::Create()->Write(stream, header);
+    stream->Flush();
+    return stream->Content();
+}
+
+static void VerifyHeader(shared_ptr<PfileHeader> header,
+                         shared_ptr<PfileHeader> expected)
+{
+    QVERIFY(header->GetPublishingLicense() == expected->GetPublishingLicense());
+    QVERIFY(header->GetFileExtension() == expected->GetFileExtension());
+    QVERIFY(header->GetContentStartPosition() ==
+            expected->GetContentStartPosition());
+    QVERIFY(header->GetOriginalFileSize() == expected->GetOriginalFileSize());
+    QVERIFY(header->GetMajorVersion() == expected->GetMajorVersion());
+    QVERIFY(header->GetMinorVersion() == expected->GetMinorVersion());
+    QVERIFY(header->GetCleartextRedirectionHeader() ==
+            expected->GetCleartextRedirectionHeader());
+}
+
+void PfileHeaderReaderTest::test_HeaderInPrefix()
+{
+    try {
+        auto expected = CreateHeader(2000);
+        auto stream   = CreateCountingStream(WriteHeader(expected) +
+                                             string(100, 'c'));
+
+        QVERIFY(expected->GetContentStartPosition() <
+                PfileHeaderReader::HEADER_PREFIX_SIZE);
+
+        auto header = IPfileHeaderReader::Create()->Read(stream);
+
+        // the whole header comes with the first read
+        QVERIFY(stream->Reads() == 1);
+        VerifyHeader(header, expected);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void PfileHeaderReaderTest::test_HeaderAfterPrefix()
+{
+    try {
+        auto expected = CreateHeader(20000);
+        auto stream   = CreateCountingStream(WriteHeader(expected) +
+                                             string(100, 'c'));
+
+        QVERIFY(expected->GetContentStartPosition() >
+                PfileHeaderReader::HEADER_PREFIX_SIZE);
+
+        auto header = IPfileHeaderReader::Create()->Read(stream);
+
+        // the license ends after the prefix, one more read fetches the rest
+        QVERIFY(stream->Reads() == 2);
+        VerifyHeader(header, expected);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void PfileHeaderReaderTest::test_TruncatedHeader()
+{
+    auto reader = IPfileHeaderReader::Create();
+
+    for (size_t cbLicense : { 2000, 20000 }) {
+        auto header = WriteHeader(CreateHeader(cbLicense));
+
+        // in the version, the redirection header, the fields and the license
+        const size_t cuts[] = { 10, 100, 430, header.size() / 2,
+                                header.size() - 1 };
+
+        for (auto cut : cuts) {
+            auto stream = CreateCountingStream(header.substr(0, cut));
+            QVERIFY_THROW(reader->Read(stream),
+                          rmscore::exceptions::RMSPFileException);
+        }
+    }
+}
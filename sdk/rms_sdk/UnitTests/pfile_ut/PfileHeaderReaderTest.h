@@ -0,0 +1,21 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef PFILEHEADERREADERTEST_H
+#define PFILEHEADERREADERTEST_H
+#include <QtTest>
+
+class PfileHeaderReaderTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void test_HeaderInPrefix();
+    void test_HeaderAfterPrefix();
+    void test_TruncatedHeader();
+};
+#endif // PFILEHEADERREADERTEST_H
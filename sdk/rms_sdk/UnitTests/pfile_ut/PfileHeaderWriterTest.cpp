@@ -0,0 +1,137 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include "PfileHeaderWriterTest.h"
+
+#include <string>
+
+#include "TestHelpers.h"
+#include "../../../rmscrypto_sdk/UnitTests/TestStreams.h"
+#include "../../ModernAPI/RMSExceptions.h"
+#include "../../PFile/PfileHeader.h"
+#include "../../PFile/PfileHeaderReader.h"
+#include "../../PFile/PfileHeaderWriter.h"
+
+using namespace std;
+using namespace rmscore::common;
+using namespace rmscore::pfile;
+
+static ByteArray TestBytes(size_t size, char first)
+{
+    ByteArray bytes(size);
+
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = static_cast<uint8_t>(first + i % 26);
+    }
+    return bytes;
+}
+
+// a header of majorVersion with contentStart bytes in front of the content,
+// 0 for the content right after the header
+static shared_ptr<PfileHeader> CreateHeader(uint32_t majorVersion,
+                                            uint64_t originalFileSize,
+                                            uint64_t contentStart = 0)
+{
+    auto create = [=](uint64_t start) {
+        return make_shared<PfileHeader>(TestBytes(3000, 'a'), ".docx", start,
+                                        originalFileSize, TestBytes(50, 'A'),
+                                        majorVersion, MNVERSION_FOR_WRITING,
+                                        CleartextRedirectHeader);
+    };
+
+    if (contentStart == 0) {
+        contentStart = IPfileHeaderWriter::Create()->GetHeaderSize(create(0));
+    }
+    return create(contentStart);
+}
+
+static void VerifyHeader(shared_ptr<PfileHeader> header,
+                         shared_ptr<PfileHeader> expected)
+{
+    QVERIFY(header->GetPublishingLicense() == expected->GetPublishingLicense());
+    QVERIFY(header->GetFileExtension() == expected->GetFileExtension());
+    QVERIFY(header->GetContentStartPosition() ==
+            expected->GetContentStartPosition());
+    QVERIFY(header->GetOriginalFileSize() == expected->GetOriginalFileSize());
+    QVERIFY(header->GetMetadata() == expected->GetMetadata());
+    QVERIFY(header->GetMajorVersion() == expected->GetMajorVersion());
+    QVERIFY(header->GetMinorVersion() == expected->GetMinorVersion());
+    QVERIFY(header->Has64BitLayout() == expected->Has64BitLayout());
+    QVERIFY(header->GetCleartextRedirectionHeader() ==
+            expected->GetCleartextRedirectionHeader());
+}
+
+void PfileHeaderWriterTest::test_RoundTrip()
+{
+    try {
+        auto writer = IPfileHeaderWriter::Create();
+        auto reader = IPfileHeaderReader::Create();
+
+        // v3 is written by default, v4 only when the content needs it
+        QVERIFY(MJVERSION_FOR_WRITING == 3);
+        QVERIFY(!CreateHeader(MJVERSION_FOR_WRITING, 0)->Has64BitLayout());
+
+        for (uint32_t majorVersion : { MJVERSION_FOR_WRITING,
+                                       MIN_MJVERSION_WITH_64BIT_LAYOUT }) {
+            auto expected = CreateHeader(majorVersion, 123456);
+            auto stream   = CreateCountingStream();
+
+            writer->Write(stream, expected);
+            QVERIFY(stream->Size() == expected->GetContentStartPosition());
+            VerifyHeader(reader->Read(stream), expected);
+
+            // the size field is rewritten in place, past 32 bits in both
+            const uint64_t originalFileSize = (1ULL << 40) + 7;
+
+            writer->WriteOriginalFileSize(stream, expected, originalFileSize);
+            VerifyHeader(reader->Read(stream),
+                         CreateHeader(majorVersion, originalFileSize));
+        }
+
+        // eight offsets and lengths of 64 instead of 32 bit
+        QVERIFY(writer->GetHeaderSize(CreateHeader(MIN_MJVERSION_WITH_64BIT_LAYOUT, 0)) ==
+                writer->GetHeaderSize(CreateHeader(MJVERSION_FOR_WRITING, 0)) + 32);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
+
+void PfileHeaderWriterTest::test_LargeOffsets()
+{
+    try {
+        auto writer = IPfileHeaderWriter::Create();
+        auto reader = IPfileHeaderReader::Create();
+
+        // the padding takes the content past 4 GB
+        const uint64_t contentStart     = (1ULL << 32) + 4096;
+        const uint64_t originalFileSize = (1ULL << 45) + 3;
+
+        auto expected = CreateHeader(MIN_MJVERSION_WITH_64BIT_LAYOUT,
+                                     originalFileSize, contentStart);
+        auto stream   = make_shared<SparseStream>();
+
+        writer->Write(stream, expected);
+        QVERIFY(stream->Size() == contentStart);
+        QVERIFY(stream->AllocatedSize() < 1024 * 1024);
+        VerifyHeader(reader->Read(stream), expected);
+
+        writer->WriteOriginalFileSize(stream, expected, originalFileSize + 1);
+        VerifyHeader(reader->Read(stream),
+                     CreateHeader(MIN_MJVERSION_WITH_64BIT_LAYOUT,
+                                  originalFileSize + 1, contentStart));
+
+        // the 32 bit fields of v3 can't point there
+        QVERIFY_THROW(writer->Write(make_shared<SparseStream>(),
+                                    CreateHeader(MJVERSION_FOR_WRITING,
+                                                 originalFileSize,
+                                                 contentStart)),
+                      rmscore::exceptions::RMSPFileException);
+    } catch (const rmscore::exceptions::RMSException& e) {
+        QTest::qFail(e.what(), __FILE__, __LINE__);
+    }
+}
@@ -0,0 +1,20 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef PFILEHEADERWRITERTEST_H
+#define PFILEHEADERWRITERTEST_H
+#include <QtTest>
+
+class PfileHeaderWriterTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void test_RoundTrip();
+    void test_LargeOffsets();
+};
+#endif // PFILEHEADERWRITERTEST_H
@@ -46,9 +46,11 @@ void FileCacheEncrypted::readCache()
     ifs.read(&cacheData[0], pos);
 
     // decrypt cacheData;
-    auto inputDataPtr = std::make_shared<std::vector<uint8_t>>(cacheData.begin(), cacheData.end());
-    auto cacheDataDecryptedPtr = rmscrypto::api::DecryptWithAutoKey(inputDataPtr);
-    ByteArray cacheDataDecrypted(cacheDataDecryptedPtr->begin(), cacheDataDecryptedPtr->end());
+    ByteArray cacheDataDecrypted(cacheData.size());
+    auto decryptedSize = rmscrypto::api::DecryptWithAutoKey(
+        reinterpret_cast<const uint8_t*>(cacheData.data()), cacheData.size(),
+        reinterpret_cast<uint8_t*>(cacheDataDecrypted.data()), cacheDataDecrypted.size());
+    cacheDataDecrypted.resize(decryptedSize);
 
     deserialize(cacheDataDecrypted);
     ifs.close();
@@ -71,9 +73,11 @@ void FileCacheEncrypted::writeCache()
 
     // encrypt cacheData
     Logger::info(Tag(), "encrypting cacheData");
-    auto inputDataPtr = std::make_shared<std::vector<uint8_t>>(cacheData.begin(), cacheData.end());
-    auto cacheDataEncryptedPtr = rmscrypto::api::EncryptWithAutoKey(inputDataPtr);
-    ByteArray cacheDataEncrypted(cacheDataEncryptedPtr->begin(), cacheDataEncryptedPtr->end());
+    ByteArray cacheDataEncrypted(rmscrypto::api::GetCipherTextSize(cacheData.size()));
+    auto encryptedSize = rmscrypto::api::EncryptWithAutoKey(
+        reinterpret_cast<const uint8_t*>(cacheData.data()), cacheData.size(),
+        reinterpret_cast<uint8_t*>(cacheDataEncrypted.data()), cacheDataEncrypted.size());
+    cacheDataEncrypted.resize(encryptedSize);
 
     Logger::info(Tag(), "writing to the file stream");
     ofs.write(&cacheDataEncrypted[0], cacheDataEncrypted.size());
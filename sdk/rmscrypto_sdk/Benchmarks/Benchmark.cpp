@@ -0,0 +1,168 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include "../CryptoAPI/CryptoAPI.h"
+#include "Benchmark.h"
+
+using namespace std;
+using namespace rmscrypto::api;
+
+namespace rmscrypto {
+namespace bench {
+string CipherModeName(CipherMode cipherMode)
+{
+  switch (cipherMode)
+  {
+  case CIPHER_MODE_CBC4K:
+    return "CBC4K";
+
+  case CIPHER_MODE_ECB:
+    return "ECB";
+
+  case CIPHER_MODE_CBC512NOPADDING:
+    return "CBC512";
+
+  case CIPHER_MODE_CTR:
+    return "CTR";
+
+  default:
+    return "unknown";
+  }
+}
+
+vector<uint8_t>BenchmarkKey()
+{
+  vector<uint8_t> key(16);
+
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<uint8_t>(i * 7 + 1);
+  }
+  return key;
+}
+
+shared_ptr<ICryptoProvider>CreateBenchmarkProvider(CipherMode cipherMode)
+{
+  if (cipherMode == CIPHER_MODE_CTR) {
+    return CreateCtrCryptoProvider(BenchmarkKey(),
+                                   vector<uint8_t>(CTR_NONCE_SIZE, 0));
+  }
+  return CreateCryptoProvider(cipherMode, BenchmarkKey());
+}
+
+vector<pair<uint64_t, uint64_t> >SplitRange(uint64_t u64Size,
+                                            uint32_t u32Parts,
+                                            uint64_t u64Align)
+{
+  vector<pair<uint64_t, uint64_t> > ranges;
+
+  uint64_t u64Units = max<uint64_t>(1, (u64Size + u64Align - 1) / u64Align);
+  uint64_t u64Parts = min<uint64_t>(max<uint32_t>(1, u32Parts), u64Units);
+  uint64_t u64Step  = u64Units / u64Parts * u64Align;
+
+  for (uint64_t i = 0; i < u64Parts; ++i)
+  {
+    uint64_t u64First = i * u64Step;
+    uint64_t u64End   = (i + 1 == u64Parts) ? u64Size : u64First + u64Step;
+
+    ranges.push_back(make_pair(u64First, u64End));
+  }
+
+  return ranges;
+}
+
+double RunThreads(uint32_t u32Threads, const function<void(uint32_t)>& work)
+{
+  vector<thread> threads;
+  exception_ptr  error;
+  mutex errorLocker;
+
+  auto start = chrono::steady_clock::now();
+
+  for (uint32_t i = 0; i < u32Threads; ++i)
+  {
+    threads.emplace_back([&work, &error, &errorLocker, i]() {
+      try {
+        work(i);
+      }
+      catch (...) {
+        // lock resources
+        lock_guard<mutex> locker(errorLocker);
+        error = current_exception();
+      }
+    });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  if (error) {
+    rethrow_exception(error);
+  }
+
+  return elapsed.count();
+}
+
+static double MegabytesPerSecond(const BenchmarkResult& result)
+{
+  return result.seconds > 0
+         ? (result.bytes / (1024.0 * 1024.0)) / result.seconds
+         : 0;
+}
+
+static double NanosecondsPerBlock(const BenchmarkResult& result)
+{
+  double blocks = static_cast<double>(result.bytes) / result.blockSize;
+
+  return blocks > 0 ? result.seconds * 1e9 / blocks : 0;
+}
+
+void PrintResult(ostream& out, const BenchmarkResult& result)
+{
+  out << left << setw(16) << result.name
+      << setw(11) << result.target
+      << setw(12) << result.pattern
+      << right << setw(12) << result.size
+      << setw(4) << result.threads
+      << setw(12) << fixed << setprecision(1) << MegabytesPerSecond(result)
+      << " MB/s"
+      << setw(12) << NanosecondsPerBlock(result)
+      << " ns/block" << endl;
+}
+
+void PrintCsvHeader(ostream& out)
+{
+  out << "name,target,pattern,size,threads,block_size,bytes,seconds,"
+         "mb_per_s,ns_per_block" << endl;
+}
+
+void PrintCsv(ostream& out, const BenchmarkResult& result)
+{
+  out << result.name << ','
+      << result.target << ','
+      << result.pattern << ','
+      << result.size << ','
+      << result.threads << ','
+      << result.blockSize << ','
+      << result.bytes << ','
+      << setprecision(9) << result.seconds << ','
+      << fixed << setprecision(3) << MegabytesPerSecond(result) << ','
+      << NanosecondsPerBlock(result) << endl;
+
+  out.unsetf(ios_base::floatfield);
+}
+} // namespace bench
+} // namespace rmscrypto
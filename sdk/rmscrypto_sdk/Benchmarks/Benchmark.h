@@ -0,0 +1,63 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _RMS_CRYPTO_BENCH_BENCHMARK_H_
+#define _RMS_CRYPTO_BENCH_BENCHMARK_H_
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../CryptoAPI/ICryptoProvider.h"
+
+namespace rmscrypto {
+namespace bench {
+struct BenchmarkResult
+{
+  std::string name;      // <cipher mode>.<operation>, e.g. CBC4K.decrypt
+  std::string target;    // provider, or the stream backend
+  std::string pattern;   // sequential or random
+  uint64_t    size;      // bytes of data the operation runs over
+  uint32_t    threads;
+  uint32_t    blockSize; // cipher block size, for ns/block
+  uint64_t    bytes;     // bytes processed in total
+  double      seconds;
+};
+
+std::string                 CipherModeName(api::CipherMode cipherMode);
+std::vector<uint8_t>        BenchmarkKey();
+
+// Provider for cipherMode under BenchmarkKey, CTR with a fixed nonce
+std::shared_ptr<api::ICryptoProvider>CreateBenchmarkProvider(
+  api::CipherMode cipherMode);
+
+// Splits [0, u64Size) into at most u32Parts ranges of whole u64Align units,
+// the last range takes the remainder
+std::vector<std::pair<uint64_t, uint64_t> >SplitRange(uint64_t u64Size,
+                                                      uint32_t u32Parts,
+                                                      uint64_t u64Align);
+
+// Runs work(0) ... work(u32Threads - 1) on as many threads and returns the
+// elapsed time in seconds
+double RunThreads(uint32_t                          u32Threads,
+                  const std::function<void(uint32_t)>& work);
+
+// Human readable table row
+void PrintResult(std::ostream         & out,
+                 const BenchmarkResult& result);
+
+// Machine readable output, one line per result
+void PrintCsvHeader(std::ostream& out);
+void PrintCsv(std::ostream         & out,
+              const BenchmarkResult& result);
+} // namespace bench
+} // namespace rmscrypto
+#endif // _RMS_CRYPTO_BENCH_BENCHMARK_H_
@@ -0,0 +1,39 @@
+REPO_ROOT = $$PWD/../../..
+DESTDIR   = $$REPO_ROOT/bin/tests
+TARGET    = rmscrypto_bench
+
+TEMPLATE = app
+
+QT       -= gui
+QT       += core
+
+CONFIG   -= app_bundle
+CONFIG   += console c++11 debug_and_release warn_on
+
+INCLUDEPATH           += $$REPO_ROOT/sdk/rmscrypto_sdk/CryptoAPI
+win32:INCLUDEPATH     += $$REPO_ROOT/third_party/include
+unix:!mac:INCLUDEPATH += /usr/include/glib-2.0/ /usr/include/libsecret-1/ /usr/lib/x86_64-linux-gnu/glib-2.0/include/
+
+LIBS                  +=  -L$$REPO_ROOT/bin -L$$REPO_ROOT/bin/crypto -L$$REPO_ROOT/bin/crypto/platform
+
+CONFIG(debug, debug|release) {
+    TARGET = $$join(TARGET,,,d)
+    LIBS +=  -lmodcryptod -lplatformkeystoraged -lplatformcryptod -lplatformloggerd -lplatformsettingsd -lrmscryptod
+} else {
+    LIBS +=  -lmodcrypto -lplatformkeystorage -lplatformcrypto -lplatformlogger -lplatformsettings -lrmscrypto
+}
+
+win32:LIBS            += -L$$REPO_ROOT/third_party/lib/eay/ -lssleay32 -llibeay32 -lGdi32 -lUser32 -lAdvapi32
+unix:!mac:LIBS        += -lssl -lcrypto -lsecret-1 -lglib-2.0
+mac:LIBS              += -lssl -lcrypto
+
+SOURCES += \
+    main.cpp \
+    Benchmark.cpp \
+    ProviderBenchmarks.cpp \
+    StreamBenchmarks.cpp
+
+HEADERS += \
+    Benchmark.h \
+    ProviderBenchmarks.h \
+    StreamBenchmarks.h
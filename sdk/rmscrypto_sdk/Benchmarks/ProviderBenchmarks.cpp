@@ -0,0 +1,85 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <vector>
+#include "../CryptoAPI/CryptoAPI.h"
+#include "ProviderBenchmarks.h"
+
+using namespace std;
+using namespace rmscrypto::api;
+
+namespace rmscrypto {
+namespace bench {
+static BenchmarkResult BenchmarkProvider(CipherMode cipherMode,
+                                         bool       bEncrypt,
+                                         uint32_t   cbBuffer,
+                                         uint32_t   iterations,
+                                         uint32_t   threads)
+{
+  auto provider = CreateBenchmarkProvider(cipherMode);
+  uint32_t cbBlock = provider->GetBlockSize();
+
+  // only final data may end inside a block
+  cbBuffer = (cbBuffer + cbBlock - 1) / cbBlock * cbBlock;
+
+  // the input doesn't need to be valid cipher text, nothing is final
+  vector<uint8_t> input(cbBuffer, bEncrypt ? 0x5a : 0xa5);
+  vector<uint8_t> output(cbBuffer + cbBlock);
+
+  auto slices = SplitRange(cbBuffer, threads, cbBlock);
+
+  double seconds = RunThreads(static_cast<uint32_t>(slices.size()),
+                              [&](uint32_t index)
+  {
+    uint32_t first   = static_cast<uint32_t>(slices[index].first);
+    uint32_t cbSlice = static_cast<uint32_t>(slices[index].second) - first;
+    uint32_t cbOut   = 0;
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+      if (bEncrypt) {
+        provider->Encrypt(&input[first], cbSlice, first / cbBlock, false,
+                          &output[first], cbSlice + cbBlock, &cbOut);
+      } else {
+        provider->Decrypt(&input[first], cbSlice, first / cbBlock, false,
+                          &output[first], cbSlice + cbBlock, &cbOut);
+      }
+    }
+  });
+
+  BenchmarkResult result;
+
+  result.name      = CipherModeName(cipherMode) + (bEncrypt ? ".encrypt"
+                                                   : ".decrypt");
+  result.target    = "provider";
+  result.pattern   = "sequential";
+  result.size      = cbBuffer;
+  result.threads   = static_cast<uint32_t>(slices.size());
+  result.blockSize = cbBlock;
+  result.bytes     = static_cast<uint64_t>(cbBuffer) * iterations;
+  result.seconds   = seconds;
+  return result;
+}
+
+BenchmarkResult BenchmarkProviderEncrypt(CipherMode cipherMode,
+                                         uint32_t   cbBuffer,
+                                         uint32_t   iterations,
+                                         uint32_t   threads)
+{
+  return BenchmarkProvider(cipherMode, true, cbBuffer, iterations, threads);
+}
+
+BenchmarkResult BenchmarkProviderDecrypt(CipherMode cipherMode,
+                                         uint32_t   cbBuffer,
+                                         uint32_t   iterations,
+                                         uint32_t   threads)
+{
+  return BenchmarkProvider(cipherMode, false, cbBuffer, iterations, threads);
+}
+} // namespace bench
+} // namespace rmscrypto
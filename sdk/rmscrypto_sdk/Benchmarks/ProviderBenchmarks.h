@@ -0,0 +1,29 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _RMS_CRYPTO_BENCH_PROVIDERBENCHMARKS_H_
+#define _RMS_CRYPTO_BENCH_PROVIDERBENCHMARKS_H_
+
+#include "Benchmark.h"
+
+namespace rmscrypto {
+namespace bench {
+// Measures raw ICryptoProvider encrypt and decrypt throughput for the given
+// cipher mode on a buffer of cbBuffer bytes, repeated iterations times. With
+// more than one thread each thread works on its own slice of the buffer.
+BenchmarkResult BenchmarkProviderEncrypt(api::CipherMode cipherMode,
+                                         uint32_t        cbBuffer,
+                                         uint32_t        iterations,
+                                         uint32_t        threads = 1);
+BenchmarkResult BenchmarkProviderDecrypt(api::CipherMode cipherMode,
+                                         uint32_t        cbBuffer,
+                                         uint32_t        iterations,
+                                         uint32_t        threads = 1);
+} // namespace bench
+} // namespace rmscrypto
+#endif // _RMS_CRYPTO_BENCH_PROVIDERBENCHMARKS_H_
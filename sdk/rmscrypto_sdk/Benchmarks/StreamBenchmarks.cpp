@@ -0,0 +1,436 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <QTemporaryFile>
+#include "../CryptoAPI/CryptoAPI.h"
+#include "../CryptoAPI/BlockBasedProtectedStream.h"
+#include "../CryptoAPI/RMSCryptoExceptions.h"
+#include "StreamBenchmarks.h"
+
+using namespace std;
+using namespace rmscrypto::api;
+
+namespace rmscrypto {
+namespace bench {
+namespace {
+// Fixed capacity byte buffer, so that the benchmark measures the protected
+// stream and not the backing stream's locking or reallocation
+class MemoryStream : public IStream {
+public:
+
+  explicit MemoryStream(uint64_t u64Capacity)
+    : m_state(make_shared<State>())
+    , m_u64Position(0)
+  {
+    m_state->data.resize(static_cast<size_t>(u64Capacity));
+    m_state->u64Size = 0;
+  }
+
+  virtual shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
+                                          int64_t     cbBuffer,
+                                          int64_t     cbOffset,
+                                          std::launch) override
+  {
+    return Ready(ReadAt(pbBuffer, cbBuffer, cbOffset));
+  }
+
+  virtual shared_future<int64_t>WriteAsync(const uint8_t *cpbBuffer,
+                                           int64_t        cbBuffer,
+                                           int64_t        cbOffset,
+                                           std::launch) override
+  {
+    return Ready(WriteAt(cpbBuffer, cbBuffer, cbOffset));
+  }
+
+  virtual future<bool>FlushAsync(std::launch) override
+  {
+    promise<bool> result;
+    result.set_value(true);
+    return result.get_future();
+  }
+
+  virtual int64_t Read(uint8_t *pbBuffer, int64_t cbBuffer) override
+  {
+    int64_t cbRead = ReadAt(pbBuffer, cbBuffer,
+                            static_cast<int64_t>(m_u64Position));
+
+    m_u64Position += static_cast<uint64_t>(cbRead);
+    return cbRead;
+  }
+
+  virtual int64_t Write(const uint8_t *cpbBuffer, int64_t cbBuffer) override
+  {
+    int64_t cbWritten = WriteAt(cpbBuffer, cbBuffer,
+                                static_cast<int64_t>(m_u64Position));
+
+    m_u64Position += static_cast<uint64_t>(cbWritten);
+    return cbWritten;
+  }
+
+  virtual bool Flush() override
+  {
+    return true;
+  }
+
+  virtual SharedStream Clone() override
+  {
+    auto clone = make_shared<MemoryStream>(*this);
+
+    clone->m_u64Position = 0;
+    return clone;
+  }
+
+  virtual void Seek(uint64_t u64Position) override
+  {
+    m_u64Position = u64Position;
+  }
+
+  virtual bool CanRead() const override
+  {
+    return true;
+  }
+
+  virtual bool CanWrite() const override
+  {
+    return true;
+  }
+
+  virtual uint64_t Position() override
+  {
+    return m_u64Position;
+  }
+
+  virtual uint64_t Size() override
+  {
+    return m_state->u64Size;
+  }
+
+  virtual void Size(uint64_t u64Value) override
+  {
+    if (u64Value > m_state->data.size()) {
+      throw exceptions::RMSCryptoInsufficientBufferException(
+              "Insufficient buffer");
+    }
+    m_state->u64Size = u64Value;
+  }
+
+private:
+
+  struct State {
+    vector<uint8_t>  data;
+    atomic<uint64_t> u64Size;
+  };
+
+  static shared_future<int64_t>Ready(int64_t value)
+  {
+    promise<int64_t> result;
+    result.set_value(value);
+    return result.get_future().share();
+  }
+
+  int64_t ReadAt(uint8_t *pbBuffer, int64_t cbBuffer, int64_t cbOffset)
+  {
+    uint64_t u64Size = m_state->u64Size;
+    uint64_t u64Offset = static_cast<uint64_t>(cbOffset);
+
+    if (u64Offset >= u64Size) {
+      return 0;
+    }
+
+    uint64_t cbRead = min(static_cast<uint64_t>(cbBuffer), u64Size - u64Offset);
+
+    memcpy(pbBuffer, &m_state->data[static_cast<size_t>(u64Offset)],
+           static_cast<size_t>(cbRead));
+    return static_cast<int64_t>(cbRead);
+  }
+
+  int64_t WriteAt(const uint8_t *cpbBuffer, int64_t cbBuffer, int64_t cbOffset)
+  {
+    uint64_t u64End = static_cast<uint64_t>(cbOffset + cbBuffer);
+
+    if (u64End > m_state->data.size()) {
+      throw exceptions::RMSCryptoInsufficientBufferException(
+              "Insufficient buffer");
+    }
+
+    memcpy(&m_state->data[static_cast<size_t>(cbOffset)], cpbBuffer,
+           static_cast<size_t>(cbBuffer));
+
+    // writers of different ranges only meet here
+    uint64_t u64Size = m_state->u64Size;
+
+    while (u64Size < u64End &&
+           !m_state->u64Size.compare_exchange_weak(u64Size, u64End)) {}
+
+    return cbBuffer;
+  }
+
+  shared_ptr<State> m_state;
+  uint64_t m_u64Position;
+};
+
+// Keeps the backing storage of one benchmark alive
+struct Backing {
+  StreamBackend             backend;
+  shared_ptr<MemoryStream>  memory;
+  shared_ptr<stringstream>  buffer;
+  unique_ptr<QTemporaryFile>file;
+};
+
+const uint64_t SEQUENTIAL_CHUNK_SIZE = 64 * 1024;
+const uint64_t RANDOM_CHUNK_SIZE     = 4 * 1024;
+const uint64_t FILL_CHUNK_SIZE       = 1024 * 1024;
+} // namespace
+
+static string BackendName(StreamBackend backend)
+{
+  switch (backend)
+  {
+  case STREAM_BACKEND_MEMORY:
+    return "memory";
+
+  case STREAM_BACKEND_STDSTREAM:
+    return "stdstream";
+
+  case STREAM_BACKEND_FILE:
+    return "file";
+
+  default:
+    return "unknown";
+  }
+}
+
+static SharedStream OpenBacking(Backing& backing, bool bWrite)
+{
+  switch (backing.backend)
+  {
+  case STREAM_BACKEND_MEMORY:
+    return backing.memory->Clone();
+
+  case STREAM_BACKEND_STDSTREAM:
+    return CreateStreamFromStdStream(static_pointer_cast<iostream>(
+                                       backing.buffer));
+
+  default:
+  {
+    // read-only file streams are memory mapped
+    ios_base::openmode mode = bWrite ? (ios_base::in | ios_base::out)
+                              : ios_base::in;
+
+    return CreateStreamFromFile(backing.file->fileName().toStdString(), mode);
+  }
+  }
+}
+
+// Same as CreateCryptoStream, which doesn't take CTR without a nonce
+static shared_ptr<BlockBasedProtectedStream>CreateBenchmarkStream(
+  CipherMode   cipherMode,
+  SharedStream backingStream)
+{
+  auto provider = CreateBenchmarkProvider(cipherMode);
+
+  return BlockBasedProtectedStream::Create(provider, backingStream, 0, -1,
+                                           provider->GetBlockSize() == 512
+                                           ? 512 : 4096);
+}
+
+// Creates u64Size bytes of protected content on the backend
+static void CreateBacking(Backing       & backing,
+                          CipherMode      cipherMode,
+                          StreamBackend   backend,
+                          uint64_t        u64Size)
+{
+  backing.backend = backend;
+
+  switch (backend)
+  {
+  case STREAM_BACKEND_MEMORY:
+
+    // room for the padding of the final block
+    backing.memory = make_shared<MemoryStream>(u64Size + 4096);
+    break;
+
+  case STREAM_BACKEND_STDSTREAM:
+    backing.buffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    break;
+
+  default:
+    backing.file.reset(new QTemporaryFile());
+
+    if (!backing.file->open()) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::UnknownError,
+              "Failed to create a temporary file");
+    }
+    break;
+  }
+
+  auto writer = CreateBenchmarkStream(cipherMode, OpenBacking(backing, true));
+  vector<uint8_t> chunk(static_cast<size_t>(min(u64Size, FILL_CHUNK_SIZE)));
+
+  for (size_t i = 0; i < chunk.size(); ++i) {
+    chunk[i] = static_cast<uint8_t>(i * 31);
+  }
+
+  for (uint64_t u64Written = 0; u64Written < u64Size;)
+  {
+    uint64_t cbChunk = min(u64Size - u64Written,
+                           static_cast<uint64_t>(chunk.size()));
+
+    writer->Write(chunk.data(), static_cast<int64_t>(cbChunk));
+    u64Written += cbChunk;
+  }
+
+  writer->Flush();
+}
+
+// Offsets each thread works through, in order
+static vector<vector<uint64_t> >ThreadOffsets(AccessPattern pattern,
+                                              uint64_t      u64Size,
+                                              uint64_t      cbChunk,
+                                              uint32_t      threads)
+{
+  uint64_t u64Chunks = (u64Size + cbChunk - 1) / cbChunk;
+  vector<vector<uint64_t> > offsets;
+
+  if (pattern == ACCESS_PATTERN_SEQUENTIAL)
+  {
+    // every thread streams through its own part of the content
+    for (auto& range : SplitRange(u64Chunks, threads, 1))
+    {
+      offsets.push_back(vector<uint64_t>());
+
+      for (uint64_t i = range.first; i < range.second; ++i) {
+        offsets.back().push_back(i * cbChunk);
+      }
+    }
+    return offsets;
+  }
+
+  vector<uint64_t> order(static_cast<size_t>(u64Chunks));
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i * cbChunk;
+  }
+
+  // the same order every run
+  mt19937_64 random(u64Size);
+  shuffle(order.begin(), order.end(), random);
+
+  offsets.resize(static_cast<size_t>(min<uint64_t>(max(1u, threads),
+                                                   u64Chunks)));
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    offsets[i % offsets.size()].push_back(order[i]);
+  }
+  return offsets;
+}
+
+static BenchmarkResult BenchmarkStream(CipherMode    cipherMode,
+                                       StreamBackend backend,
+                                       AccessPattern pattern,
+                                       bool          bWrite,
+                                       uint64_t      u64Size,
+                                       uint32_t      passes,
+                                       uint32_t      threads)
+{
+  Backing backing;
+
+  CreateBacking(backing, cipherMode, backend, u64Size);
+
+  auto stream = CreateBenchmarkStream(cipherMode,
+                                      OpenBacking(backing, bWrite));
+
+  uint64_t cbChunk = min(u64Size, pattern == ACCESS_PATTERN_SEQUENTIAL
+                         ? SEQUENTIAL_CHUNK_SIZE : RANDOM_CHUNK_SIZE);
+  auto offsets = ThreadOffsets(pattern, u64Size, cbChunk, threads);
+
+  if (offsets.size() > 1) {
+    stream->SetConcurrentAccess(true);
+  }
+
+  double seconds = RunThreads(static_cast<uint32_t>(offsets.size()),
+                              [&](uint32_t index)
+  {
+    vector<uint8_t> buffer(static_cast<size_t>(cbChunk), 0x3c);
+
+    for (uint32_t pass = 0; pass < passes; ++pass)
+    {
+      for (auto offset : offsets[index])
+      {
+        int64_t cbBuffer = static_cast<int64_t>(min(cbChunk, u64Size - offset));
+
+        if (bWrite) {
+          stream->WriteAsync(buffer.data(), cbBuffer,
+                             static_cast<int64_t>(offset),
+                             launch::deferred).get();
+        } else {
+          stream->ReadAsync(buffer.data(), cbBuffer,
+                            static_cast<int64_t>(offset),
+                            launch::deferred).get();
+        }
+      }
+    }
+  });
+
+  if (bWrite)
+  {
+    auto start = chrono::steady_clock::now();
+
+    stream->Flush();
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    seconds += elapsed.count();
+  }
+
+  BenchmarkResult result;
+
+  result.name      = CipherModeName(cipherMode) + (bWrite ? ".write" : ".read");
+  result.target    = BackendName(backend);
+  result.pattern   = pattern == ACCESS_PATTERN_SEQUENTIAL ? "sequential"
+                     : "random";
+  result.size      = u64Size;
+  result.threads   = static_cast<uint32_t>(offsets.size());
+  result.blockSize = CreateBenchmarkProvider(cipherMode)
+                     ->GetBlockSize() == 512 ? 512 : 4096;
+  result.bytes     = u64Size * passes;
+  result.seconds   = seconds;
+  return result;
+}
+
+BenchmarkResult BenchmarkStreamRead(CipherMode    cipherMode,
+                                    StreamBackend backend,
+                                    AccessPattern pattern,
+                                    uint64_t      u64Size,
+                                    uint32_t      passes,
+                                    uint32_t      threads)
+{
+  return BenchmarkStream(cipherMode, backend, pattern, false, u64Size, passes,
+                         threads);
+}
+
+BenchmarkResult BenchmarkStreamWrite(CipherMode    cipherMode,
+                                     StreamBackend backend,
+                                     AccessPattern pattern,
+                                     uint64_t      u64Size,
+                                     uint32_t      passes,
+                                     uint32_t      threads)
+{
+  return BenchmarkStream(cipherMode, backend, pattern, true, u64Size, passes,
+                         threads);
+}
+} // namespace bench
+} // namespace rmscrypto
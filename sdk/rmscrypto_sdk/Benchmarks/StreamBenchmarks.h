@@ -0,0 +1,45 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _RMS_CRYPTO_BENCH_STREAMBENCHMARKS_H_
+#define _RMS_CRYPTO_BENCH_STREAMBENCHMARKS_H_
+
+#include "Benchmark.h"
+
+namespace rmscrypto {
+namespace bench {
+enum StreamBackend {
+  STREAM_BACKEND_MEMORY,    // lock free in-memory IStream
+  STREAM_BACKEND_STDSTREAM, // StdStreamAdapter over a std::stringstream
+  STREAM_BACKEND_FILE       // CreateStreamFromFile on a temporary file
+};
+
+enum AccessPattern {
+  ACCESS_PATTERN_SEQUENTIAL, // 64 KB operations in order
+  ACCESS_PATTERN_RANDOM      // 4 KB operations in shuffled order
+};
+
+// Measures reads or writes through a BlockBasedProtectedStream over u64Size
+// bytes of existing content on the given backend, passes times. Every thread
+// works on its own share of the operations; with more than one thread the
+// stream runs in concurrent access mode. Writes include the final flush.
+BenchmarkResult BenchmarkStreamRead(api::CipherMode cipherMode,
+                                    StreamBackend   backend,
+                                    AccessPattern   pattern,
+                                    uint64_t        u64Size,
+                                    uint32_t        passes,
+                                    uint32_t        threads = 1);
+BenchmarkResult BenchmarkStreamWrite(api::CipherMode cipherMode,
+                                     StreamBackend   backend,
+                                     AccessPattern   pattern,
+                                     uint64_t        u64Size,
+                                     uint32_t        passes,
+                                     uint32_t        threads = 1);
+} // namespace bench
+} // namespace rmscrypto
+#endif // _RMS_CRYPTO_BENCH_STREAMBENCHMARKS_H_
@@ -0,0 +1,196 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Crypto/NativeAesCbc.h"
+#include "ProviderBenchmarks.h"
+#include "StreamBenchmarks.h"
+
+using namespace std;
+using namespace rmscrypto::api;
+using namespace rmscrypto::bench;
+
+namespace {
+struct Options {
+  uint64_t maxSize;
+  uint32_t maxThreads;
+  bool     csv;
+  bool     allModes;
+};
+
+// Accepts a plain byte count or one ending in K, M or G
+uint64_t ParseSize(const char *value)
+{
+  char    *end  = nullptr;
+  uint64_t size = strtoull(value, &end, 10);
+
+  switch (*end)
+  {
+  case 'G':
+  case 'g':
+    size *= 1024;
+
+  // fall through
+  case 'M':
+  case 'm':
+    size *= 1024;
+
+  // fall through
+  case 'K':
+  case 'k':
+    size *= 1024;
+    break;
+  }
+  return size;
+}
+
+void PrintUsage()
+{
+  cerr << "usage: rmscrypto_bench [--max-size <bytes>[K|M|G]] "
+          "[--threads <n>] [--all-modes] [--csv]" << endl
+       << "  --max-size   largest data size, 1 KB to 1 GB (default 64M)" << endl
+       << "  --threads    most threads to run with (default: hardware threads)"
+       << endl
+       << "  --all-modes  run the stream benchmarks for every cipher mode, "
+          "not only CBC4K" << endl
+       << "  --csv        machine readable output" << endl
+       << "RMSCRYPTO_AES_KERNEL=evp|aesni|vaes|armv8-ce picks the AES code of "
+          "the CBC modes" << endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options& options)
+{
+  options.maxSize    = 64 * 1024 * 1024;
+  options.maxThreads = max(1u, thread::hardware_concurrency());
+  options.csv        = false;
+  options.allModes   = false;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if ((strcmp(argv[i], "--max-size") == 0) && (i + 1 < argc)) {
+      options.maxSize = ParseSize(argv[++i]);
+    } else if ((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc)) {
+      options.maxThreads = max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--all-modes") == 0) {
+      options.allModes = true;
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      options.csv = true;
+    } else {
+      return false;
+    }
+  }
+
+  options.maxSize = min<uint64_t>(max<uint64_t>(options.maxSize, 1024),
+                                  1024 * 1024 * 1024);
+  return true;
+}
+
+// every size is processed at least this often, so small sizes run long enough
+// to be measured
+uint32_t Repeats(uint64_t size, uint64_t target)
+{
+  return static_cast<uint32_t>(max<uint64_t>(1, target / size));
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+  Options options;
+
+  if (!ParseOptions(argc, argv, options)) {
+    PrintUsage();
+    return 1;
+  }
+
+  // 1 KB, 16 KB, ... up to 1 GB
+  vector<uint64_t> sizes;
+
+  for (uint64_t size = 1024; size <= options.maxSize; size *= 16) {
+    sizes.push_back(size);
+  }
+
+  // 1, 2, 4, ... and the maximum
+  vector<uint32_t> threadCounts;
+
+  for (uint32_t threads = 1; threads < options.maxThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(options.maxThreads);
+
+  const CipherMode modes[] = { CIPHER_MODE_CBC4K, CIPHER_MODE_CBC512NOPADDING,
+                               CIPHER_MODE_ECB, CIPHER_MODE_CTR };
+  const StreamBackend backends[] = { STREAM_BACKEND_MEMORY,
+                                     STREAM_BACKEND_STDSTREAM,
+                                     STREAM_BACKEND_FILE };
+  const AccessPattern patterns[] = { ACCESS_PATTERN_SEQUENTIAL,
+                                     ACCESS_PATTERN_RANDOM };
+
+  // small sizes can't be split between all threads, skip the repeated runs
+  auto print = [&options](const BenchmarkResult& result, uint32_t threads) {
+                 if (result.threads < threads) {
+                   return;
+                 }
+
+                 if (options.csv) {
+                   PrintCsv(cout, result);
+                 } else {
+                   PrintResult(cout, result);
+                 }
+               };
+
+  // the results depend on it, so on stderr to keep the CSV clean
+  cerr << "AES kernel: " << rmscrypto::crypto::NativeAesCbc128::KernelName()
+       << endl;
+
+  if (options.csv) {
+    PrintCsvHeader(cout);
+  }
+
+  for (auto mode : modes) {
+    for (auto size : sizes) {
+      for (auto threads : threadCounts) {
+        uint32_t cbBuffer   = static_cast<uint32_t>(size);
+        uint32_t iterations = Repeats(size, 64 * 1024 * 1024);
+
+        print(BenchmarkProviderEncrypt(mode, cbBuffer, iterations, threads),
+              threads);
+        print(BenchmarkProviderDecrypt(mode, cbBuffer, iterations, threads),
+              threads);
+      }
+    }
+  }
+
+  for (auto mode : modes) {
+    if (!options.allModes && (mode != CIPHER_MODE_CBC4K)) {
+      continue;
+    }
+
+    for (auto backend : backends) {
+      for (auto pattern : patterns) {
+        for (auto size : sizes) {
+          for (auto threads : threadCounts) {
+            uint32_t passes = Repeats(size, 16 * 1024 * 1024);
+
+            print(BenchmarkStreamWrite(mode, backend, pattern, size, passes,
+                                       threads), threads);
+            print(BenchmarkStreamRead(mode, backend, pattern, size, passes,
+                                      threads), threads);
+          }
+        }
+      }
+    }
+  }
+
+  return 0;
+}
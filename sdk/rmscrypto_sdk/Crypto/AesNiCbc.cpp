@@ -0,0 +1,528 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <cstring>
+#include "AesNiCbc.h"
+#include "CpuFeatures.h"
+#include "CryptoConstants.h"
+#include "../CryptoAPI/RMSCryptoExceptions.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+  defined(_M_IX86)
+# define RMS_CRYPTO_AESNI_SUPPORTED
+# include <immintrin.h>
+#endif
+
+#if defined(RMS_CRYPTO_AESNI_SUPPORTED) && \
+  (defined(__GNUC__) || defined(__clang__))
+# define RMS_CRYPTO_TARGET_AESNI __attribute__((target("aes,sse2")))
+# define RMS_CRYPTO_TARGET_VAES  __attribute__((target("aes,vaes,avx2")))
+#else
+# define RMS_CRYPTO_TARGET_AESNI
+# define RMS_CRYPTO_TARGET_VAES
+#endif
+
+namespace rmscrypto {
+namespace crypto {
+#ifdef RMS_CRYPTO_AESNI_SUPPORTED
+
+// blocks in flight of the AES-NI code, enough to cover the AESENC latency
+static const uint32_t AESNI_INTERLEAVE = 8;
+
+RMS_CRYPTO_TARGET_AESNI
+static inline __m128i ExpandRoundKey(__m128i key, __m128i keygened)
+{
+  keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3, 3, 3, 3));
+  key      = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key      = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key      = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, keygened);
+}
+
+# define RMS_AES_EXPAND_ROUND(k, rcon) \
+  ExpandRoundKey(k, _mm_aeskeygenassist_si128(k, rcon))
+
+RMS_CRYPTO_TARGET_AESNI
+static void ExpandKey128(const uint8_t *pbKey,
+                         uint8_t       *pbRoundKeys,
+                         uint8_t       *pbDecryptRoundKeys)
+{
+  __m128i rk[11];
+
+  rk[0]  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pbKey));
+  rk[1]  = RMS_AES_EXPAND_ROUND(rk[0], 0x01);
+  rk[2]  = RMS_AES_EXPAND_ROUND(rk[1], 0x02);
+  rk[3]  = RMS_AES_EXPAND_ROUND(rk[2], 0x04);
+  rk[4]  = RMS_AES_EXPAND_ROUND(rk[3], 0x08);
+  rk[5]  = RMS_AES_EXPAND_ROUND(rk[4], 0x10);
+  rk[6]  = RMS_AES_EXPAND_ROUND(rk[5], 0x20);
+  rk[7]  = RMS_AES_EXPAND_ROUND(rk[6], 0x40);
+  rk[8]  = RMS_AES_EXPAND_ROUND(rk[7], 0x80);
+  rk[9]  = RMS_AES_EXPAND_ROUND(rk[8], 0x1b);
+  rk[10] = RMS_AES_EXPAND_ROUND(rk[9], 0x36);
+
+  for (int i = 0; i < 11; ++i) {
+    __m128i dk = ((i == 0) || (i == 10)) ? rk[10 - i]
+                 : _mm_aesimc_si128(rk[10 - i]);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pbRoundKeys + i * 16), rk[i]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pbDecryptRoundKeys + i * 16),
+                     dk);
+  }
+}
+
+# undef RMS_AES_EXPAND_ROUND
+
+RMS_CRYPTO_TARGET_AESNI
+static inline void LoadRoundKeys(const uint8_t *pbRoundKeys, __m128i *rk)
+{
+  for (int i = 0; i < 11; ++i) {
+    rk[i] = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(pbRoundKeys + i * 16));
+  }
+}
+
+template<uint32_t LANES>
+RMS_CRYPTO_TARGET_AESNI
+static void EncryptLanesAesNi(const uint8_t        *pbRoundKeys,
+                              const uint8_t *const *ppbIn,
+                              uint8_t *const       *ppbOut,
+                              const uint8_t *const *ppbIv,
+                              uint32_t              cBlocks)
+{
+  __m128i rk[11];
+
+  LoadRoundKeys(pbRoundKeys, rk);
+
+  // the chaining value of every lane, starts with the lane's IV
+  __m128i state[LANES];
+
+  RMS_CRYPTO_UNROLL
+  for (uint32_t lane = 0; lane < LANES; ++lane) {
+    state[lane] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ppbIv[lane]));
+  }
+
+  for (uint32_t offset = 0; offset < cBlocks * AES128_BLOCK_SIZE;
+       offset += AES128_BLOCK_SIZE) {
+    // Each round is applied to all lanes before the next round starts, so
+    // the independent AESENC instructions overlap in the pipeline.
+    RMS_CRYPTO_UNROLL
+    for (uint32_t lane = 0; lane < LANES; ++lane) {
+      __m128i block = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(ppbIn[lane] + offset));
+      state[lane] = _mm_xor_si128(_mm_xor_si128(block, state[lane]), rk[0]);
+    }
+
+    for (int round = 1; round < 10; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t lane = 0; lane < LANES; ++lane) {
+        state[lane] = _mm_aesenc_si128(state[lane], rk[round]);
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t lane = 0; lane < LANES; ++lane) {
+      state[lane] = _mm_aesenclast_si128(state[lane], rk[10]);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(ppbOut[lane] + offset),
+                       state[lane]);
+    }
+  }
+}
+
+// up to AESNI_INTERLEAVE lanes, the lane count is a constant of the kernel
+// so the lanes stay in registers
+RMS_CRYPTO_TARGET_AESNI
+static void EncryptLaneGroupAesNi(const uint8_t        *pbRoundKeys,
+                                  const uint8_t *const *ppbIn,
+                                  uint8_t *const       *ppbOut,
+                                  const uint8_t *const *ppbIv,
+                                  uint32_t              cLanes,
+                                  uint32_t              cBlocks)
+{
+  switch (cLanes) {
+  case 1:
+    EncryptLanesAesNi<1>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 2:
+    EncryptLanesAesNi<2>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 3:
+    EncryptLanesAesNi<3>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 4:
+    EncryptLanesAesNi<4>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 5:
+    EncryptLanesAesNi<5>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 6:
+    EncryptLanesAesNi<6>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 7:
+    EncryptLanesAesNi<7>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  default:
+    EncryptLanesAesNi<8>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+  }
+}
+
+RMS_CRYPTO_TARGET_AESNI
+static void DecryptChainAesNi(const uint8_t *pbDecryptRoundKeys,
+                              const uint8_t *pbIn,
+                              uint8_t       *pbOut,
+                              uint32_t       cBlocks,
+                              const uint8_t *pbIv)
+{
+  __m128i dk[11];
+
+  LoadRoundKeys(pbDecryptRoundKeys, dk);
+
+  const __m128i *in  = reinterpret_cast<const __m128i *>(pbIn);
+  __m128i       *out = reinterpret_cast<__m128i *>(pbOut);
+  __m128i previous   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pbIv));
+  uint32_t i         = 0;
+
+  // unlike encryption, the blocks of a chain can be decrypted all at once;
+  // all input is loaded before any output is stored, pbOut may be pbIn
+  for (; i + AESNI_INTERLEAVE <= cBlocks; i += AESNI_INTERLEAVE) {
+    __m128i cipher[AESNI_INTERLEAVE], state[AESNI_INTERLEAVE];
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < AESNI_INTERLEAVE; ++k) {
+      cipher[k] = _mm_loadu_si128(in + i + k);
+      state[k]  = _mm_xor_si128(cipher[k], dk[0]);
+    }
+
+    for (int round = 1; round < 10; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t k = 0; k < AESNI_INTERLEAVE; ++k) {
+        state[k] = _mm_aesdec_si128(state[k], dk[round]);
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < AESNI_INTERLEAVE; ++k) {
+      state[k] = _mm_aesdeclast_si128(state[k], dk[10]);
+      _mm_storeu_si128(out + i + k, _mm_xor_si128(state[k], previous));
+      previous = cipher[k];
+    }
+  }
+
+  for (; i < cBlocks; ++i) {
+    __m128i cipher = _mm_loadu_si128(in + i);
+    __m128i state  = _mm_xor_si128(cipher, dk[0]);
+
+    for (int round = 1; round < 10; ++round) {
+      state = _mm_aesdec_si128(state, dk[round]);
+    }
+    state = _mm_aesdeclast_si128(state, dk[10]);
+    _mm_storeu_si128(out + i, _mm_xor_si128(state, previous));
+    previous = cipher;
+  }
+}
+
+RMS_CRYPTO_TARGET_AESNI
+static void EncryptBlocksAesNi(const uint8_t *pbRoundKeys,
+                               const uint8_t *pbIn,
+                               uint8_t       *pbOut,
+                               uint32_t       cBlocks)
+{
+  __m128i rk[11];
+
+  LoadRoundKeys(pbRoundKeys, rk);
+
+  const __m128i *in  = reinterpret_cast<const __m128i *>(pbIn);
+  __m128i       *out = reinterpret_cast<__m128i *>(pbOut);
+  uint32_t i         = 0;
+
+  for (; i + AESNI_INTERLEAVE <= cBlocks; i += AESNI_INTERLEAVE) {
+    __m128i state[AESNI_INTERLEAVE];
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < AESNI_INTERLEAVE; ++k) {
+      state[k] = _mm_xor_si128(_mm_loadu_si128(in + i + k), rk[0]);
+    }
+
+    for (int round = 1; round < 10; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t k = 0; k < AESNI_INTERLEAVE; ++k) {
+        state[k] = _mm_aesenc_si128(state[k], rk[round]);
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < AESNI_INTERLEAVE; ++k) {
+      _mm_storeu_si128(out + i + k, _mm_aesenclast_si128(state[k], rk[10]));
+    }
+  }
+
+  for (; i < cBlocks; ++i) {
+    __m128i state = _mm_xor_si128(_mm_loadu_si128(in + i), rk[0]);
+
+    for (int round = 1; round < 10; ++round) {
+      state = _mm_aesenc_si128(state, rk[round]);
+    }
+    _mm_storeu_si128(out + i, _mm_aesenclast_si128(state, rk[10]));
+  }
+}
+
+// VAES, the same rounds on two blocks per register
+
+// blocks in flight of the VAES code
+static const uint32_t VAES_INTERLEAVE = 16;
+
+RMS_CRYPTO_TARGET_VAES
+static inline void LoadRoundKeys256(const uint8_t *pbRoundKeys, __m256i *rk)
+{
+  for (int i = 0; i < 11; ++i) {
+    rk[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+                                          reinterpret_cast<const __m128i *>(
+                                            pbRoundKeys + i * 16)));
+  }
+}
+
+// two 128 bit values in one register, lo in the lower half
+RMS_CRYPTO_TARGET_VAES
+static inline __m256i Combine(__m128i lo, __m128i hi)
+{
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+// Decrypts the whole VAES_INTERLEAVE groups of the chain, returns the number
+// of blocks done and in pbNextIv the last cipher block, which the rest of
+// the chain starts with
+RMS_CRYPTO_TARGET_VAES
+static uint32_t DecryptChainVaes(const uint8_t *pbDecryptRoundKeys,
+                                 const uint8_t *pbIn,
+                                 uint8_t       *pbOut,
+                                 uint32_t       cBlocks,
+                                 const uint8_t *pbIv,
+                                 uint8_t       *pbNextIv)
+{
+  const uint32_t cRegisters = VAES_INTERLEAVE / 2;
+  __m256i dk[11];
+
+  LoadRoundKeys256(pbDecryptRoundKeys, dk);
+
+  __m128i  previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pbIv));
+  uint32_t i        = 0;
+
+  for (; i + VAES_INTERLEAVE <= cBlocks; i += VAES_INTERLEAVE) {
+    const uint8_t *in = pbIn + i * AES128_BLOCK_SIZE;
+    __m256i cipher[cRegisters], chain[cRegisters], state[cRegisters];
+
+    // register k holds blocks 2k and 2k + 1, XORed after the decryption
+    // with blocks 2k - 1 and 2k; all loads come before the stores as pbOut
+    // may be pbIn
+    chain[0] = Combine(previous,
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(in)));
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < cRegisters; ++k) {
+      cipher[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                                       in + k * 2 * AES128_BLOCK_SIZE));
+
+      if (k > 0) {
+        chain[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                                        in + (k * 2 - 1) * AES128_BLOCK_SIZE));
+      }
+      state[k] = _mm256_xor_si256(cipher[k], dk[0]);
+    }
+    previous = _mm256_extracti128_si256(cipher[cRegisters - 1], 1);
+
+    for (int round = 1; round < 10; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t k = 0; k < cRegisters; ++k) {
+        state[k] = _mm256_aesdec_epi128(state[k], dk[round]);
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < cRegisters; ++k) {
+      state[k] = _mm256_aesdeclast_epi128(state[k], dk[10]);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(
+                            pbOut + (i + k * 2) * AES128_BLOCK_SIZE),
+                          _mm256_xor_si256(state[k], chain[k]));
+    }
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(pbNextIv), previous);
+  return i;
+}
+
+// ECB of the whole VAES_INTERLEAVE groups, returns the number of blocks done
+RMS_CRYPTO_TARGET_VAES
+static uint32_t EncryptBlocksVaes(const uint8_t *pbRoundKeys,
+                                  const uint8_t *pbIn,
+                                  uint8_t       *pbOut,
+                                  uint32_t       cBlocks)
+{
+  const uint32_t cRegisters = VAES_INTERLEAVE / 2;
+  __m256i rk[11];
+
+  LoadRoundKeys256(pbRoundKeys, rk);
+
+  uint32_t i = 0;
+
+  for (; i + VAES_INTERLEAVE <= cBlocks; i += VAES_INTERLEAVE) {
+    __m256i state[cRegisters];
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < cRegisters; ++k) {
+      state[k] = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                             pbIn + (i + k * 2) * AES128_BLOCK_SIZE)), rk[0]);
+    }
+
+    for (int round = 1; round < 10; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t k = 0; k < cRegisters; ++k) {
+        state[k] = _mm256_aesenc_epi128(state[k], rk[round]);
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < cRegisters; ++k) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(
+                            pbOut + (i + k * 2) * AES128_BLOCK_SIZE),
+                          _mm256_aesenclast_epi128(state[k], rk[10]));
+    }
+  }
+  return i;
+}
+
+#endif // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+
+AesNiCbc128::AesNiCbc128(const uint8_t *pbKey)
+{
+  if (pbKey == nullptr) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer pbKey exception");
+  }
+
+  if (!GetCpuFeatures().aesNi) {
+    throw exceptions::RMSCryptoNotImplementedException("AES-NI is not available");
+  }
+
+#ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  ExpandKey128(pbKey, m_roundKeys, m_decryptRoundKeys);
+#endif // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+}
+
+void AesNiCbc128::EncryptLanes(const uint8_t *const *ppbIn,
+                               uint8_t *const       *ppbOut,
+                               const uint8_t *const *ppbIv,
+                               uint32_t              cLanes,
+                               uint32_t              cBlocks) const
+{
+#ifdef RMS_CRYPTO_AESNI_SUPPORTED
+
+  // more lanes than registers in flight would only add register spills
+  for (uint32_t lane = 0; lane < cLanes; lane += AESNI_INTERLEAVE) {
+    uint32_t cGroup = cLanes - lane < AESNI_INTERLEAVE ? cLanes - lane
+                      : AESNI_INTERLEAVE;
+
+    EncryptLaneGroupAesNi(m_roundKeys, ppbIn + lane, ppbOut + lane,
+                          ppbIv + lane, cGroup, cBlocks);
+  }
+#else // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  (void)ppbIn;
+  (void)ppbOut;
+  (void)ppbIv;
+  (void)cLanes;
+  (void)cBlocks;
+#endif // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+}
+
+void AesNiCbc128::DecryptChain(const uint8_t *pbIn,
+                               uint8_t       *pbOut,
+                               uint32_t       cBlocks,
+                               const uint8_t *pbIv) const
+{
+#ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  DecryptChainAesNi(m_decryptRoundKeys, pbIn, pbOut, cBlocks, pbIv);
+#else // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  (void)pbIn;
+  (void)pbOut;
+  (void)cBlocks;
+  (void)pbIv;
+#endif // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+}
+
+void AesNiCbc128::EncryptBlocks(const uint8_t *pbIn,
+                                uint8_t       *pbOut,
+                                uint32_t       cBlocks) const
+{
+#ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  EncryptBlocksAesNi(m_roundKeys, pbIn, pbOut, cBlocks);
+#else // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  (void)pbIn;
+  (void)pbOut;
+  (void)cBlocks;
+#endif // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+}
+
+VaesCbc128::VaesCbc128(const uint8_t *pbKey)
+  : AesNiCbc128(pbKey)
+{
+  if (!GetCpuFeatures().vaes) {
+    throw exceptions::RMSCryptoNotImplementedException("VAES is not available");
+  }
+}
+
+void VaesCbc128::DecryptChain(const uint8_t *pbIn,
+                              uint8_t       *pbOut,
+                              uint32_t       cBlocks,
+                              const uint8_t *pbIv) const
+{
+#ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  // pbOut may be pbIn, so the cipher block the tail chains on comes from the
+  // kernel rather than from pbIn
+  uint8_t  previous[AES128_BLOCK_SIZE];
+  uint32_t cDone = DecryptChainVaes(m_decryptRoundKeys, pbIn, pbOut, cBlocks,
+                                    pbIv, previous);
+
+  if (cDone < cBlocks) {
+    DecryptChainAesNi(m_decryptRoundKeys, pbIn + cDone * AES128_BLOCK_SIZE,
+                      pbOut + cDone * AES128_BLOCK_SIZE, cBlocks - cDone,
+                      previous);
+  }
+#else // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  (void)pbIn;
+  (void)pbOut;
+  (void)cBlocks;
+  (void)pbIv;
+#endif // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+}
+
+void VaesCbc128::EncryptBlocks(const uint8_t *pbIn,
+                               uint8_t       *pbOut,
+                               uint32_t       cBlocks) const
+{
+#ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  uint32_t cDone = EncryptBlocksVaes(m_roundKeys, pbIn, pbOut, cBlocks);
+
+  if (cDone < cBlocks) {
+    EncryptBlocksAesNi(m_roundKeys, pbIn + cDone * AES128_BLOCK_SIZE,
+                       pbOut + cDone * AES128_BLOCK_SIZE, cBlocks - cDone);
+  }
+#else // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+  (void)pbIn;
+  (void)pbOut;
+  (void)cBlocks;
+#endif // ifdef RMS_CRYPTO_AESNI_SUPPORTED
+}
+} // namespace crypto
+} // namespace rmscrypto
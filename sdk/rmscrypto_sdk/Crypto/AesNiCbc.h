@@ -0,0 +1,61 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _CRYPTO_STREAMS_LIB_AESNICBC_H_
+#define _CRYPTO_STREAMS_LIB_AESNICBC_H_
+
+#include <stdint.h>
+#include "NativeAesCbc.h"
+
+namespace rmscrypto {
+namespace crypto {
+// x86 AES-NI kernel, 8 blocks in flight on 128 bit registers
+class AesNiCbc128 : public NativeAesCbc128 {
+public:
+
+  // pbKey must point to AES128_KEY_BYTE_LENGTH bytes
+  explicit AesNiCbc128(const uint8_t *pbKey);
+
+protected:
+
+  virtual void EncryptLanes(const uint8_t *const *ppbIn,
+                            uint8_t *const       *ppbOut,
+                            const uint8_t *const *ppbIv,
+                            uint32_t              cLanes,
+                            uint32_t              cBlocks) const override;
+  virtual void DecryptChain(const uint8_t *pbIn,
+                            uint8_t       *pbOut,
+                            uint32_t       cBlocks,
+                            const uint8_t *pbIv) const override;
+  virtual void EncryptBlocks(const uint8_t *pbIn,
+                             uint8_t       *pbOut,
+                             uint32_t       cBlocks) const override;
+};
+
+// x86 VAES kernel for the parallel paths, two blocks per 256 bit register
+// and 16 blocks in flight. Tails of less than 16 blocks and the multi-buffer
+// encryption, which gains nothing from the wider registers, use the AES-NI
+// code.
+class VaesCbc128 : public AesNiCbc128 {
+public:
+
+  explicit VaesCbc128(const uint8_t *pbKey);
+
+protected:
+
+  virtual void DecryptChain(const uint8_t *pbIn,
+                            uint8_t       *pbOut,
+                            uint32_t       cBlocks,
+                            const uint8_t *pbIv) const override;
+  virtual void EncryptBlocks(const uint8_t *pbIn,
+                             uint8_t       *pbOut,
+                             uint32_t       cBlocks) const override;
+};
+} // namespace crypto
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_AESNICBC_H_
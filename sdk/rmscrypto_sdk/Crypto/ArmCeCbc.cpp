@@ -0,0 +1,356 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <cstring>
+#include "ArmCeCbc.h"
+#include "CpuFeatures.h"
+#include "CryptoConstants.h"
+#include "../CryptoAPI/RMSCryptoExceptions.h"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+# define RMS_CRYPTO_ARMCE_SUPPORTED
+# include <arm_neon.h>
+#endif
+
+// the intrinsics need the crypto extension enabled for the functions using
+// them, unless it's part of the compiler's baseline (Apple, MSVC)
+#if !defined(RMS_CRYPTO_ARMCE_SUPPORTED) || defined(__ARM_FEATURE_CRYPTO) || \
+  defined(__ARM_FEATURE_AES) || defined(_MSC_VER)
+# define RMS_CRYPTO_TARGET_ARMCE
+#elif defined(__clang__)
+# define RMS_CRYPTO_TARGET_ARMCE __attribute__((target("aes")))
+#else
+# define RMS_CRYPTO_TARGET_ARMCE __attribute__((target("+crypto")))
+#endif
+
+namespace rmscrypto {
+namespace crypto {
+#ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+
+// blocks in flight, enough to cover the AESE/AESMC latency
+static const uint32_t ARMCE_INTERLEAVE = 8;
+
+// S-box applied to each byte of w: AESE with a zero round key on four copies
+// of w, ShiftRows doesn't move anything then
+RMS_CRYPTO_TARGET_ARMCE
+static inline uint32_t SubWord(uint32_t w)
+{
+  uint8x16_t s = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(w)),
+                           vdupq_n_u8(0));
+
+  return vgetq_lane_u32(vreinterpretq_u32_u8(s), 0);
+}
+
+RMS_CRYPTO_TARGET_ARMCE
+static void ExpandKey128(const uint8_t *pbKey,
+                         uint8_t       *pbRoundKeys,
+                         uint8_t       *pbDecryptRoundKeys)
+{
+  static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40,
+                                    0x80, 0x1b, 0x36 };
+  uint32_t w[44];
+
+  // FIPS-197 key expansion on little endian words
+  memcpy(w, pbKey, AES128_KEY_BYTE_LENGTH);
+
+  for (int i = 4; i < 44; ++i) {
+    uint32_t temp = w[i - 1];
+
+    if (i % 4 == 0) {
+      temp = SubWord((temp >> 8) | (temp << 24)) ^ rcon[i / 4 - 1];
+    }
+    w[i] = w[i - 4] ^ temp;
+  }
+  memcpy(pbRoundKeys, w, sizeof(w));
+
+  for (int i = 0; i < 11; ++i) {
+    uint8x16_t rk = vld1q_u8(pbRoundKeys + (10 - i) * 16);
+
+    vst1q_u8(pbDecryptRoundKeys + i * 16,
+             ((i == 0) || (i == 10)) ? rk : vaesimcq_u8(rk));
+  }
+
+  memset(w, 0, sizeof(w));
+}
+
+RMS_CRYPTO_TARGET_ARMCE
+static inline void LoadRoundKeys(const uint8_t *pbRoundKeys, uint8x16_t *rk)
+{
+  for (int i = 0; i < 11; ++i) {
+    rk[i] = vld1q_u8(pbRoundKeys + i * 16);
+  }
+}
+
+// AESE includes the AddRoundKey of the round before, AESMC is MixColumns
+template<uint32_t LANES>
+RMS_CRYPTO_TARGET_ARMCE
+static void EncryptLanesArmCe(const uint8_t        *pbRoundKeys,
+                              const uint8_t *const *ppbIn,
+                              uint8_t *const       *ppbOut,
+                              const uint8_t *const *ppbIv,
+                              uint32_t              cBlocks)
+{
+  uint8x16_t rk[11];
+
+  LoadRoundKeys(pbRoundKeys, rk);
+
+  // the chaining value of every lane, starts with the lane's IV
+  uint8x16_t state[LANES];
+
+  RMS_CRYPTO_UNROLL
+  for (uint32_t lane = 0; lane < LANES; ++lane) {
+    state[lane] = vld1q_u8(ppbIv[lane]);
+  }
+
+  for (uint32_t offset = 0; offset < cBlocks * AES128_BLOCK_SIZE;
+       offset += AES128_BLOCK_SIZE) {
+    RMS_CRYPTO_UNROLL
+    for (uint32_t lane = 0; lane < LANES; ++lane) {
+      state[lane] = veorq_u8(vld1q_u8(ppbIn[lane] + offset), state[lane]);
+    }
+
+    for (int round = 0; round < 9; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t lane = 0; lane < LANES; ++lane) {
+        state[lane] = vaesmcq_u8(vaeseq_u8(state[lane], rk[round]));
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t lane = 0; lane < LANES; ++lane) {
+      state[lane] = veorq_u8(vaeseq_u8(state[lane], rk[9]), rk[10]);
+      vst1q_u8(ppbOut[lane] + offset, state[lane]);
+    }
+  }
+}
+
+// up to ARMCE_INTERLEAVE lanes, the lane count is a constant of the kernel
+// so the lanes stay in registers
+RMS_CRYPTO_TARGET_ARMCE
+static void EncryptLaneGroupArmCe(const uint8_t        *pbRoundKeys,
+                                  const uint8_t *const *ppbIn,
+                                  uint8_t *const       *ppbOut,
+                                  const uint8_t *const *ppbIv,
+                                  uint32_t              cLanes,
+                                  uint32_t              cBlocks)
+{
+  switch (cLanes) {
+  case 1:
+    EncryptLanesArmCe<1>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 2:
+    EncryptLanesArmCe<2>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 3:
+    EncryptLanesArmCe<3>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 4:
+    EncryptLanesArmCe<4>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 5:
+    EncryptLanesArmCe<5>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 6:
+    EncryptLanesArmCe<6>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  case 7:
+    EncryptLanesArmCe<7>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+
+  default:
+    EncryptLanesArmCe<8>(pbRoundKeys, ppbIn, ppbOut, ppbIv, cBlocks);
+    break;
+  }
+}
+
+RMS_CRYPTO_TARGET_ARMCE
+static inline uint8x16_t EncryptBlock(uint8x16_t        state,
+                                      const uint8x16_t *rk)
+{
+  for (int round = 0; round < 9; ++round) {
+    state = vaesmcq_u8(vaeseq_u8(state, rk[round]));
+  }
+  return veorq_u8(vaeseq_u8(state, rk[9]), rk[10]);
+}
+
+RMS_CRYPTO_TARGET_ARMCE
+static inline uint8x16_t DecryptBlock(uint8x16_t        state,
+                                      const uint8x16_t *dk)
+{
+  for (int round = 0; round < 9; ++round) {
+    state = vaesimcq_u8(vaesdq_u8(state, dk[round]));
+  }
+  return veorq_u8(vaesdq_u8(state, dk[9]), dk[10]);
+}
+
+RMS_CRYPTO_TARGET_ARMCE
+static void DecryptChainArmCe(const uint8_t *pbDecryptRoundKeys,
+                              const uint8_t *pbIn,
+                              uint8_t       *pbOut,
+                              uint32_t       cBlocks,
+                              const uint8_t *pbIv)
+{
+  uint8x16_t dk[11];
+
+  LoadRoundKeys(pbDecryptRoundKeys, dk);
+
+  uint8x16_t previous = vld1q_u8(pbIv);
+  uint32_t   i        = 0;
+
+  // all input of a group is loaded before its output is stored, pbOut may be
+  // pbIn
+  for (; i + ARMCE_INTERLEAVE <= cBlocks; i += ARMCE_INTERLEAVE) {
+    uint8x16_t cipher[ARMCE_INTERLEAVE], state[ARMCE_INTERLEAVE];
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < ARMCE_INTERLEAVE; ++k) {
+      cipher[k] = vld1q_u8(pbIn + (i + k) * AES128_BLOCK_SIZE);
+      state[k]  = cipher[k];
+    }
+
+    for (int round = 0; round < 9; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t k = 0; k < ARMCE_INTERLEAVE; ++k) {
+        state[k] = vaesimcq_u8(vaesdq_u8(state[k], dk[round]));
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < ARMCE_INTERLEAVE; ++k) {
+      state[k] = veorq_u8(vaesdq_u8(state[k], dk[9]), dk[10]);
+      vst1q_u8(pbOut + (i + k) * AES128_BLOCK_SIZE,
+               veorq_u8(state[k], previous));
+      previous = cipher[k];
+    }
+  }
+
+  for (; i < cBlocks; ++i) {
+    uint8x16_t cipher = vld1q_u8(pbIn + i * AES128_BLOCK_SIZE);
+
+    vst1q_u8(pbOut + i * AES128_BLOCK_SIZE,
+             veorq_u8(DecryptBlock(cipher, dk), previous));
+    previous = cipher;
+  }
+}
+
+RMS_CRYPTO_TARGET_ARMCE
+static void EncryptBlocksArmCe(const uint8_t *pbRoundKeys,
+                               const uint8_t *pbIn,
+                               uint8_t       *pbOut,
+                               uint32_t       cBlocks)
+{
+  uint8x16_t rk[11];
+
+  LoadRoundKeys(pbRoundKeys, rk);
+
+  uint32_t i = 0;
+
+  for (; i + ARMCE_INTERLEAVE <= cBlocks; i += ARMCE_INTERLEAVE) {
+    uint8x16_t state[ARMCE_INTERLEAVE];
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < ARMCE_INTERLEAVE; ++k) {
+      state[k] = vld1q_u8(pbIn + (i + k) * AES128_BLOCK_SIZE);
+    }
+
+    for (int round = 0; round < 9; ++round) {
+      RMS_CRYPTO_UNROLL
+      for (uint32_t k = 0; k < ARMCE_INTERLEAVE; ++k) {
+        state[k] = vaesmcq_u8(vaeseq_u8(state[k], rk[round]));
+      }
+    }
+
+    RMS_CRYPTO_UNROLL
+    for (uint32_t k = 0; k < ARMCE_INTERLEAVE; ++k) {
+      vst1q_u8(pbOut + (i + k) * AES128_BLOCK_SIZE,
+               veorq_u8(vaeseq_u8(state[k], rk[9]), rk[10]));
+    }
+  }
+
+  for (; i < cBlocks; ++i) {
+    vst1q_u8(pbOut + i * AES128_BLOCK_SIZE,
+             EncryptBlock(vld1q_u8(pbIn + i * AES128_BLOCK_SIZE), rk));
+  }
+}
+
+#endif // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+
+ArmCeCbc128::ArmCeCbc128(const uint8_t *pbKey)
+{
+  if (pbKey == nullptr) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer pbKey exception");
+  }
+
+  if (!GetCpuFeatures().armAes) {
+    throw exceptions::RMSCryptoNotImplementedException(
+            "ARMv8 crypto extension is not available");
+  }
+
+#ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+  ExpandKey128(pbKey, m_roundKeys, m_decryptRoundKeys);
+#endif // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+}
+
+void ArmCeCbc128::EncryptLanes(const uint8_t *const *ppbIn,
+                               uint8_t *const       *ppbOut,
+                               const uint8_t *const *ppbIv,
+                               uint32_t              cLanes,
+                               uint32_t              cBlocks) const
+{
+#ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+  for (uint32_t lane = 0; lane < cLanes; lane += ARMCE_INTERLEAVE) {
+    uint32_t cGroup = cLanes - lane < ARMCE_INTERLEAVE ? cLanes - lane
+                      : ARMCE_INTERLEAVE;
+
+    EncryptLaneGroupArmCe(m_roundKeys, ppbIn + lane, ppbOut + lane,
+                          ppbIv + lane, cGroup, cBlocks);
+  }
+#else // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+  (void)ppbIn;
+  (void)ppbOut;
+  (void)ppbIv;
+  (void)cLanes;
+  (void)cBlocks;
+#endif // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+}
+
+void ArmCeCbc128::DecryptChain(const uint8_t *pbIn,
+                               uint8_t       *pbOut,
+                               uint32_t       cBlocks,
+                               const uint8_t *pbIv) const
+{
+#ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+  DecryptChainArmCe(m_decryptRoundKeys, pbIn, pbOut, cBlocks, pbIv);
+#else // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+  (void)pbIn;
+  (void)pbOut;
+  (void)cBlocks;
+  (void)pbIv;
+#endif // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+}
+
+void ArmCeCbc128::EncryptBlocks(const uint8_t *pbIn,
+                                uint8_t       *pbOut,
+                                uint32_t       cBlocks) const
+{
+#ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+  EncryptBlocksArmCe(m_roundKeys, pbIn, pbOut, cBlocks);
+#else // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+  (void)pbIn;
+  (void)pbOut;
+  (void)cBlocks;
+#endif // ifdef RMS_CRYPTO_ARMCE_SUPPORTED
+}
+} // namespace crypto
+} // namespace rmscrypto
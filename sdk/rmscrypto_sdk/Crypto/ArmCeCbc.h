@@ -0,0 +1,41 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _CRYPTO_STREAMS_LIB_ARMCECBC_H_
+#define _CRYPTO_STREAMS_LIB_ARMCECBC_H_
+
+#include <stdint.h>
+#include "NativeAesCbc.h"
+
+namespace rmscrypto {
+namespace crypto {
+// ARMv8 crypto extension kernel, 8 blocks in flight
+class ArmCeCbc128 : public NativeAesCbc128 {
+public:
+
+  // pbKey must point to AES128_KEY_BYTE_LENGTH bytes
+  explicit ArmCeCbc128(const uint8_t *pbKey);
+
+protected:
+
+  virtual void EncryptLanes(const uint8_t *const *ppbIn,
+                            uint8_t *const       *ppbOut,
+                            const uint8_t *const *ppbIv,
+                            uint32_t              cLanes,
+                            uint32_t              cBlocks) const override;
+  virtual void DecryptChain(const uint8_t *pbIn,
+                            uint8_t       *pbOut,
+                            uint32_t       cBlocks,
+                            const uint8_t *pbIv) const override;
+  virtual void EncryptBlocks(const uint8_t *pbIn,
+                             uint8_t       *pbOut,
+                             uint32_t       cBlocks) const override;
+};
+} // namespace crypto
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_ARMCECBC_H_
@@ -6,7 +6,9 @@
  * ======================================================================
 */
 
+#include <algorithm>
 #include <cstring>
+#include <mutex>
 #include "Cbc4kCryptoProvider.h"
 #include "CryptoConstants.h"
 #include "../CryptoAPI/CryptoAPI.h"
@@ -17,6 +19,11 @@ using namespace rmscrypto::api;
 
 namespace rmscrypto {
 namespace crypto {
+// Number of IVs derived on the stack per ECB call
+static const uint32_t IV_BATCH_BLOCKS = 64;
+
+const uint32_t Cbc4kCryptoProvider::IV_CACHE_SIZE;
+
 Cbc4kCryptoProvider::Cbc4kCryptoProvider(const vector<uint8_t>& key)
 {
   if (key.size() < AES128_KEY_BYTE_LENGTH)
@@ -25,6 +32,8 @@ Cbc4kCryptoProvider::Cbc4kCryptoProvider(const vector<uint8_t>& key)
   }
 
   m_key = key;
+  memset(m_ivCache, 0, sizeof(m_ivCache));
+
   shared_ptr<ICryptoEngine> pCryptoEngine = api::ICryptoEngine::Create();
 
   m_pEcbKey = pCryptoEngine->CreateKey(key.data(),
@@ -36,18 +45,23 @@ Cbc4kCryptoProvider::Cbc4kCryptoProvider(const vector<uint8_t>& key)
   m_pCbcPaddingKey = pCryptoEngine->CreateKey(key.data(),
                                               static_cast<uint32_t>(key.size()),
                                               CRYPTO_ALGORITHM_AES_CBC_PKCS7);
+
+  // The EVP keys above stay as the fallback for CPUs and key sizes without a
+  // native kernel.
+  m_pNativeKey = NativeAesCbc128::Create(key.data(),
+                                         static_cast<uint32_t>(key.size()));
 }
 
 void Cbc4kCryptoProvider::Encrypt(const uint8_t *pbIn,
                                   uint32_t       cbInUnsafe,
-                                  uint32_t       dwStartingBlockNumberUnsafe,
+                                  uint64_t       u64StartingBlockNumberUnsafe,
                                   bool           isFinal,
                                   uint8_t       *pbOut,
                                   uint32_t       cbOutUnsafe,
                                   uint32_t      *pcbOut)
 {
-  auto cbIn                  = cbInUnsafe, cbOut = cbOutUnsafe,
-       dwStartingBlockNumber = dwStartingBlockNumberUnsafe;
+  auto cbIn                   = cbInUnsafe, cbOut = cbOutUnsafe;
+  auto u64StartingBlockNumber = u64StartingBlockNumberUnsafe;
 
   if (pbIn == nullptr) {
     throw exceptions::RMSCryptoNullPointerException("Null pointer pbIn exception");
@@ -76,6 +90,7 @@ void Cbc4kCryptoProvider::Encrypt(const uint8_t *pbIn,
   }
 
   auto cbResult = 0;
+  uint8_t ivs[IV_BATCH_BLOCKS * AES128_BLOCK_SIZE];
 
   while (cbIn >= CBC4K_BLOCK_SIZE)
   {
@@ -83,25 +98,46 @@ void Cbc4kCryptoProvider::Encrypt(const uint8_t *pbIn,
       throw exceptions::RMSCryptoInvalidArgumentException("Invalid buffer size");
     }
 
-    // Encrypt the current block
-    EncryptBlock(pbIn,
-                 CBC4K_BLOCK_SIZE,
-                 dwStartingBlockNumber,
-                 false,
-                 pbOut,
-                 cbOut);
-
-    // Go to the next block
-
-    pbIn += CBC4K_BLOCK_SIZE;
-    cbIn -= CBC4K_BLOCK_SIZE;
-
-    pbOut += CBC4K_BLOCK_SIZE;
-    cbOut -= CBC4K_BLOCK_SIZE;
-
-    ++dwStartingBlockNumber;
-
-    cbResult += CBC4K_BLOCK_SIZE;
+    // Derive the IVs of the whole run at once
+    uint32_t cBlocks = min(min(cbIn, cbOut) / CBC4K_BLOCK_SIZE, IV_BATCH_BLOCKS);
+    GenerateIvsForBlocks(u64StartingBlockNumber, cBlocks, ivs);
+
+    for (uint32_t i = 0; i < cBlocks;)
+    {
+      uint32_t cLanes = 1;
+
+      if (m_pNativeKey.get() != nullptr)
+      {
+        // Full 4K blocks are independent CBC chains, encrypt a group of them
+        // at once
+        cLanes = min(cBlocks - i, NativeAesCbc128::MAX_LANES);
+        EncryptBlocksMultiBuffer(pbIn, cLanes, &ivs[i * AES128_BLOCK_SIZE],
+                                 pbOut);
+      }
+      else
+      {
+        // Encrypt the current block
+        EncryptBlock(pbIn,
+                     CBC4K_BLOCK_SIZE,
+                     &ivs[i * AES128_BLOCK_SIZE],
+                     false,
+                     pbOut,
+                     cbOut);
+      }
+
+      // Go to the next block
+
+      pbIn += cLanes * CBC4K_BLOCK_SIZE;
+      cbIn -= cLanes * CBC4K_BLOCK_SIZE;
+
+      pbOut += cLanes * CBC4K_BLOCK_SIZE;
+      cbOut -= cLanes * CBC4K_BLOCK_SIZE;
+
+      u64StartingBlockNumber += cLanes;
+
+      cbResult += cLanes * CBC4K_BLOCK_SIZE;
+      i        += cLanes;
+    }
   }
 
   if (!isFinal && (cbIn != 0)) {
@@ -114,8 +150,8 @@ void Cbc4kCryptoProvider::Encrypt(const uint8_t *pbIn,
     // CBC4K_BLOCK_SIZE.
     // In that case we just encrypt an empty buffer as final and get a padding
     // block of AES128_BLOCK_SIZE (16) bytes.
-    cbResult +=
-      EncryptBlock(pbIn, cbIn, dwStartingBlockNumber, true, pbOut, cbOut);
+    GenerateIvsForBlocks(u64StartingBlockNumber, 1, ivs);
+    cbResult += EncryptBlock(pbIn, cbIn, ivs, true, pbOut, cbOut);
   }
 
   *pcbOut = cbResult;
@@ -123,14 +159,14 @@ void Cbc4kCryptoProvider::Encrypt(const uint8_t *pbIn,
 
 void Cbc4kCryptoProvider::Decrypt(const uint8_t *pbIn,
                                   uint32_t       cbInUnsafe,
-                                  uint32_t       dwStartingBlockNumberUnsafe,
+                                  uint64_t       u64StartingBlockNumberUnsafe,
                                   bool           isFinal,
                                   uint8_t       *pbOut,
                                   uint32_t       cbOutUnsafe,
                                   uint32_t      *pcbOut)
 {
-  auto cbIn                  = cbInUnsafe, cbOut = cbOutUnsafe,
-       dwStartingBlockNumber = dwStartingBlockNumberUnsafe;
+  auto cbIn                   = cbInUnsafe, cbOut = cbOutUnsafe;
+  auto u64StartingBlockNumber = u64StartingBlockNumberUnsafe;
 
   if (pbIn == nullptr) {
     throw exceptions::RMSCryptoNullPointerException("Null pointer pbIn exception");
@@ -160,6 +196,7 @@ void Cbc4kCryptoProvider::Decrypt(const uint8_t *pbIn,
   }
 
   auto cbResult = 0;
+  uint8_t ivs[IV_BATCH_BLOCKS * AES128_BLOCK_SIZE];
 
   // If this is the final chunk of the data, don't decrypt the final block in
   // the loop (even if it's 4K). It needs a special
@@ -172,22 +209,30 @@ void Cbc4kCryptoProvider::Decrypt(const uint8_t *pbIn,
       throw exceptions::RMSCryptoInsufficientBufferException("Insufficient buffer");
     }
 
-    DecryptBlock(pbIn,
-                 CBC4K_BLOCK_SIZE,
-                 dwStartingBlockNumber,
-                 false,
-                 pbOut,
-                 cbOut);
+    // Derive the IVs of the whole run at once
+    uint32_t cBlocks = (isFinal ? cbIn - 1 : cbIn) / CBC4K_BLOCK_SIZE;
+    cBlocks = min(min(cBlocks, cbOut / CBC4K_BLOCK_SIZE), IV_BATCH_BLOCKS);
+    GenerateIvsForBlocks(u64StartingBlockNumber, cBlocks, ivs);
+
+    for (uint32_t i = 0; i < cBlocks; ++i)
+    {
+      DecryptBlock(pbIn,
+                   CBC4K_BLOCK_SIZE,
+                   &ivs[i * AES128_BLOCK_SIZE],
+                   false,
+                   pbOut,
+                   cbOut);
 
-    pbIn += CBC4K_BLOCK_SIZE;
-    cbIn -= CBC4K_BLOCK_SIZE;
+      pbIn += CBC4K_BLOCK_SIZE;
+      cbIn -= CBC4K_BLOCK_SIZE;
 
-    pbOut += CBC4K_BLOCK_SIZE;
-    cbOut -= CBC4K_BLOCK_SIZE;
+      pbOut += CBC4K_BLOCK_SIZE;
+      cbOut -= CBC4K_BLOCK_SIZE;
 
-    ++dwStartingBlockNumber;
+      ++u64StartingBlockNumber;
 
-    cbResult += CBC4K_BLOCK_SIZE;
+      cbResult += CBC4K_BLOCK_SIZE;
+    }
   }
 
   if (!isFinal && (cbIn != 0)) {
@@ -201,8 +246,8 @@ void Cbc4kCryptoProvider::Decrypt(const uint8_t *pbIn,
     if (cbIn < AES128_BLOCK_SIZE) {
       throw exceptions::RMSCryptoInvalidArgumentException("Invalid aligment");
     }
-    cbResult +=
-      DecryptBlock(pbIn, cbIn, dwStartingBlockNumber, true, pbOut, cbOut);
+    GenerateIvsForBlocks(u64StartingBlockNumber, 1, ivs);
+    cbResult += DecryptBlock(pbIn, cbIn, ivs, true, pbOut, cbOut);
   }
 
   *pcbOut = cbResult;
@@ -210,7 +255,7 @@ void Cbc4kCryptoProvider::Decrypt(const uint8_t *pbIn,
 
 uint32_t Cbc4kCryptoProvider::EncryptBlock(const uint8_t *pbIn,
                                            uint32_t       cbIn,
-                                           uint32_t       dwBlockNumber,
+                                           const uint8_t *pbIv,
                                            bool           isFinalBlock,
                                            uint8_t       *pbOut,
                                            uint32_t       cbOut)
@@ -227,26 +272,55 @@ uint32_t Cbc4kCryptoProvider::EncryptBlock(const uint8_t *pbIn,
     throw exceptions::RMSCryptoInvalidArgumentException("Invalid aligment");
   }
 
-  // Generate the IV
-  vector<uint8_t> iv = GenerateIvForBlock(dwBlockNumber);
+  if (m_pNativeKey.get() != nullptr)
+  {
+    if (isFinalBlock) {
+      return m_pNativeKey->EncryptPadded(pbIn, cbIn, pbOut, cbOut, pbIv);
+    }
+
+    m_pNativeKey->Encrypt(pbIn, pbOut, cbIn, pbIv);
+    return cbIn;
+  }
 
   if (!isFinalBlock)
   {
-    m_pCbcKey->Encrypt(pbIn, cbIn, pbOut, cbOut, &iv[0],
-                       static_cast<uint32_t>(iv.size()));
+    m_pCbcKey->Encrypt(pbIn, cbIn, pbOut, cbOut, pbIv,
+                       AES128_BLOCK_SIZE);
   }
   else
   {
-    m_pCbcPaddingKey->Encrypt(pbIn, cbIn, pbOut, cbOut, &iv[0],
-                              static_cast<uint32_t>(iv.size()));
+    m_pCbcPaddingKey->Encrypt(pbIn, cbIn, pbOut, cbOut, pbIv,
+                              AES128_BLOCK_SIZE);
   }
 
   return cbOut;
 }
 
+uint32_t Cbc4kCryptoProvider::EncryptBlocksMultiBuffer(
+  const uint8_t *pbIn,
+  uint32_t       cBlocks,
+  const uint8_t *pbIvs,
+  uint8_t       *pbOut)
+{
+  const uint8_t *lanesIn[NativeAesCbc128::MAX_LANES];
+  uint8_t       *lanesOut[NativeAesCbc128::MAX_LANES];
+  const uint8_t *lanesIv[NativeAesCbc128::MAX_LANES];
+
+  for (uint32_t i = 0; i < cBlocks; ++i) {
+    lanesIn[i]  = pbIn + i * CBC4K_BLOCK_SIZE;
+    lanesOut[i] = pbOut + i * CBC4K_BLOCK_SIZE;
+    lanesIv[i]  = pbIvs + i * AES128_BLOCK_SIZE;
+  }
+
+  m_pNativeKey->EncryptMultiBuffer(lanesIn, lanesOut, lanesIv, cBlocks,
+                                   CBC4K_BLOCK_SIZE);
+
+  return cBlocks * CBC4K_BLOCK_SIZE;
+}
+
 uint32_t Cbc4kCryptoProvider::DecryptBlock(const uint8_t *pbIn,
                                            uint32_t       cbIn,
-                                           uint32_t       dwBlockNumber,
+                                           const uint8_t *pbIv,
                                            bool           isFinalBlock,
                                            uint8_t       *pbOut,
                                            uint32_t       cbOut)
@@ -263,18 +337,25 @@ uint32_t Cbc4kCryptoProvider::DecryptBlock(const uint8_t *pbIn,
     throw exceptions::RMSCryptoInvalidArgumentException("Block is not aligned");
   }
 
-  // Generate the IV
-  vector<uint8_t> iv = GenerateIvForBlock(dwBlockNumber);
+  if (m_pNativeKey.get() != nullptr)
+  {
+    if (isFinalBlock) {
+      return m_pNativeKey->DecryptPadded(pbIn, cbIn, pbOut, cbOut, pbIv);
+    }
+
+    m_pNativeKey->Decrypt(pbIn, pbOut, cbIn, pbIv);
+    return cbIn;
+  }
 
   if (!isFinalBlock)
   {
-    m_pCbcKey->Decrypt(pbIn, cbIn, pbOut, cbOut, &iv[0],
-                       static_cast<uint32_t>(iv.size()));
+    m_pCbcKey->Decrypt(pbIn, cbIn, pbOut, cbOut, pbIv,
+                       AES128_BLOCK_SIZE);
   }
   else
   {
-    m_pCbcPaddingKey->Decrypt(pbIn, cbIn, pbOut, cbOut, &iv[0],
-                              static_cast<uint32_t>(iv.size()));
+    m_pCbcPaddingKey->Decrypt(pbIn, cbIn, pbOut, cbOut, pbIv,
+                              AES128_BLOCK_SIZE);
   }
 
   return cbOut;
@@ -287,21 +368,55 @@ uint32_t Cbc4kCryptoProvider::GetPaddedSize(uint32_t cbSizeUnsafe)
   return ((cbSize / AES128_BLOCK_SIZE) + 1) * AES128_BLOCK_SIZE;
 }
 
-vector<uint8_t>Cbc4kCryptoProvider::GenerateIvForBlock(uint32_t dwBlockNumber)
+void Cbc4kCryptoProvider::GenerateIvsForBlocks(uint64_t u64StartingBlockNumber,
+                                               uint32_t cBlocks,
+                                               uint8_t *pbIvs)
 {
-  vector<uint8_t> ivInput(AES128_KEY_BYTE_LENGTH, 0);
+  if (cBlocks == 0) {
+    return;
+  }
+
+  IvCacheEntry& entry = m_ivCache[u64StartingBlockNumber % IV_CACHE_SIZE];
+
+  if (cBlocks == 1)
+  {
+    // single blocks are mostly random re-reads, try the cache first
+    lock_guard<mutex> lock(m_ivCacheLocker);
 
-  // Set the first 4 bytes to the block number
-  memcpy(&ivInput[0], &dwBlockNumber, sizeof(dwBlockNumber));
+    if (entry.isValid && (entry.u64BlockNumber == u64StartingBlockNumber))
+    {
+      memcpy(pbIvs, entry.iv, AES128_BLOCK_SIZE);
+      return;
+    }
+  }
+
+  // Set the first 8 bytes of every counter to the block number and encrypt
+  // all the counters in place with a single ECB call. Below 2^32 blocks the
+  // counters are the same as with the 32 bit block numbers of older versions.
+  memset(pbIvs, 0, cBlocks * AES128_BLOCK_SIZE);
+
+  for (uint32_t i = 0; i < cBlocks; ++i)
+  {
+    uint64_t u64BlockNumber = u64StartingBlockNumber + i;
+    memcpy(&pbIvs[i * AES128_BLOCK_SIZE], &u64BlockNumber, sizeof(u64BlockNumber));
+  }
 
-  vector<uint8_t> iv(AES128_KEY_BYTE_LENGTH);
+  uint32_t cbIvs = cBlocks * AES128_BLOCK_SIZE;
 
-  uint32_t cbIv = AES128_KEY_BYTE_LENGTH;
-  m_pEcbKey->Encrypt(&ivInput[0],
-                     static_cast<uint32_t>(ivInput.size()), &iv[0], cbIv, nullptr,
-                     0);
+  if (m_pNativeKey.get() != nullptr) {
+    m_pNativeKey->EncryptEcb(pbIvs, pbIvs, cbIvs);
+  } else {
+    m_pEcbKey->Encrypt(pbIvs, cbIvs, pbIvs, cbIvs, nullptr, 0);
+  }
 
-  return iv;
+  if (cBlocks == 1)
+  {
+    lock_guard<mutex> lock(m_ivCacheLocker);
+
+    entry.u64BlockNumber = u64StartingBlockNumber;
+    entry.isValid       = true;
+    memcpy(entry.iv, pbIvs, AES128_BLOCK_SIZE);
+  }
 }
 } // namespace crypto
 } // namespace rmscrypto
@@ -9,8 +9,10 @@
 #ifndef _CRYPTO_STREAMS_LIB_CBC4KCRYPTOPROVIDER_H_
 #define _CRYPTO_STREAMS_LIB_CBC4KCRYPTOPROVIDER_H_
 
+#include <mutex>
 #include "../CryptoAPI/CryptoAPI.h"
 #include "CryptoConstants.h"
+#include "NativeAesCbc.h"
 
 
 namespace rmscrypto {
@@ -22,14 +24,14 @@ public:
 
   virtual void Encrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint64_t       u64StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
                        uint32_t      *pcbOut) override;
   virtual void Decrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint64_t       u64StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
@@ -51,18 +53,27 @@ private:
 
   uint32_t EncryptBlock(const uint8_t *pbIn,
                         uint32_t       cbIn,
-                        uint32_t       dwBlockNumber,
+                        const uint8_t *pbIv,
                         bool           isFinalBlock,
                         uint8_t       *pbOut,
                         uint32_t       cbOut);
   uint32_t DecryptBlock(const uint8_t *pbIn,
                         uint32_t       cbIn,
-                        uint32_t       dwBlockNumber,
+                        const uint8_t *pbIv,
                         bool           isFinalBlock,
                         uint8_t       *pbOut,
                         uint32_t       cbOut);
 
-  std::vector<uint8_t> GenerateIvForBlock(uint32_t dwBlockNumber);
+  uint32_t EncryptBlocksMultiBuffer(const uint8_t *pbIn,
+                                    uint32_t       cBlocks,
+                                    const uint8_t *pbIvs,
+                                    uint8_t       *pbOut);
+
+  // Derives the IVs of cBlocks consecutive blocks into pbIvs, which must hold
+  // cBlocks * AES128_BLOCK_SIZE bytes.
+  void GenerateIvsForBlocks(uint64_t u64StartingBlockNumber,
+                            uint32_t cBlocks,
+                            uint8_t *pbIvs);
 
   static uint32_t     GetPaddedSize(uint32_t cbSize);
 
@@ -71,7 +82,19 @@ private:
   std::shared_ptr<api::ICryptoKey> m_pEcbKey;
   std::shared_ptr<api::ICryptoKey> m_pCbcKey;
   std::shared_ptr<api::ICryptoKey> m_pCbcPaddingKey;
+  // AES instructions of the CPU, nullptr if it has none we support
+  std::unique_ptr<NativeAesCbc128> m_pNativeKey;
   std::vector<uint8_t> m_key;
+
+  // recently derived IVs of single blocks, indexed by block number
+  static const uint32_t IV_CACHE_SIZE = 16;
+  struct IvCacheEntry {
+    uint64_t u64BlockNumber;
+    bool     isValid;
+    uint8_t  iv[AES128_BLOCK_SIZE];
+  };
+  IvCacheEntry m_ivCache[IV_CACHE_SIZE];
+  std::mutex   m_ivCacheLocker;
 };
 } // namespace crypto
 } // namespace rmscrypto
@@ -34,18 +34,20 @@ Cbc512NoPaddingCryptoProvider::Cbc512NoPaddingCryptoProvider(
   m_pCbcKey = pCryptoEngine->CreateKey(key.data(),
                                        static_cast<uint32_t>(key.size()),
                                        CRYPTO_ALGORITHM_AES_CBC);
+  m_pNativeKey = NativeAesCbc128::Create(key.data(),
+                                         static_cast<uint32_t>(key.size()));
 }
 
 void Cbc512NoPaddingCryptoProvider::Encrypt(const uint8_t *pbIn,
                                             uint32_t       cbInUnsafe,
-                                            uint32_t       dwStartingBlockNumberUnsafe,
+                                            uint64_t       u64StartingBlockNumberUnsafe,
                                             bool           isFinal,
                                             uint8_t       *pbOut,
                                             uint32_t       cbOutUnsafe,
                                             uint32_t      *pcbOut)
 {
-  auto cbIn                  = cbInUnsafe, cbOut = cbOutUnsafe,
-       dwStartingBlockNumber = dwStartingBlockNumberUnsafe;
+  auto cbIn                   = cbInUnsafe, cbOut = cbOutUnsafe;
+  auto u64StartingBlockNumber = u64StartingBlockNumberUnsafe;
 
   if (pbIn == nullptr) {
     throw exceptions::RMSCryptoNullPointerException("Null pointer pbIn exception");
@@ -82,7 +84,7 @@ void Cbc512NoPaddingCryptoProvider::Encrypt(const uint8_t *pbIn,
     // Encrypt the current block
     EncryptBlock(pbIn,
                  CBC512_BLOCK_SIZE,
-                 dwStartingBlockNumber,
+                 u64StartingBlockNumber,
                  false,
                  pbOut,
                  cbOut);
@@ -94,27 +96,27 @@ void Cbc512NoPaddingCryptoProvider::Encrypt(const uint8_t *pbIn,
     pbOut += CBC512_BLOCK_SIZE;
     cbOut -= CBC512_BLOCK_SIZE;
 
-    ++dwStartingBlockNumber;
+    ++u64StartingBlockNumber;
     cbResult += CBC512_BLOCK_SIZE;
   }
 
   if (!isFinal && (cbIn > CBC512_BLOCK_SIZE)) {
     throw exceptions::RMSCryptoInvalidArgumentException("Invalid aligment");
   }
-  cbResult += EncryptBlock(pbIn, cbIn, dwStartingBlockNumber, true, pbOut, cbOut);
+  cbResult += EncryptBlock(pbIn, cbIn, u64StartingBlockNumber, true, pbOut, cbOut);
   *pcbOut   = cbResult;
 }
 
 void Cbc512NoPaddingCryptoProvider::Decrypt(const uint8_t *pbIn,
                                             uint32_t       cbInUnsafe,
-                                            uint32_t       dwStartingBlockNumberUnsafe,
+                                            uint64_t       u64StartingBlockNumberUnsafe,
                                             bool           isFinal,
                                             uint8_t       *pbOut,
                                             uint32_t       cbOutUnsafe,
                                             uint32_t      *pcbOut)
 {
-  auto cbIn                  = cbInUnsafe, cbOut = cbOutUnsafe,
-       dwStartingBlockNumber = dwStartingBlockNumberUnsafe;
+  auto cbIn                   = cbInUnsafe, cbOut = cbOutUnsafe;
+  auto u64StartingBlockNumber = u64StartingBlockNumberUnsafe;
 
   if (pbIn == nullptr) {
     throw exceptions::RMSCryptoNullPointerException("Null pointer pbIn exception");
@@ -164,7 +166,7 @@ void Cbc512NoPaddingCryptoProvider::Decrypt(const uint8_t *pbIn,
 
     DecryptBlock(pbIn,
                  CBC512_BLOCK_SIZE,
-                 dwStartingBlockNumber,
+                 u64StartingBlockNumber,
                  false,
                  pbOut,
                  cbOut);
@@ -175,7 +177,7 @@ void Cbc512NoPaddingCryptoProvider::Decrypt(const uint8_t *pbIn,
     pbOut += CBC512_BLOCK_SIZE;
     cbOut -= CBC512_BLOCK_SIZE;
 
-    ++dwStartingBlockNumber;
+    ++u64StartingBlockNumber;
 
     cbResult += CBC512_BLOCK_SIZE;
   }
@@ -192,7 +194,7 @@ void Cbc512NoPaddingCryptoProvider::Decrypt(const uint8_t *pbIn,
       throw exceptions::RMSCryptoInsufficientBufferException("Insufficient buffer");
     }
     cbResult +=
-      DecryptBlock(pbIn, cbIn, dwStartingBlockNumber, true, pbOut, cbOut);
+      DecryptBlock(pbIn, cbIn, u64StartingBlockNumber, true, pbOut, cbOut);
   }
 
   *pcbOut = cbResult;
@@ -209,7 +211,7 @@ uint64_t Cbc512NoPaddingCryptoProvider::GetCipherTextSize(uint64_t clearTextSize
 uint32_t Cbc512NoPaddingCryptoProvider::EncryptBlock(
   const uint8_t *pbIn,
   uint32_t       cbIn,
-  uint32_t       dwBlockNumber,
+  uint64_t       u64BlockNumber,
   bool           isFinalBlock,
   uint8_t       *pbOut,
   uint32_t       cbOut)
@@ -227,9 +229,19 @@ uint32_t Cbc512NoPaddingCryptoProvider::EncryptBlock(
   }
 
   // Generate the IV
-  vector<uint8_t> iv = GenerateIvForBlock(dwBlockNumber);
-  m_pCbcKey->Encrypt(pbIn, cbIn, pbOut, cbOut, &iv[0],
-                     static_cast<uint32_t>(iv.size()));
+  uint8_t iv[AES128_BLOCK_SIZE];
+  GenerateIvForBlock(u64BlockNumber, iv);
+
+  if (m_pNativeKey.get() != nullptr) {
+    if (cbOut < cbIn) {
+      throw exceptions::RMSCryptoInsufficientBufferException(
+              "Insufficient buffer");
+    }
+    m_pNativeKey->Encrypt(pbIn, pbOut, cbIn, iv);
+    return cbIn;
+  }
+
+  m_pCbcKey->Encrypt(pbIn, cbIn, pbOut, cbOut, iv, AES128_BLOCK_SIZE);
 
   return cbOut;
 }
@@ -237,7 +249,7 @@ uint32_t Cbc512NoPaddingCryptoProvider::EncryptBlock(
 uint32_t Cbc512NoPaddingCryptoProvider::DecryptBlock(
   const uint8_t *pbIn,
   uint32_t       cbIn,
-  uint32_t       dwBlockNumber,
+  uint64_t       u64BlockNumber,
   bool           isFinalBlock,
   uint8_t       *pbOut,
   uint32_t       cbOut)
@@ -255,10 +267,19 @@ uint32_t Cbc512NoPaddingCryptoProvider::DecryptBlock(
   }
 
   // Generate the IV
-  vector<uint8_t> iv = GenerateIvForBlock(dwBlockNumber);
+  uint8_t iv[AES128_BLOCK_SIZE];
+  GenerateIvForBlock(u64BlockNumber, iv);
+
+  if (m_pNativeKey.get() != nullptr) {
+    if (cbOut < cbIn) {
+      throw exceptions::RMSCryptoInsufficientBufferException(
+              "Insufficient buffer");
+    }
+    m_pNativeKey->Decrypt(pbIn, pbOut, cbIn, iv);
+    return cbIn;
+  }
 
-  m_pCbcKey->Decrypt(pbIn, cbIn, pbOut, cbOut, &iv[0],
-                     static_cast<uint32_t>(iv.size()));
+  m_pCbcKey->Decrypt(pbIn, cbIn, pbOut, cbOut, iv, AES128_BLOCK_SIZE);
 
   return cbOut;
 }
@@ -272,23 +293,22 @@ uint32_t Cbc512NoPaddingCryptoProvider::GetPaddedSize(uint32_t cbSizeUnsafe)
   return (((cbSize - 1) / AES128_BLOCK_SIZE) + 1) * AES128_BLOCK_SIZE;
 }
 
-vector<uint8_t>Cbc512NoPaddingCryptoProvider::GenerateIvForBlock(
-  uint32_t dwBlockNumber)
+void Cbc512NoPaddingCryptoProvider::GenerateIvForBlock(uint64_t u64BlockNumber,
+                                                       uint8_t *pbIv)
 {
-  vector<uint8_t> ivInput(AES128_KEY_BYTE_LENGTH, 0);
+  memset(pbIv, 0, AES128_BLOCK_SIZE);
 
   // Set the first 8 uint8_ts to the number of uint8_ts
-  uint64_t cbuint8_tNumber = (uint64_t)dwBlockNumber * CBC512_BLOCK_SIZE;
-  memcpy(&ivInput[0], &cbuint8_tNumber, sizeof(cbuint8_tNumber));
-
-  vector<uint8_t> iv(AES128_KEY_BYTE_LENGTH);
+  uint64_t cbuint8_tNumber = u64BlockNumber * CBC512_BLOCK_SIZE;
+  memcpy(pbIv, &cbuint8_tNumber, sizeof(cbuint8_tNumber));
 
-  uint32_t cbIv = AES128_KEY_BYTE_LENGTH;
-  m_pEcbKey->Encrypt(&ivInput[0],
-                     static_cast<uint32_t>(ivInput.size()), &iv[0], cbIv, nullptr,
-                     0);
+  if (m_pNativeKey.get() != nullptr) {
+    m_pNativeKey->EncryptEcb(pbIv, pbIv, AES128_BLOCK_SIZE);
+    return;
+  }
 
-  return iv;
+  uint32_t cbIv = AES128_BLOCK_SIZE;
+  m_pEcbKey->Encrypt(pbIv, AES128_BLOCK_SIZE, pbIv, cbIv, nullptr, 0);
 }
 } // namespace crypto
 } // namespace rmscrypto
@@ -11,6 +11,7 @@
 
 #include "../CryptoAPI/CryptoAPI.h"
 #include "CryptoConstants.h"
+#include "NativeAesCbc.h"
 
 namespace rmscrypto {
 namespace crypto {
@@ -21,14 +22,14 @@ public:
 
   virtual void Encrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint64_t       u64StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
                        uint32_t      *pcbOut) override;
   virtual void Decrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint64_t       u64StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
@@ -48,18 +49,20 @@ private:
 
   uint32_t EncryptBlock(const uint8_t *pbIn,
                         uint32_t       cbIn,
-                        uint32_t       dwBlockNumber,
+                        uint64_t       u64BlockNumber,
                         bool           isFinalBlock,
                         uint8_t       *pbOut,
                         uint32_t       cbOut);
   uint32_t DecryptBlock(const uint8_t *pbIn,
                         uint32_t       cbIn,
-                        uint32_t       dwBlockNumber,
+                        uint64_t       u64BlockNumber,
                         bool           isFinalBlock,
                         uint8_t       *pbOut,
                         uint32_t       cbOut);
 
-  std::vector<uint8_t> GenerateIvForBlock(uint32_t dwBlockNumber);
+  // pbIv receives AES128_BLOCK_SIZE bytes
+  void GenerateIvForBlock(uint64_t u64BlockNumber,
+                          uint8_t *pbIv);
 
   static uint32_t   GetPaddedSize(uint32_t cbSize);
 
@@ -69,6 +72,9 @@ private:
   std::shared_ptr<api::ICryptoKey> m_pCbcKey;
   std::shared_ptr<api::ICryptoKey> m_pCbcPaddingKey;
   std::vector<uint8_t> m_key;
+
+  // AES instructions of the CPU, nullptr if it has none we support
+  std::unique_ptr<NativeAesCbc128> m_pNativeKey;
 };
 } // namespace crypto
 } // namespace rmscrypto
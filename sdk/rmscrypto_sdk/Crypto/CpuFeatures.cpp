@@ -0,0 +1,122 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include "CpuFeatures.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+  defined(_M_IX86)
+# define RMS_CRYPTO_CPU_X86
+# if defined(_MSC_VER)
+#  include <intrin.h>
+#  include <immintrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+# define RMS_CRYPTO_CPU_ARM64
+# if defined(_WIN32)
+#  include <windows.h>
+# elif defined(__linux__)
+#  include <sys/auxv.h>
+#  ifndef HWCAP_AES
+#   define HWCAP_AES (1 << 3)
+#  endif
+# endif
+#endif
+
+namespace rmscrypto {
+namespace crypto {
+#ifdef RMS_CRYPTO_CPU_X86
+static void Cpuid(unsigned int leaf, unsigned int subleaf, unsigned int *info)
+{
+# if defined(_MSC_VER)
+  __cpuidex(reinterpret_cast<int *>(info), leaf, subleaf);
+# else
+  __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+# endif
+}
+
+// The OS saves the SSE and AVX registers on context switches
+static bool IsAvxStateEnabled()
+{
+# if defined(_MSC_VER)
+  unsigned long long xcr0 = _xgetbv(0);
+# else
+  unsigned int eax = 0, edx = 0;
+  __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  unsigned long long xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+# endif
+  return (xcr0 & 0x6) == 0x6;
+}
+
+static CpuFeatures DetectCpuFeatures()
+{
+  CpuFeatures  features = { false, false, false };
+  unsigned int info[4]  = { 0, 0, 0, 0 };
+
+  Cpuid(0, 0, info);
+  unsigned int maxLeaf = info[0];
+
+  if (maxLeaf < 1) {
+    return features;
+  }
+
+  Cpuid(1, 0, info);
+
+  // CPUID.1:ECX.AESNI[bit 25], SSE2 is part of the x86-64 baseline
+  features.aesNi = (info[2] & (1u << 25)) != 0;
+
+  // CPUID.1:ECX.OSXSAVE[bit 27] and AVX[bit 28]
+  bool avx = ((info[2] & (1u << 27)) != 0) && ((info[2] & (1u << 28)) != 0) &&
+             IsAvxStateEnabled();
+
+  if (features.aesNi && avx && (maxLeaf >= 7)) {
+    Cpuid(7, 0, info);
+
+    // CPUID.7.0:EBX.AVX2[bit 5] and ECX.VAES[bit 9]
+    features.vaes = ((info[1] & (1u << 5)) != 0) &&
+                    ((info[2] & (1u << 9)) != 0);
+  }
+  return features;
+}
+
+#elif defined(RMS_CRYPTO_CPU_ARM64)
+static CpuFeatures DetectCpuFeatures()
+{
+  CpuFeatures features = { false, false, false };
+
+# if defined(__APPLE__)
+  // every Apple ARM64 CPU has the crypto extension
+  features.armAes = true;
+# elif defined(_WIN32)
+  features.armAes = IsProcessorFeaturePresent(
+    PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != FALSE;
+# elif defined(__linux__)
+  features.armAes = (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+# endif
+  return features;
+}
+
+#else // ifdef RMS_CRYPTO_CPU_X86
+static CpuFeatures DetectCpuFeatures()
+{
+  CpuFeatures features = { false, false, false };
+
+  return features;
+}
+
+#endif // ifdef RMS_CRYPTO_CPU_X86
+
+const CpuFeatures& GetCpuFeatures()
+{
+  static const CpuFeatures features = DetectCpuFeatures();
+
+  return features;
+}
+} // namespace crypto
+} // namespace rmscrypto
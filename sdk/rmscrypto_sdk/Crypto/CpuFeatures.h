@@ -0,0 +1,30 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _CRYPTO_STREAMS_LIB_CPUFEATURES_H_
+#define _CRYPTO_STREAMS_LIB_CPUFEATURES_H_
+
+namespace rmscrypto {
+namespace crypto {
+// AES related instruction sets of the CPU the process runs on
+struct CpuFeatures {
+  // x86 AES-NI (AESENC/AESDEC on 128 bit registers)
+  bool aesNi;
+
+  // x86 VAES with AVX2, AESENC/AESDEC on two blocks per 256 bit register
+  bool vaes;
+
+  // ARMv8 cryptographic extension (AESE/AESD/AESMC/AESIMC)
+  bool armAes;
+};
+
+// Queries the CPU once, subsequent calls return the cached result
+const CpuFeatures& GetCpuFeatures();
+} // namespace crypto
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_CPUFEATURES_H_
@@ -19,11 +19,21 @@ CONFIG(debug, debug|release) {
 
 
 SOURCES += Cbc4kCryptoProvider.cpp \
+    AesNiCbc.cpp \
+    ArmCeCbc.cpp \
+    CpuFeatures.cpp \
+    NativeAesCbc.cpp \
     Cbc512NoPaddingCryptoProvider.cpp \
-    EcbCryptoProvider.cpp
+    EcbCryptoProvider.cpp \
+    CtrCryptoProvider.cpp
 
 HEADERS += \
     Cbc4kCryptoProvider.h \
     Cbc512NoPaddingCryptoProvider.h \
     EcbCryptoProvider.h \
+    CtrCryptoProvider.h \
+    AesNiCbc.h \
+    ArmCeCbc.h \
+    CpuFeatures.h \
+    NativeAesCbc.h \
     CryptoConstants.h
@@ -14,6 +14,7 @@ const unsigned int AES128_KEY_BYTE_LENGTH = 16;
 const unsigned int AES128_BLOCK_SIZE      = 16;
 const unsigned int CBC4K_BLOCK_SIZE       = 4096;
 const unsigned int CBC512_BLOCK_SIZE      = 512;
+const unsigned int CTR_BLOCK_SIZE         = 512;
 } // namespace crypto
 } // namespace rmscrypto
 #endif // _CRYPTO_STREAMS_LIB_CRYPTODEFS_H_
@@ -0,0 +1,162 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <string.h>
+#include "CtrCryptoProvider.h"
+#include "CryptoConstants.h"
+#include "../CryptoAPI/CryptoAPI.h"
+#include "../CryptoAPI/RMSCryptoExceptions.h"
+
+using namespace std;
+using namespace rmscrypto::api;
+
+namespace rmscrypto {
+namespace crypto {
+// big endian 128 bit counter of the AES block at u64Block
+static void CounterForBlock(uint64_t u64Block, uint8_t *pbCounter)
+{
+  memset(pbCounter, 0, AES128_BLOCK_SIZE);
+
+  for (unsigned int i = 1; i <= sizeof(u64Block); ++i) {
+    pbCounter[AES128_BLOCK_SIZE - i] = static_cast<uint8_t>(u64Block);
+    u64Block >>= 8;
+  }
+}
+
+CtrCryptoProvider::CtrCryptoProvider(const vector<uint8_t>& key,
+                                     const vector<uint8_t>& nonce)
+{
+  static const char label[] = "MSIPC.CTR";
+
+  if (nonce.size() != CTR_NONCE_SIZE) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Invalid CTR nonce");
+  }
+
+  // SHA-256(label || 0 || key || nonce), cut to the size of the content key
+  auto pHash = ICryptoEngine::Create()->CreateHash(
+    CRYPTO_HASH_ALGORITHM_SHA256);
+  vector<uint8_t> digest(pHash->GetOutputSize());
+  uint32_t cbDigest = static_cast<uint32_t>(digest.size());
+
+  if (key.empty() || (key.size() > digest.size())) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Invalid key size");
+  }
+
+  pHash->Update(reinterpret_cast<const uint8_t *>(label), sizeof(label));
+  pHash->Update(key.data(),   key.size());
+  pHash->Update(nonce.data(), nonce.size());
+  pHash->Final(digest.data(), cbDigest);
+
+  digest.resize(key.size());
+  InitializeKey(digest);
+}
+
+void CtrCryptoProvider::InitializeKey(const vector<uint8_t>& key)
+{
+  m_key = key;
+  shared_ptr<ICryptoEngine> pCryptoEngine = api::ICryptoEngine::Create();
+  m_pKey = pCryptoEngine->CreateKey(key.data(),
+                                    static_cast<uint32_t>(key.size()),
+                                    CRYPTO_ALGORITHM_AES_CTR);
+}
+
+void CtrCryptoProvider::Encrypt(const uint8_t *pbIn,
+                                uint32_t       cbIn,
+                                uint64_t       u64StartingBlockNumber,
+                                bool,
+                                uint8_t       *pbOut,
+                                uint32_t       cbOut,
+                                uint32_t      *pcbOut)
+{
+  TransformChecked(pbIn, cbIn, u64StartingBlockNumber, pbOut, cbOut, pcbOut);
+}
+
+void CtrCryptoProvider::Decrypt(const uint8_t *pbIn,
+                                uint32_t       cbIn,
+                                uint64_t       u64StartingBlockNumber,
+                                bool,
+                                uint8_t       *pbOut,
+                                uint32_t       cbOut,
+                                uint32_t      *pcbOut)
+{
+  TransformChecked(pbIn, cbIn, u64StartingBlockNumber, pbOut, cbOut, pcbOut);
+}
+
+void CtrCryptoProvider::TransformChecked(const uint8_t *pbIn,
+                                         uint32_t       cbIn,
+                                         uint64_t       u64StartingBlockNumber,
+                                         uint8_t       *pbOut,
+                                         uint32_t       cbOut,
+                                         uint32_t      *pcbOut)
+{
+  if (pbIn == nullptr) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer pbIn exception");
+  }
+
+  if (nullptr == pcbOut) {
+    throw exceptions::RMSCryptoNullPointerException(
+            "Null pointer pcbOut exception");
+  }
+
+  *pcbOut = cbIn;
+
+  if (nullptr == pbOut)
+  {
+    return;
+  }
+
+  if (cbOut < cbIn) {
+    throw exceptions::RMSCryptoInsufficientBufferException("Insufficient buffer");
+  }
+
+  Transform(pbIn, cbIn, u64StartingBlockNumber * CTR_BLOCK_SIZE, pbOut);
+}
+
+void CtrCryptoProvider::Transform(const uint8_t *pbIn,
+                                  uint32_t       cbIn,
+                                  uint64_t       u64Offset,
+                                  uint8_t       *pbOut)
+{
+  if ((pbIn == nullptr) || (pbOut == nullptr)) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  uint8_t  counter[AES128_BLOCK_SIZE];
+  uint64_t u64Block = u64Offset / AES128_BLOCK_SIZE;
+  uint32_t cbSkip   = static_cast<uint32_t>(u64Offset % AES128_BLOCK_SIZE);
+
+  if ((cbSkip > 0) && (cbIn > 0)) {
+    // the data starts inside an AES block, run the whole block and keep the
+    // part which belongs to the data
+    uint8_t  block[AES128_BLOCK_SIZE] = { 0 };
+    uint32_t cbHead  = min(cbIn, AES128_BLOCK_SIZE - cbSkip);
+    uint32_t cbBlock = AES128_BLOCK_SIZE;
+
+    memcpy(block + cbSkip, pbIn, cbHead);
+    CounterForBlock(u64Block, counter);
+    m_pKey->Encrypt(block, AES128_BLOCK_SIZE, block, cbBlock, counter,
+                    AES128_BLOCK_SIZE);
+    memcpy(pbOut, block + cbSkip, cbHead);
+
+    pbIn  += cbHead;
+    pbOut += cbHead;
+    cbIn  -= cbHead;
+    ++u64Block;
+  }
+
+  if (cbIn == 0) {
+    return;
+  }
+
+  uint32_t cbOut = cbIn;
+
+  CounterForBlock(u64Block, counter);
+  m_pKey->Encrypt(pbIn, cbIn, pbOut, cbOut, counter, AES128_BLOCK_SIZE);
+}
+} // namespace crypto
+} // namespace rmscrypto
@@ -0,0 +1,79 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _CRYPTO_STREAMS_LIB_CTRCRYPTOPROVIDER_H_
+#define _CRYPTO_STREAMS_LIB_CTRCRYPTOPROVIDER_H_
+
+#include "../CryptoAPI/CryptoAPI.h"
+#include "CryptoConstants.h"
+
+namespace rmscrypto {
+namespace crypto {
+// AES-CTR with the counter at byte offset / 16. The block number of
+// Encrypt/Decrypt counts CTR_BLOCK_SIZE bytes, which protected streams use as
+// their block size; Transform works at any byte offset.
+class CtrCryptoProvider : public api::ICryptoProvider {
+public:
+
+  // Encrypts one container under a key derived from key and the container's
+  // nonce (CTR_NONCE_SIZE bytes), so containers under the same key never
+  // share a key stream.
+  CtrCryptoProvider(const std::vector<uint8_t>& key,
+                    const std::vector<uint8_t>& nonce);
+
+  virtual void Encrypt(const uint8_t *pbIn,
+                       uint32_t       cbIn,
+                       uint64_t       u64StartingBlockNumber,
+                       bool           isFinal,
+                       uint8_t       *pbOut,
+                       uint32_t       cbOut,
+                       uint32_t      *pcbOut) override;
+  virtual void Decrypt(const uint8_t *pbIn,
+                       uint32_t       cbIn,
+                       uint64_t       u64StartingBlockNumber,
+                       bool           isFinal,
+                       uint8_t       *pbOut,
+                       uint32_t       cbOut,
+                       uint32_t      *pcbOut) override;
+
+  // Encrypts or decrypts (the same operation) cbIn bytes which start at
+  // u64Offset of the content. pbIn and pbOut may be the same buffer.
+  void         Transform(const uint8_t *pbIn,
+                         uint32_t       cbIn,
+                         uint64_t       u64Offset,
+                         uint8_t       *pbOut);
+
+  virtual uint64_t GetCipherTextSize(uint64_t clearTextSize) override {
+    return clearTextSize;
+  }
+
+  virtual uint32_t GetBlockSize() override {
+    return CTR_BLOCK_SIZE;
+  }
+
+  virtual std::vector<uint8_t>GetKey() override {
+    return m_key;
+  }
+
+private:
+
+  void InitializeKey(const std::vector<uint8_t>& key);
+
+  void TransformChecked(const uint8_t *pbIn,
+                        uint32_t       cbIn,
+                        uint64_t       u64StartingBlockNumber,
+                        uint8_t       *pbOut,
+                        uint32_t       cbOut,
+                        uint32_t      *pcbOut);
+
+  std::shared_ptr<api::ICryptoKey> m_pKey;
+  std::vector<uint8_t> m_key;
+};
+} // namespace crypto
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_CTRCRYPTOPROVIDER_H_
@@ -27,7 +27,7 @@ EcbCryptoProvider::EcbCryptoProvider(const vector<uint8_t>& key)
 
 void EcbCryptoProvider::Encrypt(const uint8_t *pbIn,
                                 uint32_t       cbIn,
-                                uint32_t,
+                                uint64_t,
                                 bool,
                                 uint8_t       *pbOut,
                                 uint32_t       cbOut,
@@ -62,7 +62,7 @@ void EcbCryptoProvider::Encrypt(const uint8_t *pbIn,
 
 void EcbCryptoProvider::Decrypt(const uint8_t *pbIn,
                                 uint32_t       cbIn,
-                                uint32_t,
+                                uint64_t,
                                 bool,
                                 uint8_t       *pbOut,
                                 uint32_t       cbOut,
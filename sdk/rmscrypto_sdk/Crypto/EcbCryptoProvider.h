@@ -21,14 +21,14 @@ public:
 
   virtual void Encrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint64_t       u64StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
                        uint32_t      *pcbOut) override;
   virtual void Decrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint64_t       u64StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
@@ -0,0 +1,246 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <stdlib.h>
+#include <cstring>
+#include "NativeAesCbc.h"
+#include "AesNiCbc.h"
+#include "ArmCeCbc.h"
+#include "CpuFeatures.h"
+#include "CryptoConstants.h"
+#include "../CryptoAPI/RMSCryptoExceptions.h"
+
+using namespace std;
+
+namespace rmscrypto {
+namespace crypto {
+const uint32_t NativeAesCbc128::MAX_LANES;
+
+enum AesKernel {
+  AES_KERNEL_EVP,
+  AES_KERNEL_AESNI,
+  AES_KERNEL_VAES,
+  AES_KERNEL_ARMCE
+};
+
+static const char *const AES_KERNEL_NAMES[] = { "evp", "aesni", "vaes",
+                                                "armv8-ce" };
+
+static AesKernel SelectKernel()
+{
+  const CpuFeatures& features = GetCpuFeatures();
+  bool supported[]            = { true, features.aesNi, features.vaes,
+                                  features.armAes };
+
+  const char *requested = getenv("RMSCRYPTO_AES_KERNEL");
+
+  if (requested != nullptr) {
+    for (int kernel = AES_KERNEL_EVP; kernel <= AES_KERNEL_ARMCE; ++kernel) {
+      if (supported[kernel] && (strcmp(requested, AES_KERNEL_NAMES[kernel]) == 0)) {
+        return static_cast<AesKernel>(kernel);
+      }
+    }
+  }
+
+  // the widest one the CPU has
+  if (features.vaes) {
+    return AES_KERNEL_VAES;
+  }
+
+  if (features.aesNi) {
+    return AES_KERNEL_AESNI;
+  }
+
+  if (features.armAes) {
+    return AES_KERNEL_ARMCE;
+  }
+  return AES_KERNEL_EVP;
+}
+
+static AesKernel SelectedKernel()
+{
+  static const AesKernel kernel = SelectKernel();
+
+  return kernel;
+}
+
+NativeAesCbc128::~NativeAesCbc128()
+{
+  // don't leave the key schedules behind
+  volatile uint8_t *p = m_roundKeys;
+
+  for (size_t i = 0; i < sizeof(m_roundKeys); ++i) {
+    p[i] = 0;
+  }
+
+  p = m_decryptRoundKeys;
+
+  for (size_t i = 0; i < sizeof(m_decryptRoundKeys); ++i) {
+    p[i] = 0;
+  }
+}
+
+unique_ptr<NativeAesCbc128>NativeAesCbc128::Create(const uint8_t *pbKey,
+                                                   uint32_t       cbKey)
+{
+  if (pbKey == nullptr) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer pbKey exception");
+  }
+
+  if (cbKey != AES128_KEY_BYTE_LENGTH) {
+    return nullptr;
+  }
+
+  switch (SelectedKernel()) {
+  case AES_KERNEL_VAES:
+    return unique_ptr<NativeAesCbc128>(new VaesCbc128(pbKey));
+
+  case AES_KERNEL_AESNI:
+    return unique_ptr<NativeAesCbc128>(new AesNiCbc128(pbKey));
+
+  case AES_KERNEL_ARMCE:
+    return unique_ptr<NativeAesCbc128>(new ArmCeCbc128(pbKey));
+
+  default:
+    return nullptr;
+  }
+}
+
+const char * NativeAesCbc128::KernelName()
+{
+  return AES_KERNEL_NAMES[SelectedKernel()];
+}
+
+void NativeAesCbc128::EncryptMultiBuffer(const uint8_t *const *ppbIn,
+                                         uint8_t *const       *ppbOut,
+                                         const uint8_t *const *ppbIv,
+                                         uint32_t              cLanes,
+                                         uint32_t              cbLane) const
+{
+  if ((ppbIn == nullptr) || (ppbOut == nullptr) || (ppbIv == nullptr)) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  if ((cLanes == 0) || (cLanes > MAX_LANES)) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Invalid lane count");
+  }
+
+  if (0 != cbLane % AES128_BLOCK_SIZE) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Block is not aligned");
+  }
+
+  EncryptLanes(ppbIn, ppbOut, ppbIv, cLanes, cbLane / AES128_BLOCK_SIZE);
+}
+
+void NativeAesCbc128::Encrypt(const uint8_t *pbIn,
+                              uint8_t       *pbOut,
+                              uint32_t       cb,
+                              const uint8_t *pbIv) const
+{
+  EncryptMultiBuffer(&pbIn, &pbOut, &pbIv, 1, cb);
+}
+
+void NativeAesCbc128::Decrypt(const uint8_t *pbIn,
+                              uint8_t       *pbOut,
+                              uint32_t       cb,
+                              const uint8_t *pbIv) const
+{
+  if ((pbIn == nullptr) || (pbOut == nullptr) || (pbIv == nullptr)) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  if (0 != cb % AES128_BLOCK_SIZE) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Block is not aligned");
+  }
+
+  DecryptChain(pbIn, pbOut, cb / AES128_BLOCK_SIZE, pbIv);
+}
+
+uint32_t NativeAesCbc128::EncryptPadded(const uint8_t *pbIn,
+                                        uint32_t       cbIn,
+                                        uint8_t       *pbOut,
+                                        uint32_t       cbOut,
+                                        const uint8_t *pbIv) const
+{
+  if ((pbIn == nullptr) || (pbOut == nullptr) || (pbIv == nullptr)) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  uint32_t cbAligned = cbIn - cbIn % AES128_BLOCK_SIZE;
+
+  if (cbOut < cbAligned + AES128_BLOCK_SIZE) {
+    throw exceptions::RMSCryptoInsufficientBufferException(
+            "No enough buffer size");
+  }
+
+  // the last block with the padding, taken before pbIn may be overwritten
+  uint8_t last[AES128_BLOCK_SIZE];
+  uint8_t cbPadding = static_cast<uint8_t>(AES128_BLOCK_SIZE -
+                                           cbIn % AES128_BLOCK_SIZE);
+
+  memcpy(last, pbIn + cbAligned, cbIn - cbAligned);
+  memset(last + cbIn - cbAligned, cbPadding, cbPadding);
+
+  if (cbAligned > 0) {
+    Encrypt(pbIn, pbOut, cbAligned, pbIv);
+    pbIv = pbOut + cbAligned - AES128_BLOCK_SIZE;
+  }
+
+  Encrypt(last, pbOut + cbAligned, AES128_BLOCK_SIZE, pbIv);
+  return cbAligned + AES128_BLOCK_SIZE;
+}
+
+uint32_t NativeAesCbc128::DecryptPadded(const uint8_t *pbIn,
+                                        uint32_t       cbIn,
+                                        uint8_t       *pbOut,
+                                        uint32_t       cbOut,
+                                        const uint8_t *pbIv) const
+{
+  if ((cbIn == 0) || (0 != cbIn % AES128_BLOCK_SIZE)) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Block is not aligned");
+  }
+
+  if (cbOut < cbIn) {
+    throw exceptions::RMSCryptoInsufficientBufferException(
+            "No enough buffer size");
+  }
+
+  Decrypt(pbIn, pbOut, cbIn, pbIv);
+
+  // same check as EVP_DecryptFinal_ex
+  uint8_t cbPadding = pbOut[cbIn - 1];
+  bool    valid     = (cbPadding > 0) && (cbPadding <= AES128_BLOCK_SIZE);
+
+  for (uint32_t i = 1; valid && i <= cbPadding; ++i) {
+    valid = pbOut[cbIn - i] == cbPadding;
+  }
+
+  if (!valid) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to transform final block");
+  }
+  return cbIn - cbPadding;
+}
+
+void NativeAesCbc128::EncryptEcb(const uint8_t *pbIn,
+                                 uint8_t       *pbOut,
+                                 uint32_t       cb) const
+{
+  if ((pbIn == nullptr) || (pbOut == nullptr)) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  if (0 != cb % AES128_BLOCK_SIZE) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Block is not aligned");
+  }
+
+  EncryptBlocks(pbIn, pbOut, cb / AES128_BLOCK_SIZE);
+}
+} // namespace crypto
+} // namespace rmscrypto
@@ -0,0 +1,113 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _CRYPTO_STREAMS_LIB_NATIVEAESCBC_H_
+#define _CRYPTO_STREAMS_LIB_NATIVEAESCBC_H_
+
+#include <stdint.h>
+#include <memory>
+
+// For the kernels: the per block loops must be unrolled so the blocks in
+// flight stay in registers, whatever the optimization level.
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8))
+# define RMS_CRYPTO_UNROLL _Pragma("GCC unroll 16")
+#else // if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8))
+# define RMS_CRYPTO_UNROLL
+#endif // if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8))
+
+namespace rmscrypto {
+namespace crypto {
+// AES-128 CBC on the AES instructions of the CPU, for the fixed size blocks
+// of the CBC4K and CBC512 providers. The kernel is picked once per process
+// from the CPU features and the key schedule is expanded once per key.
+class NativeAesCbc128 {
+public:
+
+  static const uint32_t MAX_LANES = 16;
+
+  virtual ~NativeAesCbc128();
+
+  // Returns nullptr if the CPU has no supported AES instructions or the key
+  // isn't an AES-128 key, the providers use the EVP based ICryptoKey then.
+  static std::unique_ptr<NativeAesCbc128>Create(const uint8_t *pbKey,
+                                                uint32_t       cbKey);
+
+  // Name of the kernel Create uses: "vaes", "aesni", "armv8-ce" or "evp".
+  // The RMSCRYPTO_AES_KERNEL environment variable set to one of these names
+  // overrides the choice if the CPU supports it, e.g. for benchmarks.
+  static const char* KernelName();
+
+  // Encrypts cLanes independent chains of cbLane bytes each (no padding).
+  // ppbIn, ppbOut and ppbIv hold one pointer per lane; cbLane must be a
+  // multiple of AES128_BLOCK_SIZE. CBC is serial within a chain, so the
+  // rounds of the lanes are interleaved to keep the AES units busy.
+  void     EncryptMultiBuffer(const uint8_t *const *ppbIn,
+                              uint8_t *const       *ppbOut,
+                              const uint8_t *const *ppbIv,
+                              uint32_t              cLanes,
+                              uint32_t              cbLane) const;
+
+  // A single chain of cb bytes (no padding), pbOut may be pbIn. Decryption
+  // of a chain is parallel, all its blocks are in flight at once.
+  void     Encrypt(const uint8_t *pbIn,
+                   uint8_t       *pbOut,
+                   uint32_t       cb,
+                   const uint8_t *pbIv) const;
+  void     Decrypt(const uint8_t *pbIn,
+                   uint8_t       *pbOut,
+                   uint32_t       cb,
+                   const uint8_t *pbIv) const;
+
+  // PKCS7 padded chains, return the output size. pbOut may be pbIn.
+  uint32_t EncryptPadded(const uint8_t *pbIn,
+                         uint32_t       cbIn,
+                         uint8_t       *pbOut,
+                         uint32_t       cbOut,
+                         const uint8_t *pbIv) const;
+  uint32_t DecryptPadded(const uint8_t *pbIn,
+                         uint32_t       cbIn,
+                         uint8_t       *pbOut,
+                         uint32_t       cbOut,
+                         const uint8_t *pbIv) const;
+
+  // ECB encryption, for the IV derivation. pbOut may be pbIn.
+  void     EncryptEcb(const uint8_t *pbIn,
+                      uint8_t       *pbOut,
+                      uint32_t       cb) const;
+
+protected:
+
+  NativeAesCbc128() {}
+
+  // the kernels, called with checked arguments and counts of AES blocks
+  virtual void EncryptLanes(const uint8_t *const *ppbIn,
+                            uint8_t *const       *ppbOut,
+                            const uint8_t *const *ppbIv,
+                            uint32_t              cLanes,
+                            uint32_t              cBlocks) const = 0;
+  virtual void DecryptChain(const uint8_t *pbIn,
+                            uint8_t       *pbOut,
+                            uint32_t       cBlocks,
+                            const uint8_t *pbIv) const = 0;
+  virtual void EncryptBlocks(const uint8_t *pbIn,
+                             uint8_t       *pbOut,
+                             uint32_t       cBlocks) const = 0;
+
+  // round keys of AES-128 for encryption and for the equivalent inverse
+  // cipher: rk[10], InvMixColumns(rk[9]) ... InvMixColumns(rk[1]), rk[0]
+  uint8_t m_roundKeys[11 * 16];
+  uint8_t m_decryptRoundKeys[11 * 16];
+
+private:
+
+  NativeAesCbc128(const NativeAesCbc128&)            = delete;
+  NativeAesCbc128& operator=(const NativeAesCbc128&) = delete;
+};
+} // namespace crypto
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_NATIVEAESCBC_H_
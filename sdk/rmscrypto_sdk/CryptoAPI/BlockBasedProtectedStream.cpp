@@ -6,24 +6,42 @@
  * ======================================================================
  */
 
+#include <algorithm>
+#include <cstring>
 #include <limits>
+#include <thread>
 #include "BlockBasedProtectedStream.h"
 #include "RMSCryptoExceptions.h"
 using namespace std;
 namespace rmscrypto {
 namespace api {
+// reads of at least 1 MB of whole blocks are decrypted in parallel by default
+static const uint64_t DEFAULT_PARALLEL_READ_THRESHOLD = 1024 * 1024;
+
+// aligned ranges of at least this many whole blocks bypass the block cache
+static const uint64_t MIN_DIRECT_IO_BLOCKS = 2;
+
+// size of the backing reads issued by pipelined reads
+static const uint64_t PIPELINED_READ_CHUNK_SIZE = 64 * 1024;
+
+// the padding can take the cipher text of the final block this many bytes
+// into the next block
+static const uint64_t MAX_FINAL_BLOCK_PADDING = 16;
+
 shared_ptr<BlockBasedProtectedStream>BlockBasedProtectedStream::Create(
   shared_ptr<ICryptoProvider>pCryptoProvider,
   shared_ptr<IStream>        pBackingStream,
   uint64_t                   u64ContentStart,
   uint64_t                   u64ContentSize,
-  uint64_t                   u64BlockSize) {
+  uint64_t                   u64BlockSize,
+  uint64_t                   u64CacheSize) {
   return std::shared_ptr<BlockBasedProtectedStream>(
     new BlockBasedProtectedStream(pCryptoProvider,
                                   pBackingStream,
                                   u64ContentStart,
                                   u64ContentSize,
-                                  u64BlockSize));
+                                  u64BlockSize,
+                                  u64CacheSize));
 }
 
 BlockBasedProtectedStream::BlockBasedProtectedStream(
@@ -31,26 +49,44 @@ BlockBasedProtectedStream::BlockBasedProtectedStream(
   shared_ptr<IStream>        pBackingStream,
   uint64_t                   u64ContentStart,
   uint64_t                   u64ContentSize,
-  uint64_t                   u64BlockSize)
+  uint64_t                   u64BlockSize,
+  uint64_t                   u64CacheSize)
   : m_locker(new mutex)
+  , m_queue(SerialQueue::Create())
   , m_u64Position(0)
   , m_bIsPositionValid(true)
   , m_u64NewSize(0)
   , m_bIsPlainText(pCryptoProvider == nullptr)
+  , m_bCanRead(false)
+  , m_bCanWrite(false)
+  , m_u64ParallelReadThreshold(DEFAULT_PARALLEL_READ_THRESHOLD)
+  , m_u32ReadPipelineDepth(0)
+  , m_bIsConcurrent(false)
+  , m_u64Size(0)
 {
   m_pSimple.reset(new SimpleProtectedStream(pCryptoProvider, pBackingStream,
                                             u64ContentStart, u64ContentSize));
-  m_pCachedBlock.reset(new CachedBlock(m_pSimple, u64BlockSize));
+  m_pCachedBlock.reset(new CachedBlock(m_pSimple, u64BlockSize, u64CacheSize));
+
+  m_bCanRead  = m_pSimple->CanRead();
+  m_bCanWrite = m_pSimple->CanWrite();
 }
 
 BlockBasedProtectedStream::BlockBasedProtectedStream(
   const BlockBasedProtectedStream& rhs)
   : enable_shared_from_this<BlockBasedProtectedStream>(rhs)
   , m_locker(new mutex)
+  , m_queue(SerialQueue::Create())
   , m_u64Position(0)
   , m_bIsPositionValid(true)
   , m_u64NewSize(0)
   , m_bIsPlainText(rhs.m_bIsPlainText)
+  , m_bCanRead(rhs.m_bCanRead)
+  , m_bCanWrite(rhs.m_bCanWrite)
+  , m_u64ParallelReadThreshold(rhs.m_u64ParallelReadThreshold)
+  , m_u32ReadPipelineDepth(rhs.m_u32ReadPipelineDepth.load())
+  , m_bIsConcurrent(false)
+  , m_u64Size(0)
 {
   m_pSimple = dynamic_pointer_cast<SimpleProtectedStream>(rhs.m_pSimple->Clone());
 
@@ -58,7 +94,12 @@ BlockBasedProtectedStream::BlockBasedProtectedStream(
     throw exceptions::RMSCryptoNullPointerException("Failed to clone stream");
   }
   m_pCachedBlock.reset(new CachedBlock(m_pSimple,
-                                       rhs.m_pCachedBlock->GetBlockSize()));
+                                       rhs.m_pCachedBlock->GetBlockSize(),
+                                       rhs.m_pCachedBlock->GetCacheSize()));
+
+  if (rhs.m_bIsConcurrent) {
+    SetConcurrentAccess(true);
+  }
 }
 
 shared_future<int64_t>BlockBasedProtectedStream::ReadAsync(uint8_t    *pbBuffer,
@@ -77,6 +118,21 @@ shared_future<int64_t>BlockBasedProtectedStream::ReadAsync(uint8_t    *pbBuffer,
     throw exceptions::RMSCryptoInvalidArgumentException("Invalid operation");
   }
 
+  if (m_bIsConcurrent)
+  {
+    auto selfPtr = this->shared_from_this();
+
+    // neither locked nor ordered here, see SetConcurrentAccess()
+    return Async(*Executor::Default(), launchType,
+                 [](shared_ptr<BlockBasedProtectedStream>self,
+                    uint8_t      *buffer,
+                    int64_t       bSize,
+                    int64_t offset) -> int64_t
+        {
+          return self->ReadConcurrent(buffer, offset, bSize);
+        }, move(selfPtr), pbBuffer, cbBuffer, cbOffset);
+  }
+
   // lock resources
   unique_lock<mutex> lock(*m_locker);
 
@@ -92,44 +148,62 @@ shared_future<int64_t>BlockBasedProtectedStream::ReadAsync(uint8_t    *pbBuffer,
 
   auto selfPtr = this->shared_from_this();
 
-  return async(launchType, [](shared_ptr<BlockBasedProtectedStream>self,
-                              uint8_t      *buffer,
-                              int64_t       bSize,
-                              int64_t offset) -> int64_t
+  return Async(*m_queue, launchType,
+               [](shared_ptr<BlockBasedProtectedStream>self,
+                  uint8_t      *buffer,
+                  int64_t       bSize,
+                  int64_t offset) -> int64_t
       {
         // lock resources
         unique_lock<mutex>lock(*self->m_locker);
 
-        // seek to offset
-        self->SeekInternal(offset);
+        return self->ReadSerialized(buffer, offset, bSize);
+      }, move(selfPtr), pbBuffer, cbBuffer, cbOffset);
+}
 
-        int64_t u64Size = bSize;
+int64_t BlockBasedProtectedStream::ReadSerialized(uint8_t *pbBuffer,
+                                                  uint64_t u64Offset,
+                                                  uint64_t u64Size)
+{
+  // seek to offset
+  SeekInternal(u64Offset);
 
-        while (u64Size > 0 && self->m_u64Position < self->SizeInner())
-        {
-          self->m_pCachedBlock->UpdateBlock(self->m_u64Position);
+  // concurrent interior reads and writes move m_u64Position without m_locker,
+  // so only publish it once done
+  uint64_t u64Position = u64Offset;
+  uint64_t u64Left     = u64Size;
 
-          uint64_t u64Read = self->m_pCachedBlock->ReadFromBlock(
-            buffer, self->m_u64Position, u64Size);
+  while (u64Left > 0 && u64Position < SizeInner())
+  {
+    // aligned ranges go straight to the backing stream
+    uint64_t u64Read = ReadBlocksDirect(pbBuffer, u64Position, u64Left);
+
+    if (0 == u64Read)
+    {
+      m_pCachedBlock->UpdateBlock(u64Position);
 
-          if (0 == u64Read)
-          {
-            // nothing to read anymore
-            break;
-          }
+      u64Read = m_pCachedBlock->ReadFromBlock(pbBuffer, u64Position, u64Left);
+    }
 
-          // advance the buffer pointer
-          buffer += u64Read;
+    if (0 == u64Read)
+    {
+      // nothing to read anymore
+      break;
+    }
 
-          // advance the current position
-          self->m_u64Position += u64Read;
+    // advance the buffer pointer
+    pbBuffer += u64Read;
 
-          // decrease the number of uint8_ts to be read
-          u64Size -= u64Read;
-        }
+    // advance the current position
+    u64Position += u64Read;
 
-        return static_cast<uint64_t>((bSize) - u64Size);
-      }, move(selfPtr), pbBuffer, cbBuffer, cbOffset);
+    // decrease the number of uint8_ts to be read
+    u64Left -= u64Read;
+  }
+
+  m_u64Position = u64Position;
+
+  return static_cast<int64_t>(u64Size - u64Left);
 }
 
 shared_future<int64_t>BlockBasedProtectedStream::WriteAsync(
@@ -184,9 +258,24 @@ shared_future<int64_t>BlockBasedProtectedStream::WriteInternalAsync(
     return ret;
   }
 
+  if (fLockResources && m_bIsConcurrent)
+  {
+    auto selfPtr = this->shared_from_this();
+
+    // neither locked nor ordered here, see SetConcurrentAccess()
+    return Async(*Executor::Default(), launchType,
+                 [](shared_ptr<BlockBasedProtectedStream>self,
+                    const uint8_t *buffer,
+                    int64_t bSize,
+                    int64_t offset) -> int64_t
+        {
+          return self->WriteConcurrent(buffer, offset, bSize);
+        }, move(selfPtr), cpbBuffer, cbBuffer, cbOffset);
+  }
+
   auto selfPtr = this->shared_from_this();
 
-  return async(launchType,
+  return Async(*m_queue, launchType,
                [](shared_ptr<BlockBasedProtectedStream>self,
                   const uint8_t *buffer,
                   int64_t bSize,
@@ -194,57 +283,464 @@ shared_future<int64_t>BlockBasedProtectedStream::WriteInternalAsync(
                   bool          fNeedLock) -> int64_t
       {
         // lock resources
-        if (fNeedLock) self->m_locker->lock();
-
-        if (!self->m_bIsPositionValid) {
-          throw exceptions::RMSCryptoInvalidArgumentException(
-            "Invalid operation");
-        }
-
-        // the number of uint8_ts to write
-        uint64_t sizeRemaining = bSize;
-
-        try {
-            // seek to write
-            self->SeekInternal(offset);
-
-            while (sizeRemaining > 0)
-            {
-              self->m_pCachedBlock->UpdateBlock(self->m_u64Position);
-
-              uint64_t u64Written = self->m_pCachedBlock->WriteToBlock(
-                buffer,
-                self->m_u64Position,
-                sizeRemaining);
-
-              if (0 == u64Written)
-              {
-                // nothing to write
-                break;
-              }
-
-              // advance the buffer pointer
-              buffer += u64Written;
-
-              // advance the current position
-              self->m_u64Position += u64Written;
-
-              // decrease the number to be written
-              sizeRemaining -= u64Written;
-            }
-        }
-        catch(exceptions::RMSCryptoException) {
-            if (fNeedLock) self->m_locker->unlock();
-            throw;
-        }
-
-        if (fNeedLock) self->m_locker->unlock();
-
-        // return total number of written
-        return static_cast<int64_t>(bSize - sizeRemaining);
+        unique_lock<mutex>lock(*self->m_locker, defer_lock);
+
+        if (fNeedLock) lock.lock();
+
+        return self->WriteSerialized(buffer, offset, bSize);
       }, move(selfPtr), cpbBuffer, cbBuffer, cbOffset, fLockResources);
 }
 
+int64_t BlockBasedProtectedStream::WriteSerialized(const uint8_t *cpbBuffer,
+                                                   uint64_t       u64Offset,
+                                                   uint64_t       u64Size)
+{
+  if (!m_bIsPositionValid) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Invalid operation");
+  }
+
+  // the number of uint8_ts to write
+  uint64_t sizeRemaining = u64Size;
+
+  // seek to write
+  SeekInternal(u64Offset);
+
+  // see ReadSerialized()
+  uint64_t u64Position = u64Offset;
+
+  while (sizeRemaining > 0)
+  {
+    // aligned ranges are encrypted and written in one go
+    uint64_t u64Written = m_pCachedBlock->WriteBlocks(cpbBuffer,
+                                                      u64Position,
+                                                      sizeRemaining,
+                                                      MIN_DIRECT_IO_BLOCKS);
+
+    if (0 == u64Written)
+    {
+      m_pCachedBlock->UpdateBlock(u64Position);
+
+      u64Written = m_pCachedBlock->WriteToBlock(cpbBuffer,
+                                                u64Position,
+                                                sizeRemaining);
+    }
+
+    if (0 == u64Written)
+    {
+      // nothing to write
+      break;
+    }
+
+    // advance the buffer pointer
+    cpbBuffer += u64Written;
+
+    // advance the current position
+    u64Position += u64Written;
+
+    // decrease the number to be written
+    sizeRemaining -= u64Written;
+  }
+
+  m_u64Position = u64Position;
+
+  // return total number of written
+  return static_cast<int64_t>(u64Size - sizeRemaining);
+}
+
+uint64_t BlockBasedProtectedStream::ReadBlocksDirect(uint8_t *pbBuffer,
+                                                     uint64_t u64Position,
+                                                     uint64_t u64Size)
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+
+  // The cache goes first if it holds data that hasn't reached the backing
+  // stream yet, or if the position isn't at a block boundary
+  if (m_pCachedBlock->IsWritePending() || (u64Position % u64BlockSize != 0) ||
+      (u64Size / u64BlockSize < MIN_DIRECT_IO_BLOCKS)) {
+    return 0;
+  }
+
+  // blocks written behind must have reached the backing stream
+  m_pCachedBlock->WaitForWritesBehind();
+
+  uint64_t u64CipherSize = m_pSimple->Size();
+
+  if (u64CipherSize == 0) {
+    return 0;
+  }
+
+  // Only whole blocks which are not the final (padded) block
+  uint64_t u64End = min(u64Position + (u64Size / u64BlockSize) * u64BlockSize,
+                        ((u64CipherSize - 1) / u64BlockSize) * u64BlockSize);
+
+  if ((u64End <= u64Position) ||
+      ((u64End - u64Position) / u64BlockSize < MIN_DIRECT_IO_BLOCKS)) {
+    return 0;
+  }
+
+  if (u64End - u64Position < m_u64ParallelReadThreshold)
+  {
+    return static_cast<uint64_t>(ReadRange(pbBuffer, u64Position,
+                                           u64End - u64Position));
+  }
+
+  uint64_t u64Blocks = (u64End - u64Position) / u64BlockSize;
+  uint64_t u64Tasks  = max(1u, thread::hardware_concurrency());
+  u64Tasks = min(u64Tasks, u64Blocks);
+
+  uint64_t u64BlocksPerTask = (u64Blocks + u64Tasks - 1) / u64Tasks;
+
+  vector<TaskHandle<int64_t> > tasks;
+
+  for (uint64_t u64First = 0; u64First < u64Blocks;
+       u64First += u64BlocksPerTask)
+  {
+    uint64_t u64Offset = u64Position + u64First * u64BlockSize;
+    uint64_t u64Length = min(u64BlocksPerTask, u64Blocks - u64First) *
+                         u64BlockSize;
+    tasks.push_back(Spawn(*Executor::Default(),
+                          [this](uint8_t *buffer,
+                                 uint64_t offset,
+                                 uint64_t length) -> int64_t
+        {
+          return ReadRange(buffer, offset, length);
+        }, pbBuffer + u64First * u64BlockSize, u64Offset, u64Length));
+  }
+
+  uint64_t u64Read = 0;
+
+  // wait for every range before rethrowing, the buffer must outlive them
+  exception_ptr error;
+
+  for (auto& task : tasks)
+  {
+    try {
+      u64Read += static_cast<uint64_t>(task.Get());
+    }
+    catch (...) {
+      error = current_exception();
+    }
+  }
+
+  if (error) {
+    rethrow_exception(error);
+  }
+
+  return u64Read;
+}
+
+int64_t BlockBasedProtectedStream::ReadRange(uint8_t *pbBuffer,
+                                             uint64_t u64Position,
+                                             uint64_t u64Size)
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+
+  if (m_u32ReadPipelineDepth > 0)
+  {
+    uint64_t u64ChunkSize = max(u64BlockSize,
+                                PIPELINED_READ_CHUNK_SIZE / u64BlockSize *
+                                u64BlockSize);
+
+    return m_pSimple->ReadPipelined(pbBuffer, static_cast<int64_t>(u64Size),
+                                    static_cast<int64_t>(u64Position),
+                                    u64BlockSize, u64ChunkSize,
+                                    m_u32ReadPipelineDepth);
+  }
+
+  // one backing read and one decrypt call for the whole range
+  return m_pSimple->ReadInternalAsync(
+    pbBuffer, static_cast<int64_t>(u64Size), static_cast<int64_t>(u64Position),
+    std::launch::deferred,
+    u64Position / u64BlockSize, false).get();
+}
+
+int64_t BlockBasedProtectedStream::ReadConcurrent(uint8_t *pbBuffer,
+                                                  uint64_t u64Offset,
+                                                  uint64_t u64Size)
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+  uint64_t u64First           = u64Offset / u64BlockSize;
+
+  if (u64Size > 0)
+  {
+    uint64_t u64End = (u64Offset + u64Size - 1) / u64BlockSize + 1;
+
+    if (u64End <= FirstTailBlock())
+    {
+      RangeLock::Scope range(m_ranges, u64First, u64End, false);
+
+      // the stream may have been truncated in the meantime
+      if (u64End <= FirstTailBlock())
+      {
+        uint64_t u64Read = ReadInteriorBlocks(pbBuffer, u64Offset, u64Size);
+
+        m_u64Position = u64Offset + u64Read;
+        return static_cast<int64_t>(u64Read);
+      }
+    }
+  }
+
+  // the range reaches the tail, which only the cached block may touch
+  RangeLock::Scope range(m_ranges, min(u64First, FirstTailBlock()),
+                         RangeLock::END, false);
+
+  // lock resources
+  unique_lock<mutex> lock(*m_locker);
+
+  int64_t cbRead = 0;
+
+  try {
+    cbRead = ReadSerialized(pbBuffer, u64Offset, u64Size);
+  }
+  catch (...) {
+    PublishState();
+    throw;
+  }
+
+  PublishState();
+  return cbRead;
+}
+
+int64_t BlockBasedProtectedStream::WriteConcurrent(const uint8_t *cpbBuffer,
+                                                   uint64_t       u64Offset,
+                                                   uint64_t       u64Size)
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+  uint64_t u64First           = u64Offset / u64BlockSize;
+
+  if (u64Size > 0)
+  {
+    uint64_t u64End = (u64Offset + u64Size - 1) / u64BlockSize + 1;
+
+    if (u64End <= FirstTailBlock())
+    {
+      RangeLock::Scope range(m_ranges, u64First, u64End, true);
+
+      // the stream may have been truncated in the meantime
+      if (u64End <= FirstTailBlock())
+      {
+        WriteInteriorBlocks(cpbBuffer, u64Offset, u64Size);
+
+        m_u64Position = u64Offset + u64Size;
+        return static_cast<int64_t>(u64Size);
+      }
+    }
+  }
+
+  // the range reaches the tail (or grows the stream), which only the cached
+  // block may touch
+  RangeLock::Scope range(m_ranges, min(u64First, FirstTailBlock()),
+                         RangeLock::END, true);
+
+  // lock resources
+  unique_lock<mutex> lock(*m_locker);
+
+  int64_t cbWritten = 0;
+
+  try {
+    cbWritten = WriteSerialized(cpbBuffer, u64Offset, u64Size);
+  }
+  catch (...) {
+    PublishState();
+    throw;
+  }
+
+  PublishState();
+  return cbWritten;
+}
+
+uint64_t BlockBasedProtectedStream::ReadInteriorBlocks(uint8_t *pbBuffer,
+                                                       uint64_t u64Offset,
+                                                       uint64_t u64Size)
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+  vector<uint8_t> block;
+  uint64_t u64Done = 0;
+
+  while (u64Done < u64Size)
+  {
+    uint64_t u64Position = u64Offset + u64Done;
+    uint64_t u64InBlock  = u64Position % u64BlockSize;
+    uint64_t u64Left     = u64Size - u64Done;
+
+    if ((u64InBlock == 0) && (u64Left >= u64BlockSize))
+    {
+      // whole blocks are decrypted straight into the buffer
+      uint64_t u64Length = u64Left / u64BlockSize * u64BlockSize;
+      uint64_t u64Read   = static_cast<uint64_t>(
+        ReadRange(pbBuffer + u64Done, u64Position, u64Length));
+
+      u64Done += u64Read;
+
+      if (u64Read < u64Length) {
+        break;
+      }
+      continue;
+    }
+
+    // partial blocks go through the cache of clean blocks
+    block.resize(static_cast<size_t>(u64BlockSize));
+    ReadInteriorBlock(block.data(), u64Position - u64InBlock);
+
+    uint64_t u64Length = min(u64BlockSize - u64InBlock, u64Left);
+    memcpy(pbBuffer + u64Done, &block[static_cast<size_t>(u64InBlock)],
+           static_cast<size_t>(u64Length));
+    u64Done += u64Length;
+  }
+
+  return u64Done;
+}
+
+void BlockBasedProtectedStream::ReadInteriorBlock(uint8_t *pbBlock,
+                                                  uint64_t u64BlockStart)
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+  auto     pBlockCache        = m_pCachedBlock->GetBlockCache();
+  uint64_t u64BlockNumber     = u64BlockStart / u64BlockSize;
+  uint64_t u64Cached = 0;
+
+  if (pBlockCache->Lookup(u64BlockNumber, pbBlock, u64Cached) &&
+      (u64Cached == u64BlockSize)) {
+    return;
+  }
+
+  uint64_t u64Generation = pBlockCache->GetGeneration();
+
+  if (ReadRange(pbBlock, u64BlockStart, u64BlockSize) !=
+      static_cast<int64_t>(u64BlockSize)) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Read error");
+  }
+
+  pBlockCache->Insert(u64BlockNumber, pbBlock, u64BlockSize, u64Generation);
+}
+
+void BlockBasedProtectedStream::WriteInteriorBlocks(const uint8_t *cpbBuffer,
+                                                    uint64_t       u64Offset,
+                                                    uint64_t       u64Size)
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+  uint64_t u64Start           = u64Offset / u64BlockSize * u64BlockSize;
+  uint64_t u64End             = (u64Offset + u64Size + u64BlockSize - 1) /
+                                u64BlockSize * u64BlockSize;
+  const uint8_t *pbPlainText = cpbBuffer;
+  vector<uint8_t> blocks;
+
+  if ((u64Start != u64Offset) || (u64End != u64Offset + u64Size))
+  {
+    // merge the data with the rest of the partial head and tail blocks
+    uint64_t u64LastStart = u64End - u64BlockSize;
+
+    blocks.resize(static_cast<size_t>(u64End - u64Start));
+
+    if (u64Start != u64Offset) {
+      ReadInteriorBlock(&blocks[0], u64Start);
+    }
+
+    if ((u64End != u64Offset + u64Size) &&
+        ((u64LastStart != u64Start) || (u64Start == u64Offset))) {
+      ReadInteriorBlock(&blocks[static_cast<size_t>(u64LastStart - u64Start)],
+                        u64LastStart);
+    }
+
+    memcpy(&blocks[static_cast<size_t>(u64Offset - u64Start)], cpbBuffer,
+           static_cast<size_t>(u64Size));
+    pbPlainText = blocks.data();
+  }
+
+  uint64_t u64FirstBlock = u64Start / u64BlockSize;
+
+  m_pSimple->WriteInternalAsync(pbPlainText,
+                                static_cast<int64_t>(u64End - u64Start),
+                                static_cast<int64_t>(u64Start),
+                                std::launch::deferred,
+                                u64FirstBlock,
+                                false).get();
+
+  // cached copies are stale now
+  m_pCachedBlock->GetBlockCache()->Invalidate(
+    u64FirstBlock, (u64End - u64Start) / u64BlockSize);
+}
+
+uint64_t BlockBasedProtectedStream::FirstTailBlock() const
+{
+  const uint64_t u64BlockSize = m_pCachedBlock->GetBlockSize();
+  uint64_t u64Size            = m_u64Size;
+
+  // the final block starts at most a block and its padding before the end
+  if (u64Size <= u64BlockSize + MAX_FINAL_BLOCK_PADDING) {
+    return 0;
+  }
+
+  return (u64Size - MAX_FINAL_BLOCK_PADDING - 1) / u64BlockSize;
+}
+
+void BlockBasedProtectedStream::PublishState()
+{
+  m_u64Size = SizeInner();
+
+  // the blocks before the tail are accessed directly from now on
+  m_pCachedBlock->ReleaseBlocksBefore(FirstTailBlock() *
+                                      m_pCachedBlock->GetBlockSize());
+}
+
+void BlockBasedProtectedStream::SetConcurrentAccess(bool bIsConcurrent)
+{
+  if (m_bIsPlainText) {
+    return;
+  }
+
+  // wait for the operations in flight
+  RangeLock::Scope range(m_ranges, 0, RangeLock::END, true);
+
+  // lock resources
+  unique_lock<mutex> lock(*m_locker);
+
+  if (bIsConcurrent) {
+    PublishState();
+  }
+
+  m_bIsConcurrent = bIsConcurrent;
+}
+
+bool BlockBasedProtectedStream::GetConcurrentAccess() const
+{
+  return m_bIsConcurrent;
+}
+
+void BlockBasedProtectedStream::SetParallelReadThreshold(uint64_t u64Threshold)
+{
+  // lock resources
+  unique_lock<mutex> lock(*m_locker);
+
+  m_u64ParallelReadThreshold = max<uint64_t>(u64Threshold, 1);
+}
+
+uint64_t BlockBasedProtectedStream::GetParallelReadThreshold() const
+{
+  // lock resources
+  unique_lock<mutex> lock(*m_locker);
+
+  return m_u64ParallelReadThreshold;
+}
+
+void BlockBasedProtectedStream::SetReadPipelineDepth(uint32_t u32Depth)
+{
+  // lock resources
+  unique_lock<mutex> lock(*m_locker);
+
+  m_u32ReadPipelineDepth = u32Depth;
+}
+
+uint32_t BlockBasedProtectedStream::GetReadPipelineDepth() const
+{
+  // lock resources
+  unique_lock<mutex> lock(*m_locker);
+
+  return m_u32ReadPipelineDepth;
+}
+
 future<bool>BlockBasedProtectedStream::FlushAsync(launch launchType)
 {
   if (m_bIsPlainText)
@@ -256,7 +752,26 @@ future<bool>BlockBasedProtectedStream::FlushAsync(launch launchType)
 
   auto selfPtr = this->shared_from_this();
 
-  return async(launchType, [](shared_ptr<BlockBasedProtectedStream>self) -> bool
+  if (m_bIsConcurrent)
+  {
+    return Async(*Executor::Default(), launchType,
+                 [](shared_ptr<BlockBasedProtectedStream>self) -> bool
+        {
+          // wait for the operations in flight
+          RangeLock::Scope range(self->m_ranges, 0, RangeLock::END, true);
+
+          // lock resources
+          unique_lock<mutex>lock(*self->m_locker);
+
+          bool bResult = self->m_pCachedBlock->Flush();
+
+          self->PublishState();
+          return bResult;
+        }, move(selfPtr));
+  }
+
+  return Async(*m_queue, launchType,
+               [](shared_ptr<BlockBasedProtectedStream>self) -> bool
       {
         // lock resources
         unique_lock<mutex>lock(*self->m_locker);
@@ -287,34 +802,45 @@ shared_ptr<IStream>BlockBasedProtectedStream::Clone()
 
 void BlockBasedProtectedStream::Seek(uint64_t u64Position)
 {
+  if (m_bIsConcurrent && (u64Position <= m_u64Size))
+  {
+    m_u64Position = u64Position;
+    return;
+  }
+
+  // seeking past the end may grow the stream
+  RangeLock::Scope range(m_ranges, 0, RangeLock::END, true);
+
   // lock resources
   unique_lock<mutex> lock(*m_locker);
   SeekInternal(u64Position);
+
+  if (m_bIsConcurrent) {
+    PublishState();
+  }
 }
 
 bool BlockBasedProtectedStream::CanRead() const
 {
-  // lock resources
-  unique_lock<mutex> lock(*m_locker);
-
-  return m_pSimple->CanRead();
+  return m_bCanRead;
 }
 
 bool BlockBasedProtectedStream::CanWrite() const
 {
-  // lock resources
-  unique_lock<mutex> lock(*m_locker);
-
   return CanWriteInner();
 }
 
 bool BlockBasedProtectedStream::CanWriteInner() const
 {
-  return m_pSimple->CanWrite();
+  return m_bCanWrite;
 }
 
 uint64_t BlockBasedProtectedStream::Position()
 {
+  if (m_bIsConcurrent) {
+    return m_u64Position;
+  }
+
   // lock resources
   unique_lock<mutex> lock(*m_locker);
   return PositionInner();
@@ -322,6 +848,10 @@ uint64_t BlockBasedProtectedStream::Position()
 
 uint64_t BlockBasedProtectedStream::Size()
 {
+  if (m_bIsConcurrent) {
+    return m_u64Size;
+  }
+
   // lock resources
   unique_lock<mutex> lock(*m_locker);
   return SizeInner();
@@ -389,9 +919,16 @@ void BlockBasedProtectedStream::Size(uint64_t value) {
     throw exceptions::RMSCryptoInvalidArgumentException("Invalid operation");
   }
 
+  // wait for the operations in flight
+  RangeLock::Scope range(m_ranges, 0, RangeLock::END, true);
+
   // lock resources
   unique_lock<mutex> lock(*m_locker);
   SizeInner(value);
+
+  if (m_bIsConcurrent) {
+    PublishState();
+  }
 }
 
 void BlockBasedProtectedStream::ProcessSizeChangeRequest()
@@ -9,12 +9,16 @@
 #ifndef _CRYPTO_STREAMS_LIB_PROTECTION_BLOCKBASEDPROTECTEDSTREAM_H_
 #define _CRYPTO_STREAMS_LIB_PROTECTION_BLOCKBASEDPROTECTEDSTREAM_H_
 
+#include <atomic>
 #include <mutex>
 #include "CryptoAPIExport.h"
+#include "CryptoAPI.h"
 #include "IStream.h"
 #include "ICryptoProvider.h"
 #include "SimpleProtectedStream.h"
 #include "CachedBlock.h"
+#include "Executor.h"
+#include "RangeLock.h"
 
 namespace rmscrypto {
 namespace api {
@@ -28,7 +32,8 @@ public:
     std::shared_ptr<IStream>        pBackingStream,
     uint64_t                        u64ContentStart,
     uint64_t                        u64ContentSize,
-    uint64_t                        u64BlockSize);
+    uint64_t                        u64BlockSize,
+    uint64_t                        u64CacheSize = DEFAULT_BLOCK_CACHE_SIZE);
 
   // IStream implementation
   virtual std::shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
@@ -60,6 +65,33 @@ public:
 
   virtual ~BlockBasedProtectedStream() override;
 
+  // Aligned reads and writes of several whole blocks bypass the block cache
+  // and reach the backing stream as one I/O. Reads that cover at least
+  // u64Threshold bytes of whole blocks are also split into block aligned
+  // ranges and decrypted concurrently. The partial head and tail blocks still
+  // go through the block cache.
+  // std::numeric_limits<uint64_t>::max() disables parallel reads.
+  DLL_PUBLIC_CRYPTO void     SetParallelReadThreshold(uint64_t u64Threshold);
+  DLL_PUBLIC_CRYPTO uint64_t GetParallelReadThreshold() const;
+
+  // Pipelined mode: direct reads are split into chunks and the ciphertext of
+  // up to u32Depth chunks is requested ahead of the chunk being decrypted.
+  // Meant for backing streams with real asynchronous I/O (see
+  // CreateAsyncStreamFromFile). 0, the default, reads each range in one call.
+  DLL_PUBLIC_CRYPTO void     SetReadPipelineDepth(uint32_t u32Depth);
+  DLL_PUBLIC_CRYPTO uint32_t GetReadPipelineDepth() const;
+
+  // Concurrent mode: reads and writes with an explicit offset lock only the
+  // blocks they touch, so threads working on disjoint block ranges of the
+  // stream run in parallel, and Position(), Size(), CanRead() and CanWrite()
+  // don't wait for them. Operations touching the final block (including
+  // appends and size changes) still run one at a time. Operations issued
+  // concurrently may complete in any order; overlapping ones are applied in the
+  // order they were issued. Switch modes while no operation is pending. Plain
+  // text streams ignore the setting.
+  DLL_PUBLIC_CRYPTO void     SetConcurrentAccess(bool bIsConcurrent);
+  DLL_PUBLIC_CRYPTO bool     GetConcurrentAccess() const;
+
 private:
 
   BlockBasedProtectedStream(
@@ -67,7 +99,8 @@ private:
     std::shared_ptr<IStream>        pBackingStream,
     uint64_t                        u64ContentStart,
     uint64_t                        u64ContentSize,
-    uint64_t                        u64BlockSize);
+    uint64_t                        u64BlockSize,
+    uint64_t                        u64CacheSize);
 
   void                       SeekInternal(uint64_t u64Position);
   uint64_t                   PositionInner();
@@ -80,6 +113,39 @@ private:
                                                 std::launch    launchType,
                                                 bool           fLockResources);
 
+  uint64_t                   ReadBlocksDirect(uint8_t *pbBuffer,
+                                              uint64_t u64Position,
+                                              uint64_t u64Size);
+  int64_t                    ReadRange(uint8_t *pbBuffer,
+                                       uint64_t u64Position,
+                                       uint64_t u64Size);
+
+  // the caller holds m_locker
+  int64_t                    ReadSerialized(uint8_t *pbBuffer,
+                                            uint64_t u64Offset,
+                                            uint64_t u64Size);
+  int64_t                    WriteSerialized(const uint8_t *cpbBuffer,
+                                             uint64_t       u64Offset,
+                                             uint64_t       u64Size);
+
+  // concurrent mode
+  int64_t                    ReadConcurrent(uint8_t *pbBuffer,
+                                            uint64_t u64Offset,
+                                            uint64_t u64Size);
+  int64_t                    WriteConcurrent(const uint8_t *cpbBuffer,
+                                             uint64_t       u64Offset,
+                                             uint64_t       u64Size);
+  uint64_t                   ReadInteriorBlocks(uint8_t *pbBuffer,
+                                                uint64_t u64Offset,
+                                                uint64_t u64Size);
+  void                       ReadInteriorBlock(uint8_t *pbBlock,
+                                               uint64_t u64BlockStart);
+  void                       WriteInteriorBlocks(const uint8_t *cpbBuffer,
+                                                 uint64_t       u64Offset,
+                                                 uint64_t       u64Size);
+  uint64_t                   FirstTailBlock() const;
+  void                       PublishState();
+
   void                       ProcessSizeChangeRequest();
   void                       SizeInternal(uint64_t size);
   void                       FillWithZeros(uint64_t newSize);
@@ -92,13 +158,28 @@ private:
 
   std::shared_ptr<std::mutex> m_locker;
 
+  // keeps asynchronous operations in the order they were issued
+  std::shared_ptr<SerialQueue> m_queue;
+
   std::shared_ptr<SimpleProtectedStream> m_pSimple;
   std::shared_ptr<CachedBlock> m_pCachedBlock;
 
-  uint64_t m_u64Position;
+  std::atomic<uint64_t> m_u64Position;
   bool     m_bIsPositionValid;
   uint64_t m_u64NewSize;
   bool     m_bIsPlainText;
+  bool     m_bCanRead;
+  bool     m_bCanWrite;
+  uint64_t m_u64ParallelReadThreshold;
+  std::atomic<uint32_t> m_u32ReadPipelineDepth;
+
+  // Concurrent mode. Blocks from FirstTailBlock() on, which hold or may soon
+  // hold the final block, are only accessed under m_locker through
+  // m_pCachedBlock; the blocks before them are read and written directly under
+  // m_ranges. m_u64Size mirrors SizeInner() between operations.
+  std::atomic<bool>     m_bIsConcurrent;
+  std::atomic<uint64_t> m_u64Size;
+  RangeLock m_ranges;
 };
 } // namespace api
 } // namespace rmscrypto
@@ -0,0 +1,156 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#include <cstring>
+#include "BlockCache.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace api {
+BlockCache::BlockCache(uint64_t u64BlockSize, uint64_t u64MemoryBudget)
+  : m_u64BlockSize(u64BlockSize)
+  , m_u64MemoryBudget(u64MemoryBudget)
+  , m_u32Capacity(static_cast<uint32_t>(u64BlockSize > 0
+                                        ? u64MemoryBudget / u64BlockSize
+                                        : 0))
+  , m_u64Generation(0)
+{}
+
+uint64_t BlockCache::GetMemoryBudget() const
+{
+  return m_u64MemoryBudget;
+}
+
+uint32_t BlockCache::GetCapacity() const
+{
+  return m_u32Capacity;
+}
+
+bool BlockCache::Lookup(uint64_t  u64BlockNumber,
+                        uint8_t  *pbBuffer,
+                        uint64_t& u64Size)
+{
+  lock_guard<mutex> lock(m_locker);
+
+  auto it = m_index.find(u64BlockNumber);
+
+  if (it == m_index.end()) {
+    return false;
+  }
+
+  // move to the front
+  m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+  const vector<uint8_t>& data = it->second->data;
+  u64Size = data.size();
+
+  if (!data.empty()) {
+    memcpy(pbBuffer, data.data(), data.size());
+  }
+  return true;
+}
+
+bool BlockCache::Contains(uint64_t u64BlockNumber)
+{
+  lock_guard<mutex> lock(m_locker);
+
+  return m_index.find(u64BlockNumber) != m_index.end();
+}
+
+void BlockCache::Insert(uint64_t       u64BlockNumber,
+                        const uint8_t *pbBuffer,
+                        uint64_t       u64Size,
+                        uint64_t       u64Generation)
+{
+  if ((m_u32Capacity == 0) || (u64Size > m_u64BlockSize)) {
+    return;
+  }
+
+  lock_guard<mutex> lock(m_locker);
+
+  if (u64Generation != m_u64Generation) {
+    // the content has changed since the block was read
+    return;
+  }
+
+  auto it = m_index.find(u64BlockNumber);
+
+  if (it != m_index.end())
+  {
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+  }
+  else if (m_entries.size() < m_u32Capacity)
+  {
+    m_entries.push_front(Entry());
+  }
+  else
+  {
+    // reuse the buffer of the least recently used block
+    m_index.erase(m_entries.back().u64BlockNumber);
+    m_entries.splice(m_entries.begin(), m_entries, --m_entries.end());
+  }
+
+  Entry& entry = m_entries.front();
+  entry.u64BlockNumber = u64BlockNumber;
+  entry.data.assign(pbBuffer, pbBuffer + u64Size);
+  m_index[u64BlockNumber] = m_entries.begin();
+}
+
+void BlockCache::Invalidate(uint64_t u64BlockNumber)
+{
+  lock_guard<mutex> lock(m_locker);
+
+  ++m_u64Generation;
+
+  auto it = m_index.find(u64BlockNumber);
+
+  if (it != m_index.end())
+  {
+    m_entries.erase(it->second);
+    m_index.erase(it);
+  }
+}
+
+void BlockCache::Invalidate(uint64_t u64FirstBlockNumber, uint64_t cBlocks)
+{
+  lock_guard<mutex> lock(m_locker);
+
+  ++m_u64Generation;
+
+  for (auto it = m_entries.begin(); it != m_entries.end();)
+  {
+    if ((it->u64BlockNumber >= u64FirstBlockNumber) &&
+        (it->u64BlockNumber - u64FirstBlockNumber < cBlocks))
+    {
+      m_index.erase(it->u64BlockNumber);
+      it = m_entries.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+void BlockCache::Clear()
+{
+  lock_guard<mutex> lock(m_locker);
+
+  ++m_u64Generation;
+  m_entries.clear();
+  m_index.clear();
+}
+
+uint64_t BlockCache::GetGeneration()
+{
+  lock_guard<mutex> lock(m_locker);
+
+  return m_u64Generation;
+}
+} // namespace api
+} // namespace rmscrypto
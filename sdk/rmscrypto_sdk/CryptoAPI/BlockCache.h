@@ -0,0 +1,72 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _CRYPTO_STREAMS_LIB_BLOCKCACHE_H_
+#define _CRYPTO_STREAMS_LIB_BLOCKCACHE_H_
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace rmscrypto {
+namespace api {
+// LRU cache of decrypted (clean) blocks. The number of blocks is bounded by
+// the memory budget given at construction. The cache is thread safe, so that
+// read-ahead tasks can fill it in the background.
+class BlockCache {
+public:
+
+  BlockCache(uint64_t u64BlockSize,
+             uint64_t u64MemoryBudget);
+
+  uint64_t GetMemoryBudget() const;
+  uint32_t GetCapacity() const;
+
+  // Copies the block into pbBuffer (which must hold a whole block) and
+  // returns true if it's cached.
+  bool     Lookup(uint64_t  u64BlockNumber,
+                  uint8_t  *pbBuffer,
+                  uint64_t& u64Size);
+  bool     Contains(uint64_t u64BlockNumber);
+
+  // Inserts a block, unless the cache has been invalidated since
+  // u64Generation was taken.
+  void     Insert(uint64_t       u64BlockNumber,
+                  const uint8_t *pbBuffer,
+                  uint64_t       u64Size,
+                  uint64_t       u64Generation);
+
+  void     Invalidate(uint64_t u64BlockNumber);
+  void     Invalidate(uint64_t u64FirstBlockNumber,
+                      uint64_t cBlocks);
+  void     Clear();
+  uint64_t GetGeneration();
+
+private:
+
+  struct Entry
+  {
+    uint64_t             u64BlockNumber;
+    std::vector<uint8_t> data;
+  };
+
+  std::mutex m_locker;
+  uint64_t   m_u64BlockSize;
+  uint64_t   m_u64MemoryBudget;
+  uint32_t   m_u32Capacity;
+  uint64_t   m_u64Generation;
+
+  // most recently used first
+  std::list<Entry> m_entries;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+};
+} // namespace api
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_BLOCKCACHE_H_
@@ -14,8 +14,19 @@
 using namespace std;
 namespace rmscrypto {
 namespace api {
+// the most blocks prefetched ahead of a sequential reader
+static const uint32_t MAX_READ_AHEAD_BLOCKS = 16;
+
+// Dirty blocks are written behind in batches of up to this many bytes. One
+// batch is written while the next one is being filled; batches must land in
+// order because some backing streams (e.g. std::stringstream) can't be
+// written past their end.
+static const uint64_t WRITE_BATCH_SIZE            = 64 * 1024;
+static const size_t   MAX_WRITE_BATCHES_IN_FLIGHT = 1;
+
 CachedBlock::CachedBlock(shared_ptr<SimpleProtectedStream>pSimple,
-                         uint64_t                         u64BlockSize)
+                         uint64_t                         u64BlockSize,
+                         uint64_t                         u64CacheSize)
   : m_pSimple(pSimple)
   , m_u64BlockSize(u64BlockSize)
   , m_u64CacheStart(numeric_limits<uint64_t>::max())
@@ -23,19 +34,49 @@ CachedBlock::CachedBlock(shared_ptr<SimpleProtectedStream>pSimple,
   , m_cache(static_cast<size_t>(u64BlockSize))
   , m_bFinalBlockHasBeenWritten(false)
   , m_bWritePending(false)
-{}
+  , m_pBlockCache(make_shared<BlockCache>(u64BlockSize, u64CacheSize))
+  , m_u64LastBlockNumber(numeric_limits<uint64_t>::max())
+  , m_u32SequentialBlocks(0)
+  , m_u64ReadAheadFirst(0)
+  , m_u64ReadAheadEnd(0)
+  , m_bIsInBlockCache(false)
+  , m_u64WriteBatchFirst(0)
+  , m_u32WriteBatchBlocks(0)
+  , m_u64WriteBehindEnd(0)
+{
+  // keep at least half of the cache for blocks which have already been read
+  m_u32ReadAheadBlocks = min(MAX_READ_AHEAD_BLOCKS,
+                             m_pBlockCache->GetCapacity() / 2);
+}
+
+CachedBlock::~CachedBlock()
+{
+  WaitForReadAhead();
+
+  try {
+    WaitForWritesBehind();
+  }
+  catch (...) {
+    // nobody to report to, Flush() is where write errors surface
+  }
+}
 
 uint64_t CachedBlock::GetBlockSize()
 {
   return m_u64BlockSize;
 }
 
+uint64_t CachedBlock::GetCacheSize() const
+{
+  return m_pBlockCache->GetMemoryBudget();
+}
+
 void CachedBlock::UpdateBlock(uint64_t u64Position)
 {
-  uint32_t u32BlockNumber = CalculateBlockNumber(u64Position);
+  uint64_t u64BlockNumber = CalculateBlockNumber(u64Position);
 
   if ((numeric_limits<uint64_t>::max() != m_u64CacheStart) &&
-      (CalculateBlockNumber(m_u64CacheStart) == u32BlockNumber))
+      (CalculateBlockNumber(m_u64CacheStart) == u64BlockNumber))
   {
     // the current cache is up-to-date no need to overwrite it
     return;
@@ -48,7 +89,7 @@ void CachedBlock::UpdateBlock(uint64_t u64Position)
 
     // determine if this is the final block
     bool bCurrentBlockIsLastBlock =
-      (m_u64CacheStart + m_u64BlockSize >= m_pSimple->Size());
+      (m_u64CacheStart + m_u64BlockSize >= BackingSize());
     bool bCurrentBlockIsFinal = false;
 
     if (bCurrentBlockIsLastBlock)
@@ -62,13 +103,23 @@ void CachedBlock::UpdateBlock(uint64_t u64Position)
       }
     }
 
-    // Write the block
-    m_pSimple->WriteInternalAsync(m_cache.data(),
-                                  m_u64CacheSize,
-                                  m_u64CacheStart,
-                                  std::launch::deferred,
-                                  CalculateBlockNumber(m_u64CacheStart),
-                                  bCurrentBlockIsFinal).get();
+    if (!bCurrentBlockIsFinal && (m_u64CacheSize == m_u64BlockSize))
+    {
+      // full blocks in the middle don't depend on the padding, let them be
+      // written in the background
+      WriteBehind(CalculateBlockNumber(m_u64CacheStart));
+    }
+    else
+    {
+      // Write the block
+      WaitForWritesBehind();
+      m_pSimple->WriteInternalAsync(m_cache.data(),
+                                    m_u64CacheSize,
+                                    m_u64CacheStart,
+                                    std::launch::deferred,
+                                    CalculateBlockNumber(m_u64CacheStart),
+                                    bCurrentBlockIsFinal).get();
+    }
 
     if (bCurrentBlockIsFinal)
     {
@@ -76,22 +127,194 @@ void CachedBlock::UpdateBlock(uint64_t u64Position)
     }
 
     m_bWritePending = false;
+
+    // cached copies of this block are stale now
+    m_pBlockCache->Invalidate(CalculateBlockNumber(m_u64CacheStart));
+  }
+  else if ((numeric_limits<uint64_t>::max() != m_u64CacheStart) &&
+           !m_bIsInBlockCache)
+  {
+    // keep the clean block around, it may be read again
+    m_pBlockCache->Insert(CalculateBlockNumber(m_u64CacheStart),
+                          m_cache.data(),
+                          m_u64CacheSize,
+                          m_pBlockCache->GetGeneration());
   }
 
   // calculate the start of the block
-  m_u64CacheStart = static_cast<uint64_t>(u32BlockNumber) * m_u64BlockSize;
+  m_u64CacheStart = u64BlockNumber * m_u64BlockSize;
 
   // determine if this is the final block
   bool bNewBlockIsFinal =
-    (m_u64CacheStart + m_u64BlockSize >= m_pSimple->Size());
-
-  // go to the start of the block and read
-  m_u64CacheSize = m_pSimple->ReadInternalAsync(&m_cache[0],
-                                                m_u64BlockSize,
-                                                m_u64CacheStart,
-                                                std::launch::deferred,
-                                                u32BlockNumber,
-                                                bNewBlockIsFinal).get();
+    (m_u64CacheStart + m_u64BlockSize >= BackingSize());
+
+  LoadBlock(u64BlockNumber, bNewBlockIsFinal);
+}
+
+void CachedBlock::LoadBlock(uint64_t u64BlockNumber, bool bIsFinal)
+{
+  bool bFound = m_pBlockCache->Lookup(u64BlockNumber, &m_cache[0],
+                                      m_u64CacheSize);
+
+  if (!bFound && m_readAhead.Valid() &&
+      (m_u64ReadAheadFirst <= u64BlockNumber) &&
+      (u64BlockNumber < m_u64ReadAheadEnd))
+  {
+    // the block is on its way, don't decrypt it twice
+    WaitForReadAhead();
+    bFound = m_pBlockCache->Lookup(u64BlockNumber, &m_cache[0],
+                                   m_u64CacheSize);
+  }
+
+  m_bIsInBlockCache = bFound;
+
+  if (!bFound && IsWrittenBehind(u64BlockNumber))
+  {
+    // the backing stream doesn't have this block yet
+    WaitForWritesBehind();
+  }
+
+  if (!bFound && (m_u64CacheStart >= m_pSimple->Size()))
+  {
+    // a new block past the end of the stream, blocks before it may still be
+    // written behind
+    m_u64CacheSize = 0;
+  }
+  else if (!bFound)
+  {
+    // go to the start of the block and read
+    m_u64CacheSize = m_pSimple->ReadInternalAsync(&m_cache[0],
+                                                  m_u64BlockSize,
+                                                  m_u64CacheStart,
+                                                  std::launch::deferred,
+                                                  u64BlockNumber,
+                                                  bIsFinal).get();
+  }
+
+  // detect sequential access
+  if (u64BlockNumber == m_u64LastBlockNumber + 1)
+  {
+    ++m_u32SequentialBlocks;
+  }
+  else
+  {
+    m_u32SequentialBlocks = 0;
+  }
+
+  m_u64LastBlockNumber = u64BlockNumber;
+
+  if ((m_u32SequentialBlocks > 0) && !bIsFinal)
+  {
+    ReadAhead(u64BlockNumber);
+  }
+}
+
+void CachedBlock::ReadAhead(uint64_t u64BlockNumber)
+{
+  if ((m_u32ReadAheadBlocks == 0) || (m_u32WriteBatchBlocks > 0) ||
+      !m_writesBehind.empty()) {
+    // don't read what may still be on its way to the backing stream
+    return;
+  }
+
+  if (m_readAhead.Valid())
+  {
+    if (!m_readAhead.IsReady())
+    {
+      // the previous read-ahead is still running
+      return;
+    }
+    WaitForReadAhead();
+  }
+
+  // the window ends m_u32ReadAheadBlocks after the current block, refill it
+  // once half of it has been consumed
+  uint64_t u64WindowEnd = u64BlockNumber + 1 + m_u32ReadAheadBlocks;
+  uint64_t u64First     = u64BlockNumber + 1;
+
+  if ((u64First < m_u64ReadAheadEnd) && (m_u64ReadAheadEnd <= u64WindowEnd))
+  {
+    if (m_u64ReadAheadEnd - u64First > m_u32ReadAheadBlocks / 2) {
+      return;
+    }
+    u64First = m_u64ReadAheadEnd;
+  }
+
+  uint64_t u64CipherSize = m_pSimple->Size();
+  vector<uint64_t> blocks;
+
+  for (uint64_t u64Block = u64First; u64Block < u64WindowEnd; ++u64Block)
+  {
+    // the final block is left to the reader, it may be rewritten
+    if ((u64Block + 1) * m_u64BlockSize >=
+        u64CipherSize) {
+      break;
+    }
+
+    if (!m_pBlockCache->Contains(u64Block)) {
+      blocks.push_back(u64Block);
+    }
+  }
+
+  if (blocks.empty()) {
+    return;
+  }
+
+  auto     pSimple       = m_pSimple;
+  auto     pBlockCache   = m_pBlockCache;
+  uint64_t u64BlockSize  = m_u64BlockSize;
+  uint64_t u64Generation = pBlockCache->GetGeneration();
+
+  m_u64ReadAheadFirst = blocks.front();
+  m_u64ReadAheadEnd   = blocks.back() + 1;
+  m_readAhead         = Spawn(*Executor::Default(),
+                              [pSimple, pBlockCache, u64BlockSize,
+                               u64Generation](vector<uint64_t>blocks)
+      {
+        vector<uint8_t> buffer;
+
+        for (size_t i = 0; i < blocks.size();)
+        {
+          // read each run of consecutive blocks at once
+          size_t cBlocks = 1;
+
+          while ((i + cBlocks < blocks.size()) &&
+                 (blocks[i + cBlocks] == blocks[i] + cBlocks)) {
+            ++cBlocks;
+          }
+
+          buffer.resize(static_cast<size_t>(cBlocks * u64BlockSize));
+
+          try {
+            uint64_t u64Read = pSimple->ReadInternalAsync(
+              &buffer[0], buffer.size(), blocks[i] * u64BlockSize,
+              std::launch::deferred, blocks[i], false).get();
+
+            for (size_t j = 0; j < cBlocks; ++j)
+            {
+              if ((j + 1) * u64BlockSize > u64Read) {
+                break;
+              }
+              pBlockCache->Insert(blocks[i + j], &buffer[j * u64BlockSize],
+                                  u64BlockSize, u64Generation);
+            }
+          }
+          catch (...) {
+            // the reader will hit the same error and report it
+            return;
+          }
+
+          i += cBlocks;
+        }
+      }, move(blocks));
+}
+
+void CachedBlock::WaitForReadAhead()
+{
+  if (m_readAhead.Valid())
+  {
+    m_readAhead.Get();
+  }
 }
 
 uint64_t CachedBlock::ReadFromBlock(uint8_t *pbBuffer,
@@ -152,7 +375,7 @@ uint64_t CachedBlock::WriteToBlock(
 
     // determine if this is the final block
     bool bCurrentBlockIsFinal =
-      (m_u64CacheStart + m_u64BlockSize >= m_pSimple->Size());
+      (m_u64CacheStart + m_u64BlockSize >= BackingSize());
 
     if (bCurrentBlockIsFinal)
     {
@@ -168,7 +391,72 @@ uint64_t CachedBlock::WriteToBlock(
   }
 }
 
-uint32_t CachedBlock::CalculateBlockNumber(uint64_t u64Position) const
+uint64_t CachedBlock::WriteBlocks(const uint8_t *pbBuffer,
+                                  uint64_t       u64Position,
+                                  uint64_t       u64Size,
+                                  uint64_t       u64MinBlocks)
+{
+  if (u64Position % m_u64BlockSize != 0) {
+    return 0;
+  }
+
+  // Leave at least the last block to the cached block, it may turn out to be
+  // the final block and need padding
+  uint64_t u64Blocks = (u64Size - 1) / m_u64BlockSize;
+
+  if ((u64Size == 0) || (u64Blocks < u64MinBlocks)) {
+    return 0;
+  }
+
+  uint64_t u64FirstBlock = u64Position / m_u64BlockSize;
+  uint64_t u64End        = u64Position + u64Blocks * m_u64BlockSize;
+
+  if (numeric_limits<uint64_t>::max() != m_u64CacheStart)
+  {
+    if ((m_u64CacheStart >= u64Position) && (m_u64CacheStart < u64End))
+    {
+      // the cached block is about to be overwritten as a whole
+      m_u64CacheStart = numeric_limits<uint64_t>::max();
+      m_u64CacheSize  = 0;
+      m_bWritePending = false;
+    }
+    else if (m_bWritePending)
+    {
+      // Write the cached block first, the backing stream may not allow writing
+      // past its end. There is more data after it, so it isn't final.
+      WaitForWritesBehind();
+      m_pSimple->WriteInternalAsync(m_cache.data(),
+                                    m_u64CacheSize,
+                                    m_u64CacheStart,
+                                    std::launch::deferred,
+                                    CalculateBlockNumber(m_u64CacheStart),
+                                    false).get();
+      m_bWritePending = false;
+      m_pBlockCache->Invalidate(CalculateBlockNumber(m_u64CacheStart));
+    }
+  }
+
+  WaitForWritesBehind();
+
+  if (u64End >= m_pSimple->Size())
+  {
+    // the final block is overwritten, the cached block will write a new one
+    m_bFinalBlockHasBeenWritten = false;
+  }
+
+  m_pSimple->WriteInternalAsync(pbBuffer,
+                                u64End - u64Position,
+                                u64Position,
+                                std::launch::deferred,
+                                u64FirstBlock,
+                                false).get();
+
+  m_pBlockCache->Invalidate(u64FirstBlock, u64Blocks);
+
+  return u64End - u64Position;
+}
+
+uint64_t CachedBlock::CalculateBlockNumber(uint64_t u64Position) const
 {
   uint64_t u64BlockNumber = u64Position / m_u64BlockSize;
 
@@ -187,7 +475,7 @@ uint32_t CachedBlock::CalculateBlockNumber(uint64_t u64Position) const
     }
   }
 
-  return static_cast<uint32_t>(u64BlockNumber);
+  return u64BlockNumber;
 }
 
 void CachedBlock::RewriteFinalBlock(uint64_t newSize)
@@ -219,6 +507,9 @@ void CachedBlock::RewriteFinalBlock(uint64_t newSize)
     // Now write the uint8_t
     WriteToBlock(&byte, newSize - 1, 1);
   }
+
+  // the backing stream is about to be truncated
+  WaitForWritesBehind();
 }
 
 bool CachedBlock::Flush()
@@ -231,6 +522,8 @@ bool CachedBlock::Flush()
     cacheStart = 0;
   }
 
+  WaitForWritesBehind();
+
   // determine if this is the final block
   bool bIsFinal = (cacheStart + m_u64BlockSize >= m_pSimple->Size());
 
@@ -243,6 +536,7 @@ bool CachedBlock::Flush()
   }
 
   m_bWritePending = false;
+  m_pBlockCache->Invalidate(CalculateBlockNumber(cacheStart));
 
   return m_pSimple->Flush();
 }
@@ -255,12 +549,162 @@ uint64_t CachedBlock::GetSizeInternal() const
   // the size from our own cache
   if (m_bWritePending && !m_bFinalBlockHasBeenWritten)
   {
-    return (CalculateBlockNumber(m_u64CacheStart) *
-            static_cast<uint64_t>(m_u64BlockSize)) +
-           static_cast<uint64_t>(m_u64CacheSize);
+    // an existing stream may be written in the middle before its final block
+    // has been written, that doesn't make it shorter
+    return max(BackingSize(),
+               (CalculateBlockNumber(m_u64CacheStart) *
+                static_cast<uint64_t>(m_u64BlockSize)) +
+               static_cast<uint64_t>(m_u64CacheSize));
+  }
+
+  return BackingSize();
+}
+
+bool CachedBlock::IsWritePending() const
+{
+  return m_bWritePending;
+}
+
+void CachedBlock::ReleaseBlocksBefore(uint64_t u64Position)
+{
+  WaitForReadAhead();
+  WaitForWritesBehind();
+
+  if ((numeric_limits<uint64_t>::max() == m_u64CacheStart) ||
+      (m_u64CacheStart >= u64Position)) {
+    return;
+  }
+
+  if (m_bWritePending)
+  {
+    // there is data after this block, so it isn't final
+    m_pSimple->WriteInternalAsync(m_cache.data(),
+                                  m_u64CacheSize,
+                                  m_u64CacheStart,
+                                  std::launch::deferred,
+                                  CalculateBlockNumber(m_u64CacheStart),
+                                  false).get();
+    m_bWritePending = false;
+    m_pBlockCache->Invalidate(CalculateBlockNumber(m_u64CacheStart));
+  }
+
+  m_u64CacheStart   = numeric_limits<uint64_t>::max();
+  m_u64CacheSize    = 0;
+  m_bIsInBlockCache = false;
+}
+
+shared_ptr<BlockCache>CachedBlock::GetBlockCache() const
+{
+  return m_pBlockCache;
+}
+
+uint64_t CachedBlock::BackingSize() const
+{
+  return max(m_pSimple->Size(), m_u64WriteBehindEnd);
+}
+
+void CachedBlock::WriteBehind(uint64_t u64BlockNumber)
+{
+  if ((m_u32WriteBatchBlocks > 0) &&
+      (m_u64WriteBatchFirst + m_u32WriteBatchBlocks != u64BlockNumber))
+  {
+    // only consecutive blocks go into one batch
+    SubmitWriteBatch();
+  }
+
+  if (m_u32WriteBatchBlocks == 0)
+  {
+    m_u64WriteBatchFirst = u64BlockNumber;
+    m_writeBatch.swap(m_spareWriteBatch);
+    m_writeBatch.clear();
+  }
+
+  m_writeBatch.insert(m_writeBatch.end(), m_cache.begin(), m_cache.end());
+  ++m_u32WriteBatchBlocks;
+
+  m_u64WriteBehindEnd = max(m_u64WriteBehindEnd,
+                            m_u64CacheStart + m_u64BlockSize);
+
+  if (m_writeBatch.size() >= WRITE_BATCH_SIZE)
+  {
+    SubmitWriteBatch();
+  }
+}
+
+void CachedBlock::SubmitWriteBatch()
+{
+  if (m_u32WriteBatchBlocks == 0) {
+    return;
+  }
+
+  while (m_writesBehind.size() >= MAX_WRITE_BATCHES_IN_FLIGHT)
+  {
+    CompleteOldestWrite();
+  }
+
+  PendingWrite write;
+  write.u64FirstBlock = m_u64WriteBatchFirst;
+  write.u32Blocks     = m_u32WriteBatchBlocks;
+  write.buffer.swap(m_writeBatch);
+
+  m_u32WriteBatchBlocks = 0;
+
+  auto     pSimple  = m_pSimple;
+  uint64_t u64Start = write.u64FirstBlock * m_u64BlockSize;
+
+  // the vector's storage stays put while the write is queued
+  write.done = Spawn(*Executor::Default(), [pSimple, u64Start](
+                       const uint8_t *pbBuffer,
+                       uint64_t       u64Size,
+                       uint64_t       u64FirstBlock)
+      {
+        pSimple->WriteInternalAsync(pbBuffer, u64Size, u64Start,
+                                    std::launch::deferred, u64FirstBlock,
+                                    false).get();
+      }, write.buffer.data(), write.buffer.size(), write.u64FirstBlock);
+
+  m_writesBehind.push_back(move(write));
+}
+
+void CachedBlock::CompleteOldestWrite()
+{
+  PendingWrite write = move(m_writesBehind.front());
+
+  m_writesBehind.pop_front();
+
+  // recycle the buffer even if the write failed
+  write.done.Wait();
+  m_spareWriteBatch.swap(write.buffer);
+  write.done.Get();
+}
+
+void CachedBlock::WaitForWritesBehind()
+{
+  SubmitWriteBatch();
+
+  while (!m_writesBehind.empty())
+  {
+    CompleteOldestWrite();
+  }
+}
+
+bool CachedBlock::IsWrittenBehind(uint64_t u64BlockNumber) const
+{
+  if ((m_u32WriteBatchBlocks > 0) &&
+      (m_u64WriteBatchFirst <= u64BlockNumber) &&
+      (u64BlockNumber < m_u64WriteBatchFirst + m_u32WriteBatchBlocks)) {
+    return true;
   }
 
-  return m_pSimple->Size();
+  for (auto& write : m_writesBehind)
+  {
+    if ((write.u64FirstBlock <= u64BlockNumber) &&
+        (u64BlockNumber < write.u64FirstBlock + write.u32Blocks)) {
+      return true;
+    }
+  }
+
+  return false;
 }
 
 void CachedBlock::SizeInternal(uint64_t u64Size)
@@ -277,6 +721,14 @@ void CachedBlock::SizeInternal(uint64_t u64Size)
   }
 
   m_u64CacheSize = min(m_u64CacheSize, u64Size - u64BlockPosition);
+
+  // the final block has moved
+  WaitForReadAhead();
+  WaitForWritesBehind();
+  m_u64WriteBehindEnd = 0;
+  m_pBlockCache->Clear();
+  m_u64ReadAheadFirst = 0;
+  m_u64ReadAheadEnd   = 0;
 }
 } // namespace api
 } // namespace rmscrypto
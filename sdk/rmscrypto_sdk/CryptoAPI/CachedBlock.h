@@ -9,20 +9,31 @@
 #ifndef _CRYPTO_STREAMS_LIB_CACHEDBLOCK_H_
 #define _CRYPTO_STREAMS_LIB_CACHEDBLOCK_H_
 
+#include <deque>
 #include <memory>
 #include <vector>
+#include "BlockCache.h"
+#include "Executor.h"
 
 namespace rmscrypto {
 namespace api {
 class SimpleProtectedStream;
 
+// Holds the block currently being read or written. Clean blocks that go out
+// of the current block are kept in an LRU cache bounded by u64CacheSize bytes,
+// and sequential reads prefetch the following blocks into that cache.
+// Full dirty blocks are batched and written behind by background tasks;
+// Flush() waits for them.
 class CachedBlock {
 public:
 
   CachedBlock(std::shared_ptr<SimpleProtectedStream>pSimple,
-              uint64_t                              u64BlockSize);
+              uint64_t                              u64BlockSize,
+              uint64_t                              u64CacheSize);
+  ~CachedBlock();
 
   uint64_t GetBlockSize();
+  uint64_t GetCacheSize() const;
 
   void     UpdateBlock(uint64_t u64Position);
 
@@ -34,14 +45,44 @@ public:
                         uint64_t       u64Position,
                         uint64_t       u64Size);
 
+  // Encrypts and writes whole blocks at an aligned position straight to the
+  // backing stream, bypassing the cached block. Returns 0 if the range has
+  // fewer than u64MinBlocks blocks, in which case the cached block has to be
+  // used.
+  uint64_t WriteBlocks(const uint8_t *pbBuffer,
+                       uint64_t       u64Position,
+                       uint64_t       u64Size,
+                       uint64_t       u64MinBlocks);
+
   void     RewriteFinalBlock(uint64_t newSize);
   bool     Flush();
   uint64_t GetSizeInternal() const;
   void     SizeInternal(uint64_t u64Size);
+  bool     IsWritePending() const;
+  void     WaitForWritesBehind();
+
+  // Waits for the read-ahead and write-behind tasks and lets go of the current
+  // block if it starts before u64Position, writing it first if it's dirty.
+  // Afterwards the blocks before u64Position can be accessed without going
+  // through this object.
+  void     ReleaseBlocksBefore(uint64_t u64Position);
+
+  // The cache of clean blocks is thread safe and may be used directly for
+  // blocks released with ReleaseBlocksBefore()
+  std::shared_ptr<BlockCache>GetBlockCache() const;
 
 private:
 
-  uint32_t CalculateBlockNumber(uint64_t u64Position) const;
+  uint64_t CalculateBlockNumber(uint64_t u64Position) const;
+  void     LoadBlock(uint64_t u64BlockNumber,
+                     bool     bIsFinal);
+  void     ReadAhead(uint64_t u64BlockNumber);
+  void     WaitForReadAhead();
+  uint64_t BackingSize() const;
+  void     WriteBehind(uint64_t u64BlockNumber);
+  void     SubmitWriteBatch();
+  void     CompleteOldestWrite();
+  bool     IsWrittenBehind(uint64_t u64BlockNumber) const;
 
 private:
 
@@ -53,6 +94,40 @@ private:
   std::vector<uint8_t> m_cache;
   bool m_bFinalBlockHasBeenWritten;
   bool m_bWritePending;
+
+  std::shared_ptr<BlockCache> m_pBlockCache;
+  uint32_t m_u32ReadAheadBlocks;
+  uint64_t m_u64LastBlockNumber;
+  uint32_t m_u32SequentialBlocks;
+
+  // blocks [first, end) are being prefetched by m_readAhead
+  TaskHandle<void> m_readAhead;
+  uint64_t m_u64ReadAheadFirst;
+  uint64_t m_u64ReadAheadEnd;
+
+  // the current block is also held by m_pBlockCache
+  bool m_bIsInBlockCache;
+
+  // consecutive dirty blocks waiting to be submitted as one write
+  std::vector<uint8_t> m_writeBatch;
+  uint64_t m_u64WriteBatchFirst;
+  uint32_t m_u32WriteBatchBlocks;
+
+  struct PendingWrite
+  {
+    uint64_t             u64FirstBlock;
+    uint32_t             u32Blocks;
+    std::vector<uint8_t> buffer;
+    TaskHandle<void>     done;
+  };
+
+  // submitted batches, oldest first
+  std::deque<PendingWrite> m_writesBehind;
+  std::vector<uint8_t> m_spareWriteBatch;
+
+  // end of the data written behind, which the backing stream may not know
+  // about yet
+  uint64_t m_u64WriteBehindEnd;
 };
 } // namespace api
 } // namespace rmscrypto
@@ -7,9 +7,11 @@
  */
 
 #include <openssl/bio.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 
+#include <fstream>
 #include <sstream>
 
 #include "../Platform/KeyStorage/IKeyStorage.h"
@@ -19,27 +21,32 @@
 #include "../Crypto/Cbc4kCryptoProvider.h"
 #include "../Crypto/Cbc512NoPaddingCryptoProvider.h"
 #include "../Crypto/EcbCryptoProvider.h"
+#include "../Crypto/CtrCryptoProvider.h"
 
 #include "CryptoAPI.h"
 #include "BlockBasedProtectedStream.h"
 #include "ICryptoStream.h"
+#include "KeyCache.h"
 #include "StdStreamAdapter.h"
+#ifndef _WIN32
+# include "MappedFileStream.h"
+# include "PositionalFileStream.h"
+#endif // ifndef _WIN32
+#ifdef __linux__
+# include "UringFileStream.h"
+#endif // ifdef __linux__
 #include "RMSCryptoExceptions.h"
 
 using namespace std;
 using namespace rmscrypto::crypto;
 namespace rmscrypto {
 namespace api {
-SharedStream CreateCryptoStream(
-  CipherMode             cipherMode,
-  const vector<uint8_t>& key,
-  SharedStream           backingStream)
+static SharedStream CreateCryptoStream(
+  shared_ptr<ICryptoProvider>pCryptoProvider,
+  SharedStream               backingStream)
 {
-  shared_ptr<ICryptoProvider> pCryptoProvider = nullptr;
-  uint64_t nProtectedStreamBlockSize          = 4096;
-
-  pCryptoProvider           = CreateCryptoProvider(cipherMode, key);
-  nProtectedStreamBlockSize = pCryptoProvider->GetBlockSize() == 512 ? 512 : 4096;
+  uint64_t nProtectedStreamBlockSize =
+    pCryptoProvider->GetBlockSize() == 512 ? 512 : 4096;
 
   auto pProtectedStreamImpl = BlockBasedProtectedStream::Create(pCryptoProvider,
                                                                 backingStream,
@@ -50,9 +57,18 @@ SharedStream CreateCryptoStream(
   return pProtectedStreamImpl;
 }
 
-SharedStream CreateCryptoStreamWithAutoKey(CipherMode    cipherMode,
-                                           const string& csKeyName,
-                                           SharedStream  backingStream)
+SharedStream CreateCryptoStream(
+  CipherMode             cipherMode,
+  const vector<uint8_t>& key,
+  SharedStream           backingStream)
+{
+  return CreateCryptoStream(CreateCryptoProvider(cipherMode, key),
+                            backingStream);
+}
+
+// Looks up the key stored under csKeyName, creating it on first use. Returns
+// nullptr if the key storage fails.
+static SharedSecureKey LoadAutoKey(const string& csKeyName)
 {
   vector<uint8_t> key(16); // AES-128 crypto key
   auto ks = platform::keystorage::IKeyStorage::Create();
@@ -69,71 +85,233 @@ SharedStream CreateCryptoStreamWithAutoKey(CipherMode    cipherMode,
 
       // now store the new key
       ks->StoreKey(csKeyName, keyBase64);
+      OPENSSL_cleanse(&keyBase64[0], keyBase64.size());
 
       // reload the new key
       ret = ks->LookupKey(csKeyName);
     }
+    OPENSSL_cleanse(key.data(), key.size());
   }
 
   if ((ret.get() != nullptr) && !ret->empty()) {
     auto keyDec = platform::keystorage::base64_decode(*ret);
-    key = vector<uint8_t>(keyDec.begin(), keyDec.end());
-    return CreateCryptoStream(cipherMode, key, backingStream);
+    auto result = make_shared<SecureKey>(
+      reinterpret_cast<const uint8_t *>(keyDec.data()), keyDec.size());
+
+    OPENSSL_cleanse(&keyDec[0], keyDec.size());
+    OPENSSL_cleanse(&(*ret)[0], ret->size());
+    return result;
   }
 
   // fault
   return nullptr;
 }
 
-std::shared_ptr<std::vector<uint8_t> >EncryptWithAutoKey(
-  std::shared_ptr<std::vector<uint8_t> >pbIn,
-  CipherMode                            cipherMode,
-  const std::string                   & csKeyName /*= "default"*/) {
-  // create backing stream
-  auto backingStdStream = make_shared<stringstream>(
-    ios::in | ios::out | ios::binary);
+// Same as LoadAutoKey, but a key name goes to the key storage only until its
+// key has been loaded once
+static SharedSecureKey GetAutoKey(const string& csKeyName)
+{
+  return KeyCache::Instance().Get(csKeyName, LoadAutoKey);
+}
 
-  auto backingStream =
-    CreateStreamFromStdStream(static_pointer_cast<iostream>(backingStdStream));
+// Provider for the cached key, without leaving a copy of the key behind
+static shared_ptr<ICryptoProvider>CreateProviderForKey(
+  CipherMode             cipherMode,
+  const SharedSecureKey& key)
+{
+  auto keyCopy = key->ToVector();
+
+  try {
+    auto provider = CreateCryptoProvider(cipherMode, keyCopy);
+    OPENSSL_cleanse(keyCopy.data(), keyCopy.size());
+    return provider;
+  } catch (...) {
+    OPENSSL_cleanse(keyCopy.data(), keyCopy.size());
+    throw;
+  }
+}
 
-  auto cryptoStream = CreateCryptoStreamWithAutoKey(cipherMode,
-                                                    csKeyName,
-                                                    backingStream);
+// The auto key is shared by everything encrypted under its name and the auto
+// key formats have no room for a nonce, so CTR would reuse its key stream
+static void CheckAutoKeyCipherMode(CipherMode cipherMode)
+{
+  if (cipherMode == CIPHER_MODE_CTR) {
+    throw exceptions::RMSCryptoInvalidArgumentException(
+            "CTR can't be used with an auto key");
+  }
+}
 
-  // encrypt
-  cryptoStream->Write(pbIn->data(), pbIn->size());
-  cryptoStream->Flush();
+void InvalidateAutoKey(const string& csKeyName)
+{
+  KeyCache::Instance().Invalidate(csKeyName);
+}
 
-  // return result
-  auto resStr = backingStdStream->str();
-  return make_shared<vector<uint8_t> >(resStr.begin(), resStr.end());
+void InvalidateAllAutoKeys()
+{
+  KeyCache::Instance().InvalidateAll();
 }
 
-std::shared_ptr<std::vector<uint8_t> >DecryptWithAutoKey(
-  std::shared_ptr<std::vector<uint8_t> >cbIn,
-  CipherMode                            cipherMode,
-  const std::string                   & csKeyName /*= "default"*/) {
-  // create backing stream
-  auto backingStdStream = make_shared<stringstream>(
-    ios::in | ios::out | ios::binary);
+SharedStream CreateCryptoStreamWithAutoKey(CipherMode    cipherMode,
+                                           const string& csKeyName,
+                                           SharedStream  backingStream)
+{
+  CheckAutoKeyCipherMode(cipherMode);
 
-  backingStdStream->write(reinterpret_cast<const char *>(cbIn->data()),
-                          cbIn->size());
+  auto key = GetAutoKey(csKeyName);
 
-  backingStdStream->flush();
+  if (key == nullptr) {
+    // fault
+    return nullptr;
+  }
+
+  return CreateCryptoStream(CreateProviderForKey(cipherMode, key),
+                            backingStream);
+}
 
-  auto backingStream =
-    CreateStreamFromStdStream(static_pointer_cast<iostream>(backingStdStream));
+uint64_t GetCipherTextSize(uint64_t cbPlainText, CipherMode cipherMode)
+{
+  switch (cipherMode)
+  {
+  case CIPHER_MODE_CBC4K:
 
-  auto cryptoStream = CreateCryptoStreamWithAutoKey(cipherMode,
-                                                    csKeyName,
-                                                    backingStream);
+    // the final block is padded, a whole block of padding if it is aligned
+    return (cbPlainText / AES128_BLOCK_SIZE + 1) * AES128_BLOCK_SIZE;
 
-  // encrypt
-  auto resVec = cryptoStream->Read(cbIn->size());
+  case CIPHER_MODE_ECB:
+  case CIPHER_MODE_CBC512NOPADDING:
+  case CIPHER_MODE_CTR:
+    return cbPlainText;
 
-  // return result
-  return make_shared<vector<uint8_t> >(resVec.begin(), resVec.end());
+  default:
+    throw exceptions::RMSCryptoInvalidArgumentException("Invalid cipher mod");
+  }
+}
+
+// The provider takes 32 bit sizes, bigger buffers go through in pieces of
+// whole blocks. Only the last piece is final, as the final block of a stream.
+static uint64_t TransformWithAutoKey(bool           bEncrypt,
+                                     const uint8_t *pbIn,
+                                     uint64_t       cbIn,
+                                     uint8_t       *pbOut,
+                                     uint64_t       cbOut,
+                                     CipherMode     cipherMode,
+                                     const string & csKeyName)
+{
+  static const uint8_t empty = 0;
+
+  CheckAutoKeyCipherMode(cipherMode);
+
+  uint64_t cbRequired = bEncrypt ? GetCipherTextSize(cbIn, cipherMode) : cbIn;
+
+  if (((pbIn == nullptr) && (cbIn > 0)) ||
+      ((pbOut == nullptr) && (cbRequired > 0))) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  if (cbOut < cbRequired) {
+    throw exceptions::RMSCryptoInsufficientBufferException(
+            "Insufficient buffer");
+  }
+
+  if (cbRequired == 0) {
+    return 0;
+  }
+
+  if (cbIn == 0) {
+    // CBC4K still writes a block of padding
+    pbIn = &empty;
+  }
+
+  auto key = GetAutoKey(csKeyName);
+
+  if (key == nullptr) {
+    throw exceptions::RMSCryptoIOKeyException("Failed to get the key");
+  }
+
+  auto provider = CreateProviderForKey(cipherMode, key);
+
+  const uint64_t cbBlock = provider->GetBlockSize();
+  const uint64_t cbPiece = 256 * 1024 * 1024 / cbBlock * cbBlock;
+  uint64_t cbDone        = 0;
+  uint64_t cbWritten     = 0;
+
+  do
+  {
+    uint64_t cbLeft  = cbIn - cbDone;
+    bool     isFinal = cbLeft <= cbPiece + AES128_BLOCK_SIZE;
+    uint64_t cbNext  = isFinal ? cbLeft : cbPiece;
+    uint32_t cbPieceOut = 0;
+
+    if (bEncrypt) {
+      provider->Encrypt(pbIn + cbDone, static_cast<uint32_t>(cbNext),
+                        cbDone / cbBlock, isFinal,
+                        pbOut + cbWritten,
+                        static_cast<uint32_t>(min(cbOut - cbWritten,
+                                                  cbPiece + cbBlock)),
+                        &cbPieceOut);
+    } else {
+      provider->Decrypt(pbIn + cbDone, static_cast<uint32_t>(cbNext),
+                        cbDone / cbBlock, isFinal,
+                        pbOut + cbWritten,
+                        static_cast<uint32_t>(min(cbOut - cbWritten,
+                                                  cbPiece + cbBlock)),
+                        &cbPieceOut);
+    }
+
+    cbDone    += cbNext;
+    cbWritten += cbPieceOut;
+  } while (cbDone < cbIn);
+
+  return cbWritten;
+}
+
+uint64_t EncryptWithAutoKey(const uint8_t *pbIn,
+                            uint64_t       cbIn,
+                            uint8_t       *pbOut,
+                            uint64_t       cbOut,
+                            CipherMode     cipherMode,
+                            const string & csKeyName)
+{
+  return TransformWithAutoKey(true, pbIn, cbIn, pbOut, cbOut, cipherMode,
+                              csKeyName);
+}
+
+uint64_t DecryptWithAutoKey(const uint8_t *pbIn,
+                            uint64_t       cbIn,
+                            uint8_t       *pbOut,
+                            uint64_t       cbOut,
+                            CipherMode     cipherMode,
+                            const string & csKeyName)
+{
+  return TransformWithAutoKey(false, pbIn, cbIn, pbOut, cbOut, cipherMode,
+                              csKeyName);
+}
+
+std::shared_ptr<std::vector<uint8_t> >EncryptWithAutoKey(
+  std::shared_ptr<std::vector<uint8_t> >pbIn,
+  CipherMode                            cipherMode,
+  const std::string                   & csKeyName /*= "default"*/) {
+  auto result = make_shared<vector<uint8_t> >(
+    static_cast<size_t>(GetCipherTextSize(pbIn->size(), cipherMode)));
+
+  result->resize(static_cast<size_t>(
+                   EncryptWithAutoKey(pbIn->data(), pbIn->size(),
+                                      result->data(), result->size(),
+                                      cipherMode, csKeyName)));
+  return result;
+}
+
+std::shared_ptr<std::vector<uint8_t> >DecryptWithAutoKey(
+  std::shared_ptr<std::vector<uint8_t> >cbIn,
+  CipherMode                            cipherMode,
+  const std::string                   & csKeyName /*= "default"*/) {
+  auto result = make_shared<vector<uint8_t> >(cbIn->size());
+
+  result->resize(static_cast<size_t>(
+                   DecryptWithAutoKey(cbIn->data(), cbIn->size(),
+                                      result->data(), result->size(),
+                                      cipherMode, csKeyName)));
+  return result;
 }
 
 SharedStream CreateStreamFromStdStream(
@@ -152,6 +330,39 @@ SharedStream CreateStreamFromStdStream(
   return static_pointer_cast<IStream>(make_shared<StdStreamAdapter>(stdIOStream));
 }
 
+SharedStream CreateStreamFromFile(const std::string     & path,
+                                  std::ios_base::openmode mode)
+{
+#ifndef _WIN32
+  if ((mode & (ios_base::out | ios_base::app)) == 0) {
+    return static_pointer_cast<IStream>(make_shared<MappedFileStream>(path));
+  }
+  return static_pointer_cast<IStream>(make_shared<PositionalFileStream>(path,
+                                                                        mode));
+#else // ifndef _WIN32
+  auto file = make_shared<fstream>(path, mode | ios_base::binary);
+
+  if (!file->is_open()) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::OperationUnavailable,
+            "Failed to open file: " + path);
+  }
+  return CreateStreamFromStdStream(static_pointer_cast<iostream>(file));
+#endif // ifndef _WIN32
+}
+
+SharedStream CreateAsyncStreamFromFile(const std::string     & path,
+                                       std::ios_base::openmode mode)
+{
+#ifdef __linux__
+  if (UringFileStream::IsSupported()) {
+    return static_pointer_cast<IStream>(make_shared<UringFileStream>(path,
+                                                                     mode));
+  }
+#endif // ifdef __linux__
+  return CreateStreamFromFile(path, mode);
+}
+
 std::shared_ptr<ICryptoProvider>CreateCryptoProvider(
   CipherMode                  cipherMode,
   const std::vector<uint8_t>& key)
@@ -167,6 +378,12 @@ std::shared_ptr<ICryptoProvider>CreateCryptoProvider(
   case CIPHER_MODE_CBC512NOPADDING:
     return make_shared<Cbc512NoPaddingCryptoProvider>(key);
 
+  case CIPHER_MODE_CTR:
+
+    // without a nonce every user of the key would share one key stream
+    throw exceptions::RMSCryptoInvalidArgumentException(
+            "CTR needs a nonce, use CreateCtrCryptoProvider");
+
   default:
     throw exceptions::RMSCryptoInvalidArgumentException("Invalid cipher mod");
   }
@@ -176,5 +393,25 @@ std::shared_ptr<ICryptoEngine>CreateCryptoEngine()
 {
   return ICryptoEngine::Create();
 }
+
+std::vector<uint8_t>CreateCtrNonce()
+{
+  vector<uint8_t> nonce(CTR_NONCE_SIZE);
+
+  if (RAND_bytes(nonce.data(), static_cast<int>(nonce.size())) != 1) {
+    throw exceptions::RMSCryptoException(
+            exceptions::RMSCryptoException::LogicError,
+            exceptions::RMSCryptoException::OperationUnavailable,
+            "Failed to generate a CTR nonce");
+  }
+  return nonce;
+}
+
+std::shared_ptr<ICryptoProvider>CreateCtrCryptoProvider(
+  const std::vector<uint8_t>& key,
+  const std::vector<uint8_t>& nonce)
+{
+  return make_shared<CtrCryptoProvider>(key, nonce);
+}
 } // namespace api
 } // namespace rmscrypto
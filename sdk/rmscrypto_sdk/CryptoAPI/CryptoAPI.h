@@ -9,7 +9,9 @@
 #ifndef _RMS_CRYPTO_API_H_
 #define _RMS_CRYPTO_API_H_
 
+#include <ios>
 #include <memory>
+#include <string>
 #include <vector>
 #include "CryptoAPIExport.h"
 #include "IStream.h"
@@ -18,6 +20,9 @@
 
 namespace rmscrypto {
 namespace api {
+// Default memory budget for the decrypted blocks cached by a protected stream
+const uint64_t DEFAULT_BLOCK_CACHE_SIZE = 256 * 1024;
+
 // Stream factory
 SharedStream DLL_PUBLIC_CRYPTO CreateCryptoStream(
   CipherMode                  cipherMode,
@@ -28,6 +33,8 @@ SharedStream DLL_PUBLIC_CRYPTO CreateCryptoStream(
 // keyInitializationData
 // To reuse the same key you MUST put the same keyInitializationData as the
 // first time
+// CIPHER_MODE_CTR throws RMSCryptoInvalidArgumentException here and in the
+// other auto key functions: one key for everything means one key stream.
 SharedStream DLL_PUBLIC_CRYPTO CreateCryptoStreamWithAutoKey(
   CipherMode         cipherMode,
   const std::string& csKeyName,
@@ -43,6 +50,36 @@ std::shared_ptr<std::vector<uint8_t> >DLL_PUBLIC_CRYPTO DecryptWithAutoKey(
   CipherMode                            cipherMode = CIPHER_MODE_CBC4K,
   const std::string                   & csKeyName = "default");
 
+// Buffer to buffer versions of the above, without a stream in between. The
+// output is in the format of a stream created by CreateCryptoStreamWithAutoKey.
+// pbOut must hold GetCipherTextSize(cbIn) bytes to encrypt and cbIn bytes to
+// decrypt. Both return the number of bytes written to pbOut.
+uint64_t DLL_PUBLIC_CRYPTO EncryptWithAutoKey(
+  const uint8_t     *pbIn,
+  uint64_t           cbIn,
+  uint8_t           *pbOut,
+  uint64_t           cbOut,
+  CipherMode         cipherMode = CIPHER_MODE_CBC4K,
+  const std::string& csKeyName = "default");
+
+uint64_t DLL_PUBLIC_CRYPTO DecryptWithAutoKey(
+  const uint8_t     *pbIn,
+  uint64_t           cbIn,
+  uint8_t           *pbOut,
+  uint64_t           cbOut,
+  CipherMode         cipherMode = CIPHER_MODE_CBC4K,
+  const std::string& csKeyName = "default");
+
+// Auto keys are looked up in the key storage once per process and kept in
+// locked memory. Invalidate them after the stored key was changed or removed.
+void DLL_PUBLIC_CRYPTO InvalidateAutoKey(const std::string& csKeyName);
+void DLL_PUBLIC_CRYPTO InvalidateAllAutoKeys();
+
+// Size of the protected content for cbPlainText bytes of plain text
+uint64_t DLL_PUBLIC_CRYPTO GetCipherTextSize(
+  uint64_t   cbPlainText,
+  CipherMode cipherMode = CIPHER_MODE_CBC4K);
+
 SharedStream DLL_PUBLIC_CRYPTO CreateStreamFromStdStream(
   std::shared_ptr<std::istream>stdIStream);
 SharedStream DLL_PUBLIC_CRYPTO CreateStreamFromStdStream(
@@ -50,11 +87,38 @@ SharedStream DLL_PUBLIC_CRYPTO CreateStreamFromStdStream(
 SharedStream DLL_PUBLIC_CRYPTO CreateStreamFromStdStream(
   std::shared_ptr<std::iostream>stdIOStream);
 
-// create crypto primitives directly
+// Opens a file as a stream. Read-only streams (mode without ios_base::out) are
+// served from a memory mapping of the file shared by all clones, falling back
+// to pread for files that can't be mapped. Writable streams use pread/pwrite
+// at explicit offsets, so clones don't serialize on a shared cursor.
+SharedStream DLL_PUBLIC_CRYPTO CreateStreamFromFile(
+  const std::string     & path,
+  std::ios_base::openmode mode = std::ios_base::in);
+
+// Opens a file as a stream whose ReadAsync/WriteAsync are served by io_uring:
+// the returned futures are completed by the ring, not by a thread per request.
+// Falls back to CreateStreamFromFile where io_uring is unavailable.
+SharedStream DLL_PUBLIC_CRYPTO CreateAsyncStreamFromFile(
+  const std::string     & path,
+  std::ios_base::openmode mode = std::ios_base::in);
+
+// create crypto primitives directly, CIPHER_MODE_CTR throws
+// RMSCryptoInvalidArgumentException: use CreateCtrCryptoProvider
 std::shared_ptr<ICryptoProvider>DLL_PUBLIC_CRYPTO CreateCryptoProvider(
   CipherMode                  cipherMode,
   const std::vector<uint8_t>& key);
 std::shared_ptr<ICryptoEngine>DLL_PUBLIC_CRYPTO   CreateCryptoEngine();
+
+// The only way to get a CIPHER_MODE_CTR provider, for one container: the key
+// is derived from key and the container's random nonce (CreateCtrNonce), which
+// the caller stores with the container, so containers under the same key get
+// different key streams
+const uint32_t CTR_NONCE_SIZE = 16;
+
+std::vector<uint8_t>DLL_PUBLIC_CRYPTO             CreateCtrNonce();
+std::shared_ptr<ICryptoProvider>DLL_PUBLIC_CRYPTO CreateCtrCryptoProvider(
+  const std::vector<uint8_t>& key,
+  const std::vector<uint8_t>& nonce);
 } // namespace api
 } // namespace rmscrypto
 #endif // _RMS_CRYPTO_API_H_
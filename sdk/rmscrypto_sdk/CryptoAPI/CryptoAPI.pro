@@ -42,7 +42,11 @@ unix {
 
 HEADERS += \
     BlockBasedProtectedStream.h \
+    BlockCache.h \
     CachedBlock.h \
+    Executor.h \
+    KeyCache.h \
+    RangeLock.h \
     IStream.h \
     SimpleProtectedStream.h \
     ICryptoStream.h \
@@ -58,11 +62,25 @@ HEADERS += \
 
 SOURCES += \
     BlockBasedProtectedStream.cpp \
+    BlockCache.cpp \
     CachedBlock.cpp \
+    Executor.cpp \
+    KeyCache.cpp \
+    RangeLock.cpp \
     SimpleProtectedStream.cpp \
     CryptoAPI.cpp \
     StdStreamAdapter.cpp \
     IRMSCryptoEnvironment.cpp
 
+unix {
+    HEADERS += MappedFileStream.h PositionalFileStream.h
+    SOURCES += MappedFileStream.cpp PositionalFileStream.cpp
+}
+
+linux {
+    HEADERS += UringFileStream.h
+    SOURCES += UringFileStream.cpp
+}
+
 DISTFILES += \
     rmscrypto.rc
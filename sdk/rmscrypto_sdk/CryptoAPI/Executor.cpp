@@ -0,0 +1,214 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include "Executor.h"
+#include "IRMSCryptoEnvironment.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace api {
+namespace {
+// the executor and queue the current thread works for, if any
+thread_local Executor *t_pExecutor = nullptr;
+thread_local size_t    t_index     = 0;
+} // namespace
+
+Executor::Executor(size_t threadCount)
+  : m_pending(0)
+  , m_next(0)
+  , m_stop(false)
+{
+  if (threadCount == 0) {
+    threadCount = max(1u, thread::hardware_concurrency());
+  }
+
+  for (size_t i = 0; i < threadCount; ++i) {
+    m_queues.emplace_back(new Queue);
+  }
+
+  for (size_t i = 0; i < threadCount; ++i) {
+    m_threads.emplace_back(&Executor::WorkerLoop, this, i);
+  }
+}
+
+Executor::~Executor()
+{
+  {
+    lock_guard<mutex> lock(m_sleepLocker);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+
+  for (auto& worker : m_threads) {
+    worker.join();
+  }
+}
+
+shared_ptr<Executor>Executor::Default()
+{
+  static shared_ptr<Executor> *s_pExecutor = nullptr;
+  static once_flag s_once;
+
+  call_once(s_once, []() {
+    auto count = RMSCryptoEnvironment()->ExecutorThreadCount();
+    s_pExecutor = new shared_ptr<Executor>(make_shared<Executor>(count));
+  });
+  return *s_pExecutor;
+}
+
+size_t Executor::ThreadCount() const
+{
+  return m_threads.size();
+}
+
+void Executor::Post(Task task)
+{
+  // workers keep what they post, others spread their tasks
+  size_t index = IsWorkerThread() ? t_index : m_next++ % m_queues.size();
+
+  {
+    // lock resources
+    lock_guard<mutex> lock(m_queues[index]->locker);
+    m_queues[index]->tasks.push_back(move(task));
+  }
+
+  {
+    // taken so that a worker can't miss the wake-up between checking
+    // m_pending and going to sleep
+    lock_guard<mutex> lock(m_sleepLocker);
+    ++m_pending;
+  }
+  m_wake.notify_one();
+}
+
+bool Executor::IsWorkerThread() const
+{
+  return t_pExecutor == this;
+}
+
+bool Executor::RunOne(size_t index)
+{
+  Task task;
+
+  {
+    // own queue first, newest task first
+    lock_guard<mutex> lock(m_queues[index]->locker);
+
+    if (!m_queues[index]->tasks.empty()) {
+      task = move(m_queues[index]->tasks.back());
+      m_queues[index]->tasks.pop_back();
+    }
+  }
+
+  // then steal the oldest task of another worker
+  for (size_t i = 1; !task && i < m_queues.size(); ++i) {
+    auto& victim = *m_queues[(index + i) % m_queues.size()];
+    lock_guard<mutex> lock(victim.locker);
+
+    if (!victim.tasks.empty()) {
+      task = move(victim.tasks.front());
+      victim.tasks.pop_front();
+    }
+  }
+
+  if (!task) {
+    return false;
+  }
+
+  --m_pending;
+
+  try {
+    task();
+  }
+  catch (...) {
+    // tasks posted through Async() report errors through their future
+  }
+  return true;
+}
+
+void Executor::WorkerLoop(size_t index)
+{
+  t_pExecutor = this;
+  t_index     = index;
+
+  for (;;) {
+    if (RunOne(index)) {
+      continue;
+    }
+
+    unique_lock<mutex> lock(m_sleepLocker);
+    m_wake.wait(lock, [this]() {
+      return m_stop || m_pending > 0;
+    });
+
+    if (m_stop && (m_pending == 0)) {
+      return;
+    }
+  }
+}
+
+shared_ptr<SerialQueue>SerialQueue::Create(shared_ptr<Executor>executor)
+{
+  return shared_ptr<SerialQueue>(new SerialQueue(executor));
+}
+
+SerialQueue::SerialQueue(shared_ptr<Executor>executor)
+  : m_executor(executor)
+  , m_bIsRunning(false)
+{}
+
+void SerialQueue::Post(Executor::Task task)
+{
+  {
+    // lock resources
+    lock_guard<mutex> lock(m_locker);
+    m_tasks.push_back(move(task));
+
+    if (m_bIsRunning) {
+      return;
+    }
+    m_bIsRunning = true;
+
+    if (!m_executor) {
+      m_executor = Executor::Default();
+    }
+  }
+
+  auto self = shared_from_this();
+  m_executor->Post([self]() {
+    self->Drain();
+  });
+}
+
+void SerialQueue::Drain()
+{
+  for (;;) {
+    Executor::Task task;
+
+    {
+      // lock resources
+      lock_guard<mutex> lock(m_locker);
+
+      if (m_tasks.empty()) {
+        m_bIsRunning = false;
+        return;
+      }
+      task = move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+
+    try {
+      task();
+    }
+    catch (...) {
+      // tasks posted through Async() report errors through their future
+    }
+  }
+}
+} // namespace api
+} // namespace rmscrypto
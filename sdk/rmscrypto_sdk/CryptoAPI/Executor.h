@@ -0,0 +1,208 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#ifndef _RMS_CRYPTO_EXECUTOR_H_
+#define _RMS_CRYPTO_EXECUTOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "CryptoAPIExport.h"
+
+namespace rmscrypto {
+namespace api {
+/*!
+  @brief Bounded pool of worker threads for the SDK's ...Async methods.
+
+  Each worker owns a queue; tasks posted from a worker go to its own queue
+  and idle workers steal from the others. Use Async() instead of std::async
+  so that asynchronous launches don't start a thread each.
+*/
+class DLL_PUBLIC_CRYPTO Executor {
+public:
+
+  typedef std::function<void()> Task;
+
+  // 0 threads means one per hardware thread
+  explicit Executor(size_t threadCount);
+  ~Executor();
+
+  // Process-wide executor, created on first use with
+  // IRMSCryptoEnvironment::ExecutorThreadCount() threads. It is never
+  // destroyed, so tasks may still run while the process exits.
+  static std::shared_ptr<Executor>Default();
+
+  size_t ThreadCount() const;
+  void   Post(Task task);
+
+  // true on this executor's own workers; code that blocks on other tasks of
+  // the same executor should run them inline there instead
+  bool   IsWorkerThread() const;
+
+private:
+
+  struct Queue {
+    std::mutex       locker;
+    std::deque<Task> tasks;
+  };
+
+  bool RunOne(size_t index);
+  void WorkerLoop(size_t index);
+
+  Executor(const Executor&);
+  Executor& operator=(const Executor&);
+
+  std::vector<std::unique_ptr<Queue> > m_queues;
+  std::vector<std::thread> m_threads;
+  std::mutex               m_sleepLocker;
+  std::condition_variable  m_wake;
+  std::atomic<size_t>      m_pending;
+  std::atomic<size_t>      m_next;
+  std::atomic<bool>        m_stop;
+};
+
+/*!
+  @brief Runs tasks on an executor one at a time, in the order they were
+  posted, without holding a worker while idle. Streams use one to keep their
+  asynchronous operations ordered.
+*/
+class DLL_PUBLIC_CRYPTO SerialQueue
+  : public std::enable_shared_from_this<SerialQueue>{
+public:
+
+  // a null executor means Executor::Default(), looked up on the first Post()
+  static std::shared_ptr<SerialQueue>Create(
+    std::shared_ptr<Executor>executor = nullptr);
+
+  void Post(Executor::Task task);
+
+private:
+
+  SerialQueue(std::shared_ptr<Executor>executor);
+
+  void Drain();
+
+  std::shared_ptr<Executor>  m_executor;
+  std::mutex                 m_locker;
+  std::deque<Executor::Task> m_tasks;
+  bool                       m_bIsRunning;
+};
+
+// Behaves like std::async(launchType, f, args...), except that asynchronous
+// launches are posted to the scheduler (an Executor or a SerialQueue) instead
+// of starting a thread. Deferred launches still run on the waiting thread.
+template<typename Scheduler, typename F, typename ... Args>
+std::future<typename std::result_of<F(Args ...)>::type>
+Async(Scheduler& scheduler, std::launch launchType, F&& f, Args&& ... args)
+{
+  typedef typename std::result_of<F(Args ...)>::type Result;
+
+  auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args) ...);
+
+  if ((launchType & std::launch::async) != std::launch::async) {
+    return std::async(std::launch::deferred, std::move(bound));
+  }
+
+  auto task   = std::make_shared<std::packaged_task<Result()> >(std::move(bound));
+  auto result = task->get_future();
+
+  scheduler.Post([task]() {
+    (*task)();
+  });
+  return result;
+}
+
+/*!
+  @brief Result of a task started with Spawn(). If no worker has picked the
+  task up by the time Get() is called, the caller runs it itself, so waiting
+  never depends on a free worker. Meant for work a stream splits off and
+  waits for while holding its own lock.
+*/
+template<typename Result>
+class TaskHandle {
+public:
+
+  TaskHandle() {}
+
+  bool Valid() const {
+    return m_state != nullptr;
+  }
+
+  // true once the task has run, false while it is queued or running
+  bool IsReady() const {
+    return m_state->result.wait_for(std::chrono::seconds(0)) ==
+           std::future_status::ready;
+  }
+
+  void Wait() {
+    Claim();
+    m_state->result.wait();
+  }
+
+  Result Get() {
+    Claim();
+    auto state = std::move(m_state);
+    return state->result.get();
+  }
+
+private:
+
+  struct State {
+    std::atomic<bool>             bIsClaimed;
+    std::packaged_task<Result()>  task;
+    std::future<Result>           result;
+  };
+
+  void Claim() {
+    if (!m_state->bIsClaimed.exchange(true)) {
+      m_state->task();
+    }
+  }
+
+  std::shared_ptr<State> m_state;
+
+  template<typename F, typename ... Args>
+  friend TaskHandle<typename std::result_of<F(Args ...)>::type>
+  Spawn(Executor& executor, F&& f, Args&& ... args);
+};
+
+template<typename F, typename ... Args>
+TaskHandle<typename std::result_of<F(Args ...)>::type>
+Spawn(Executor& executor, F&& f, Args&& ... args)
+{
+  typedef typename std::result_of<F(Args ...)>::type Result;
+  typedef typename TaskHandle<Result>::State         State;
+
+  auto state = std::make_shared<State>();
+
+  state->bIsClaimed = false;
+  state->task       = std::packaged_task<Result()>(
+    std::bind(std::forward<F>(f), std::forward<Args>(args) ...));
+  state->result = state->task.get_future();
+
+  executor.Post([state]() {
+    if (!state->bIsClaimed.exchange(true)) {
+      state->task();
+    }
+  });
+
+  TaskHandle<Result> handle;
+  handle.m_state = state;
+  return handle;
+}
+} // namespace api
+} // namespace rmscrypto
+#endif // _RMS_CRYPTO_EXECUTOR_H_
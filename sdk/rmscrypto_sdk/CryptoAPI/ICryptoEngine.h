@@ -20,6 +20,7 @@ enum CryptoAlgorithm
   CRYPTO_ALGORITHM_AES_ECB       = 0,
   CRYPTO_ALGORITHM_AES_CBC       = 1,
   CRYPTO_ALGORITHM_AES_CBC_PKCS7 = 2,
+  CRYPTO_ALGORITHM_AES_CTR       = 3,
 };
 
 class ICryptoEngine {
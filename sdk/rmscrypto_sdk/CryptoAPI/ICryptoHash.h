@@ -8,7 +8,10 @@
 
 #ifndef _CRYPTO_STREAMS_LIB_ICRYPTOHASH
 #define _CRYPTO_STREAMS_LIB_ICRYPTOHASH
+#include <stddef.h>
 #include <stdint.h>
+#include <limits>
+#include "RMSCryptoExceptions.h"
 namespace rmscrypto {
 namespace api {
 enum CryptoHashAlgorithm
@@ -21,10 +24,68 @@ class ICryptoHash {
 public:
 
   virtual size_t GetOutputSize() = 0;
+
+  // One-shot digest of pbIn. Discards data passed to Update before.
   virtual void   Hash(const uint8_t *pbIn,
                       uint32_t       cbIn,
                       uint8_t       *pbOut,
                       uint32_t     & cbOut) = 0;
+
+  // Streaming digest: Update any number of times, then Final writes the
+  // digest of everything passed to Update and resets for the next message.
+  // Implementations that predate streaming keep these defaults, which throw
+  // RMSCryptoNotImplementedException.
+  virtual void   Update(const uint8_t *,
+                        size_t)
+  {
+    throw exceptions::RMSCryptoNotImplementedException(
+            "Streaming digest is not implemented");
+  }
+
+  virtual void   Final(uint8_t *,
+                       uint32_t&)
+  {
+    throw exceptions::RMSCryptoNotImplementedException(
+            "Streaming digest is not implemented");
+  }
+
+  // Digests of count independent inputs, written one after the other to
+  // pbOut, which holds count * GetOutputSize() bytes (cbOut).
+  // This is a batching API only: the inputs are hashed one after the other,
+  // not interleaved across SIMD lanes. It saves the per-call setup, which is
+  // what dominates small inputs. The default calls Hash for each input.
+  virtual void   HashMany(const uint8_t *const *ppbIn,
+                          const size_t         *pcbIn,
+                          size_t                count,
+                          uint8_t              *pbOut,
+                          size_t                cbOut)
+  {
+    size_t cbDigest = GetOutputSize();
+
+    if (count == 0) {
+      return;
+    }
+
+    if ((ppbIn == nullptr) || (pcbIn == nullptr) || (pbOut == nullptr)) {
+      throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+    }
+
+    if (cbOut / cbDigest < count) {
+      throw exceptions::RMSCryptoInvalidArgumentException("Bounds error");
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      if (pcbIn[i] > std::numeric_limits<uint32_t>::max()) {
+        throw exceptions::RMSCryptoInvalidArgumentException("Bounds error");
+      }
+
+      uint32_t cbDigestOut = static_cast<uint32_t>(cbDigest);
+      Hash(ppbIn[i], static_cast<uint32_t>(pcbIn[i]), pbOut + i * cbDigest,
+           cbDigestOut);
+    }
+  }
+
+  virtual ~ICryptoHash() {}
 };
 } // namespace api
 } // namespace rmscrypto
@@ -9,10 +9,12 @@
 #ifndef _CRYPTO_STREAMS_LIB_CRYPTOPROVIDER_H_
 #define _CRYPTO_STREAMS_LIB_CRYPTOPROVIDER_H_
 #include <stdint.h>
+#include <limits>
 #include <memory>
 #include <vector>
 
 #include "CryptoAPIExport.h"
+#include "RMSCryptoExceptions.h"
 
 namespace rmscrypto {
 namespace api {
@@ -20,33 +22,120 @@ enum CipherMode
 {
   CIPHER_MODE_CBC4K,
   CIPHER_MODE_ECB,
-  CIPHER_MODE_CBC512NOPADDING
+  CIPHER_MODE_CBC512NOPADDING,
+
+  // AES-CTR, no padding and any size. The counter follows the byte offset, so
+  // every block is encrypted and decrypted on its own. Rewriting data at the
+  // same offset under the same key reuses the key stream, use it for content
+  // that is written once per key. CTR providers come only from
+  // CreateCtrCryptoProvider, which gives each container its own key; the
+  // mode is refused by CreateCryptoProvider and the auto key functions.
+  CIPHER_MODE_CTR
 };
 
 class ICryptoProvider {
 public:
 
+  // Providers override the 64-bit Encrypt and Decrypt. Providers written when
+  // the block number was a uint32_t still override the 32-bit overloads
+  // below; the defaults of each pair forward to the other, so a provider
+  // must override one of them.
+  virtual void Encrypt(const uint8_t *pbIn,
+                       uint32_t       cbIn,
+                       uint64_t       u64StartingBlockNumber,
+                       bool           isFinal,
+                       uint8_t       *pbOut,
+                       uint32_t       cbOut,
+                       uint32_t      *pcbOut)
+  {
+    Encrypt(pbIn, cbIn, Narrow(u64StartingBlockNumber), isFinal, pbOut, cbOut,
+            pcbOut);
+  }
+
+  // pbOut may be the same buffer as pbIn (in-place decryption), but the two
+  // must not partially overlap
+  virtual void Decrypt(const uint8_t *pbIn,
+                       uint32_t       cbIn,
+                       uint64_t       u64StartingBlockNumber,
+                       bool           isFinal,
+                       uint8_t       *pbOut,
+                       uint32_t       cbOut,
+                       uint32_t      *pcbOut)
+  {
+    Decrypt(pbIn, cbIn, Narrow(u64StartingBlockNumber), isFinal, pbOut, cbOut,
+            pcbOut);
+  }
+
+  // Deprecated, the 32-bit form of Encrypt and Decrypt. Kept so that
+  // providers and callers built on it still compile.
   virtual void Encrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint32_t       u32StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
-                       uint32_t      *pcbOut) = 0;
+                       uint32_t      *pcbOut)
+  {
+    Encrypt(pbIn, cbIn, static_cast<uint64_t>(u32StartingBlockNumber), isFinal,
+            pbOut, cbOut, pcbOut);
+  }
+
   virtual void Decrypt(const uint8_t *pbIn,
                        uint32_t       cbIn,
-                       uint32_t       dwStartingBlockNumber,
+                       uint32_t       u32StartingBlockNumber,
                        bool           isFinal,
                        uint8_t       *pbOut,
                        uint32_t       cbOut,
-                       uint32_t      *pcbOut) = 0;
+                       uint32_t      *pcbOut)
+  {
+    Decrypt(pbIn, cbIn, static_cast<uint64_t>(u32StartingBlockNumber), isFinal,
+            pbOut, cbOut, pcbOut);
+  }
 
+  // A literal block number converts to both types above, this picks one
+  void Encrypt(const uint8_t *pbIn,
+               uint32_t       cbIn,
+               int            startingBlockNumber,
+               bool           isFinal,
+               uint8_t       *pbOut,
+               uint32_t       cbOut,
+               uint32_t      *pcbOut)
+  {
+    Encrypt(pbIn, cbIn, static_cast<uint64_t>(startingBlockNumber), isFinal,
+            pbOut, cbOut, pcbOut);
+  }
+
+  void Decrypt(const uint8_t *pbIn,
+               uint32_t       cbIn,
+               int            startingBlockNumber,
+               bool           isFinal,
+               uint8_t       *pbOut,
+               uint32_t       cbOut,
+               uint32_t      *pcbOut)
+  {
+    Decrypt(pbIn, cbIn, static_cast<uint64_t>(startingBlockNumber), isFinal,
+            pbOut, cbOut, pcbOut);
+  }
 
   virtual uint64_t            GetCipherTextSize(uint64_t clearTextSize)
     = 0;
 
   virtual uint32_t            GetBlockSize() = 0;
   virtual std::vector<uint8_t>GetKey() = 0;
+
+private:
+
+  // a 32-bit provider would derive the IVs of blocks past 2^32 from wrapped
+  // block numbers
+  static uint32_t Narrow(uint64_t u64StartingBlockNumber)
+  {
+    if (u64StartingBlockNumber > std::numeric_limits<uint32_t>::max()) {
+      throw exceptions::RMSCryptoInvalidArgumentException(
+              "Block number is out of range of a 32-bit provider");
+    }
+
+    return static_cast<uint32_t>(u64StartingBlockNumber);
+  }
 };
 } // namespace api
 } // namespace rmscrypto
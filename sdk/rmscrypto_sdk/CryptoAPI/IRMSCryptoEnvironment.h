@@ -9,7 +9,9 @@
 #ifndef _CRYPTO_STREAMS_LIB_IRMSENVIRONMENT_H
 #define _CRYPTO_STREAMS_LIB_IRMSENVIRONMENT_H
 
+#include <cstddef>
 #include <memory>
+#include <string>
 
 #include "CryptoAPIExport.h"
 
@@ -23,6 +25,25 @@ public:
   enum class LoggerOption : int { Always, Never };
   virtual void         LogOption(LoggerOption opt) = 0;
   virtual LoggerOption LogOption()                 = 0;
+
+  // Number of worker threads of the shared executor which runs asynchronous
+  // stream operations. Read when the executor is first used, so set it
+  // before that; 0 (the default) means one per hardware thread.
+  virtual void         ExecutorThreadCount(size_t count) = 0;
+  virtual size_t       ExecutorThreadCount()             = 0;
+
+  // Where auto keys are kept. Platform is the system key store (libsecret on
+  // Linux), File a single local file, encrypted with the base64 encoded 256
+  // bit master key in the RMSCRYPTO_MASTER_KEY environment variable, for hosts
+  // without a key store daemon.
+  enum class KeyStorageOption : int { Platform, File };
+  virtual void             KeyStorage(KeyStorageOption opt) = 0;
+  virtual KeyStorageOption KeyStorage()                     = 0;
+
+  // Key file of KeyStorageOption::File, an empty path (the default) means
+  // .rmscrypto_keys in the home directory
+  virtual void        KeyFilePath(const std::string& path) = 0;
+  virtual std::string KeyFilePath()                        = 0;
 };
 
 DLL_PUBLIC_CRYPTO std::shared_ptr<IRMSCryptoEnvironment>RMSCryptoEnvironment();
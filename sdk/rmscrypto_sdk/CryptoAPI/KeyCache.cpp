@@ -0,0 +1,187 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include <openssl/crypto.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else // ifdef _WIN32
+# include <sys/mman.h>
+# include <unistd.h>
+#endif // ifdef _WIN32
+
+#include "KeyCache.h"
+#include "RMSCryptoExceptions.h"
+
+using namespace std;
+
+namespace rmscrypto {
+namespace api {
+static size_t PageSize()
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+#else // ifdef _WIN32
+  return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif // ifdef _WIN32
+}
+
+SecureKey::SecureKey(const uint8_t *pbKey, size_t cbKey)
+  : m_pbKey(nullptr)
+  , m_cbKey(cbKey)
+  , m_cbAllocated(0)
+  , m_bLocked(false)
+{
+  if ((pbKey == nullptr) && (cbKey > 0)) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  // whole pages, so unlocking this key doesn't unlock anything else
+  size_t cbPage = PageSize();
+
+  m_cbAllocated = max<size_t>(1, (cbKey + cbPage - 1) / cbPage) * cbPage;
+
+#ifdef _WIN32
+  m_pbKey = static_cast<uint8_t *>(VirtualAlloc(nullptr, m_cbAllocated,
+                                                MEM_COMMIT | MEM_RESERVE,
+                                                PAGE_READWRITE));
+
+  if (m_pbKey == nullptr) {
+    throw exceptions::RMSCryptoInsufficientBufferException(
+            "Failed to allocate key memory");
+  }
+
+  m_bLocked = VirtualLock(m_pbKey, m_cbAllocated) != FALSE;
+#else // ifdef _WIN32
+  void *pv = mmap(nullptr, m_cbAllocated, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (pv == MAP_FAILED) {
+    throw exceptions::RMSCryptoInsufficientBufferException(
+            "Failed to allocate key memory");
+  }
+
+  m_pbKey = static_cast<uint8_t *>(pv);
+
+  // may fail over RLIMIT_MEMLOCK, the key is still usable then
+  m_bLocked = mlock(m_pbKey, m_cbAllocated) == 0;
+# ifdef MADV_DONTDUMP
+  madvise(m_pbKey, m_cbAllocated, MADV_DONTDUMP);
+# endif // ifdef MADV_DONTDUMP
+#endif // ifdef _WIN32
+
+  if (cbKey > 0) {
+    memcpy(m_pbKey, pbKey, cbKey);
+  }
+}
+
+SecureKey::~SecureKey()
+{
+  OPENSSL_cleanse(m_pbKey, m_cbAllocated);
+
+#ifdef _WIN32
+  if (m_bLocked) {
+    VirtualUnlock(m_pbKey, m_cbAllocated);
+  }
+  VirtualFree(m_pbKey, 0, MEM_RELEASE);
+#else // ifdef _WIN32
+  if (m_bLocked) {
+    munlock(m_pbKey, m_cbAllocated);
+  }
+  munmap(m_pbKey, m_cbAllocated);
+#endif // ifdef _WIN32
+}
+
+vector<uint8_t>SecureKey::ToVector() const
+{
+  return vector<uint8_t>(m_pbKey, m_pbKey + m_cbKey);
+}
+
+KeyCache& KeyCache::Instance()
+{
+  static KeyCache instance;
+
+  return instance;
+}
+
+SharedSecureKey KeyCache::Get(const string& csKeyName, const Loader& loader)
+{
+  promise<SharedSecureKey> loading;
+  shared_ptr<PendingKey>   pending;
+  bool bIsLoader = false;
+
+  {
+    // lock resources
+    lock_guard<mutex> lock(m_locker);
+
+    auto it = m_keys.find(csKeyName);
+
+    if (it != m_keys.end()) {
+      // loaded already or being loaded by another caller
+      pending = it->second;
+    } else {
+      pending           = make_shared<PendingKey>(loading.get_future().share());
+      m_keys[csKeyName] = pending;
+      bIsLoader         = true;
+    }
+  }
+
+  if (!bIsLoader) {
+    return pending->get();
+  }
+
+  // the key storage may be slow, load outside the lock
+  SharedSecureKey key;
+  exception_ptr   error;
+
+  try {
+    key = loader(csKeyName);
+  } catch (...) {
+    error = current_exception();
+  }
+
+  if (key == nullptr) {
+    // lock resources
+    lock_guard<mutex> lock(m_locker);
+
+    // forget the failure, unless it was invalidated and is loading again
+    auto it = m_keys.find(csKeyName);
+
+    if ((it != m_keys.end()) && (it->second == pending)) {
+      m_keys.erase(it);
+    }
+  }
+
+  if (error != nullptr) {
+    loading.set_exception(error);
+  } else {
+    loading.set_value(key);
+  }
+
+  return pending->get();
+}
+
+void KeyCache::Invalidate(const string& csKeyName)
+{
+  // lock resources
+  lock_guard<mutex> lock(m_locker);
+
+  m_keys.erase(csKeyName);
+}
+
+void KeyCache::InvalidateAll()
+{
+  // lock resources
+  lock_guard<mutex> lock(m_locker);
+
+  m_keys.clear();
+}
+} // namespace api
+} // namespace rmscrypto
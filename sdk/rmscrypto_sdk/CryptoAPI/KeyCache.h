@@ -0,0 +1,93 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#ifndef _CRYPTO_STREAMS_LIB_KEYCACHE_H_
+#define _CRYPTO_STREAMS_LIB_KEYCACHE_H_
+
+#include <stdint.h>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "CryptoAPIExport.h"
+
+namespace rmscrypto {
+namespace api {
+// Key material on pages of its own that are locked in memory where the
+// platform allows it and zeroized before they are released.
+class DLL_PUBLIC_CRYPTO SecureKey {
+public:
+
+  SecureKey(const uint8_t *pbKey,
+            size_t         cbKey);
+  ~SecureKey();
+
+  const uint8_t* Data() const {
+    return m_pbKey;
+  }
+
+  size_t Size() const {
+    return m_cbKey;
+  }
+
+  // copy for APIs that take the key by vector, the caller should cleanse it
+  std::vector<uint8_t>ToVector() const;
+
+private:
+
+  SecureKey(const SecureKey&);
+  SecureKey& operator=(const SecureKey&);
+
+  uint8_t *m_pbKey;
+  size_t   m_cbKey;
+  size_t   m_cbAllocated;
+  bool     m_bLocked;
+};
+
+typedef std::shared_ptr<const SecureKey> SharedSecureKey;
+
+// Process wide name -> key cache in front of the platform key storage, whose
+// lookups may be slow (a D-Bus round-trip with libsecret). Concurrent first
+// lookups of the same name share a single load. Failed loads aren't cached.
+class DLL_PUBLIC_CRYPTO KeyCache {
+public:
+
+  // returns nullptr if there is no key, may throw
+  typedef std::function<SharedSecureKey(const std::string&)> Loader;
+
+  static KeyCache& Instance();
+
+  SharedSecureKey  Get(const std::string& csKeyName,
+                       const Loader     & loader);
+
+  // Drops the cached key, the next Get loads it again. Holders of the old key
+  // keep it until they release it.
+  void             Invalidate(const std::string& csKeyName);
+  void             InvalidateAll();
+
+private:
+
+  typedef std::shared_future<SharedSecureKey> PendingKey;
+
+  KeyCache() {}
+
+  KeyCache(const KeyCache&);
+  KeyCache& operator=(const KeyCache&);
+
+  // lock resources
+  std::mutex m_locker;
+
+  // loaded keys and loads in progress
+  std::map<std::string, std::shared_ptr<PendingKey> > m_keys;
+};
+} // namespace api
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_KEYCACHE_H_
@@ -0,0 +1,235 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include "MappedFileStream.h"
+#include "Executor.h"
+#include "RMSCryptoExceptions.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace api {
+// Owns the file descriptor and the read-only mapping of the whole file. It is
+// immutable after construction, so clones may use it concurrently.
+class MappedFileStream::Mapping {
+public:
+
+  Mapping(const string& path)
+    : m_fd(-1)
+    , m_pbData(nullptr)
+    , m_u64Size(0)
+  {
+    do {
+      m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    } while (m_fd < 0 && errno == EINTR);
+
+    if (m_fd < 0) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::OperationUnavailable,
+              "Failed to open file: " + path);
+    }
+
+    struct stat st;
+
+    if (fstat(m_fd, &st) != 0) {
+      close(m_fd);
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::UnknownError,
+              "Failed to get file size: " + path);
+    }
+
+    m_u64Size = static_cast<uint64_t>(st.st_size);
+
+    // mmap can't map empty files and fails for files larger than the address
+    // space; those are read with pread instead
+    if (S_ISREG(st.st_mode) && (m_u64Size > 0) &&
+        (m_u64Size <= static_cast<uint64_t>(SIZE_MAX))) {
+      void *pMapped = mmap(nullptr, static_cast<size_t>(m_u64Size), PROT_READ,
+                           MAP_SHARED, m_fd, 0);
+
+      if (pMapped != MAP_FAILED) {
+        m_pbData = static_cast<const uint8_t *>(pMapped);
+      }
+    }
+  }
+
+  ~Mapping()
+  {
+    if (m_pbData != nullptr) {
+      munmap(const_cast<uint8_t *>(m_pbData), static_cast<size_t>(m_u64Size));
+    }
+    close(m_fd);
+  }
+
+  int64_t Read(uint8_t *pbBuffer, int64_t cbBuffer, int64_t cbOffset) const
+  {
+    if ((cbOffset < 0) || (cbBuffer < 0)) {
+      throw exceptions::RMSCryptoInvalidArgumentException("Bad parameter");
+    }
+
+    if (static_cast<uint64_t>(cbOffset) >= m_u64Size) {
+      return 0;
+    }
+
+    uint64_t toRead = min(static_cast<uint64_t>(cbBuffer),
+                          m_u64Size - static_cast<uint64_t>(cbOffset));
+
+    if (m_pbData != nullptr) {
+      memcpy(pbBuffer, m_pbData + cbOffset, static_cast<size_t>(toRead));
+      return static_cast<int64_t>(toRead);
+    }
+
+    // fallback: positional reads don't touch the shared file offset
+    uint64_t done = 0;
+
+    while (done < toRead) {
+      ssize_t cbRead = pread(m_fd, pbBuffer + done,
+                             static_cast<size_t>(toRead - done),
+                             static_cast<off_t>(cbOffset + done));
+
+      if (cbRead < 0) {
+        if (errno == EINTR) continue;
+        throw exceptions::RMSCryptoIOException(
+                exceptions::RMSCryptoException::UnknownError,
+                "Read error");
+      }
+
+      if (cbRead == 0) break;
+
+      done += static_cast<uint64_t>(cbRead);
+    }
+    return static_cast<int64_t>(done);
+  }
+
+  bool IsMapped() const {
+    return m_pbData != nullptr;
+  }
+
+  uint64_t Size() const {
+    return m_u64Size;
+  }
+
+private:
+
+  Mapping(const Mapping&);
+  Mapping& operator=(const Mapping&);
+
+  int            m_fd;
+  const uint8_t *m_pbData;
+  uint64_t       m_u64Size;
+};
+
+MappedFileStream::MappedFileStream(const string& path)
+  : m_mapping(make_shared<Mapping>(path))
+  , m_u64Position(0)
+{}
+
+MappedFileStream::MappedFileStream(shared_ptr<Mapping>mapping)
+  : m_mapping(mapping)
+  , m_u64Position(0)
+{}
+
+shared_future<int64_t>MappedFileStream::ReadAsync(uint8_t *pbBuffer,
+                                                  int64_t  cbBuffer,
+                                                  int64_t  cbOffset,
+                                                  launch   launchType)
+{
+  auto selfPtr = shared_from_this();
+
+  return Async(*Executor::Default(), launchType,
+               [](shared_ptr<MappedFileStream>self,
+                  uint8_t *buffer,
+                  int64_t  size,
+                  int64_t  offset) -> int64_t {
+        return self->ReadAt(buffer, size, offset);
+      }, selfPtr, pbBuffer, cbBuffer, cbOffset);
+}
+
+shared_future<int64_t>MappedFileStream::WriteAsync(const uint8_t *,
+                                                   int64_t,
+                                                   int64_t,
+                                                   launch)
+{
+  throw exceptions::RMSCryptoIOException(
+          exceptions::RMSCryptoIOException::OperationUnavailable,
+          "Operation unavailable!");
+}
+
+future<bool>MappedFileStream::FlushAsync(launch launchType) {
+  return Async(*Executor::Default(), launchType,
+               []() -> bool {
+        return true;
+      });
+}
+
+int64_t MappedFileStream::Read(uint8_t *pbBuffer,
+                               int64_t  cbBuffer) {
+  auto read = ReadAt(pbBuffer, cbBuffer, static_cast<int64_t>(m_u64Position));
+
+  m_u64Position += static_cast<uint64_t>(read);
+  return read;
+}
+
+int64_t MappedFileStream::Write(const uint8_t *,
+                                int64_t) {
+  throw exceptions::RMSCryptoIOException(
+          exceptions::RMSCryptoIOException::OperationUnavailable,
+          "Operation unavailable!");
+}
+
+bool MappedFileStream::Flush() {
+  return true;
+}
+
+int64_t MappedFileStream::ReadAt(uint8_t *pbBuffer,
+                                 int64_t  cbBuffer,
+                                 int64_t  cbOffset) const {
+  return m_mapping->Read(pbBuffer, cbBuffer, cbOffset);
+}
+
+SharedStream MappedFileStream::Clone() {
+  return static_pointer_cast<IStream>(shared_ptr<MappedFileStream>(
+                                        new MappedFileStream(m_mapping)));
+}
+
+void MappedFileStream::Seek(uint64_t u64Position) {
+  m_u64Position = u64Position;
+}
+
+bool MappedFileStream::CanRead() const {
+  return true;
+}
+
+bool MappedFileStream::CanWrite() const {
+  return false;
+}
+
+uint64_t MappedFileStream::Position() {
+  return m_u64Position;
+}
+
+uint64_t MappedFileStream::Size() {
+  return m_mapping->Size();
+}
+
+void MappedFileStream::Size(uint64_t) {
+  throw exceptions::RMSCryptoIOException(
+          exceptions::RMSCryptoIOException::OperationUnavailable,
+          "Operation unavailable!");
+}
+
+bool MappedFileStream::IsMapped() const {
+  return m_mapping->IsMapped();
+}
+} // namespace api
+} // namespace rmscrypto
@@ -0,0 +1,78 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#ifndef _CRYPTO_STREAMS_LIB_MAPPEDFILESTREAM_H
+#define _CRYPTO_STREAMS_LIB_MAPPEDFILESTREAM_H
+
+#include <atomic>
+#include <string>
+#include "IStream.h"
+
+namespace rmscrypto {
+namespace api {
+/*!
+  @brief Read-only file stream that serves reads from a memory mapping of the
+  file.
+
+  The mapping is opened once and shared by all clones; since it is never
+  modified after construction, reads take no lock. Each clone keeps its own
+  position for the sync Read/Seek methods. Files that cannot be mapped (empty
+  files, address space exhaustion, special files) are read with pread instead.
+*/
+class MappedFileStream : public IStream,
+                         public std::enable_shared_from_this<MappedFileStream>{
+public:
+
+  MappedFileStream(const std::string& path);
+
+  virtual std::shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
+                                               int64_t     cbBuffer,
+                                               int64_t     cbOffset,
+                                               std::launch launchType) override;
+  virtual std::shared_future<int64_t>WriteAsync(const uint8_t *cpbBuffer,
+                                                int64_t        cbBuffer,
+                                                int64_t        cbOffset,
+                                                std::launch    launchType)
+  override;
+  virtual std::future<bool>FlushAsync(std::launch launchType) override;
+
+  // Sync methods
+  virtual int64_t          Read(uint8_t *pbBuffer,
+                                int64_t  cbBuffer) override;
+  virtual int64_t          Write(const uint8_t *cpbBuffer,
+                                 int64_t        cbBuffer) override;
+  virtual bool             Flush()                        override;
+
+  virtual SharedStream     Clone() override;
+
+  virtual void             Seek(uint64_t u64Position) override;
+  virtual bool             CanRead()  const           override;
+  virtual bool             CanWrite() const           override;
+  virtual uint64_t         Position()                 override;
+  virtual uint64_t         Size()                     override;
+  virtual void             Size(uint64_t u64Value)    override;
+
+  // true if reads are served from the mapping rather than pread
+  bool                     IsMapped() const;
+
+private:
+
+  class Mapping;
+
+  MappedFileStream(std::shared_ptr<Mapping>mapping);
+
+  int64_t ReadAt(uint8_t *pbBuffer,
+                 int64_t  cbBuffer,
+                 int64_t  cbOffset) const;
+
+  std::shared_ptr<Mapping> m_mapping;
+  std::atomic<uint64_t>    m_u64Position;
+};
+} // namespace api
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_MAPPEDFILESTREAM_H
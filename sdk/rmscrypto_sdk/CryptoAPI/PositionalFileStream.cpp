@@ -0,0 +1,293 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "PositionalFileStream.h"
+#include "Executor.h"
+#include "RMSCryptoExceptions.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace api {
+// Owns the file descriptor shared by all clones. pread/pwrite never touch the
+// descriptor's file offset, so no locking is needed.
+class PositionalFileStream::File {
+public:
+
+  File(const string& path, ios_base::openmode mode)
+    : m_fd(-1)
+    , m_bCanRead((mode & ios_base::in) != 0)
+    , m_bCanWrite((mode & (ios_base::out | ios_base::app)) != 0)
+  {
+    if (!m_bCanRead && !m_bCanWrite) {
+      throw exceptions::RMSCryptoInvalidArgumentException("Bad parameter");
+    }
+
+    // same create/truncate rules as std::fstream; append is handled through
+    // the initial position because pwrite on an O_APPEND descriptor ignores
+    // the offset
+    int flags = m_bCanRead ? (m_bCanWrite ? O_RDWR : O_RDONLY) : O_WRONLY;
+
+    if (m_bCanWrite && (!m_bCanRead || (mode & ios_base::trunc) ||
+                        (mode & ios_base::app))) {
+      flags |= O_CREAT;
+    }
+
+    if ((mode & ios_base::trunc) ||
+        (m_bCanWrite && !m_bCanRead && !(mode & ios_base::app))) {
+      flags |= O_TRUNC;
+    }
+
+    do {
+      m_fd = open(path.c_str(), flags | O_CLOEXEC, 0666);
+    } while (m_fd < 0 && errno == EINTR);
+
+    if (m_fd < 0) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::OperationUnavailable,
+              "Failed to open file: " + path);
+    }
+  }
+
+  ~File()
+  {
+    close(m_fd);
+  }
+
+  int64_t ReadAt(uint8_t *pbBuffer, int64_t cbBuffer, int64_t cbOffset) const
+  {
+    if (!m_bCanRead) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoIOException::OperationUnavailable,
+              "Operation unavailable!");
+    }
+
+    if ((cbOffset < 0) || (cbBuffer < 0)) {
+      throw exceptions::RMSCryptoInvalidArgumentException("Bad parameter");
+    }
+
+    int64_t done = 0;
+
+    while (done < cbBuffer) {
+      ssize_t cbRead = pread(m_fd, pbBuffer + done,
+                             static_cast<size_t>(cbBuffer - done),
+                             static_cast<off_t>(cbOffset + done));
+
+      if (cbRead < 0) {
+        if (errno == EINTR) continue;
+        throw exceptions::RMSCryptoIOException(
+                exceptions::RMSCryptoException::UnknownError,
+                "Read error");
+      }
+
+      if (cbRead == 0) break;
+
+      done += cbRead;
+    }
+    return done;
+  }
+
+  int64_t WriteAt(const uint8_t *cpbBuffer, int64_t cbBuffer,
+                  int64_t cbOffset) const
+  {
+    if (!m_bCanWrite) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoIOException::OperationUnavailable,
+              "Operation unavailable!");
+    }
+
+    if ((cbOffset < 0) || (cbBuffer < 0)) {
+      throw exceptions::RMSCryptoInvalidArgumentException("Bad parameter");
+    }
+
+    int64_t done = 0;
+
+    while (done < cbBuffer) {
+      ssize_t cbWritten = pwrite(m_fd, cpbBuffer + done,
+                                 static_cast<size_t>(cbBuffer - done),
+                                 static_cast<off_t>(cbOffset + done));
+
+      if (cbWritten < 0) {
+        if (errno == EINTR) continue;
+        throw exceptions::RMSCryptoIOException(
+                exceptions::RMSCryptoException::UnknownError,
+                "Write error");
+      }
+
+      done += cbWritten;
+    }
+    return done;
+  }
+
+  uint64_t Size() const
+  {
+    struct stat st;
+
+    if (fstat(m_fd, &st) != 0) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::UnknownError,
+              "Failed to get file size");
+    }
+    return static_cast<uint64_t>(st.st_size);
+  }
+
+  void Size(uint64_t u64Value) const
+  {
+    if (!m_bCanWrite) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoIOException::OperationUnavailable,
+              "Operation unavailable!");
+    }
+
+    int res;
+
+    do {
+      res = ftruncate(m_fd, static_cast<off_t>(u64Value));
+    } while (res != 0 && errno == EINTR);
+
+    if (res != 0) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::UnknownError,
+              "Failed to resize file");
+    }
+  }
+
+  int Descriptor() const {
+    return m_fd;
+  }
+
+  bool CanRead() const {
+    return m_bCanRead;
+  }
+
+  bool CanWrite() const {
+    return m_bCanWrite;
+  }
+
+private:
+
+  File(const File&);
+  File& operator=(const File&);
+
+  int  m_fd;
+  bool m_bCanRead;
+  bool m_bCanWrite;
+};
+
+PositionalFileStream::PositionalFileStream(const string     & path,
+                                           ios_base::openmode mode)
+  : m_file(make_shared<File>(path, mode))
+  , m_u64Position(0)
+{
+  if (mode & (ios_base::ate | ios_base::app)) {
+    m_u64Position = m_file->Size();
+  }
+}
+
+PositionalFileStream::PositionalFileStream(shared_ptr<File>file)
+  : m_file(file)
+  , m_u64Position(0)
+{}
+
+shared_future<int64_t>PositionalFileStream::ReadAsync(uint8_t *pbBuffer,
+                                                      int64_t  cbBuffer,
+                                                      int64_t  cbOffset,
+                                                      launch   launchType)
+{
+  auto file = m_file;
+
+  return Async(*Executor::Default(), launchType,
+               [file](uint8_t *buffer,
+                      int64_t  size,
+                      int64_t  offset) -> int64_t {
+        return file->ReadAt(buffer, size, offset);
+      }, pbBuffer, cbBuffer, cbOffset);
+}
+
+shared_future<int64_t>PositionalFileStream::WriteAsync(const uint8_t *cpbBuffer,
+                                                       int64_t        cbBuffer,
+                                                       int64_t        cbOffset,
+                                                       launch         launchType)
+{
+  auto file = m_file;
+
+  return Async(*Executor::Default(), launchType,
+               [file](const uint8_t *buffer,
+                      int64_t        size,
+                      int64_t        offset) -> int64_t {
+        return file->WriteAt(buffer, size, offset);
+      }, cpbBuffer, cbBuffer, cbOffset);
+}
+
+future<bool>PositionalFileStream::FlushAsync(launch launchType) {
+  return Async(*Executor::Default(), launchType,
+               []() -> bool {
+        return true;
+      });
+}
+
+int64_t PositionalFileStream::Read(uint8_t *pbBuffer,
+                                   int64_t  cbBuffer) {
+  auto read = m_file->ReadAt(pbBuffer, cbBuffer,
+                             static_cast<int64_t>(m_u64Position));
+
+  m_u64Position += static_cast<uint64_t>(read);
+  return read;
+}
+
+int64_t PositionalFileStream::Write(const uint8_t *cpbBuffer,
+                                    int64_t        cbBuffer) {
+  auto written = m_file->WriteAt(cpbBuffer, cbBuffer,
+                                 static_cast<int64_t>(m_u64Position));
+
+  m_u64Position += static_cast<uint64_t>(written);
+  return written;
+}
+
+// writes are unbuffered, so there is nothing to flush
+bool PositionalFileStream::Flush() {
+  return true;
+}
+
+SharedStream PositionalFileStream::Clone() {
+  return static_pointer_cast<IStream>(shared_ptr<PositionalFileStream>(
+                                        new PositionalFileStream(m_file)));
+}
+
+void PositionalFileStream::Seek(uint64_t u64Position) {
+  m_u64Position = u64Position;
+}
+
+bool PositionalFileStream::CanRead() const {
+  return m_file->CanRead();
+}
+
+bool PositionalFileStream::CanWrite() const {
+  return m_file->CanWrite();
+}
+
+uint64_t PositionalFileStream::Position() {
+  return m_u64Position;
+}
+
+uint64_t PositionalFileStream::Size() {
+  return m_file->Size();
+}
+
+void PositionalFileStream::Size(uint64_t u64Value) {
+  m_file->Size(u64Value);
+}
+
+int PositionalFileStream::Descriptor() const {
+  return m_file->Descriptor();
+}
+} // namespace api
+} // namespace rmscrypto
@@ -0,0 +1,76 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#ifndef _CRYPTO_STREAMS_LIB_POSITIONALFILESTREAM_H
+#define _CRYPTO_STREAMS_LIB_POSITIONALFILESTREAM_H
+
+#include <atomic>
+#include <ios>
+#include <string>
+#include "IStream.h"
+
+namespace rmscrypto {
+namespace api {
+/*!
+  @brief File stream built on pread/pwrite.
+
+  Every ReadAsync/WriteAsync goes to the offset it is given, so there is no
+  shared cursor and no lock: clones share the file descriptor and may read and
+  write different regions of the file concurrently. Each clone keeps its own
+  position for the sync Read/Write/Seek methods.
+*/
+class PositionalFileStream : public IStream,
+                             public std::enable_shared_from_this<
+                               PositionalFileStream>{
+public:
+
+  PositionalFileStream(const std::string     & path,
+                       std::ios_base::openmode mode);
+
+  virtual std::shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
+                                               int64_t     cbBuffer,
+                                               int64_t     cbOffset,
+                                               std::launch launchType) override;
+  virtual std::shared_future<int64_t>WriteAsync(const uint8_t *cpbBuffer,
+                                                int64_t        cbBuffer,
+                                                int64_t        cbOffset,
+                                                std::launch    launchType)
+  override;
+  virtual std::future<bool>FlushAsync(std::launch launchType) override;
+
+  // Sync methods
+  virtual int64_t          Read(uint8_t *pbBuffer,
+                                int64_t  cbBuffer) override;
+  virtual int64_t          Write(const uint8_t *cpbBuffer,
+                                 int64_t        cbBuffer) override;
+  virtual bool             Flush()                        override;
+
+  virtual SharedStream     Clone() override;
+
+  virtual void             Seek(uint64_t u64Position) override;
+  virtual bool             CanRead()  const           override;
+  virtual bool             CanWrite() const           override;
+  virtual uint64_t         Position()                 override;
+  virtual uint64_t         Size()                     override;
+  virtual void             Size(uint64_t u64Value)    override;
+
+protected:
+
+  class File;
+
+  PositionalFileStream(std::shared_ptr<File>file);
+
+  // the descriptor shared by all clones, for streams that do their own I/O
+  int                   Descriptor() const;
+
+  std::shared_ptr<File> m_file;
+  std::atomic<uint64_t> m_u64Position;
+};
+} // namespace api
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_POSITIONALFILESTREAM_H
@@ -0,0 +1,64 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include "RangeLock.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace api {
+const uint64_t RangeLock::END;
+
+RangeLock::Scope::Scope(RangeLock& lock,
+                        uint64_t   u64First,
+                        uint64_t   u64End,
+                        bool       bIsExclusive)
+  : m_lock(lock)
+{
+  Request request;
+
+  request.u64First     = u64First;
+  request.u64End       = u64End;
+  request.bIsExclusive = bIsExclusive;
+
+  // lock resources
+  unique_lock<mutex> locker(m_lock.m_locker);
+
+  m_request = m_lock.m_requests.insert(m_lock.m_requests.end(), request);
+
+  m_lock.m_released.wait(locker, [this]() {
+    return !m_lock.IsBlocked(m_request);
+  });
+}
+
+RangeLock::Scope::~Scope()
+{
+  {
+    // lock resources
+    lock_guard<mutex> locker(m_lock.m_locker);
+    m_lock.m_requests.erase(m_request);
+  }
+  m_lock.m_released.notify_all();
+}
+
+bool RangeLock::IsBlocked(list<Request>::iterator request) const
+{
+  // earlier requests go first, whether they are held or still waiting
+  for (auto it = m_requests.begin(); it != request; ++it)
+  {
+    bool bOverlaps = (it->u64First < request->u64End) &&
+                     (request->u64First < it->u64End);
+
+    if (bOverlaps && (it->bIsExclusive || request->bIsExclusive)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+} // namespace api
+} // namespace rmscrypto
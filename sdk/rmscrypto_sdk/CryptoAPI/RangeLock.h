@@ -0,0 +1,74 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#ifndef _CRYPTO_STREAMS_LIB_RANGELOCK_H_
+#define _CRYPTO_STREAMS_LIB_RANGELOCK_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <limits>
+#include <list>
+#include <mutex>
+
+namespace rmscrypto {
+namespace api {
+// Reader/writer lock over ranges [first, end) of block numbers. Shared holders
+// of overlapping ranges run together, an exclusive holder excludes every range
+// it overlaps. Requests are granted in arrival order, so a writer isn't starved
+// by readers arriving after it.
+class RangeLock {
+private:
+
+  struct Request
+  {
+    uint64_t u64First;
+    uint64_t u64End;
+    bool     bIsExclusive;
+  };
+
+public:
+
+  static const uint64_t END = std::numeric_limits<uint64_t>::max();
+
+  // Holds a range for its lifetime
+  class Scope {
+  public:
+
+    Scope(RangeLock& lock,
+          uint64_t   u64First,
+          uint64_t   u64End,
+          bool       bIsExclusive);
+    ~Scope();
+
+  private:
+
+    Scope(const Scope&);
+    Scope& operator=(const Scope&);
+
+    RangeLock& m_lock;
+    std::list<Request>::iterator m_request;
+  };
+
+  RangeLock() {}
+
+private:
+
+  RangeLock(const RangeLock&);
+  RangeLock& operator=(const RangeLock&);
+
+  bool IsBlocked(std::list<Request>::iterator request) const;
+
+  std::mutex              m_locker;
+  std::condition_variable m_released;
+
+  // held and waiting requests, oldest first
+  std::list<Request> m_requests;
+};
+} // namespace api
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_RANGELOCK_H_
@@ -7,8 +7,10 @@
  */
 
 #include <stdint.h>
+#include <deque>
 #include "../Platform/Logger/Logger.h"
 #include "SimpleProtectedStream.h"
+#include "Executor.h"
 #include "RMSCryptoExceptions.h"
 
 using namespace std;
@@ -64,7 +66,7 @@ shared_future<int64_t>SimpleProtectedStream::ReadInternalAsync(
   int64_t     cbBuffer,
   int64_t     cbOffset,
   std::launch launchType,
-  uint32_t    u32StartingBlockNumber,
+  uint64_t    u64StartingBlockNumber,
   bool        bIsFinal)
 {
   if (m_bIsPlainText)
@@ -83,45 +85,142 @@ shared_future<int64_t>SimpleProtectedStream::ReadInternalAsync(
 
   auto selfPtr = this->shared_from_this();
 
-  return std::async(launchType, [](shared_ptr<SimpleProtectedStream>self,
-                                   uint8_t *buffer,
-                                   int64_t  bSize,
-                                   int64_t  offset,
-                                   uint32_t startingBlockNumber,
-                                   bool     isFinal) -> int64_t
+  return Async(*Executor::Default(), launchType,
+               [](shared_ptr<SimpleProtectedStream>self,
+                  uint8_t *buffer,
+                  int64_t  bSize,
+                  int64_t  offset,
+                  uint64_t startingBlockNumber,
+                  bool     isFinal) -> int64_t
       {
-        // lock resources
-        unique_lock<mutex>lock(*self->m_locker);
+        uint64_t toRead = 0;
 
-        // calculate the number of uint8_ts left in the stream
-        uint64_t u64ContentLeft = self->m_u64ContentSize - offset;
-        uint64_t toRead = min(static_cast<uint64_t>(bSize), u64ContentLeft);
+        {
+          // lock resources
+          unique_lock<mutex>lock(*self->m_locker);
 
-        // seek to Read
-        self->SeekInternal(offset);
+          // calculate the number of uint8_ts left in the stream
+          uint64_t u64ContentLeft = self->m_u64ContentSize - offset;
+          toRead = min(static_cast<uint64_t>(bSize), u64ContentLeft);
+        }
 
-        // read the cipherText from the backing stream (make sure we don't read
-        // more
-        // than u64ContentLeft)
-        vector<uint8_t>cipherText = self->m_pBackingStream->Read(toRead);
+        // read the cipherText from the backing stream at an explicit offset
+        // (make sure we don't read more than u64ContentLeft). The stream lock
+        // is not held here, so reads of different blocks can be decrypted
+        // concurrently.
+        // The cipherText is never longer than the plain text, so it's read
+        // straight into the supplied buffer and decrypted in place.
+        int64_t cbRead = 0;
 
-        // decrypt the ciphertext into the supplied buffer
+        if (toRead > 0)
+        {
+          cbRead = self->m_pBackingStream->ReadAsync(
+            buffer, toRead, offset + self->m_u64ContentStart,
+            std::launch::deferred).get();
+        }
+
+        // decrypt the ciphertext in place
         uint32_t cbOut = 0;
 
-        if (cipherText.size() > 0)
+        if (cbRead > 0)
         {
-          self->m_pCryptoProvider->Decrypt(&cipherText[0],
-                                           static_cast<uint32_t>(cipherText.size()),
+          self->m_pCryptoProvider->Decrypt(buffer,
+                                           static_cast<uint32_t>(cbRead),
                                            startingBlockNumber, isFinal,
                                            buffer, static_cast<uint32_t>(bSize),
                                            &cbOut);
         }
 
         return static_cast<int64_t>(cbOut);
-      }, selfPtr, pbBuffer, cbBuffer, cbOffset, u32StartingBlockNumber,
+      }, selfPtr, pbBuffer, cbBuffer, cbOffset, u64StartingBlockNumber,
                     bIsFinal);
 }
 
+int64_t SimpleProtectedStream::ReadPipelined(uint8_t *pbBuffer,
+                                             int64_t  cbBuffer,
+                                             int64_t  cbOffset,
+                                             uint64_t u64BlockSize,
+                                             uint64_t u64ChunkSize,
+                                             uint32_t u32Depth)
+{
+  uint64_t toRead = 0;
+
+  {
+    // lock resources
+    unique_lock<mutex> lock(*m_locker);
+
+    // calculate the number of uint8_ts left in the stream
+    uint64_t u64ContentLeft = m_u64ContentSize - cbOffset;
+    toRead = min(static_cast<uint64_t>(cbBuffer), u64ContentLeft);
+  }
+
+  // Reads are started with launch::async: a stream with real asynchronous
+  // I/O has them running as soon as ReadAsync returns, others run them on
+  // the executor. Either way the next chunks are on their way while the
+  // current one is decrypted in place. On an executor worker the reads are
+  // deferred instead, so that waiting for them can't hold up the workers
+  // they would need; streams with real asynchronous I/O ignore that.
+  const std::launch readLaunch = Executor::Default()->IsWorkerThread() ?
+                                 std::launch::deferred : std::launch::async;
+  deque<pair<uint64_t, shared_future<int64_t> > > reads;
+  uint64_t u64Issued    = 0;
+  uint64_t u64Decrypted = 0;
+  bool     bEndOfStream = false;
+  exception_ptr error;
+
+  try {
+    while (!bEndOfStream && ((u64Issued < toRead) || !reads.empty()))
+    {
+      while ((u64Issued < toRead) && (reads.size() < max(u32Depth, 1u)))
+      {
+        uint64_t u64Length = min(u64ChunkSize, toRead - u64Issued);
+
+        reads.push_back(make_pair(u64Length, m_pBackingStream->ReadAsync(
+                                    pbBuffer + u64Issued,
+                                    static_cast<int64_t>(u64Length),
+                                    cbOffset + u64Issued + m_u64ContentStart,
+                                    readLaunch)));
+        u64Issued += u64Length;
+      }
+
+      uint64_t u64Length = reads.front().first;
+      int64_t  cbRead    = reads.front().second.get();
+      reads.pop_front();
+
+      uint32_t cbOut = 0;
+
+      if (cbRead > 0)
+      {
+        m_pCryptoProvider->Decrypt(pbBuffer + u64Decrypted,
+                                   static_cast<uint32_t>(cbRead),
+                                   (cbOffset + u64Decrypted) / u64BlockSize,
+                                   false,
+                                   pbBuffer + u64Decrypted,
+                                   static_cast<uint32_t>(u64Length),
+                                   &cbOut);
+      }
+
+      u64Decrypted += cbOut;
+      bEndOfStream  = static_cast<uint64_t>(cbRead) < u64Length;
+    }
+  }
+  catch (...) {
+    error = current_exception();
+  }
+
+  // the reads still in flight target the caller's buffer, wait for them
+  for (auto& read : reads)
+  {
+    read.second.wait();
+  }
+
+  if (error) {
+    rethrow_exception(error);
+  }
+
+  return static_cast<int64_t>(u64Decrypted);
+}
+
 shared_future<int64_t>SimpleProtectedStream::WriteAsync(const uint8_t *cpbBuffer,
                                                         int64_t        cbBuffer,
                                                         int64_t        cbOffset,
@@ -140,24 +239,24 @@ shared_future<int64_t>SimpleProtectedStream::WriteInternalAsync(
   int64_t        cbBuffer,
   int64_t        cbOffset,
   std::launch    launchType,
-  uint32_t       u32StartingBlockNumber,
+  uint64_t       u64StartingBlockNumber,
   bool           bIsFinal)
 {
   auto selfPtr = this->shared_from_this();
 
-  return std::async(launchType, [](shared_ptr<SimpleProtectedStream>self,
-                                   const uint8_t *buffer,
-                                   int64_t  bSize,
-                                   int64_t  offset,
-                                   uint32_t       startingBlockNumber,
-                                   bool           isFinal) -> int64_t
+  return Async(*Executor::Default(), launchType,
+               [](shared_ptr<SimpleProtectedStream>self,
+                  const uint8_t *buffer,
+                  int64_t  bSize,
+                  int64_t  offset,
+                  uint64_t       startingBlockNumber,
+                  bool           isFinal) -> int64_t
       {
         uint32_t cbOut = (uint32_t)(bSize);
         vector<uint8_t>cipherText;
 
-        // lock resources
-        unique_lock<mutex>lock(*self->m_locker);
-
+        // the stream lock isn't needed for encrypting, so writes of different
+        // blocks can be encrypted concurrently
         if (self->m_bIsPlainText)
         {
           cipherText = vector<uint8_t>(buffer, buffer + bSize);
@@ -169,7 +268,7 @@ shared_future<int64_t>SimpleProtectedStream::WriteInternalAsync(
 
           cipherText.resize(encryptedSize);
 
-          Logger::Hidden("writing block #%d", startingBlockNumber);
+          Logger::Hidden("writing block #%I64d", startingBlockNumber);
 
           // encrypt the supplied buffer into cipherText
           self->m_pCryptoProvider->Encrypt(buffer, static_cast<uint32_t>(bSize),
@@ -179,7 +278,9 @@ shared_future<int64_t>SimpleProtectedStream::WriteInternalAsync(
                                            &cbOut);
         }
 
-        // cipherText.size();
+        // lock resources
+        unique_lock<mutex>lock(*self->m_locker);
+
         // write the cipherText to the buffer
         int64_t u64Written =
           self->m_pBackingStream->WriteAsync(&cipherText[0],
@@ -195,7 +296,7 @@ shared_future<int64_t>SimpleProtectedStream::WriteInternalAsync(
       }, selfPtr, cpbBuffer,
                     cbBuffer,
                     cbOffset,
-                    u32StartingBlockNumber,
+                    u64StartingBlockNumber,
                     bIsFinal);
 }
 
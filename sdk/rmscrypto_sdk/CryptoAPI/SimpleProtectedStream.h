@@ -61,15 +61,25 @@ public:
                                                int64_t cbBuffer,
                                                int64_t cbOffset,
                                                std::launch   launchType,
-                                               uint32_t      u32StartingBlockNumber,
+                                               uint64_t      u64StartingBlockNumber,
                                                bool          bIsFinal);
   std::shared_future<int64_t>WriteInternalAsync(const uint8_t *cpbBuffer,
                                                 int64_t  cbBuffer,
                                                 int64_t  cbOffset,
                                                 std::launch    launchType,
-                                                uint32_t       u32StartingBlockNumber,
+                                                uint64_t       u64StartingBlockNumber,
                                                 bool           bIsFinal);
 
+  // Reads and decrypts non-final blocks in chunks of u64ChunkSize bytes,
+  // keeping up to u32Depth backing reads in flight ahead of the chunk being
+  // decrypted. cbOffset and u64ChunkSize must be multiples of u64BlockSize.
+  int64_t                    ReadPipelined(uint8_t *pbBuffer,
+                                           int64_t  cbBuffer,
+                                           int64_t  cbOffset,
+                                           uint64_t u64BlockSize,
+                                           uint64_t u64ChunkSize,
+                                           uint32_t u32Depth);
+
 private:
 
   uint64_t               SizeInternal();
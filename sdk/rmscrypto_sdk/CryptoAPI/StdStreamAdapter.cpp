@@ -15,23 +15,27 @@ namespace rmscrypto {
 namespace api {
 StdStreamAdapter::StdStreamAdapter(shared_ptr<iostream>backingIOStream)
   : m_locker(new mutex)
+  , m_queue(SerialQueue::Create())
   , m_iBackingStream(static_pointer_cast<istream>(backingIOStream))
   , m_oBackingStream(static_pointer_cast<ostream>(backingIOStream))
 {}
 
 StdStreamAdapter::StdStreamAdapter(shared_ptr<ostream>backingOStream)
   : m_locker(new mutex)
+  , m_queue(SerialQueue::Create())
   , m_oBackingStream(backingOStream)
 {}
 
 StdStreamAdapter::StdStreamAdapter(shared_ptr<istream>backingIStream)
   : m_locker(new mutex)
+  , m_queue(SerialQueue::Create())
   , m_iBackingStream(backingIStream)
 {}
 
 // copy all properties include mutex to support thread safety work!
 StdStreamAdapter::StdStreamAdapter(std::shared_ptr<StdStreamAdapter>from)
   : m_locker(from->m_locker)
+  , m_queue(from->m_queue)
   , m_iBackingStream(from->m_iBackingStream)
   , m_oBackingStream(from->m_oBackingStream)
 {}
@@ -43,10 +47,11 @@ shared_future<int64_t>StdStreamAdapter::ReadAsync(uint8_t *pbBuffer,
 {
   auto selfPtr = shared_from_this();
 
-  return async(launchType, [](shared_ptr<StdStreamAdapter>self,
-                              uint8_t      *buffer,
-                              int64_t size,
-                              int64_t offset) -> int64_t {
+  return Async(*m_queue, launchType,
+               [](shared_ptr<StdStreamAdapter>self,
+                  uint8_t      *buffer,
+                  int64_t size,
+                  int64_t offset) -> int64_t {
         // first lock object
         lock_guard<mutex>lock(*self->m_locker);
 
@@ -72,10 +77,11 @@ shared_future<int64_t>StdStreamAdapter::WriteAsync(const uint8_t *cpbBuffer,
 {
   auto selfPtr = shared_from_this();
 
-  return async(launchType, [](shared_ptr<StdStreamAdapter>self,
-                              const uint8_t *buffer,
-                              int64_t size,
-                              int64_t offset) -> int64_t {
+  return Async(*m_queue, launchType,
+               [](shared_ptr<StdStreamAdapter>self,
+                  const uint8_t *buffer,
+                  int64_t size,
+                  int64_t offset) -> int64_t {
         // first lock object
         lock_guard<mutex>lock(*self->m_locker);
 
@@ -103,7 +109,8 @@ shared_future<int64_t>StdStreamAdapter::WriteAsync(const uint8_t *cpbBuffer,
 future<bool>StdStreamAdapter::FlushAsync(launch launchType) {
   auto selfPtr = shared_from_this();
 
-  return async(launchType, [](shared_ptr<StdStreamAdapter>self) -> bool {
+  return Async(*m_queue, launchType,
+               [](shared_ptr<StdStreamAdapter>self) -> bool {
         return self->Flush();
       }, selfPtr);
 }
@@ -11,6 +11,7 @@
 
 #include <iostream>
 #include "IStream.h"
+#include "Executor.h"
 
 namespace rmscrypto {
 namespace api {
@@ -54,6 +55,7 @@ private:
   StdStreamAdapter(std::shared_ptr<StdStreamAdapter>from);
 
   std::shared_ptr<std::mutex>   m_locker;
+  std::shared_ptr<SerialQueue>  m_queue;
   std::shared_ptr<std::istream> m_iBackingStream;
   std::shared_ptr<std::ostream> m_oBackingStream;
 
@@ -0,0 +1,428 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "UringFileStream.h"
+#include "RMSCryptoExceptions.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace api {
+namespace {
+// the completion queue is twice this size, which bounds the number of
+// requests in flight
+const unsigned RING_ENTRIES = 1024;
+
+struct UringRequest {
+  shared_ptr<void>  file; // keeps the descriptor open until completion
+  int               fd;
+  uint8_t           opcode;
+  uint8_t          *pbBuffer;
+  int64_t           cbBuffer;
+  int64_t           cbOffset;
+  int64_t           cbDone;
+  struct iovec      iov;
+  promise<int64_t>  result;
+};
+
+/*!
+  Process-wide ring. Submissions are serialized by a mutex and entered one at
+  a time, so the submission queue never fills; a detached thread waits for
+  completions and fulfils the promises. The ring lives until the process
+  exits.
+*/
+class IoRing {
+public:
+
+  static IoRing* Get()
+  {
+    static IoRing   *s_pRing = nullptr;
+    static once_flag s_once;
+
+    call_once(s_once, []() {
+      IoRing *pRing = new IoRing;
+
+      if (pRing->Setup()) {
+        s_pRing = pRing;
+        thread(&IoRing::Reap, pRing).detach();
+      } else {
+        delete pRing;
+      }
+    });
+    return s_pRing;
+  }
+
+  // bReserved is set when a request that already owns a completion slot is
+  // resubmitted
+  void Submit(UringRequest *pRequest, bool bReserved)
+  {
+    // lock resources
+    unique_lock<mutex> lock(m_locker);
+
+    if (!bReserved) {
+      m_slotFree.wait(lock, [this]() {
+        return m_u32InFlight < m_u32Capacity;
+      });
+      ++m_u32InFlight;
+    }
+
+    pRequest->iov.iov_base = pRequest->pbBuffer + pRequest->cbDone;
+    pRequest->iov.iov_len  = static_cast<size_t>(pRequest->cbBuffer -
+                                                 pRequest->cbDone);
+
+    unsigned tail  = *m_pSqTail;
+    unsigned index = tail & *m_pSqMask;
+    struct io_uring_sqe *pSqe = &m_pSqes[index];
+
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode    = pRequest->opcode;
+    pSqe->fd        = pRequest->fd;
+    pSqe->addr      = reinterpret_cast<uint64_t>(&pRequest->iov);
+    pSqe->len       = 1;
+    pSqe->off       = static_cast<uint64_t>(pRequest->cbOffset +
+                                            pRequest->cbDone);
+    pSqe->user_data = reinterpret_cast<uint64_t>(pRequest);
+
+    m_pSqArray[index] = index;
+    __atomic_store_n(m_pSqTail, tail + 1, __ATOMIC_RELEASE);
+
+    int res;
+
+    do {
+      res = Enter(1, 0, 0);
+
+      if ((res < 0) && ((errno == EAGAIN) || (errno == EBUSY))) {
+        this_thread::yield();
+      }
+    } while (res < 0 &&
+             (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+    if (res < 0) {
+      // the kernel didn't take the entry, withdraw it
+      __atomic_store_n(m_pSqTail, tail, __ATOMIC_RELEASE);
+
+      if (!bReserved) {
+        --m_u32InFlight;
+        m_slotFree.notify_one();
+      }
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::UnknownError,
+              "io_uring submission failed");
+    }
+  }
+
+private:
+
+  IoRing()
+    : m_fd(-1)
+    , m_pSqRing(MAP_FAILED)
+    , m_pCqRing(MAP_FAILED)
+    , m_pSqesMap(MAP_FAILED)
+    , m_u32InFlight(0)
+    , m_u32Capacity(0)
+  {}
+
+  ~IoRing()
+  {
+    if (m_pSqesMap != MAP_FAILED) munmap(m_pSqesMap, m_sqesSize);
+
+    if ((m_pCqRing != MAP_FAILED) && (m_pCqRing != m_pSqRing)) {
+      munmap(m_pCqRing, m_cqRingSize);
+    }
+
+    if (m_pSqRing != MAP_FAILED) munmap(m_pSqRing, m_sqRingSize);
+
+    if (m_fd >= 0) close(m_fd);
+  }
+
+  bool Setup()
+  {
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    m_fd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES,
+                                    &params));
+
+    if (m_fd < 0) {
+      // ENOSYS on old kernels, EPERM when disabled by policy
+      return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries *
+                   sizeof(struct io_uring_cqe);
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool bSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    if (bSingleMap) {
+      m_sqRingSize = m_cqRingSize = max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_pSqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+
+    if (m_pSqRing == MAP_FAILED) return false;
+
+    m_pCqRing = bSingleMap ? m_pSqRing :
+                mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+
+    if (m_pCqRing == MAP_FAILED) return false;
+
+    m_pSqesMap = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+
+    if (m_pSqesMap == MAP_FAILED) return false;
+
+    uint8_t *pSq = static_cast<uint8_t *>(m_pSqRing);
+    uint8_t *pCq = static_cast<uint8_t *>(m_pCqRing);
+
+    m_pSqTail  = reinterpret_cast<unsigned *>(pSq + params.sq_off.tail);
+    m_pSqMask  = reinterpret_cast<unsigned *>(pSq + params.sq_off.ring_mask);
+    m_pSqArray = reinterpret_cast<unsigned *>(pSq + params.sq_off.array);
+    m_pSqes    = static_cast<struct io_uring_sqe *>(m_pSqesMap);
+
+    m_pCqHead = reinterpret_cast<unsigned *>(pCq + params.cq_off.head);
+    m_pCqTail = reinterpret_cast<unsigned *>(pCq + params.cq_off.tail);
+    m_pCqMask = reinterpret_cast<unsigned *>(pCq + params.cq_off.ring_mask);
+    m_pCqes   = reinterpret_cast<struct io_uring_cqe *>(pCq +
+                                                        params.cq_off.cqes);
+
+    m_u32Capacity = params.cq_entries;
+    return true;
+  }
+
+  int Enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+  {
+    return static_cast<int>(syscall(__NR_io_uring_enter, m_fd, toSubmit,
+                                    minComplete, flags, nullptr, 0));
+  }
+
+  void Reap()
+  {
+    for (;;) {
+      Enter(0, 1, IORING_ENTER_GETEVENTS);
+
+      unsigned head = *m_pCqHead;
+      unsigned tail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+
+      while (head != tail) {
+        struct io_uring_cqe *pCqe = &m_pCqes[head & *m_pCqMask];
+        auto pRequest = reinterpret_cast<UringRequest *>(pCqe->user_data);
+        int  res      = pCqe->res;
+
+        // release the entry before a possible resubmission
+        __atomic_store_n(m_pCqHead, ++head, __ATOMIC_RELEASE);
+
+        Complete(pRequest, res);
+      }
+    }
+  }
+
+  void Complete(UringRequest *pRequest, int res)
+  {
+    if ((res == -EINTR) || (res == -EAGAIN)) {
+      Resubmit(pRequest);
+      return;
+    }
+
+    if (res < 0) {
+      Finish(pRequest, make_exception_ptr(exceptions::RMSCryptoIOException(
+                                            exceptions::RMSCryptoException::
+                                            UnknownError,
+                                            pRequest->opcode ==
+                                            IORING_OP_READV ? "Read error" :
+                                            "Write error")));
+      return;
+    }
+
+    pRequest->cbDone += res;
+
+    // short transfers continue where they stopped, a read of 0 bytes is the
+    // end of the file
+    if ((res > 0) && (pRequest->cbDone < pRequest->cbBuffer)) {
+      Resubmit(pRequest);
+      return;
+    }
+
+    Finish(pRequest, nullptr);
+  }
+
+  void Resubmit(UringRequest *pRequest)
+  {
+    try {
+      Submit(pRequest, true);
+    }
+    catch (...) {
+      Finish(pRequest, current_exception());
+    }
+  }
+
+  void Finish(UringRequest *pRequest, exception_ptr error)
+  {
+    if (error) {
+      pRequest->result.set_exception(error);
+    } else {
+      pRequest->result.set_value(pRequest->cbDone);
+    }
+    delete pRequest;
+
+    // lock resources
+    lock_guard<mutex> lock(m_locker);
+
+    --m_u32InFlight;
+    m_slotFree.notify_one();
+  }
+
+  int    m_fd;
+  void  *m_pSqRing;
+  void  *m_pCqRing;
+  void  *m_pSqesMap;
+  size_t m_sqRingSize;
+  size_t m_cqRingSize;
+  size_t m_sqesSize;
+
+  unsigned *m_pSqTail;
+  unsigned *m_pSqMask;
+  unsigned *m_pSqArray;
+  struct io_uring_sqe *m_pSqes;
+
+  unsigned *m_pCqHead;
+  unsigned *m_pCqTail;
+  unsigned *m_pCqMask;
+  struct io_uring_cqe *m_pCqes;
+
+  mutex              m_locker;
+  condition_variable m_slotFree;
+  uint32_t           m_u32InFlight;
+  uint32_t           m_u32Capacity;
+};
+
+shared_future<int64_t>SubmitRequest(shared_ptr<void>file,
+                                    int              fd,
+                                    uint8_t          opcode,
+                                    uint8_t         *pbBuffer,
+                                    int64_t          cbBuffer,
+                                    int64_t          cbOffset)
+{
+  if ((cbOffset < 0) || (cbBuffer < 0)) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Bad parameter");
+  }
+
+  unique_ptr<UringRequest> request(new UringRequest);
+  auto result = request->result.get_future().share();
+
+  if (cbBuffer == 0) {
+    request->result.set_value(0);
+    return result;
+  }
+
+  request->file     = file;
+  request->fd       = fd;
+  request->opcode   = opcode;
+  request->pbBuffer = pbBuffer;
+  request->cbBuffer = cbBuffer;
+  request->cbOffset = cbOffset;
+  request->cbDone   = 0;
+
+  // the ring owns the request once it has been submitted
+  IoRing::Get()->Submit(request.get(), false);
+  request.release();
+
+  return result;
+}
+} // namespace
+
+UringFileStream::UringFileStream(const string     & path,
+                                 ios_base::openmode mode)
+  : PositionalFileStream(path, mode)
+{
+  if (!IsSupported()) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::NotImplemented,
+            "io_uring is not supported");
+  }
+}
+
+UringFileStream::UringFileStream(shared_ptr<File>file)
+  : PositionalFileStream(file)
+{}
+
+bool UringFileStream::IsSupported()
+{
+  return IoRing::Get() != nullptr;
+}
+
+shared_future<int64_t>UringFileStream::ReadAsync(uint8_t *pbBuffer,
+                                                 int64_t  cbBuffer,
+                                                 int64_t  cbOffset,
+                                                 launch)
+{
+  if (!CanRead()) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoIOException::OperationUnavailable,
+            "Operation unavailable!");
+  }
+
+  return SubmitRequest(m_file, Descriptor(), IORING_OP_READV, pbBuffer,
+                       cbBuffer, cbOffset);
+}
+
+shared_future<int64_t>UringFileStream::WriteAsync(const uint8_t *cpbBuffer,
+                                                  int64_t        cbBuffer,
+                                                  int64_t        cbOffset,
+                                                  launch)
+{
+  if (!CanWrite()) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoIOException::OperationUnavailable,
+            "Operation unavailable!");
+  }
+
+  // the kernel only reads from the buffer
+  return SubmitRequest(m_file, Descriptor(), IORING_OP_WRITEV,
+                       const_cast<uint8_t *>(cpbBuffer), cbBuffer, cbOffset);
+}
+
+int64_t UringFileStream::Read(uint8_t *pbBuffer,
+                              int64_t  cbBuffer) {
+  auto read = ReadAsync(pbBuffer, cbBuffer,
+                        static_cast<int64_t>(m_u64Position),
+                        launch::deferred).get();
+
+  m_u64Position += static_cast<uint64_t>(read);
+  return read;
+}
+
+int64_t UringFileStream::Write(const uint8_t *cpbBuffer,
+                               int64_t        cbBuffer) {
+  auto written = WriteAsync(cpbBuffer, cbBuffer,
+                            static_cast<int64_t>(m_u64Position),
+                            launch::deferred).get();
+
+  m_u64Position += static_cast<uint64_t>(written);
+  return written;
+}
+
+SharedStream UringFileStream::Clone() {
+  return static_pointer_cast<IStream>(shared_ptr<UringFileStream>(
+                                        new UringFileStream(m_file)));
+}
+} // namespace api
+} // namespace rmscrypto
@@ -0,0 +1,59 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#ifndef _CRYPTO_STREAMS_LIB_URINGFILESTREAM_H
+#define _CRYPTO_STREAMS_LIB_URINGFILESTREAM_H
+
+#include "PositionalFileStream.h"
+
+namespace rmscrypto {
+namespace api {
+/*!
+  @brief File stream whose ReadAsync/WriteAsync are submitted to io_uring.
+
+  All streams share one process-wide ring. A single completion thread fulfils
+  the returned futures, so no thread is started per request and the I/O is
+  already running when ReadAsync returns, whatever the launch type. Size,
+  truncation and clones behave as in PositionalFileStream.
+
+  Use IsSupported() (or CreateAsyncStreamFromFile, which does it for you) to
+  fall back to PositionalFileStream on kernels without io_uring.
+*/
+class UringFileStream : public PositionalFileStream {
+public:
+
+  UringFileStream(const std::string     & path,
+                  std::ios_base::openmode mode);
+
+  // true if the kernel accepted io_uring setup for this process
+  static bool IsSupported();
+
+  virtual std::shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
+                                               int64_t     cbBuffer,
+                                               int64_t     cbOffset,
+                                               std::launch launchType) override;
+  virtual std::shared_future<int64_t>WriteAsync(const uint8_t *cpbBuffer,
+                                                int64_t        cbBuffer,
+                                                int64_t        cbOffset,
+                                                std::launch    launchType)
+  override;
+
+  virtual int64_t          Read(uint8_t *pbBuffer,
+                                int64_t  cbBuffer) override;
+  virtual int64_t          Write(const uint8_t *cpbBuffer,
+                                 int64_t        cbBuffer) override;
+
+  virtual SharedStream     Clone() override;
+
+private:
+
+  UringFileStream(std::shared_ptr<File>file);
+};
+} // namespace api
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_URINGFILESTREAM_H
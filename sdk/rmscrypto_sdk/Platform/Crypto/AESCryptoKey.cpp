@@ -15,17 +15,80 @@ using namespace std;
 namespace rmscrypto {
 namespace platform {
 namespace crypto {
+static const EVP_CIPHER* SelectCipher(api::CryptoAlgorithm algorithm,
+                                      size_t               cbKey)
+{
+  switch (algorithm) {
+  case api::CRYPTO_ALGORITHM_AES_ECB:
+    switch(cbKey) {
+    case 16:
+       return EVP_aes_128_ecb();
+    case 24:
+       return EVP_aes_192_ecb();
+    case 32:
+       return EVP_aes_256_ecb();
+    default:
+        throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
+    }
+
+  case api::CRYPTO_ALGORITHM_AES_CBC:
+  case api::CRYPTO_ALGORITHM_AES_CBC_PKCS7:
+      switch(cbKey) {
+      case 16:
+         return EVP_aes_128_cbc();
+      case 24:
+         return EVP_aes_192_cbc();
+      case 32:
+         return EVP_aes_256_cbc();
+      default:
+          throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
+      }
+
+  case api::CRYPTO_ALGORITHM_AES_CTR:
+      switch(cbKey) {
+      case 16:
+         return EVP_aes_128_ctr();
+      case 24:
+         return EVP_aes_192_ctr();
+      case 32:
+         return EVP_aes_256_ctr();
+      default:
+          throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
+      }
+
+  default:
+    throw exceptions::RMSCryptoInvalidArgumentException("Unsupported algorithm");
+  }
+}
+
 AESCryptoKey::AESCryptoKey(const uint8_t *pbKey, uint32_t cbKey,
                            api::CryptoAlgorithm& algorithm)
-  : m_key(cbKey), m_algorithm(algorithm)
+  : m_key(cbKey), m_algorithm(algorithm), m_cipher(nullptr)
 {
   if (cbKey == 0) {
     throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
   }
   memcpy(&m_key[0], pbKey, cbKey);
+
+  m_cipher = SelectCipher(m_algorithm, m_key.size());
+
+  if (EVP_CIPHER_key_length(m_cipher) != static_cast<int>(m_key.size())) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
+  }
 }
 
-AESCryptoKey::~AESCryptoKey() {}
+AESCryptoKey::~AESCryptoKey()
+{
+  for (auto ctx : m_encryptContexts) {
+    EVP_CIPHER_CTX_free(ctx);
+  }
+
+  for (auto ctx : m_decryptContexts) {
+    EVP_CIPHER_CTX_free(ctx);
+  }
+
+  OPENSSL_cleanse(m_key.data(), m_key.size());
+}
 
 void AESCryptoKey::Encrypt(const uint8_t *pbIn,
                            uint32_t       cbIn,
@@ -47,6 +110,48 @@ void AESCryptoKey::Decrypt(const uint8_t *pbIn,
   TransformBlock(false, pbIn, cbIn, pbOut, cbOut, pbIv, cbIv);
 }
 
+EVP_CIPHER_CTX * AESCryptoKey::AcquireContext(bool encrypt)
+{
+  {
+    lock_guard<mutex> lock(m_contextLocker);
+    auto& pool = encrypt ? m_encryptContexts : m_decryptContexts;
+
+    if (!pool.empty()) {
+      EVP_CIPHER_CTX *ctx = pool.back();
+      pool.pop_back();
+      return ctx;
+    }
+  }
+
+  // no idle context, create a new one and run the key schedule once
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+  if (ctx == nullptr) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to allocate cipher context");
+  }
+
+  if (!EVP_CipherInit_ex(ctx, m_cipher, NULL, m_key.data(), NULL,
+                         encrypt ? 1 : 0)) {
+    EVP_CIPHER_CTX_free(ctx);
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to initialize cipher context");
+  }
+
+  EVP_CIPHER_CTX_set_padding(ctx,
+                             m_algorithm == api::CRYPTO_ALGORITHM_AES_CBC_PKCS7
+                             ? 1 : 0);
+  return ctx;
+}
+
+void AESCryptoKey::ReleaseContext(bool encrypt, EVP_CIPHER_CTX *ctx)
+{
+  lock_guard<mutex> lock(m_contextLocker);
+  (encrypt ? m_encryptContexts : m_decryptContexts).push_back(ctx);
+}
+
 void AESCryptoKey::TransformBlock(bool           encrypt,
                                   const uint8_t *pbIn,
                                   uint32_t       cbIn,
@@ -69,94 +174,56 @@ void AESCryptoKey::TransformBlock(bool           encrypt,
   }
 
   int totalOut = static_cast<int>(cbOut);
-  EVP_CIPHER_CTX ctx;
-  EVP_CIPHER_CTX_init(&ctx);
-  const EVP_CIPHER *cipher = nullptr;
-
-  switch (m_algorithm) {
-  case api::CRYPTO_ALGORITHM_AES_ECB:
-    switch(m_key.size()) {
-    case 16:
-       cipher = EVP_aes_128_ecb();
-       break;
-    case 24:
-       cipher = EVP_aes_192_ecb();
-       break;
-    case 32:
-       cipher = EVP_aes_256_ecb();
-       break;
-    default:
-        throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
-    }
-    break;
-
-  case api::CRYPTO_ALGORITHM_AES_CBC:
-  case api::CRYPTO_ALGORITHM_AES_CBC_PKCS7:
-      switch(m_key.size()) {
-      case 16:
-         cipher = EVP_aes_128_cbc();
-         break;
-      case 24:
-         cipher = EVP_aes_192_cbc();
-         break;
-      case 32:
-         cipher = EVP_aes_256_cbc();
-         break;
-      default:
-          throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
-      }
-      break;
-    break;
-
-  default:
-    throw exceptions::RMSCryptoInvalidArgumentException("Unsupported algorithm");
-  }
 
   // check lengths
   if ((pbIv != nullptr) &&
-      (EVP_CIPHER_iv_length(cipher) != static_cast<int>(cbIv))) {
+      (EVP_CIPHER_iv_length(m_cipher) != static_cast<int>(cbIv))) {
     throw exceptions::RMSCryptoInvalidArgumentException(
             "Invalid initial vector length");
   }
 
-  if (EVP_CIPHER_key_length(cipher) != static_cast<int>(m_key.size())) {
-    throw exceptions::RMSCryptoInvalidArgumentException("Invalid key length");
-  }
-
-  EVP_CipherInit_ex(&ctx, cipher, NULL, m_key.data(), pbIv, encrypt ? 1 : 0);
+  EVP_CIPHER_CTX *ctx = AcquireContext(encrypt);
 
-  if (m_algorithm == api::CRYPTO_ALGORITHM_AES_CBC_PKCS7) {
-    EVP_CIPHER_CTX_set_padding(&ctx, 1);
-  } else {
-    EVP_CIPHER_CTX_set_padding(&ctx, 0);
-  }
+  try {
+    // re-arm the pre-keyed context with the new IV only, the key schedule is
+    // kept
+    if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, pbIv, -1)) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::UnknownError,
+              "Failed to initialize cipher context");
+    }
 
-  if (!EVP_CipherUpdate(&ctx, pbOut, &totalOut, pbIn, static_cast<int>(cbIn))) {
-    throw exceptions::RMSCryptoIOException(
-            exceptions::RMSCryptoException::UnknownError,
-            "Failed to transform data");
-  }
+    if (!EVP_CipherUpdate(ctx, pbOut, &totalOut, pbIn, static_cast<int>(cbIn))) {
+      throw exceptions::RMSCryptoIOException(
+              exceptions::RMSCryptoException::UnknownError,
+              "Failed to transform data");
+    }
 
-  pbOut += totalOut;
+    pbOut += totalOut;
 
-  // add padding if necessary
-  if (m_algorithm == api::CRYPTO_ALGORITHM_AES_CBC_PKCS7) {
-    int remain = cbOut - totalOut;
+    // add padding if necessary
+    if (m_algorithm == api::CRYPTO_ALGORITHM_AES_CBC_PKCS7) {
+      int remain = cbOut - totalOut;
 
-    if (remain < EVP_CIPHER_block_size(cipher)) {
-      throw exceptions::RMSCryptoInsufficientBufferException(
-              "No enough buffer size");
-    }
+      if (remain < EVP_CIPHER_block_size(m_cipher)) {
+        throw exceptions::RMSCryptoInsufficientBufferException(
+                "No enough buffer size");
+      }
 
-    if (!EVP_CipherFinal_ex(&ctx, pbOut, &remain)) {
-      throw exceptions::RMSCryptoIOException(
-              exceptions::RMSCryptoException::UnknownError,
-              "Failed to transform final block");
+      if (!EVP_CipherFinal_ex(ctx, pbOut, &remain)) {
+        throw exceptions::RMSCryptoIOException(
+                exceptions::RMSCryptoException::UnknownError,
+                "Failed to transform final block");
+      }
+      totalOut += remain;
     }
-    totalOut += remain;
+  }
+  catch (exceptions::RMSCryptoException&) {
+    ReleaseContext(encrypt, ctx);
+    throw;
   }
 
-  EVP_CIPHER_CTX_cleanup(&ctx);
+  ReleaseContext(encrypt, ctx);
 
   // remember total size
   cbOut = static_cast<uint32_t>(totalOut);
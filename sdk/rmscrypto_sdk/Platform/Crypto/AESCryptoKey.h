@@ -9,6 +9,7 @@
 #ifndef _CRYPTO_STREAMS_LIB_CRYPTOKEY_
 #define _CRYPTO_STREAMS_LIB_CRYPTOKEY_
 #include <openssl/evp.h>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -48,9 +49,19 @@ private:
                       const uint8_t *pbIv,
                       uint32_t       cbIv);
 
+  // Pre-keyed cipher contexts are pooled per direction, so the key schedule
+  // runs once per context and every transform only re-arms the IV.
+  EVP_CIPHER_CTX* AcquireContext(bool encrypt);
+  void            ReleaseContext(bool            encrypt,
+                                 EVP_CIPHER_CTX *ctx);
 
   std::vector<uint8_t> m_key;
   api::CryptoAlgorithm m_algorithm;
+  const EVP_CIPHER    *m_cipher;
+
+  std::mutex m_contextLocker;
+  std::vector<EVP_CIPHER_CTX *> m_encryptContexts;
+  std::vector<EVP_CIPHER_CTX *> m_decryptContexts;
 };
 } // namespace crypto
 } // namespace platform
@@ -10,14 +10,52 @@
 #include "../../CryptoAPI/RMSCryptoExceptions.h"
 using namespace std;
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+# define EVP_MD_CTX_new  EVP_MD_CTX_create
+# define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif // if OPENSSL_VERSION_NUMBER < 0x10100000L
+
 namespace rmscrypto {
 namespace platform {
 namespace crypto {
-CryptoHash::CryptoHash(std::shared_ptr<QCryptographicHash> hash,
-                       api::CryptoHashAlgorithm  algorithm)
-  : m_hash(hash)
-  , m_algorithm(algorithm)
-{}
+static const EVP_MD* SelectDigest(api::CryptoHashAlgorithm algorithm)
+{
+  switch (algorithm)
+  {
+  case api::CRYPTO_HASH_ALGORITHM_SHA1:
+    return EVP_sha1();
+
+  case api::CRYPTO_HASH_ALGORITHM_SHA256:
+    return EVP_sha256();
+
+  default:
+    throw exceptions::RMSCryptoInvalidArgumentException("Invalid algorithm");
+  }
+}
+
+CryptoHash::CryptoHash(api::CryptoHashAlgorithm algorithm)
+  : m_algorithm(algorithm)
+  , m_md(SelectDigest(algorithm))
+  , m_ctx(EVP_MD_CTX_new())
+{
+  if (m_ctx == nullptr) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to allocate digest context");
+  }
+
+  try {
+    Init();
+  } catch (...) {
+    EVP_MD_CTX_free(m_ctx);
+    throw;
+  }
+}
+
+CryptoHash::~CryptoHash()
+{
+  EVP_MD_CTX_free(m_ctx);
+}
 
 size_t CryptoHash::GetOutputSize()
 {
@@ -34,31 +72,104 @@ size_t CryptoHash::GetOutputSize()
   }
 }
 
+// starts a new message, reusing the context without reallocating it
+void CryptoHash::Init()
+{
+  if (!EVP_DigestInit_ex(m_ctx, m_md, NULL)) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to initialize digest");
+  }
+}
+
+// writes GetOutputSize() bytes and starts a new message
+void CryptoHash::Finish(uint8_t *pbOut)
+{
+  unsigned int cbDigest = 0;
+
+  if (!EVP_DigestFinal_ex(m_ctx, pbOut, &cbDigest)) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to finalize digest");
+  }
+  Init();
+}
+
 void CryptoHash::Hash(const uint8_t *pbIn,
                       uint32_t       cbIn,
                       uint8_t       *pbOut,
                       uint32_t     & cbOut)
 {
-  m_hash->addData(reinterpret_cast<const char *>(pbIn), cbIn);
+  Init();
+  Update(pbIn, cbIn);
+  Final(pbOut, cbOut);
+}
+
+void CryptoHash::Update(const uint8_t *pbIn,
+                        size_t         cbIn)
+{
+  if (cbIn == 0) {
+    return;
+  }
+
+  if (pbIn == nullptr) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
 
-  // get the hash valuew
-  auto valueBuffer = m_hash->result();
-  m_hash->reset();
+  if (!EVP_DigestUpdate(m_ctx, pbIn, cbIn)) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to update digest");
+  }
+}
 
+void CryptoHash::Final(uint8_t  *pbOut,
+                       uint32_t& cbOut)
+{
   // check that the output buffer is big enough
-  if (static_cast<int>(cbOut) < valueBuffer.length()) {
+  if (cbOut < GetOutputSize()) {
     throw exceptions::RMSCryptoInvalidArgumentException("Bounds error");
   }
 
+  if (pbOut == nullptr) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  Finish(pbOut);
+
   // set the output size
-  cbOut = valueBuffer.length();
-
-  // copy
-#ifdef Q_OS_WIN32
-  memcpy_s(pbOut, cbOut, valueBuffer.data(), valueBuffer.size());
-#else
-  memcpy(pbOut, valueBuffer.data(), valueBuffer.size());
-#endif
+  cbOut = static_cast<uint32_t>(GetOutputSize());
+}
+
+// One context for all the inputs: small inputs are dominated by setting up a
+// digest, not by the compression function. The inputs are still hashed one
+// after the other; OpenSSL has no public multi-buffer SHA-256.
+void CryptoHash::HashMany(const uint8_t *const *ppbIn,
+                          const size_t         *pcbIn,
+                          size_t                count,
+                          uint8_t              *pbOut,
+                          size_t                cbOut)
+{
+  size_t cbDigest = GetOutputSize();
+
+  if (count == 0) {
+    return;
+  }
+
+  if ((ppbIn == nullptr) || (pcbIn == nullptr) || (pbOut == nullptr)) {
+    throw exceptions::RMSCryptoNullPointerException("Null pointer exception");
+  }
+
+  if (cbOut / cbDigest < count) {
+    throw exceptions::RMSCryptoInvalidArgumentException("Bounds error");
+  }
+
+  Init();
+
+  for (size_t i = 0; i < count; ++i) {
+    Update(ppbIn[i], pcbIn[i]);
+    Finish(pbOut + i * cbDigest);
+  }
 }
 } // namespace crypto
 } // namespace platform
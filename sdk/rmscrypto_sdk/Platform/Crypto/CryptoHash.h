@@ -8,28 +8,45 @@
 
 #ifndef _CRYPTO_STREAMS_LIB_CRYPTOHASH_
 #define _CRYPTO_STREAMS_LIB_CRYPTOHASH_
-#include <memory>
-#include <QCryptographicHash>
+#include <openssl/evp.h>
 #include "../../CryptoAPI/ICryptoHash.h"
 namespace rmscrypto {
 namespace platform {
 namespace crypto {
+// OpenSSL EVP digest, which uses the SHA extensions of the CPU where it has
+// them. Not thread safe, like the streaming state it holds.
 class CryptoHash : public api::ICryptoHash {
 public:
 
-  CryptoHash(std::shared_ptr<QCryptographicHash>hash,
-             api::CryptoHashAlgorithm                algorithm);
+  explicit CryptoHash(api::CryptoHashAlgorithm algorithm);
+  virtual ~CryptoHash();
 
   virtual size_t GetOutputSize() override;
   virtual void   Hash(const uint8_t *pbIn,
                       uint32_t       cbIn,
                       uint8_t       *pbOut,
                       uint32_t     & cbOut) override;
+  virtual void   Update(const uint8_t *pbIn,
+                        size_t         cbIn) override;
+  virtual void   Final(uint8_t  *pbOut,
+                       uint32_t& cbOut) override;
+  virtual void   HashMany(const uint8_t *const *ppbIn,
+                          const size_t         *pcbIn,
+                          size_t                count,
+                          uint8_t              *pbOut,
+                          size_t                cbOut) override;
 
 private:
 
-  std::shared_ptr<QCryptographicHash> m_hash;
+  CryptoHash(const CryptoHash&);
+  CryptoHash& operator=(const CryptoHash&);
+
+  void Init();
+  void Finish(uint8_t *pbOut);
+
   api::CryptoHashAlgorithm m_algorithm;
+  const EVP_MD *m_md;
+  EVP_MD_CTX   *m_ctx;
 };
 } // namespace crypto
 } // namespace platform
@@ -23,8 +23,12 @@ public:
                                                const std::string& csKey) = 0;
   virtual std::shared_ptr<std::string>LookupKey(const std::string& csKeyWrapper) = 0;
 
+  // The key storage selected by IRMSCryptoEnvironment::KeyStorage()
   static std::shared_ptr<IKeyStorage> Create();
 
+  // The system key store of this platform
+  static std::shared_ptr<IKeyStorage> CreatePlatform();
+
   virtual ~IKeyStorage() {}
 };
 } // namespace keystorage
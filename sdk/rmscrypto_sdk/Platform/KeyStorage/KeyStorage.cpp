@@ -0,0 +1,28 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include "IKeyStorage.h"
+#include "KeyStorageFile.h"
+#include "../Settings/IRMSCryptoEnvironmentImpl.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace platform {
+namespace keystorage {
+shared_ptr<IKeyStorage>IKeyStorage::Create() {
+  auto env = settings::IRMSCryptoEnvironmentImpl::Environment();
+
+  if (env->KeyStorage() ==
+      api::IRMSCryptoEnvironment::KeyStorageOption::File) {
+    return KeyStorageFile::Shared(env->KeyFilePath());
+  }
+  return CreatePlatform();
+}
+} // namespace keystorage
+} // namespace platform
+} // namespace rmscrypto
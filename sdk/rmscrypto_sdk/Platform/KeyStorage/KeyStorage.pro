@@ -9,7 +9,7 @@ CONFIG   += staticlib warn_on c++11 debug_and_release
 QT       += core
 
 unix:!mac:INCLUDEPATH  += /usr/include/glib-2.0/ /usr/include/libsecret-1/ /usr/lib/x86_64-linux-gnu/glib-2.0/include/
-win32:INCLUDEPATH += $$REPO_ROOT/sdk/rmscrypto_sdk/
+win32:INCLUDEPATH += $$REPO_ROOT/sdk/rmscrypto_sdk/ $$REPO_ROOT/third_party/include
 # mac:INCLUDEPATH   += //TODO: Add osxkeychain
 
 LIBS +=  -L$$DESTDIR
@@ -24,10 +24,13 @@ unix {
 
 HEADERS += \
     base64.h \
-    IKeyStorage.h
+    IKeyStorage.h \
+    KeyStorageFile.h
 
 SOURCES += \
-    base64.cpp
+    base64.cpp \
+    KeyStorage.cpp \
+    KeyStorageFile.cpp
 
 #include different versions of keystorage
 win32 {
@@ -0,0 +1,384 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+ */
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <stdlib.h>
+#include <string.h>
+#include <QDir>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include "KeyStorageFile.h"
+#include "base64.h"
+#include "../../CryptoAPI/RMSCryptoExceptions.h"
+
+using namespace std;
+namespace rmscrypto {
+namespace platform {
+namespace keystorage {
+// file layout: magic | nonce | encrypted entries | tag
+static const char   FILE_MAGIC[]    = "RMSKEYS1";
+static const size_t FILE_MAGIC_SIZE = sizeof(FILE_MAGIC) - 1;
+static const size_t NONCE_SIZE      = 12;
+static const size_t TAG_SIZE        = 16;
+static const size_t MASTER_KEY_SIZE = 32;
+
+static const char MASTER_KEY_VARIABLE[] = "RMSCRYPTO_MASTER_KEY";
+
+// how long a change waits for another process to finish its change
+static const int LOCK_TIMEOUT_MS = 30000;
+
+static void Cleanse(string& s) {
+  if (!s.empty()) {
+    OPENSSL_cleanse(&s[0], s.size());
+  }
+}
+
+// AES-256-GCM over pbIn, the magic is authenticated with it. Returns false if
+// the tag doesn't match when decrypting.
+static bool TransformFile(bool           encrypt,
+                          const uint8_t *pbKey,
+                          const uint8_t *pbNonce,
+                          const uint8_t *pbIn,
+                          size_t         cbIn,
+                          uint8_t       *pbOut,
+                          uint8_t       *pbTag) {
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+  if (ctx == nullptr) {
+    throw exceptions::RMSCryptoIOException(
+            exceptions::RMSCryptoException::UnknownError,
+            "Failed to allocate cipher context");
+  }
+
+  int  cbOut = 0;
+  bool ok    = EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, pbKey, pbNonce,
+                                 encrypt ? 1 : 0) &&
+               EVP_CipherUpdate(ctx, NULL, &cbOut,
+                                reinterpret_cast<const uint8_t *>(FILE_MAGIC),
+                                static_cast<int>(FILE_MAGIC_SIZE)) &&
+               ((cbIn == 0) ||
+                EVP_CipherUpdate(ctx, pbOut, &cbOut, pbIn,
+                                 static_cast<int>(cbIn)));
+
+  if (ok && !encrypt) {
+    ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+                             static_cast<int>(TAG_SIZE), pbTag) != 0;
+  }
+
+  ok = ok && EVP_CipherFinal_ex(ctx, pbOut + cbIn, &cbOut);
+
+  if (ok && encrypt) {
+    ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG,
+                             static_cast<int>(TAG_SIZE), pbTag) != 0;
+  }
+  EVP_CIPHER_CTX_free(ctx);
+
+  if (!ok && encrypt) {
+    throw exceptions::RMSCryptoIOKeyException("Failed to encrypt the key file");
+  }
+  return ok;
+}
+
+// Serializes the read-modify-write of the file with the other instances and
+// processes using it. A lock left by a crashed process is taken over.
+static void LockKeyFile(QLockFile& lock) {
+  if (!lock.tryLock(LOCK_TIMEOUT_MS)) {
+    throw exceptions::RMSCryptoIOKeyException("Failed to lock the key file");
+  }
+}
+
+KeyStorageFile::KeyStorageFile(const string         & path,
+                               const vector<uint8_t>& masterKey)
+  : m_path(path), m_masterKey(masterKey), m_bLoaded(false),
+  m_i64LoadedTime(-1), m_i64LoadedSize(-1)
+{
+  if (m_masterKey.size() != MASTER_KEY_SIZE) {
+    throw exceptions::RMSCryptoInvalidArgumentException(
+            "Invalid master key length");
+  }
+}
+
+KeyStorageFile::~KeyStorageFile() {
+  Clear();
+  OPENSSL_cleanse(m_masterKey.data(), m_masterKey.size());
+}
+
+void KeyStorageFile::Clear() {
+  for (auto& entry : m_keys) {
+    Cleanse(entry.second);
+  }
+  m_keys.clear();
+}
+
+void KeyStorageFile::RemoveKey(const string& csKeyWrapper) {
+  // lock resources
+  lock_guard<mutex> lock(m_locker);
+  QLockFile fileLock(QString::fromStdString(m_path + ".lock"));
+
+  LockKeyFile(fileLock);
+
+  // the keys other processes stored since the last read are kept
+  Load(true);
+
+  auto it = m_keys.find(csKeyWrapper);
+
+  if (it == m_keys.end()) {
+    return;
+  }
+
+  string removed = it->second;
+  m_keys.erase(it);
+
+  try {
+    Save();
+  } catch (...) {
+    m_keys[csKeyWrapper] = removed;
+    Cleanse(removed);
+    throw;
+  }
+  Cleanse(removed);
+}
+
+void KeyStorageFile::StoreKey(const string& csKeyWrapper, const string& csKey) {
+  // lock resources
+  lock_guard<mutex> lock(m_locker);
+  QLockFile fileLock(QString::fromStdString(m_path + ".lock"));
+
+  LockKeyFile(fileLock);
+
+  // the keys other processes stored since the last read are kept
+  Load(true);
+
+  auto   it       = m_keys.find(csKeyWrapper);
+  bool   existed  = it != m_keys.end();
+  string previous = existed ? it->second : string();
+
+  m_keys[csKeyWrapper] = csKey;
+
+  try {
+    Save();
+  } catch (...) {
+    if (existed) {
+      m_keys[csKeyWrapper] = previous;
+    } else {
+      m_keys.erase(csKeyWrapper);
+    }
+    Cleanse(previous);
+    throw;
+  }
+  Cleanse(previous);
+}
+
+shared_ptr<string>KeyStorageFile::LookupKey(const string& csKeyWrapper) {
+  // lock resources
+  lock_guard<mutex> lock(m_locker);
+
+  Load(false);
+
+  auto it = m_keys.find(csKeyWrapper);
+
+  if (it == m_keys.end()) {
+    // another process may have stored it within the resolution of the
+    // file's modification time
+    Load(true);
+    it = m_keys.find(csKeyWrapper);
+  }
+
+  if (it == m_keys.end()) {
+    return nullptr;
+  }
+  return make_shared<string>(it->second);
+}
+
+// Reads the file on first use and when it changed since, a missing file is
+// an empty key storage. The file is replaced as a whole on every change, so a
+// read never sees a partial write.
+void KeyStorageFile::Load(bool force) {
+  QFileInfo info(QString::fromStdString(m_path));
+  int64_t   i64Time = info.exists() ?
+                      info.lastModified().toMSecsSinceEpoch() : -1;
+  int64_t   i64Size = info.exists() ? info.size() : -1;
+
+  if (m_bLoaded && !force && (i64Time == m_i64LoadedTime) &&
+      (i64Size == m_i64LoadedSize)) {
+    return;
+  }
+
+  Clear();
+  m_bLoaded = false;
+
+  QFile file(QString::fromStdString(m_path));
+
+  if (!file.exists()) {
+    m_bLoaded       = true;
+    m_i64LoadedTime = -1;
+    m_i64LoadedSize = -1;
+    return;
+  }
+
+  if (!file.open(QIODevice::ReadOnly)) {
+    throw exceptions::RMSCryptoIOKeyException("Failed to open the key file");
+  }
+
+  QByteArray content = file.readAll();
+  file.close();
+
+  if ((static_cast<size_t>(content.size()) <
+       FILE_MAGIC_SIZE + NONCE_SIZE + TAG_SIZE) ||
+      (memcmp(content.constData(), FILE_MAGIC, FILE_MAGIC_SIZE) != 0)) {
+    throw exceptions::RMSCryptoIOKeyException("Invalid key file");
+  }
+
+  auto pbContent = reinterpret_cast<uint8_t *>(content.data());
+  auto pbNonce   = pbContent + FILE_MAGIC_SIZE;
+  auto pbIn      = pbNonce + NONCE_SIZE;
+  auto cbIn      = content.size() - FILE_MAGIC_SIZE - NONCE_SIZE - TAG_SIZE;
+  auto pbTag     = pbIn + cbIn;
+
+  string entries(cbIn, '\0');
+
+  if (!TransformFile(false, m_masterKey.data(), pbNonce, pbIn, cbIn,
+                     reinterpret_cast<uint8_t *>(&entries[0]), pbTag)) {
+    Cleanse(entries);
+    throw exceptions::RMSCryptoIOKeyException(
+            "Key file is corrupt or the master key is wrong");
+  }
+
+  // one "<base64 name> <base64 key>" line per key
+  for (size_t line = 0; line < entries.size();) {
+    size_t separator = entries.find(' ', line);
+    size_t end       = entries.find('\n', line);
+
+    if ((separator == string::npos) || (end == string::npos) ||
+        (separator > end)) {
+      Clear();
+      Cleanse(entries);
+      throw exceptions::RMSCryptoIOKeyException("Invalid key file");
+    }
+
+    string key = base64_decode(entries.substr(separator + 1,
+                                              end - separator - 1));
+    m_keys[base64_decode(entries.substr(line, separator - line))] = key;
+    Cleanse(key);
+    line = end + 1;
+  }
+  Cleanse(entries);
+  m_bLoaded       = true;
+  m_i64LoadedTime = i64Time;
+  m_i64LoadedSize = i64Size;
+}
+
+// Replaces the file, so a failure or crash leaves the previous version
+void KeyStorageFile::Save() {
+  string entries;
+  size_t cbEntries = 0;
+
+  // no reallocation, which would leave copies of the keys behind
+  for (auto& entry : m_keys) {
+    cbEntries += (entry.first.size() + 2) / 3 * 4 +
+                 (entry.second.size() + 2) / 3 * 4 + 2;
+  }
+  entries.reserve(cbEntries);
+
+  for (auto& entry : m_keys) {
+    entries += base64_encode(
+      reinterpret_cast<const unsigned char *>(entry.first.data()),
+      static_cast<unsigned int>(entry.first.size()));
+    entries += ' ';
+
+    string key = base64_encode(
+      reinterpret_cast<const unsigned char *>(entry.second.data()),
+      static_cast<unsigned int>(entry.second.size()));
+    entries += key;
+    entries += '\n';
+    Cleanse(key);
+  }
+
+  QByteArray content(static_cast<int>(FILE_MAGIC_SIZE + NONCE_SIZE +
+                                       entries.size() + TAG_SIZE), '\0');
+  auto pbContent = reinterpret_cast<uint8_t *>(content.data());
+  auto pbNonce   = pbContent + FILE_MAGIC_SIZE;
+  auto pbOut     = pbNonce + NONCE_SIZE;
+  auto pbTag     = pbOut + entries.size();
+
+  memcpy(pbContent, FILE_MAGIC, FILE_MAGIC_SIZE);
+
+  if (RAND_bytes(pbNonce, static_cast<int>(NONCE_SIZE)) != 1) {
+    Cleanse(entries);
+    throw exceptions::RMSCryptoIOKeyException("Failed to generate a nonce");
+  }
+
+  try {
+    TransformFile(true, m_masterKey.data(), pbNonce,
+                  reinterpret_cast<const uint8_t *>(entries.data()),
+                  entries.size(), pbOut, pbTag);
+  } catch (...) {
+    Cleanse(entries);
+    throw;
+  }
+  Cleanse(entries);
+
+  QSaveFile file(QString::fromStdString(m_path));
+
+  if (!file.open(QIODevice::WriteOnly) ||
+      !file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner) ||
+      (file.write(content) != content.size()) ||
+      !file.commit()) {
+    throw exceptions::RMSCryptoIOKeyException("Failed to write the key file");
+  }
+
+  // what was written is what's in memory, no need to read it back
+  QFileInfo info(QString::fromStdString(m_path));
+  m_i64LoadedTime = info.lastModified().toMSecsSinceEpoch();
+  m_i64LoadedSize = info.size();
+}
+
+string KeyStorageFile::DefaultPath() {
+  return QDir(QDir::homePath()).filePath(".rmscrypto_keys").toStdString();
+}
+
+shared_ptr<IKeyStorage>KeyStorageFile::Shared(const string& path) {
+  static mutex locker;
+  static shared_ptr<KeyStorageFile> instance;
+  static string instanceMasterKey;
+
+  const char *masterKeyVariable = getenv(MASTER_KEY_VARIABLE);
+  string masterKey = base64_decode(masterKeyVariable != nullptr
+                                   ? masterKeyVariable : "");
+
+  if (masterKey.size() != MASTER_KEY_SIZE) {
+    Cleanse(masterKey);
+    throw exceptions::RMSCryptoIOKeyException(
+            "RMSCRYPTO_MASTER_KEY must hold a base64 encoded 256 bit key");
+  }
+
+  string filePath = path.empty() ? DefaultPath() : path;
+
+  // lock resources
+  lock_guard<mutex> lock(locker);
+
+  // a new instance, and so a new read of the file, only if the configuration
+  // changed
+  if ((instance == nullptr) || (instance->m_path != filePath) ||
+      (instanceMasterKey != masterKey)) {
+    Cleanse(instanceMasterKey);
+    instance = make_shared<KeyStorageFile>(
+      filePath, vector<uint8_t>(masterKey.begin(), masterKey.end()));
+    instanceMasterKey = masterKey;
+  }
+  Cleanse(masterKey);
+  return instance;
+}
+} // namespace keystorage
+} // namespace platform
+} // namespace rmscrypto
@@ -0,0 +1,74 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef _CRYPTO_STREAMS_LIB_KEYSTORAGEFILE_H
+#define _CRYPTO_STREAMS_LIB_KEYSTORAGEFILE_H
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "IKeyStorage.h"
+
+namespace rmscrypto {
+namespace platform {
+namespace keystorage {
+
+// Key storage in a single local file, for hosts without a system key store.
+// The file is read again whenever it changed on disk. Every change holds a
+// lock file, re-reads the file and rewrites it atomically, so processes
+// sharing the file don't drop each other's keys. Its content is encrypted and
+// authenticated with AES-256-GCM under a master key that never touches the
+// disk.
+class KeyStorageFile : public IKeyStorage
+{
+public:
+    KeyStorageFile(const std::string         & path,
+                   const std::vector<uint8_t>& masterKey);
+    virtual ~KeyStorageFile();
+
+    virtual void                        RemoveKey(const std::string& csKeyWrapper) override;
+    virtual void                        StoreKey(const std::string& csKeyWrapper,
+                                                 const std::string& csKey) override;
+    virtual std::shared_ptr<std::string>LookupKey(const std::string& csKeyWrapper) override;
+
+    // Instance for path (the default key file if empty) and the master key in
+    // the RMSCRYPTO_MASTER_KEY environment variable, shared by the callers
+    // using the same file
+    static std::shared_ptr<IKeyStorage> Shared(const std::string& path);
+
+    static std::string                  DefaultPath();
+
+private:
+
+    // force reads the file even if it looks unchanged
+    void Load(bool force);
+    void Save();
+    void Clear();
+
+    // lock resources
+    std::mutex m_locker;
+
+    std::string          m_path;
+    std::vector<uint8_t> m_masterKey;
+    bool                 m_bLoaded;
+
+    // modification time (ms since the epoch) and size of the file when it
+    // was read, -1 if it didn't exist
+    int64_t              m_i64LoadedTime;
+    int64_t              m_i64LoadedSize;
+
+    std::map<std::string, std::string> m_keys;
+};
+
+} // namespace keystorage
+} // namespace platform
+} // namespace rmscrypto
+#endif // _CRYPTO_STREAMS_LIB_KEYSTORAGEFILE_H
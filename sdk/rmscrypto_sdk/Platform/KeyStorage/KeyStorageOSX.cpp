@@ -29,7 +29,7 @@ shared_ptr<string>KeyStorageOSX::LookupKey(const string& /*csKeyWrapper*/) {
           "Key storage for OSX is not implemented");
 }
 
-std::shared_ptr<IKeyStorage>IKeyStorage::Create() {
+std::shared_ptr<IKeyStorage>IKeyStorage::CreatePlatform() {
   throw exceptions::RMSCryptoNotImplementedException(
           "KeyStorage is not implemented on this platform");
 }
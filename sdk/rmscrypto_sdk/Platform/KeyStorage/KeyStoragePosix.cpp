@@ -94,7 +94,7 @@ shared_ptr<string>KeyStoragePosix::LookupKey(const string& csKeyWrapper) {
   return res;
 }
 
-std::shared_ptr<IKeyStorage>IKeyStorage::Create() {
+std::shared_ptr<IKeyStorage>IKeyStorage::CreatePlatform() {
   return std::shared_ptr<KeyStoragePosix>(new KeyStoragePosix);
 }
 } // namespace keystorage
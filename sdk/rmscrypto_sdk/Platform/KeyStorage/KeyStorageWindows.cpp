@@ -27,7 +27,7 @@ shared_ptr<string>KeyStorageWindows::LookupKey(const string& csKeyWrapper) {
     return StorageAccessWindows::Instance().LookupKey(csKeyWrapper);
 }
 
-std::shared_ptr<IKeyStorage>IKeyStorage::Create() {
+std::shared_ptr<IKeyStorage>IKeyStorage::CreatePlatform() {
     return std::shared_ptr<KeyStorageWindows>(new KeyStorageWindows);
 }
 
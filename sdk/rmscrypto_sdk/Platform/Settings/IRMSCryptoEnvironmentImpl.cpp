@@ -16,6 +16,8 @@ shared_ptr<IRMSCryptoEnvironmentImpl> _instance = make_shared<IRMSCryptoEnvironm
 
 IRMSCryptoEnvironmentImpl::IRMSCryptoEnvironmentImpl()
   : _optLog(static_cast<int>(LoggerOption::Always))
+  , _executorThreads(0)
+  , _keyStorage(static_cast<int>(KeyStorageOption::Platform))
 {}
 
 void IRMSCryptoEnvironmentImpl::LogOption(LoggerOption opt) {
@@ -26,6 +28,33 @@ api::IRMSCryptoEnvironment::LoggerOption IRMSCryptoEnvironmentImpl::LogOption()
   return static_cast<LoggerOption>(_optLog.load());
 }
 
+void IRMSCryptoEnvironmentImpl::ExecutorThreadCount(size_t count) {
+  _executorThreads = static_cast<int>(count);
+}
+
+size_t IRMSCryptoEnvironmentImpl::ExecutorThreadCount() {
+  return static_cast<size_t>(_executorThreads.load());
+}
+
+void IRMSCryptoEnvironmentImpl::KeyStorage(KeyStorageOption opt) {
+  _keyStorage = static_cast<int>(opt);
+}
+
+api::IRMSCryptoEnvironment::KeyStorageOption IRMSCryptoEnvironmentImpl::KeyStorage()
+{
+  return static_cast<KeyStorageOption>(_keyStorage.load());
+}
+
+void IRMSCryptoEnvironmentImpl::KeyFilePath(const string& path) {
+  lock_guard<mutex> lock(_keyFilePathLocker);
+  _keyFilePath = path;
+}
+
+string IRMSCryptoEnvironmentImpl::KeyFilePath() {
+  lock_guard<mutex> lock(_keyFilePathLocker);
+  return _keyFilePath;
+}
+
 shared_ptr<api::IRMSCryptoEnvironment>IRMSCryptoEnvironmentImpl::Environment() {
   return std::dynamic_pointer_cast<api::IRMSCryptoEnvironment>(
     platform::settings::_instance);
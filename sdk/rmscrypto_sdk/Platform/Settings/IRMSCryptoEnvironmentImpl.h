@@ -25,12 +25,26 @@ public:
 
   virtual void                                      LogOption(LoggerOption opt);
   virtual LoggerOption                              LogOption();
+  virtual void                                      ExecutorThreadCount(
+    size_t count);
+  virtual size_t                                    ExecutorThreadCount();
+  virtual void                                      KeyStorage(
+    KeyStorageOption opt);
+  virtual KeyStorageOption                          KeyStorage();
+  virtual void                                      KeyFilePath(
+    const std::string& path);
+  virtual std::string                               KeyFilePath();
 
   static std::shared_ptr<api::IRMSCryptoEnvironment>Environment();
 
 private:
 
   QAtomicInt _optLog;
+  QAtomicInt _executorThreads;
+  QAtomicInt _keyStorage;
+
+  std::mutex  _keyFilePathLocker;
+  std::string _keyFilePath;
 };
 
 extern std::shared_ptr<IRMSCryptoEnvironmentImpl> _instance;
@@ -7,8 +7,13 @@
  */
 
 #include <sstream>
+#include <thread>
+#include <QTemporaryFile>
 #include "CryptedStreamTests.h"
+#include "TestHelpers.h"
+#include "TestStreams.h"
 #include "../CryptoAPI/CryptoAPI.h"
+#include "../CryptoAPI/BlockBasedProtectedStream.h"
 #include "../CryptoAPI/RMSCryptoExceptions.h"
 
 using namespace std;
@@ -76,3 +81,506 @@ void CryptedStreamTests::CryptedStreamToMemory() {
     QTest::qFail(e.what(), __FILE__, __LINE__);
   }
 }
+
+void CryptedStreamTests::ParallelRead_data() {
+  QTest::addColumn<int>("plainSize");
+  QTest::addColumn<int>("readOffset");
+
+  QTest::newRow("Aligned")      << 4096 * 64 << 0;
+  QTest::newRow("AlignedTail")  << 4096 * 64 + 123 << 0;
+  QTest::newRow("UnalignedHead") << 4096 * 64 + 123 << 1000;
+  QTest::newRow("BlockOffset")  << 4096 * 65 << 4096;
+}
+
+void CryptedStreamTests::ParallelRead() {
+  QFETCH(int, plainSize);
+  QFETCH(int, readOffset);
+
+  try {
+    vector<uint8_t> key(16, 0x42);
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>((i * 31) % 253);
+    }
+
+    auto backingBuffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    auto backingStream =
+      rmscrypto::api::CreateStreamFromStdStream(static_pointer_cast<iostream>(
+                                                  backingBuffer));
+
+    auto writer = rmscrypto::api::CreateCryptoStream(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key, backingStream);
+    writer->Write(plainText.data(), plainText.size());
+    writer->Flush();
+
+    // read the same content once through the block cache only and once with
+    // the parallel path enabled for anything bigger than a block
+    auto reader = dynamic_pointer_cast<rmscrypto::api::BlockBasedProtectedStream>(
+      rmscrypto::api::CreateCryptoStream(rmscrypto::api::CIPHER_MODE_CBC4K, key,
+                                         backingStream->Clone()));
+    QVERIFY(reader.get() != nullptr);
+    reader->SetParallelReadThreshold(4096);
+
+    vector<uint8_t> decrypted(plainSize);
+    auto read = reader->ReadAsync(decrypted.data(), plainSize, readOffset,
+                                  launch::deferred).get();
+
+    QVERIFY2(read == plainSize - readOffset, "Invalid decrypted size!");
+    QVERIFY2(memcmp(decrypted.data(), &plainText[readOffset],
+                    static_cast<size_t>(read)) == 0,
+             "Invalid decrypted data!");
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptedStreamTests::BlockCacheReadWrite_data() {
+  QTest::addColumn<int>("cacheSize");
+  QTest::addColumn<int>("chunkSize");
+
+  QTest::newRow("NoCache")       << 0 << 1000;
+  QTest::newRow("SmallCache")    << 4096 * 4 << 1000;
+  QTest::newRow("DefaultCache")  << static_cast<int>(
+    rmscrypto::api::DEFAULT_BLOCK_CACHE_SIZE) << 1000;
+  QTest::newRow("BlockChunks")   << 4096 * 16 << 4096;
+  QTest::newRow("AlignedChunks") << 4096 * 16 << 4096 * 8;
+}
+
+void CryptedStreamTests::BlockCacheReadWrite() {
+  QFETCH(int, cacheSize);
+  QFETCH(int, chunkSize);
+
+  try {
+    const int plainSize = 4096 * 40 + 77;
+    vector<uint8_t> key(16, 0x24);
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>((i * 7) % 251);
+    }
+
+    auto backingBuffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    auto backingStream =
+      rmscrypto::api::CreateStreamFromStdStream(static_pointer_cast<iostream>(
+                                                  backingBuffer));
+    auto provider = rmscrypto::api::CreateCryptoProvider(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key);
+
+    auto writer = rmscrypto::api::BlockBasedProtectedStream::Create(
+      provider, backingStream, 0, static_cast<uint64_t>(-1), 4096,
+      static_cast<uint64_t>(cacheSize));
+    writer->Write(plainText.data(), plainText.size());
+    writer->Flush();
+
+    auto stream = rmscrypto::api::BlockBasedProtectedStream::Create(
+      provider, backingStream->Clone(), 0, static_cast<uint64_t>(-1), 4096,
+      static_cast<uint64_t>(cacheSize));
+
+    // read sequentially in chunks (which triggers read-ahead), then overwrite
+    // blocks that are cached by now and read everything again
+    for (int pass = 0; pass < 2; ++pass) {
+      vector<uint8_t> decrypted(plainSize);
+
+      for (int offset = 0; offset < plainSize; offset += chunkSize) {
+        int64_t toRead = min(chunkSize, plainSize - offset);
+        auto read = stream->ReadAsync(&decrypted[offset], toRead, offset,
+                                      launch::deferred).get();
+        QVERIFY2(read == toRead, "Invalid decrypted size!");
+      }
+
+      QVERIFY2(decrypted == plainText, "Invalid decrypted data!");
+
+      for (int offset = 4096 * 3 + 10; offset < plainSize;
+           offset += 4096 * 5) {
+        plainText[offset] ^= 0xFF;
+        stream->WriteAsync(&plainText[offset], 1, offset,
+                           launch::deferred).get();
+        stream->Flush();
+      }
+    }
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptedStreamTests::WriteBehind_data() {
+  QTest::addColumn<int>("plainSize");
+  QTest::addColumn<int>("chunkSize");
+
+  QTest::newRow("SingleBlock")     << 4096 << 1000;
+  QTest::newRow("ManyBlocks")      << 4096 * 100 << 1000;
+  QTest::newRow("ManyBlocksTail")  << 4096 * 100 + 77 << 4096;
+  QTest::newRow("LargeChunks")     << 1000000 << 70000;
+  QTest::newRow("AlignedChunks")   << 4096 * 64 + 10 << 65536;
+}
+
+void CryptedStreamTests::WriteBehind() {
+  QFETCH(int, plainSize);
+  QFETCH(int, chunkSize);
+
+  try {
+    vector<uint8_t> key(16, 0x5A);
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>((i * 13) % 249);
+    }
+
+    auto backingBuffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    auto backingStream =
+      rmscrypto::api::CreateStreamFromStdStream(static_pointer_cast<iostream>(
+                                                  backingBuffer));
+    auto stream = rmscrypto::api::CreateCryptoStream(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key, backingStream);
+
+    // small writes fill blocks which are written behind, Flush() must wait
+    // for them and pad the final block
+    for (int offset = 0; offset < plainSize; offset += chunkSize) {
+      stream->Write(&plainText[offset], min(chunkSize, plainSize - offset));
+    }
+    stream->Flush();
+
+    auto provider = rmscrypto::api::CreateCryptoProvider(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key);
+    vector<uint8_t> expected(provider->GetCipherTextSize(plainSize));
+    uint32_t cbExpected = 0;
+    provider->Encrypt(plainText.data(), plainSize, 0, true, expected.data(),
+                      static_cast<uint32_t>(expected.size()), &cbExpected);
+    expected.resize(cbExpected);
+
+    string cipherText = backingBuffer->str();
+    QVERIFY2(cipherText.size() == expected.size(), "Invalid encrypted size!");
+    QVERIFY2(memcmp(cipherText.data(), expected.data(),
+                    expected.size()) == 0,
+             "Invalid encrypted data!");
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptedStreamTests::LargeSparseContent_data() {
+  QTest::addColumn<int>("cipherMode");
+  QTest::addColumn<int>("blockSize");
+  QTest::addColumn<int>("tailSize");
+
+  QTest::newRow("CBC4K")  << static_cast<int>(
+    rmscrypto::api::CIPHER_MODE_CBC4K) << 4096 << 100;
+  QTest::newRow("CBC512") << static_cast<int>(
+    rmscrypto::api::CIPHER_MODE_CBC512NOPADDING) << 512 << 0;
+}
+
+void CryptedStreamTests::LargeSparseContent() {
+  QFETCH(int, cipherMode);
+  QFETCH(int, blockSize);
+  QFETCH(int, tailSize);
+
+  try {
+    // the content starts past block 2^32, only its last blocks are written
+    const uint64_t firstBlock = (1ull << 32) + 3;
+    const uint64_t offset     = firstBlock * blockSize;
+    const int plainSize       = blockSize * 3 + tailSize;
+    vector<uint8_t> key(16, 0x3C);
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>((i * 11) % 241);
+    }
+
+    auto provider = rmscrypto::api::CreateCryptoProvider(
+      static_cast<rmscrypto::api::CipherMode>(cipherMode), key);
+    auto encrypt = [&](uint64_t u64BlockNumber) {
+                     vector<uint8_t> cipherText(
+                       rmscrypto::api::GetCipherTextSize(
+                         plainSize,
+                         static_cast<rmscrypto::api::CipherMode>(cipherMode)));
+                     uint32_t cbCipherText = 0;
+                     provider->Encrypt(plainText.data(), plainSize,
+                                       u64BlockNumber, true,
+                                       cipherText.data(),
+                                       static_cast<uint32_t>(cipherText.size()),
+                                       &cbCipherText);
+                     cipherText.resize(cbCipherText);
+                     return cipherText;
+                   };
+
+    // a block number truncated to 32 bits would give the IVs of block 3
+    auto cipherText = encrypt(firstBlock);
+    QVERIFY2(cipherText != encrypt(3), "Block number is truncated!");
+
+    auto backingStream = make_shared<SparseStream>();
+    backingStream->WriteAsync(cipherText.data(), cipherText.size(), offset,
+                              launch::deferred).get();
+    QVERIFY2(backingStream->AllocatedSize() < 1024 * 1024,
+             "Backing stream isn't sparse!");
+
+    auto stream = rmscrypto::api::BlockBasedProtectedStream::Create(
+      provider, backingStream, 0, backingStream->Size(), blockSize);
+
+    vector<uint8_t> decrypted(plainSize);
+    auto read = stream->ReadAsync(decrypted.data(), plainSize, offset,
+                                  launch::deferred).get();
+    QVERIFY2(read == plainSize,     "Invalid decrypted size!");
+    QVERIFY2(decrypted == plainText, "Invalid decrypted data!");
+
+    // rewrite the middle block and read it back through a new stream
+    for (int i = 0; i < blockSize; ++i) {
+      plainText[blockSize + i] ^= 0xA5;
+    }
+    stream->WriteAsync(&plainText[blockSize], blockSize, offset + blockSize,
+                       launch::deferred).get();
+    stream->Flush();
+
+    auto reopened = rmscrypto::api::BlockBasedProtectedStream::Create(
+      provider, backingStream->Clone(), 0, backingStream->Size(), blockSize);
+    read = reopened->ReadAsync(decrypted.data(), plainSize, offset,
+                               launch::deferred).get();
+    QVERIFY2(read == plainSize,     "Invalid decrypted size!");
+    QVERIFY2(decrypted == plainText, "Invalid decrypted data!");
+    QVERIFY2(backingStream->Size() == offset + cipherText.size(),
+             "Invalid encrypted size!");
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptedStreamTests::FileStreamRead_data() {
+  QTest::addColumn<int>("plainSize");
+
+  QTest::newRow("SingleBlock") << 100;
+  QTest::newRow("ManyBlocks")  << 4096 * 20;
+  QTest::newRow("Tail")        << 4096 * 20 + 333;
+}
+
+void CryptedStreamTests::FileStreamRead() {
+  QFETCH(int, plainSize);
+
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  string path = file.fileName().toStdString();
+
+  try {
+    vector<uint8_t> key(16, 0x3C);
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>((i * 7) % 251);
+    }
+
+    {
+      auto backingStream = rmscrypto::api::CreateStreamFromFile(
+        path, ios::in | ios::out | ios::trunc);
+      auto stream = rmscrypto::api::CreateCryptoStream(
+        rmscrypto::api::CIPHER_MODE_CBC4K, key, backingStream);
+      stream->Write(plainText.data(), plainSize);
+      stream->Flush();
+    }
+
+    // read-only streams are served from the mapping
+    auto backingStream = rmscrypto::api::CreateStreamFromFile(path);
+    QVERIFY(backingStream->CanRead());
+    QVERIFY(!backingStream->CanWrite());
+
+    auto stream = rmscrypto::api::CreateCryptoStream(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key, backingStream);
+    vector<uint8_t> decrypted(plainSize);
+    auto read = stream->ReadAsync(decrypted.data(), plainSize, 0,
+                                  launch::deferred).get();
+    QVERIFY2(read == plainSize, "Invalid decrypted size!");
+    QVERIFY2(decrypted == plainText, "Invalid decrypted data!");
+
+    // clones share the mapping but not the position
+    auto clone = backingStream->Clone();
+    clone->Seek(10);
+    QVERIFY(backingStream->Position() == 0);
+    QVERIFY(clone->Size() == backingStream->Size());
+    QVERIFY_THROW(clone->Write(plainText.data(), 1),
+                  rmscrypto::exceptions::RMSCryptoIOException);
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptedStreamTests::FileStreamConcurrentWrite() {
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  string path = file.fileName().toStdString();
+
+  const int regionSize = 10000;
+  const int regions    = 8;
+
+  try {
+    auto stream = rmscrypto::api::CreateStreamFromFile(
+      path, ios::in | ios::out | ios::trunc);
+
+    // each clone writes its own region at an explicit offset
+    vector<thread> writers;
+
+    for (int i = 0; i < regions; ++i) {
+      auto clone = stream->Clone();
+      writers.emplace_back([clone, i, regionSize]() {
+        vector<uint8_t> region(regionSize, static_cast<uint8_t>(i));
+        clone->WriteAsync(region.data(), regionSize, i * regionSize,
+                          launch::deferred).get();
+      });
+    }
+
+    for (auto& writer : writers) {
+      writer.join();
+    }
+
+    QVERIFY(stream->Size() == static_cast<uint64_t>(regionSize * regions));
+
+    vector<uint8_t> data(regionSize * regions);
+    QVERIFY(stream->Read(data.data(), data.size()) ==
+            static_cast<int64_t>(data.size()));
+
+    for (size_t i = 0; i < data.size(); ++i) {
+      QVERIFY(data[i] == i / regionSize);
+    }
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptedStreamTests::ConcurrentAccess() {
+  const int blockSize  = 4096;
+  const int regionSize = blockSize * 8;
+  const int regions    = 6;
+  const int plainSize  = regionSize * regions + 123;
+
+  try {
+    vector<uint8_t> key(16, 0x17);
+    vector<uint8_t> expected(plainSize);
+
+    for (size_t i = 0; i < expected.size(); ++i) {
+      expected[i] = static_cast<uint8_t>((i * 13) % 251);
+    }
+
+    auto backingBuffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    auto backingStream =
+      rmscrypto::api::CreateStreamFromStdStream(static_pointer_cast<iostream>(
+                                                  backingBuffer));
+
+    auto writer = rmscrypto::api::CreateCryptoStream(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key, backingStream);
+    writer->Write(expected.data(), expected.size());
+    writer->Flush();
+
+    auto stream = dynamic_pointer_cast<rmscrypto::api::BlockBasedProtectedStream>(
+      rmscrypto::api::CreateCryptoStream(rmscrypto::api::CIPHER_MODE_CBC4K, key,
+                                         backingStream->Clone()));
+    QVERIFY(stream.get() != nullptr);
+    stream->SetConcurrentAccess(true);
+
+    uint64_t size = stream->Size();
+
+    // every thread rewrites and reads back unaligned pieces of its own region,
+    // the last one also touches the final block
+    vector<thread> workers;
+    vector<int>    failures(regions, 0);
+
+    for (int i = 0; i < regions; ++i) {
+      workers.emplace_back([&, i]() {
+        for (int j = 0; j < 16; ++j) {
+          int offset = i * regionSize + (j * 1237) % (regionSize - 700);
+          int length = 1 + (j * 389) % 700;
+
+          if ((i == regions - 1) && (j % 4 == 0)) {
+            offset = plainSize - length;
+          }
+
+          vector<uint8_t> piece(length, static_cast<uint8_t>(i * 16 + j));
+          stream->WriteAsync(piece.data(), length, offset,
+                             launch::deferred).get();
+          copy(piece.begin(), piece.end(), expected.begin() + offset);
+
+          vector<uint8_t> readBack(length);
+          auto read = stream->ReadAsync(readBack.data(), length, offset,
+                                        launch::deferred).get();
+
+          if ((read != length) || (readBack != piece)) {
+            ++failures[i];
+          }
+        }
+      });
+    }
+
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    for (int i = 0; i < regions; ++i) {
+      QVERIFY2(failures[i] == 0, "Invalid data read back!");
+    }
+
+    QVERIFY(stream->Size() == size);
+    stream->Flush();
+
+    auto reader = rmscrypto::api::CreateCryptoStream(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key, backingStream->Clone());
+    vector<uint8_t> decrypted(plainSize);
+
+    QVERIFY(reader->Read(decrypted.data(), plainSize) == plainSize);
+    QVERIFY2(decrypted == expected, "Invalid decrypted data!");
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptedStreamTests::AsyncFileStreamRead_data() {
+  QTest::addColumn<int>("plainSize");
+  QTest::addColumn<int>("pipelineDepth");
+
+  QTest::newRow("NoPipeline")    << 4096 * 100 + 50 << 0;
+  QTest::newRow("Pipeline1")     << 4096 * 100 + 50 << 1;
+  QTest::newRow("Pipeline4")     << 4096 * 100 + 50 << 4;
+  QTest::newRow("PipelineLarge") << 3000000 << 8;
+}
+
+void CryptedStreamTests::AsyncFileStreamRead() {
+  QFETCH(int, plainSize);
+  QFETCH(int, pipelineDepth);
+
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  string path = file.fileName().toStdString();
+
+  try {
+    vector<uint8_t> key(16, 0x71);
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>((i * 11) % 241);
+    }
+
+    auto provider = rmscrypto::api::CreateCryptoProvider(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key);
+
+    {
+      auto backingStream = rmscrypto::api::CreateAsyncStreamFromFile(
+        path, ios::in | ios::out | ios::trunc);
+      auto stream = rmscrypto::api::BlockBasedProtectedStream::Create(
+        provider, backingStream, 0, backingStream->Size(), 4096);
+      stream->Write(plainText.data(), plainSize);
+      stream->Flush();
+    }
+
+    auto backingStream = rmscrypto::api::CreateAsyncStreamFromFile(path);
+    auto stream        = rmscrypto::api::BlockBasedProtectedStream::Create(
+      provider, backingStream, 0, backingStream->Size(), 4096);
+    stream->SetReadPipelineDepth(static_cast<uint32_t>(pipelineDepth));
+
+    vector<uint8_t> decrypted(plainSize);
+    auto read = stream->ReadAsync(decrypted.data(), plainSize, 0,
+                                  launch::deferred).get();
+    QVERIFY2(read == plainSize, "Invalid decrypted size!");
+    QVERIFY2(decrypted == plainText, "Invalid decrypted data!");
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
@@ -19,6 +19,20 @@ private Q_SLOTS:
 
   void CryptedStreamToMemory_data();
   void CryptedStreamToMemory();
+  void ParallelRead_data();
+  void ParallelRead();
+  void BlockCacheReadWrite_data();
+  void BlockCacheReadWrite();
+  void WriteBehind_data();
+  void WriteBehind();
+  void LargeSparseContent_data();
+  void LargeSparseContent();
+  void FileStreamRead_data();
+  void FileStreamRead();
+  void FileStreamConcurrentWrite();
+  void ConcurrentAccess();
+  void AsyncFileStreamRead_data();
+  void AsyncFileStreamRead();
 };
 
 #endif // CRYPTEDSTREAMTESTS_H
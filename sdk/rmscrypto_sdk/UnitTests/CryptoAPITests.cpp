@@ -6,10 +6,22 @@
  * ======================================================================
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <QString>
 #include "../CryptoAPI/CryptoAPI.h"
+#include "../CryptoAPI/BlockBasedProtectedStream.h"
 #include "../CryptoAPI/RMSCryptoExceptions.h"
+#include "../CryptoAPI/Executor.h"
+#include "../CryptoAPI/KeyCache.h"
+#include "../CryptoAPI/ICryptoEngine.h"
+#include "../Crypto/NativeAesCbc.h"
 #include "CryptoAPITests.h"
+#include "TestHelpers.h"
 
 using namespace std;
 
@@ -51,3 +63,775 @@ void CryptoAPITests::EncryptDecryptBlockTest() {
     QTest::qFail(e.what(), __FILE__, __LINE__);
   }
 }
+
+void CryptoAPITests::EncryptDecryptBufferTest_data() {
+  QTest::addColumn<int>("plainSize");
+
+  QTest::newRow("Empty")       << 0;
+  QTest::newRow("Short")       << 15;
+  QTest::newRow("Block")       << 4096;
+  QTest::newRow("BlockAndOne") << 4097;
+  QTest::newRow("Blocks")      << 4096 * 3 + 100;
+}
+
+void CryptoAPITests::EncryptDecryptBufferTest() {
+  QFETCH(int, plainSize);
+  try {
+    const string keyName = "TestWrapperBuffer";
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>(i * 11);
+    }
+
+    vector<uint8_t> cipherText(rmscrypto::api::GetCipherTextSize(plainSize));
+    auto cbCipherText = rmscrypto::api::EncryptWithAutoKey(plainText.data(),
+                                                           plainText.size(),
+                                                           cipherText.data(),
+                                                           cipherText.size(),
+                                                           rmscrypto::api::CIPHER_MODE_CBC4K,
+                                                           keyName);
+    QVERIFY2(cbCipherText == cipherText.size(), "Invalid encrypted size!");
+
+    // same bytes as through a stream with the same key
+    auto backingBuffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    auto stream = rmscrypto::api::CreateCryptoStreamWithAutoKey(
+      rmscrypto::api::CIPHER_MODE_CBC4K, keyName,
+      rmscrypto::api::CreateStreamFromStdStream(
+        static_pointer_cast<iostream>(backingBuffer)));
+
+    if (plainSize > 0) {
+      stream->Write(plainText.data(), plainSize);
+    }
+    stream->Flush();
+
+    auto streamed = backingBuffer->str();
+    QVERIFY2(string(cipherText.begin(), cipherText.end()) == streamed,
+             "Buffer and stream formats differ!");
+
+    vector<uint8_t> decrypted(cipherText.size());
+    auto cbPlainText = rmscrypto::api::DecryptWithAutoKey(cipherText.data(),
+                                                          cipherText.size(),
+                                                          decrypted.data(),
+                                                          decrypted.size(),
+                                                          rmscrypto::api::CIPHER_MODE_CBC4K,
+                                                          keyName);
+    decrypted.resize(cbPlainText);
+    QVERIFY2(decrypted == plainText, "Failed to decrypt data!");
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptoAPITests::MultiBlockEncryptTest_data() {
+  QTest::addColumn<int>("blockCount");
+
+  QTest::newRow("1")  << 1;
+  QTest::newRow("3")  << 3;
+  QTest::newRow("8")  << 8;
+  QTest::newRow("21") << 21;
+}
+
+void CryptoAPITests::MultiBlockEncryptTest() {
+  QFETCH(int, blockCount);
+  try {
+    const uint32_t blockSize = 4096;
+    vector<uint8_t> key(16);
+
+    for (size_t i = 0; i < key.size(); ++i) {
+      key[i] = static_cast<uint8_t>(i * 13 + 5);
+    }
+
+    auto provider = rmscrypto::api::CreateCryptoProvider(
+      rmscrypto::api::CIPHER_MODE_CBC4K, key);
+
+    vector<uint8_t> plainText(blockCount * blockSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>(i % 251);
+    }
+
+    // encrypt all blocks in one call (may take the multi-buffer path)
+    vector<uint8_t> bulk(plainText.size());
+    uint32_t cbBulk = 0;
+    provider->Encrypt(plainText.data(), static_cast<uint32_t>(plainText.size()),
+                      7, false, bulk.data(), static_cast<uint32_t>(bulk.size()),
+                      &cbBulk);
+    QVERIFY2(cbBulk == plainText.size(), "Invalid encrypted size!");
+
+    // encrypt block by block and compare
+    for (int block = 0; block < blockCount; ++block) {
+      vector<uint8_t> single(blockSize);
+      uint32_t cbSingle = 0;
+      provider->Encrypt(&plainText[block * blockSize], blockSize, 7 + block,
+                        false, single.data(), blockSize, &cbSingle);
+      QVERIFY2(memcmp(single.data(), &bulk[block * blockSize], blockSize) == 0,
+               "Multi-block encryption differs from single block encryption!");
+    }
+
+    // and decrypt back
+    vector<uint8_t> decrypted(bulk.size());
+    uint32_t cbDecrypted = 0;
+    provider->Decrypt(bulk.data(), cbBulk, 7, false, decrypted.data(),
+                      static_cast<uint32_t>(decrypted.size()), &cbDecrypted);
+    QVERIFY2(decrypted == plainText, "Failed to decrypt data!");
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptoAPITests::Cbc4kIvCacheTest() {
+  try {
+    using namespace rmscrypto::api;
+
+    const uint32_t blockSize = 4096;
+
+    // more blocks than one batch of IVs (64) and than the IV cache (16)
+    const uint32_t blockCount = 70;
+    vector<uint8_t> key(16);
+
+    for (size_t i = 0; i < key.size(); ++i) {
+      key[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    auto provider = CreateCryptoProvider(CIPHER_MODE_CBC4K, key);
+
+    // the IV of a block is its number, 8 little endian bytes padded with
+    // zeros, encrypted with the key
+    auto engine = ICryptoEngine::Create();
+    auto ecbKey = engine->CreateKey(key.data(), 16, CRYPTO_ALGORITHM_AES_ECB);
+    auto cbcKey = engine->CreateKey(key.data(), 16, CRYPTO_ALGORITHM_AES_CBC);
+    auto reference = [&](const uint8_t *pbIn, uint64_t u64Block,
+                         uint8_t *pbOut) {
+      uint8_t  iv[16] = { 0 };
+      uint32_t cbIv = sizeof(iv), cbOut = blockSize;
+
+      for (int i = 0; i < 8; ++i) {
+        iv[i] = static_cast<uint8_t>(u64Block >> (8 * i));
+      }
+      ecbKey->Encrypt(iv, sizeof(iv), iv, cbIv, nullptr, 0);
+      cbcKey->Encrypt(pbIn, blockSize, pbOut, cbOut, iv, sizeof(iv));
+    };
+
+    vector<uint8_t> plainText(blockCount * blockSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>(i % 253);
+    }
+
+    // single blocks out of order: repeats hit the cache, blocks 16 apart
+    // share a cache entry and evict each other
+    const uint32_t order[] = { 3, 19, 3, 35, 0, 69, 16, 0, 19, 64, 48, 32,
+                               3, 68, 1, 17, 33, 1, 65, 69 };
+
+    // the last start crosses 2^32, where the IV input widens to 8 bytes
+    const uint64_t starts[] = { 0, 5, (1ULL << 32) - 3, 1ULL << 32,
+                                (1ULL << 40) + 11 };
+
+    for (auto start : starts) {
+      vector<uint8_t> bulk(plainText.size());
+      uint32_t cbBulk = 0;
+
+      provider->Encrypt(plainText.data(),
+                        static_cast<uint32_t>(plainText.size()), start, false,
+                        bulk.data(), static_cast<uint32_t>(bulk.size()),
+                        &cbBulk);
+      QVERIFY(cbBulk == plainText.size());
+
+      for (uint32_t block = 0; block < blockCount; ++block) {
+        vector<uint8_t> expected(blockSize);
+
+        reference(&plainText[block * blockSize], start + block, expected.data());
+        QVERIFY2(memcmp(expected.data(), &bulk[block * blockSize],
+                        blockSize) == 0,
+                 "Batched encryption differs from the reference!");
+      }
+
+      for (auto block : order) {
+        vector<uint8_t> single(blockSize), decrypted(blockSize);
+        uint32_t cbSingle = 0;
+
+        provider->Encrypt(&plainText[block * blockSize], blockSize,
+                          start + block, false, single.data(), blockSize,
+                          &cbSingle);
+        QVERIFY2(memcmp(single.data(), &bulk[block * blockSize],
+                        blockSize) == 0,
+                 "Single block encryption differs from batched encryption!");
+
+        provider->Decrypt(&bulk[block * blockSize], blockSize, start + block,
+                          false, decrypted.data(), blockSize, &cbSingle);
+        QVERIFY2(memcmp(decrypted.data(), &plainText[block * blockSize],
+                        blockSize) == 0, "Failed to decrypt data!");
+      }
+    }
+
+    // block 2^32 doesn't wrap onto the IV of block 0
+    vector<uint8_t> first(blockSize), wide(blockSize);
+    uint32_t cbOut = 0;
+
+    provider->Encrypt(plainText.data(), blockSize, 0, false, first.data(),
+                      blockSize, &cbOut);
+    provider->Encrypt(plainText.data(), blockSize, starts[3], false,
+                      wide.data(), blockSize, &cbOut);
+    QVERIFY(first != wide);
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptoAPITests::NativeAesKernelTest_data() {
+  QTest::addColumn<int>("blockCount");
+
+  QTest::newRow("1")  << 1;
+  QTest::newRow("7")  << 7;
+  QTest::newRow("16") << 16;
+  QTest::newRow("37") << 37;
+}
+
+void CryptoAPITests::NativeAesKernelTest() {
+  QFETCH(int, blockCount);
+  try {
+    using rmscrypto::crypto::NativeAesCbc128;
+
+    vector<uint8_t> key(16), iv(16);
+
+    for (size_t i = 0; i < key.size(); ++i) {
+      key[i] = static_cast<uint8_t>(i * 29 + 1);
+      iv[i]  = static_cast<uint8_t>(i * 3 + 7);
+    }
+
+    auto nativeKey = NativeAesCbc128::Create(key.data(),
+                                             static_cast<uint32_t>(key.size()));
+
+    if (nativeKey.get() == nullptr) {
+      QSKIP("No native AES kernel on this CPU");
+    }
+
+    auto engine = rmscrypto::api::ICryptoEngine::Create();
+    auto cbcKey = engine->CreateKey(key.data(), 16,
+                                    rmscrypto::api::CRYPTO_ALGORITHM_AES_CBC);
+    auto ecbKey = engine->CreateKey(key.data(), 16,
+                                    rmscrypto::api::CRYPTO_ALGORITHM_AES_ECB);
+    auto paddingKey = engine->CreateKey(
+      key.data(), 16, rmscrypto::api::CRYPTO_ALGORITHM_AES_CBC_PKCS7);
+
+    uint32_t cbData = static_cast<uint32_t>(blockCount) * 16;
+    vector<uint8_t> plainText(cbData);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>(i % 241);
+    }
+
+    // every kernel must give the EVP results
+    vector<uint8_t> expected(cbData + 16), actual(cbData + 16);
+    uint32_t cbExpected = cbData;
+    cbcKey->Encrypt(plainText.data(), cbData, expected.data(), cbExpected,
+                    iv.data(), 16);
+    nativeKey->Encrypt(plainText.data(), actual.data(), cbData, iv.data());
+    QVERIFY2(memcmp(expected.data(), actual.data(), cbData) == 0,
+             "CBC encryption differs from EVP!");
+
+    // decryption in place
+    nativeKey->Decrypt(actual.data(), actual.data(), cbData, iv.data());
+    QVERIFY2(memcmp(plainText.data(), actual.data(), cbData) == 0,
+             "CBC decryption differs from EVP!");
+
+    cbExpected = cbData;
+    ecbKey->Encrypt(plainText.data(), cbData, expected.data(), cbExpected,
+                    nullptr, 0);
+    nativeKey->EncryptEcb(plainText.data(), actual.data(), cbData);
+    QVERIFY2(memcmp(expected.data(), actual.data(), cbData) == 0,
+             "ECB encryption differs from EVP!");
+
+    // padded, with a partial last block
+    uint32_t cbPartial = cbData - 5;
+    cbExpected = static_cast<uint32_t>(expected.size());
+    paddingKey->Encrypt(plainText.data(), cbPartial, expected.data(),
+                        cbExpected, iv.data(), 16);
+    uint32_t cbActual = nativeKey->EncryptPadded(
+      plainText.data(), cbPartial, actual.data(),
+      static_cast<uint32_t>(actual.size()), iv.data());
+    QVERIFY2((cbActual == cbExpected) &&
+             (memcmp(expected.data(), actual.data(), cbActual) == 0),
+             "Padded encryption differs from EVP!");
+    QVERIFY2(nativeKey->DecryptPadded(actual.data(), cbActual, actual.data(),
+                                      cbActual, iv.data()) == cbPartial,
+             "Invalid padded decryption size!");
+    QVERIFY2(memcmp(plainText.data(), actual.data(), cbPartial) == 0,
+             "Padded decryption failed!");
+
+    // lanes, each with its own IV
+    const uint32_t cLanes = 5;
+    vector<uint8_t> lanesOut(cLanes * cbData);
+    const uint8_t *lanesIn[cLanes];
+    uint8_t       *lanesOutPointers[cLanes];
+    const uint8_t *lanesIv[cLanes];
+    vector<uint8_t> ivs(cLanes * 16);
+
+    for (uint32_t lane = 0; lane < cLanes; ++lane) {
+      ivs[lane * 16]         = static_cast<uint8_t>(lane);
+      lanesIn[lane]          = plainText.data();
+      lanesOutPointers[lane] = &lanesOut[lane * cbData];
+      lanesIv[lane]          = &ivs[lane * 16];
+    }
+    nativeKey->EncryptMultiBuffer(lanesIn, lanesOutPointers, lanesIv, cLanes,
+                                  cbData);
+
+    for (uint32_t lane = 0; lane < cLanes; ++lane) {
+      cbExpected = cbData;
+      cbcKey->Encrypt(plainText.data(), cbData, expected.data(), cbExpected,
+                      lanesIv[lane], 16);
+      QVERIFY2(memcmp(expected.data(), lanesOutPointers[lane], cbData) == 0,
+               "Multi-buffer encryption differs from EVP!");
+    }
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptoAPITests::InPlaceDecryptTest_data() {
+  QTest::addColumn<int>("cipherMode");
+  QTest::addColumn<int>("plainSize");
+
+  QTest::newRow("CBC4K")          << static_cast<int>(
+    rmscrypto::api::CIPHER_MODE_CBC4K) << 4096 * 3 + 100;
+  QTest::newRow("CBC512")         << static_cast<int>(
+    rmscrypto::api::CIPHER_MODE_CBC512NOPADDING) << 512 * 5;
+  QTest::newRow("ECB")            << static_cast<int>(
+    rmscrypto::api::CIPHER_MODE_ECB) << 16 * 20;
+  QTest::newRow("CTR")            << static_cast<int>(
+    rmscrypto::api::CIPHER_MODE_CTR) << 512 * 3 + 7;
+}
+
+void CryptoAPITests::InPlaceDecryptTest() {
+  QFETCH(int, cipherMode);
+  QFETCH(int, plainSize);
+  try {
+    vector<uint8_t> key(16, 0x33);
+    auto provider = cipherMode == rmscrypto::api::CIPHER_MODE_CTR
+                    ? rmscrypto::api::CreateCtrCryptoProvider(
+      key, rmscrypto::api::CreateCtrNonce())
+                    : rmscrypto::api::CreateCryptoProvider(
+      static_cast<rmscrypto::api::CipherMode>(cipherMode), key);
+
+    vector<uint8_t> plainText(plainSize);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>(i % 239);
+    }
+
+    vector<uint8_t> buffer(provider->GetCipherTextSize(plainSize));
+    uint32_t cbEncrypted = 0;
+    provider->Encrypt(plainText.data(), plainSize, 0, true, buffer.data(),
+                      static_cast<uint32_t>(buffer.size()), &cbEncrypted);
+
+    // protected streams decrypt straight in the destination buffer
+    uint32_t cbDecrypted = 0;
+    provider->Decrypt(buffer.data(), cbEncrypted, 0, true, buffer.data(),
+                      static_cast<uint32_t>(buffer.size()), &cbDecrypted);
+
+    QVERIFY2(cbDecrypted == static_cast<uint32_t>(plainSize),
+             "Invalid decrypted size!");
+    QVERIFY2(memcmp(buffer.data(), plainText.data(), plainSize) == 0,
+             "Failed to decrypt data in place!");
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptoAPITests::CtrRandomAccessTest() {
+  try {
+    vector<uint8_t> key(16, 0x5c);
+    auto provider = rmscrypto::api::CreateCtrCryptoProvider(
+      key, rmscrypto::api::CreateCtrNonce());
+
+    QVERIFY(provider->GetCipherTextSize(1001) == 1001);
+    QVERIFY(rmscrypto::api::GetCipherTextSize(
+              1001, rmscrypto::api::CIPHER_MODE_CTR) == 1001);
+
+    const uint32_t  cbPlain = 3 * 512 + 77;
+    vector<uint8_t> plainText(cbPlain);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    vector<uint8_t> cipherText(cbPlain);
+    uint32_t cbOut = 0;
+    provider->Encrypt(plainText.data(), cbPlain, 0, true, cipherText.data(),
+                      cbPlain, &cbOut);
+    QVERIFY(cbOut == cbPlain);
+
+    // any block on its own gives the same bytes as the whole content
+    vector<uint8_t> block(512);
+    provider->Decrypt(&cipherText[512], 512, 1, false, block.data(), 512,
+                      &cbOut);
+    QVERIFY(equal(block.begin(), block.end(), plainText.begin() + 512));
+
+    // and so does any byte range through a protected stream
+    auto backingBuffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    backingBuffer->write(reinterpret_cast<const char *>(cipherText.data()),
+                         cipherText.size());
+
+    auto stream = rmscrypto::api::BlockBasedProtectedStream::Create(
+      provider,
+      rmscrypto::api::CreateStreamFromStdStream(
+        static_pointer_cast<iostream>(backingBuffer)),
+      0, -1, 512);
+
+    QVERIFY(stream->Size() == cbPlain);
+
+    const uint64_t offsets[] = { 0, 5, 511, 512, 1000, cbPlain - 3 };
+
+    for (auto offset : offsets) {
+      uint8_t bytes[3] = { 0 };
+      stream->Seek(offset);
+      auto cbRead = stream->Read(bytes, sizeof(bytes));
+      QVERIFY(cbRead == static_cast<int64_t>(sizeof(bytes)));
+      QVERIFY(equal(bytes, bytes + sizeof(bytes),
+                    plainText.begin() + offset));
+    }
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptoAPITests::CtrNonceTest() {
+  try {
+    vector<uint8_t> key(16, 0x5c);
+    auto nonce1 = rmscrypto::api::CreateCtrNonce();
+    auto nonce2 = rmscrypto::api::CreateCtrNonce();
+
+    QVERIFY(nonce1.size() == rmscrypto::api::CTR_NONCE_SIZE);
+    QVERIFY(nonce1 != nonce2);
+
+    // a CTR provider always has a nonce
+    QVERIFY_THROW(rmscrypto::api::CreateCryptoProvider(
+                    rmscrypto::api::CIPHER_MODE_CTR, key),
+                  rmscrypto::exceptions::RMSCryptoInvalidArgumentException);
+
+    // one key, two key streams
+    vector<shared_ptr<rmscrypto::api::ICryptoProvider> > providers = {
+      rmscrypto::api::CreateCtrCryptoProvider(key, nonce1),
+      rmscrypto::api::CreateCtrCryptoProvider(key, nonce2)
+    };
+
+    const uint32_t  cbPlain = 512 + 33;
+    vector<uint8_t> plainText(cbPlain, 0);
+    vector<vector<uint8_t> > cipherTexts;
+
+    for (auto& provider : providers) {
+      vector<uint8_t> cipherText(cbPlain);
+      uint32_t cbOut = 0;
+      provider->Encrypt(plainText.data(), cbPlain, 0, true, cipherText.data(),
+                        cbPlain, &cbOut);
+      cipherTexts.push_back(cipherText);
+    }
+
+    QVERIFY(cipherTexts[0] != cipherTexts[1]);
+    QVERIFY(providers[0]->GetKey() != key);
+
+    // the same nonce gives the same key again
+    auto provider = rmscrypto::api::CreateCtrCryptoProvider(key, nonce1);
+    uint32_t cbOut = 0;
+    provider->Decrypt(cipherTexts[0].data(), cbPlain, 0, true,
+                      cipherTexts[0].data(), cbPlain, &cbOut);
+    QVERIFY(cipherTexts[0] == plainText);
+
+    QVERIFY_THROW(rmscrypto::api::CreateCtrCryptoProvider(
+                    key, vector<uint8_t>(8, 0)),
+                  rmscrypto::exceptions::RMSCryptoInvalidArgumentException);
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+// Everything under one auto key shares the key, so two buffers must not be
+// encrypted with the same key stream: c1 ^ c2 == p1 ^ p2 would give one plain
+// text away with the other
+void CryptoAPITests::AutoKeyCtrTest() {
+  try {
+    const string keyName = "TestWrapperCtr";
+    const size_t cbPlain = 4096;
+    vector<uint8_t> plainText1(cbPlain, 0x11);
+    vector<uint8_t> plainText2(cbPlain);
+
+    for (size_t i = 0; i < plainText2.size(); ++i) {
+      plainText2[i] = static_cast<uint8_t>(i * 13);
+    }
+
+    const rmscrypto::api::CipherMode modes[] = {
+      rmscrypto::api::CIPHER_MODE_CBC4K,
+      rmscrypto::api::CIPHER_MODE_CBC512NOPADDING,
+      rmscrypto::api::CIPHER_MODE_ECB
+    };
+
+    for (auto mode : modes) {
+      auto cbCipher = rmscrypto::api::GetCipherTextSize(cbPlain, mode);
+      vector<uint8_t> cipherText1(cbCipher);
+      vector<uint8_t> cipherText2(cbCipher);
+
+      rmscrypto::api::EncryptWithAutoKey(plainText1.data(), cbPlain,
+                                         cipherText1.data(), cbCipher,
+                                         mode, keyName);
+      rmscrypto::api::EncryptWithAutoKey(plainText2.data(), cbPlain,
+                                         cipherText2.data(), cbCipher,
+                                         mode, keyName);
+
+      size_t cbSameXor = 0;
+
+      for (size_t i = 0; i < cbPlain; ++i) {
+        if ((cipherText1[i] ^ cipherText2[i]) ==
+            (plainText1[i] ^ plainText2[i])) {
+          ++cbSameXor;
+        }
+      }
+
+      // a byte matches by chance one time in 256
+      QVERIFY(cbSameXor < cbPlain / 16);
+    }
+
+    // CTR has no nonce to store with an auto key, so it is refused
+    vector<uint8_t> cipherText(cbPlain);
+    QVERIFY_THROW(rmscrypto::api::EncryptWithAutoKey(
+                    plainText1.data(), cbPlain, cipherText.data(), cbPlain,
+                    rmscrypto::api::CIPHER_MODE_CTR, keyName),
+                  rmscrypto::exceptions::RMSCryptoInvalidArgumentException);
+    QVERIFY_THROW(rmscrypto::api::DecryptWithAutoKey(
+                    cipherText.data(), cbPlain, plainText1.data(), cbPlain,
+                    rmscrypto::api::CIPHER_MODE_CTR, keyName),
+                  rmscrypto::exceptions::RMSCryptoInvalidArgumentException);
+    QVERIFY_THROW(rmscrypto::api::EncryptWithAutoKey(
+                    make_shared<vector<uint8_t> >(plainText2),
+                    rmscrypto::api::CIPHER_MODE_CTR, keyName),
+                  rmscrypto::exceptions::RMSCryptoInvalidArgumentException);
+    QVERIFY_THROW(rmscrypto::api::CreateCryptoStreamWithAutoKey(
+                    rmscrypto::api::CIPHER_MODE_CTR, keyName,
+                    rmscrypto::api::CreateStreamFromStdStream(
+                      static_pointer_cast<iostream>(make_shared<stringstream>(
+                                                      ios::in | ios::out |
+                                                      ios::binary)))),
+                  rmscrypto::exceptions::RMSCryptoInvalidArgumentException);
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+namespace {
+// A provider written against the 32-bit block number, it XORs each byte
+// with its block number
+class LegacyProvider : public rmscrypto::api::ICryptoProvider {
+public:
+
+  virtual void Encrypt(const uint8_t *pbIn,
+                       uint32_t       cbIn,
+                       uint32_t       u32StartingBlockNumber,
+                       bool,
+                       uint8_t       *pbOut,
+                       uint32_t,
+                       uint32_t      *pcbOut) override
+  {
+    for (uint32_t i = 0; i < cbIn; ++i) {
+      pbOut[i] = pbIn[i] ^
+                 static_cast<uint8_t>(u32StartingBlockNumber + i / 16);
+    }
+    *pcbOut = cbIn;
+  }
+
+  virtual void Decrypt(const uint8_t *pbIn,
+                       uint32_t       cbIn,
+                       uint32_t       u32StartingBlockNumber,
+                       bool           isFinal,
+                       uint8_t       *pbOut,
+                       uint32_t       cbOut,
+                       uint32_t      *pcbOut) override
+  {
+    Encrypt(pbIn, cbIn, u32StartingBlockNumber, isFinal, pbOut, cbOut, pcbOut);
+  }
+
+  virtual uint64_t GetCipherTextSize(uint64_t clearTextSize) override
+  {
+    return clearTextSize;
+  }
+
+  virtual uint32_t GetBlockSize() override
+  {
+    return 16;
+  }
+
+  virtual vector<uint8_t>GetKey() override
+  {
+    return vector<uint8_t>();
+  }
+};
+} // namespace
+
+void CryptoAPITests::LegacyProviderTest() {
+  try {
+    auto provider = make_shared<LegacyProvider>();
+    vector<uint8_t> plainText(100);
+
+    for (size_t i = 0; i < plainText.size(); ++i) {
+      plainText[i] = static_cast<uint8_t>(i);
+    }
+
+    // protected streams call the 64-bit overloads, which reach the provider
+    auto backingBuffer = make_shared<stringstream>(
+      ios::in | ios::out | ios::binary);
+    auto stream = rmscrypto::api::BlockBasedProtectedStream::Create(
+      provider,
+      rmscrypto::api::CreateStreamFromStdStream(
+        static_pointer_cast<iostream>(backingBuffer)),
+      0, -1, 16);
+
+    stream->Write(plainText.data(), plainText.size());
+    stream->Flush();
+
+    string cipherText = backingBuffer->str();
+    QVERIFY(cipherText.size() == plainText.size());
+    QVERIFY(static_cast<uint8_t>(cipherText[17]) == (plainText[17] ^ 1));
+
+    vector<uint8_t> decrypted(plainText.size());
+    stream->Seek(0);
+    stream->Read(decrypted.data(), decrypted.size());
+    QVERIFY(decrypted == plainText);
+
+    // blocks past 2^32 are refused rather than wrapped
+    uint32_t cbOut = 0;
+    shared_ptr<rmscrypto::api::ICryptoProvider> base = provider;
+    QVERIFY_THROW(base->Encrypt(plainText.data(), 16,
+                                static_cast<uint64_t>(1) << 32, false,
+                                decrypted.data(), 16, &cbOut),
+                  rmscrypto::exceptions::RMSCryptoInvalidArgumentException);
+  } catch (rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
+
+void CryptoAPITests::ExecutorTest() {
+  using rmscrypto::api::Executor;
+  using rmscrypto::api::SerialQueue;
+  using rmscrypto::api::TaskHandle;
+
+  auto executor = make_shared<Executor>(2);
+  QVERIFY2(executor->ThreadCount() == 2, "Invalid thread count!");
+
+  // a serial queue runs its tasks one at a time, in order
+  auto queue = SerialQueue::Create(executor);
+  vector<int> order;
+  vector<future<void> > done;
+
+  for (int i = 0; i < 1000; ++i) {
+    done.push_back(rmscrypto::api::Async(*queue, launch::async,
+                                         [&order](int value) {
+        order.push_back(value);
+      }, i));
+  }
+
+  for (auto& task : done) {
+    task.get();
+  }
+
+  for (int i = 0; i < 1000; ++i) {
+    QVERIFY2(order[i] == i, "Serial queue reordered its tasks!");
+  }
+
+  // exceptions come back through the future
+  auto failed = rmscrypto::api::Async(*executor, launch::async, []() -> int {
+        throw rmscrypto::exceptions::RMSCryptoInvalidArgumentException("Test");
+      });
+  QVERIFY_EXCEPTION_THROWN(failed.get(),
+                           rmscrypto::exceptions::RMSCryptoException);
+
+  // a task waiting for tasks it spawned doesn't need a free worker
+  auto single = make_shared<Executor>(1);
+  auto sum    = rmscrypto::api::Async(*single, launch::async, [single]() -> int {
+        vector<TaskHandle<int> > parts;
+
+        for (int i = 0; i < 8; ++i) {
+          parts.push_back(rmscrypto::api::Spawn(*single, [](int value) {
+            return value * 2;
+          }, i));
+        }
+
+        int result = 0;
+
+        for (auto& part : parts) {
+          result += part.Get();
+        }
+        return result;
+      });
+  QVERIFY2(sum.get() == 56, "Spawned tasks returned a wrong result!");
+}
+
+void CryptoAPITests::KeyCacheTest() {
+  using rmscrypto::api::KeyCache;
+  using rmscrypto::api::SecureKey;
+  using rmscrypto::api::SharedSecureKey;
+
+  const string keyName = "TestKeyCache";
+  const uint8_t keyBytes[16] = { 1, 2, 3, 4, 5, 6, 7, 8,
+                                 9, 10, 11, 12, 13, 14, 15, 16 };
+  atomic<int> loads(0);
+  mutex       gate;
+
+  auto loader = [&](const string&) -> SharedSecureKey {
+                  ++loads;
+
+                  // hold the first load until every thread asked for the key
+                  lock_guard<mutex> lock(gate);
+                  return make_shared<SecureKey>(keyBytes, sizeof(keyBytes));
+                };
+
+  auto& cache = KeyCache::Instance();
+  cache.Invalidate(keyName);
+
+  // concurrent first lookups share one load
+  vector<SharedSecureKey> keys(8);
+  {
+    unique_lock<mutex> hold(gate);
+    vector<thread> threads;
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+      threads.push_back(thread([&, i]() {
+        keys[i] = cache.Get(keyName, loader);
+      }));
+    }
+    this_thread::sleep_for(chrono::milliseconds(50));
+    hold.unlock();
+
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+  QVERIFY2(loads == 1, "Concurrent lookups were not coalesced!");
+
+  for (auto& key : keys) {
+    QVERIFY2(key == keys[0], "Lookups returned different keys!");
+  }
+  QVERIFY2(keys[0]->Size() == sizeof(keyBytes) &&
+           memcmp(keys[0]->Data(), keyBytes, sizeof(keyBytes)) == 0,
+           "Invalid cached key!");
+
+  // cached until invalidated
+  cache.Get(keyName, loader);
+  QVERIFY2(loads == 1, "Key was loaded again!");
+  cache.Invalidate(keyName);
+  cache.Get(keyName, loader);
+  QVERIFY2(loads == 2, "Invalidated key was not loaded again!");
+
+  // failures aren't cached
+  const string missingName = "TestKeyCacheMissing";
+  auto missing = [&](const string&) -> SharedSecureKey {
+                   ++loads;
+                   return nullptr;
+                 };
+  cache.Invalidate(missingName);
+  QVERIFY(cache.Get(missingName, missing) == nullptr);
+  QVERIFY(cache.Get(missingName, missing) == nullptr);
+  QVERIFY2(loads == 4, "Failed lookup was cached!");
+
+  cache.Invalidate(keyName);
+}
@@ -19,6 +19,21 @@ private Q_SLOTS:
 
   void EncryptDecryptBlockTest_data();
   void EncryptDecryptBlockTest();
+  void EncryptDecryptBufferTest_data();
+  void EncryptDecryptBufferTest();
+  void MultiBlockEncryptTest_data();
+  void MultiBlockEncryptTest();
+  void Cbc4kIvCacheTest();
+  void NativeAesKernelTest_data();
+  void NativeAesKernelTest();
+  void InPlaceDecryptTest_data();
+  void InPlaceDecryptTest();
+  void CtrRandomAccessTest();
+  void CtrNonceTest();
+  void AutoKeyCtrTest();
+  void LegacyProviderTest();
+  void ExecutorTest();
+  void KeyCacheTest();
 };
 
 #endif // CRYPTOAPITEST
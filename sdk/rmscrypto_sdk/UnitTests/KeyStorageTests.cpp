@@ -7,7 +7,12 @@
  */
 
 #include <QString>
+#include <QTemporaryDir>
+#include <thread>
 #include "../Platform/KeyStorage/IKeyStorage.h"
+#include "../Platform/KeyStorage/KeyStorageFile.h"
+#include "../Platform/KeyStorage/base64.h"
+#include "../CryptoAPI/IRMSCryptoEnvironment.h"
 #include "../CryptoAPI/RMSCryptoExceptions.h"
 #include "KeyStorageTests.h"
 
@@ -53,3 +58,123 @@ void KeyStorageTests::KeyUsage()
     QTest::qFail(e.what(), __FILE__, __LINE__);
   }
 }
+
+void KeyStorageTests::FileKeyUsage()
+{
+  using rmscrypto::api::IRMSCryptoEnvironment;
+  using namespace rmscrypto::platform::keystorage;
+
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+
+  auto env = rmscrypto::api::RMSCryptoEnvironment();
+  auto path = dir.path().toStdString() + "/keys";
+
+  vector<uint8_t> masterKey(32, 0x42);
+  qputenv("RMSCRYPTO_MASTER_KEY",
+          base64_encode(masterKey.data(),
+                        static_cast<unsigned int>(masterKey.size())).c_str());
+  env->KeyStorage(IRMSCryptoEnvironment::KeyStorageOption::File);
+  env->KeyFilePath(path);
+
+  try {
+    auto ks = IKeyStorage::Create();
+
+    QVERIFY2(ks->LookupKey("TestWrapperOne").get() == nullptr,
+             "Found key in a new key file!");
+
+    ks->StoreKey("TestWrapperOne", "TestKeyOne");
+    ks->StoreKey("TestWrapperTwo", "TestKeyTwo");
+    ks->RemoveKey("TestWrapperTwo");
+
+    // a new instance reads what the first one wrote
+    KeyStorageFile reloaded(path, masterKey);
+    auto findKey = reloaded.LookupKey("TestWrapperOne");
+
+    QVERIFY2(findKey.get() != nullptr && *findKey == "TestKeyOne",
+             "Invalid key found!");
+    QVERIFY2(reloaded.LookupKey("TestWrapperTwo").get() == nullptr,
+             "Found removed key!");
+
+    // the file can't be read without the master key
+    KeyStorageFile wrongKey(path, vector<uint8_t>(32, 0x24));
+    QVERIFY_EXCEPTION_THROWN(wrongKey.LookupKey("TestWrapperOne"),
+                             rmscrypto::exceptions::RMSCryptoIOKeyException);
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+
+  env->KeyStorage(IRMSCryptoEnvironment::KeyStorageOption::Platform);
+  env->KeyFilePath("");
+}
+
+void KeyStorageTests::FileKeySharedByInstances()
+{
+  using namespace rmscrypto::platform::keystorage;
+
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+
+  auto path = dir.path().toStdString() + "/keys";
+  vector<uint8_t> masterKey(32, 0x17);
+
+  try {
+    // each instance stands for a process with its own copy of the keys
+    KeyStorageFile first(path, masterKey);
+    KeyStorageFile second(path, masterKey);
+
+    QVERIFY2(first.LookupKey("TestWrapperOne").get() == nullptr,
+             "Found key in a new key file!");
+    QVERIFY2(second.LookupKey("TestWrapperOne").get() == nullptr,
+             "Found key in a new key file!");
+
+    first.StoreKey("TestWrapperOne", "TestKeyOne");
+    second.StoreKey("TestWrapperTwo", "TestKeyTwo");
+
+    auto findKey = first.LookupKey("TestWrapperTwo");
+    QVERIFY2(findKey.get() != nullptr && *findKey == "TestKeyTwo",
+             "Key stored by another instance not found!");
+
+    // concurrent changes from many instances all end up in the file
+    const int cInstances = 8;
+    const int cKeys      = 10;
+    vector<thread> threads;
+
+    for (int i = 0; i < cInstances; ++i) {
+      threads.emplace_back([&path, &masterKey, i]() {
+          KeyStorageFile instance(path, masterKey);
+
+          for (int k = 0; k < cKeys; ++k) {
+            instance.StoreKey("Wrapper" + to_string(i) + "_" + to_string(k),
+                              "Key" + to_string(i) + "_" + to_string(k));
+          }
+        });
+    }
+
+    for (auto& t : threads) {
+      t.join();
+    }
+
+    second.RemoveKey("TestWrapperOne");
+
+    KeyStorageFile reloaded(path, masterKey);
+
+    for (int i = 0; i < cInstances; ++i) {
+      for (int k = 0; k < cKeys; ++k) {
+        findKey = reloaded.LookupKey("Wrapper" + to_string(i) + "_" +
+                                     to_string(k));
+        QVERIFY2(findKey.get() != nullptr &&
+                 *findKey == "Key" + to_string(i) + "_" + to_string(k),
+                 "Key lost by a concurrent change!");
+      }
+    }
+
+    QVERIFY2(reloaded.LookupKey("TestWrapperOne").get() == nullptr,
+             "Found removed key!");
+    findKey = reloaded.LookupKey("TestWrapperTwo");
+    QVERIFY2(findKey.get() != nullptr && *findKey == "TestKeyTwo",
+             "Invalid key found!");
+  } catch (const rmscrypto::exceptions::RMSCryptoException& e) {
+    QTest::qFail(e.what(), __FILE__, __LINE__);
+  }
+}
@@ -17,6 +17,8 @@ private Q_SLOTS:
 
   void KeyUsage_data();
   void KeyUsage();
+  void FileKeyUsage();
+  void FileKeySharedByInstances();
 };
 
 #endif // COMMONTESTA_H
@@ -6,6 +6,8 @@
  * ======================================================================
 */
 
+#include <algorithm>
+#include <vector>
 #include <CryptoAPI.h>
 #include "TestHelpers.h"
 #include "PlatformCryptoTest.h"
@@ -119,6 +121,58 @@ void PlatformCryptoTest::testSHA()
   QCOMPARE(HashString(hashSha256, data), result_sha256);
 }
 
+void PlatformCryptoTest::testSHAStreaming_data()
+{
+  testSHA_data();
+}
+
+void PlatformCryptoTest::testSHAStreaming()
+{
+  auto pcrypto    = CreateCryptoEngine();
+  auto hashSha256 = pcrypto->CreateHash(CRYPTO_HASH_ALGORITHM_SHA256);
+
+  QFETCH(QString, data);
+  QFETCH(QString, result_sha256);
+
+  auto     strCopy = data.toStdString();
+  auto     pbData  = reinterpret_cast<const uint8_t *>(strCopy.data());
+  size_t   cbHash  = hashSha256->GetOutputSize();
+  uint32_t cbOut   = static_cast<uint32_t>(cbHash);
+
+  // the same digest in uneven pieces, twice to check Final resets
+  std::vector<uint8_t> res(cbHash);
+
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < strCopy.size(); i += 7) {
+      hashSha256->Update(pbData + i, std::min<size_t>(7, strCopy.size() - i));
+    }
+    hashSha256->Final(&res[0], cbOut);
+
+    QCOMPARE(QString(QByteArray(reinterpret_cast<const char *>(res.data()),
+                                static_cast<int>(res.size())).toHex()),
+             result_sha256);
+  }
+
+  // a batch of the prefixes matches hashing them one by one
+  std::vector<const uint8_t *> inputs;
+  std::vector<size_t> sizes;
+
+  for (size_t i = 0; i <= strCopy.size(); ++i) {
+    inputs.push_back(pbData);
+    sizes.push_back(i);
+  }
+
+  std::vector<uint8_t> batch(inputs.size() * cbHash);
+  hashSha256->HashMany(inputs.data(), sizes.data(), inputs.size(),
+                       batch.data(), batch.size());
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    cbOut = static_cast<uint32_t>(cbHash);
+    hashSha256->Hash(pbData, static_cast<uint32_t>(i), &res[0], cbOut);
+    QVERIFY(std::equal(res.begin(), res.end(), batch.begin() + i * cbHash));
+  }
+}
+
 void PlatformCryptoTest::testAESECB_data() {
   // AES_ECB data
   QTest::addColumn<QString>("key");
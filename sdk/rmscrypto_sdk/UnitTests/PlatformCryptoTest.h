@@ -24,6 +24,8 @@ private Q_SLOTS:
 
   void testSHA_data();
   void testSHA();
+  void testSHAStreaming_data();
+  void testSHAStreaming();
   void testAESECB_data();
   void testAESECB();
   void testAESECB_Bad_data();
@@ -0,0 +1,281 @@
+/*
+ * ======================================================================
+ * Copyright (c) Microsoft Open Technologies, Inc.  All rights reserved.
+ * Licensed under the MIT License.
+ * See LICENSE.md in the project root for license information.
+ * ======================================================================
+*/
+
+#ifndef TESTSTREAMS_H
+#define TESTSTREAMS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../CryptoAPI/CryptoAPI.h"
+#include "../CryptoAPI/RMSCryptoExceptions.h"
+
+// Test streams shared by the unit tests of the crypto and of the RMS SDK.
+
+// In-memory stream where ranges never written, or only written with zeros,
+// read as zeros and take no memory, for content at offsets no test machine
+// has the disk for. Clones share the content and have a position of their
+// own.
+class SparseStream : public rmscrypto::api::IStream {
+public:
+
+  SparseStream() : m_content(std::make_shared<Content>()), m_u64Position(0) {}
+
+  virtual std::shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
+                                               int64_t     cbBuffer,
+                                               int64_t     cbOffset,
+                                               std::launch launchType) override
+  {
+    return std::async(launchType, [this, pbBuffer, cbBuffer, cbOffset]() {
+        return ReadAt(pbBuffer, cbBuffer, static_cast<uint64_t>(cbOffset));
+      }).share();
+  }
+
+  virtual std::shared_future<int64_t>WriteAsync(const uint8_t *cpbBuffer,
+                                                int64_t        cbBuffer,
+                                                int64_t        cbOffset,
+                                                std::launch    launchType) override
+  {
+    return std::async(launchType, [this, cpbBuffer, cbBuffer, cbOffset]() {
+        return WriteAt(cpbBuffer, cbBuffer, static_cast<uint64_t>(cbOffset));
+      }).share();
+  }
+
+  virtual std::future<bool>FlushAsync(std::launch launchType) override
+  {
+    return std::async(launchType, []() { return true; });
+  }
+
+  virtual int64_t Read(uint8_t *pbBuffer, int64_t cbBuffer) override
+  {
+    int64_t cbRead = ReadAt(pbBuffer, cbBuffer, m_u64Position);
+    m_u64Position += cbRead;
+    return cbRead;
+  }
+
+  virtual int64_t Write(const uint8_t *cpbBuffer, int64_t cbBuffer) override
+  {
+    int64_t cbWritten = WriteAt(cpbBuffer, cbBuffer, m_u64Position);
+    m_u64Position += cbWritten;
+    return cbWritten;
+  }
+
+  virtual bool Flush() override { return true; }
+
+  virtual rmscrypto::api::SharedStream Clone() override
+  {
+    auto clone = std::make_shared<SparseStream>();
+    clone->m_content = m_content;
+    return clone;
+  }
+
+  virtual void Seek(uint64_t u64Position) override { m_u64Position = u64Position; }
+  virtual bool CanRead() const override { return true; }
+  virtual bool CanWrite() const override { return true; }
+  virtual uint64_t Position() override { return m_u64Position; }
+
+  virtual uint64_t Size() override
+  {
+    std::lock_guard<std::mutex> lock(m_content->locker);
+    return m_content->u64Size;
+  }
+
+  virtual void Size(uint64_t u64Value) override
+  {
+    std::lock_guard<std::mutex> lock(m_content->locker);
+    m_content->u64Size = u64Value;
+  }
+
+  // bytes of memory the written pages take
+  uint64_t AllocatedSize()
+  {
+    std::lock_guard<std::mutex> lock(m_content->locker);
+    return m_content->pages.size() * PAGE_SIZE;
+  }
+
+private:
+
+  static const uint64_t PAGE_SIZE = 64 * 1024;
+
+  struct Content {
+    std::mutex locker;
+    std::map<uint64_t, std::vector<uint8_t> >pages;
+    uint64_t u64Size = 0;
+  };
+
+  int64_t ReadAt(uint8_t *pbBuffer, int64_t cbBuffer, uint64_t u64Offset)
+  {
+    std::lock_guard<std::mutex> lock(m_content->locker);
+
+    if (u64Offset >= m_content->u64Size) {
+      return 0;
+    }
+
+    uint64_t cbRead = std::min(static_cast<uint64_t>(cbBuffer),
+                               m_content->u64Size - u64Offset);
+
+    for (uint64_t cbDone = 0; cbDone < cbRead;)
+    {
+      uint64_t u64Page   = (u64Offset + cbDone) / PAGE_SIZE;
+      uint64_t u64InPage = (u64Offset + cbDone) % PAGE_SIZE;
+      uint64_t cbChunk   = std::min(cbRead - cbDone, PAGE_SIZE - u64InPage);
+      auto     page      = m_content->pages.find(u64Page);
+
+      if (page == m_content->pages.end()) {
+        memset(pbBuffer + cbDone, 0, cbChunk);
+      } else {
+        memcpy(pbBuffer + cbDone, &page->second[u64InPage], cbChunk);
+      }
+      cbDone += cbChunk;
+    }
+    return static_cast<int64_t>(cbRead);
+  }
+
+  int64_t WriteAt(const uint8_t *cpbBuffer, int64_t cbBuffer, uint64_t u64Offset)
+  {
+    std::lock_guard<std::mutex> lock(m_content->locker);
+    uint64_t cbWrite = static_cast<uint64_t>(cbBuffer);
+
+    for (uint64_t cbDone = 0; cbDone < cbWrite;)
+    {
+      uint64_t u64Page     = (u64Offset + cbDone) / PAGE_SIZE;
+      uint64_t u64InPage   = (u64Offset + cbDone) % PAGE_SIZE;
+      uint64_t cbChunk     = std::min(cbWrite - cbDone, PAGE_SIZE - u64InPage);
+      auto     page        = m_content->pages.find(u64Page);
+      const uint8_t *chunk = cpbBuffer + cbDone;
+
+      if (page != m_content->pages.end()) {
+        memcpy(&page->second[u64InPage], chunk, cbChunk);
+      } else if (std::any_of(chunk, chunk + cbChunk,
+                             [](uint8_t b) { return b != 0; })) {
+        auto& added = m_content->pages[u64Page];
+
+        added.resize(PAGE_SIZE);
+        memcpy(&added[u64InPage], chunk, cbChunk);
+      }
+      cbDone += cbChunk;
+    }
+    m_content->u64Size = std::max(m_content->u64Size, u64Offset + cbWrite);
+    return cbBuffer;
+  }
+
+  std::shared_ptr<Content> m_content;
+  uint64_t m_u64Position;
+};
+
+// An in-memory stream which counts the reads of its content, and whose
+// writes, also through its clones, can be made to fail
+class CountingStream : public rmscrypto::api::IStream {
+public:
+
+  CountingStream(std::shared_ptr<std::stringstream>backing)
+    : m_backing(backing)
+    , m_pImpl(rmscrypto::api::CreateStreamFromStdStream(
+                std::static_pointer_cast<std::iostream>(backing)))
+    , m_reads(0)
+    , m_pFailWrites(std::make_shared<std::atomic<bool> >(false))
+  {}
+
+  std::string Content() const { return m_backing->str(); }
+  int Reads() const { return m_reads; }
+  void FailWrites(bool bFail) { *m_pFailWrites = bFail; }
+
+  virtual std::shared_future<int64_t>ReadAsync(uint8_t    *pbBuffer,
+                                               int64_t     cbBuffer,
+                                               int64_t     cbOffset,
+                                               std::launch launchType) override
+  {
+    ++m_reads;
+    return m_pImpl->ReadAsync(pbBuffer, cbBuffer, cbOffset, launchType);
+  }
+
+  virtual std::shared_future<int64_t>WriteAsync(const uint8_t *cpbBuffer,
+                                                int64_t        cbBuffer,
+                                                int64_t        cbOffset,
+                                                std::launch    launchType) override
+  {
+    CheckWrite();
+    return m_pImpl->WriteAsync(cpbBuffer, cbBuffer, cbOffset, launchType);
+  }
+
+  virtual std::future<bool>FlushAsync(std::launch launchType) override
+  {
+    return m_pImpl->FlushAsync(launchType);
+  }
+
+  virtual int64_t Read(uint8_t *pbBuffer, int64_t cbBuffer) override
+  {
+    ++m_reads;
+    return m_pImpl->Read(pbBuffer, cbBuffer);
+  }
+
+  virtual int64_t Write(const uint8_t *cpbBuffer, int64_t cbBuffer) override
+  {
+    CheckWrite();
+    return m_pImpl->Write(cpbBuffer, cbBuffer);
+  }
+
+  virtual bool Flush() override { return m_pImpl->Flush(); }
+
+  virtual rmscrypto::api::SharedStream Clone() override
+  {
+    return std::shared_ptr<CountingStream>(
+      new CountingStream(m_backing, m_pImpl->Clone(), m_pFailWrites));
+  }
+
+  virtual void Seek(uint64_t u64Position) override { m_pImpl->Seek(u64Position); }
+  virtual bool CanRead() const override { return m_pImpl->CanRead(); }
+  virtual bool CanWrite() const override { return m_pImpl->CanWrite(); }
+  virtual uint64_t Position() override { return m_pImpl->Position(); }
+  virtual uint64_t Size() override { return m_pImpl->Size(); }
+  virtual void Size(uint64_t u64Value) override { m_pImpl->Size(u64Value); }
+
+private:
+
+  CountingStream(std::shared_ptr<std::stringstream> backing,
+                 rmscrypto::api::SharedStream       pImpl,
+                 std::shared_ptr<std::atomic<bool> >pFailWrites)
+    : m_backing(backing)
+    , m_pImpl(pImpl)
+    , m_reads(0)
+    , m_pFailWrites(pFailWrites)
+  {}
+
+  void CheckWrite()
+  {
+    if (*m_pFailWrites) {
+      throw rmscrypto::exceptions::RMSCryptoIOException(
+              rmscrypto::exceptions::RMSCryptoException::UnknownError,
+              "Write failed");
+    }
+  }
+
+  std::shared_ptr<std::stringstream> m_backing;
+  rmscrypto::api::SharedStream m_pImpl;
+  int m_reads;
+  std::shared_ptr<std::atomic<bool> > m_pFailWrites;
+};
+
+inline std::shared_ptr<CountingStream>CreateCountingStream(
+  const std::string& content = std::string())
+{
+  auto backing = std::make_shared<std::stringstream>(
+    std::ios::in | std::ios::out | std::ios::binary);
+
+  backing->write(content.data(), content.size());
+  return std::make_shared<CountingStream>(backing);
+}
+
+#endif // TESTSTREAMS_H
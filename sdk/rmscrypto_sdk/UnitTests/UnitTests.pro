@@ -41,4 +41,5 @@ HEADERS += \
     PlatformCryptoTest.h \
     CryptedStreamTests.h \
     TestHelpers.h \
+    TestStreams.h \
     CryptoAPITests.h
@@ -6,8 +6,10 @@ SUBDIRS += \
     Crypto \
     CryptoAPI \
     Platform \
-    UnitTests
+    UnitTests \
+    Benchmarks
 
 CryptoAPI.depends  = Crypto
 Crypto.depends     = Platform
 UnitTests.depends  = CryptoAPI
+Benchmarks.depends = CryptoAPI